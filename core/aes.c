@@ -0,0 +1,193 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "aes.h"
+
+/* AES (FIPS 197) forward cipher with 32-bit round tables */
+
+static uint8_t sbox[256];
+static uint32_t te[4][256];
+static int tables_ready;
+
+#define XTIME(x) ((uint8_t)(((x) << 1) ^ (((x) & 0x80) ? 0x1b : 0)))
+#define ROR8(x) (((x) >> 8) | ((x) << 24))
+
+/* S-box from inverses in GF(2^8), walked with generator 3 */
+static void
+aes_tables_init(void)
+{
+  uint8_t p = 1, q = 1, s;
+  int i;
+
+  do {
+    /* p times 3 */
+    p = p ^ XTIME(p);
+    /* q divided by 3 */
+    q ^= q << 1;
+    q ^= q << 2;
+    q ^= q << 4;
+    if (q & 0x80) {
+      q ^= 0x09;
+    }
+    s = q ^ (q << 1 | q >> 7) ^ (q << 2 | q >> 6) ^ (q << 3 | q >> 5) ^ (q << 4 | q >> 4);
+    sbox[p] = s ^ 0x63;
+  } while (p != 1);
+  sbox[0] = 0x63;
+
+  for (i = 0; i < 256; i++) {
+    uint8_t s1 = sbox[i], s2 = XTIME(s1), s3 = s2 ^ s1;
+    uint32_t t = (uint32_t)s2 << 24 | (uint32_t)s1 << 16 | (uint32_t)s1 << 8 | s3;
+    te[0][i] = t;
+    te[1][i] = ROR8(t);
+    te[2][i] = ROR8(te[1][i]);
+    te[3][i] = ROR8(te[2][i]);
+  }
+
+  tables_ready = 1;
+}
+
+static inline uint32_t
+load_be32(const uint8_t *p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static inline void
+store_be32(uint8_t *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static inline uint32_t
+sub_word(uint32_t w)
+{
+  return (uint32_t)sbox[w >> 24] << 24 | (uint32_t)sbox[(w >> 16) & 0xff] << 16 |
+         (uint32_t)sbox[(w >> 8) & 0xff] << 8 | sbox[w & 0xff];
+}
+
+/* Key of 16, 24 or 32 bytes */
+void
+aes_key_init(struct aes_key *key, const uint8_t *k, uint32_t key_len)
+{
+  uint32_t i, nk = key_len / 4, total, t;
+  uint8_t rcon = 1;
+
+  if (!tables_ready) {
+    aes_tables_init();
+  }
+
+  key->rounds = nk + 6;
+  total = 4 * (key->rounds + 1);
+  for (i = 0; i < nk; i++) {
+    key->rk[i] = load_be32(k + i * 4);
+  }
+  for (; i < total; i++) {
+    t = key->rk[i - 1];
+    if (i % nk == 0) {
+      t = sub_word(t << 8 | t >> 24) ^ (uint32_t)rcon << 24;
+      rcon = XTIME(rcon);
+    } else if (nk > 6 && i % nk == 4) {
+      t = sub_word(t);
+    }
+    key->rk[i] = key->rk[i - nk] ^ t;
+  }
+}
+
+void
+aes_encrypt(const struct aes_key *key, const uint8_t *in, uint8_t *out)
+{
+  const uint32_t *rk = key->rk;
+  uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+  int r;
+
+  s0 = load_be32(in) ^ rk[0];
+  s1 = load_be32(in + 4) ^ rk[1];
+  s2 = load_be32(in + 8) ^ rk[2];
+  s3 = load_be32(in + 12) ^ rk[3];
+
+  for (r = 1; r < key->rounds; r++) {
+    rk += 4;
+    t0 = te[0][s0 >> 24] ^ te[1][(s1 >> 16) & 0xff] ^ te[2][(s2 >> 8) & 0xff] ^ te[3][s3 & 0xff] ^ rk[0];
+    t1 = te[0][s1 >> 24] ^ te[1][(s2 >> 16) & 0xff] ^ te[2][(s3 >> 8) & 0xff] ^ te[3][s0 & 0xff] ^ rk[1];
+    t2 = te[0][s2 >> 24] ^ te[1][(s3 >> 16) & 0xff] ^ te[2][(s0 >> 8) & 0xff] ^ te[3][s1 & 0xff] ^ rk[2];
+    t3 = te[0][s3 >> 24] ^ te[1][(s0 >> 16) & 0xff] ^ te[2][(s1 >> 8) & 0xff] ^ te[3][s2 & 0xff] ^ rk[3];
+    s0 = t0;
+    s1 = t1;
+    s2 = t2;
+    s3 = t3;
+  }
+
+  /* Last round has no MixColumns */
+  rk += 4;
+  store_be32(out, ((uint32_t)sbox[s0 >> 24] << 24 | (uint32_t)sbox[(s1 >> 16) & 0xff] << 16 |
+                   (uint32_t)sbox[(s2 >> 8) & 0xff] << 8 | sbox[s3 & 0xff]) ^ rk[0]);
+  store_be32(out + 4, ((uint32_t)sbox[s1 >> 24] << 24 | (uint32_t)sbox[(s2 >> 16) & 0xff] << 16 |
+                       (uint32_t)sbox[(s3 >> 8) & 0xff] << 8 | sbox[s0 & 0xff]) ^ rk[1]);
+  store_be32(out + 8, ((uint32_t)sbox[s2 >> 24] << 24 | (uint32_t)sbox[(s3 >> 16) & 0xff] << 16 |
+                       (uint32_t)sbox[(s0 >> 8) & 0xff] << 8 | sbox[s1 & 0xff]) ^ rk[2]);
+  store_be32(out + 12, ((uint32_t)sbox[s3 >> 24] << 24 | (uint32_t)sbox[(s0 >> 16) & 0xff] << 16 |
+                        (uint32_t)sbox[(s1 >> 8) & 0xff] << 8 | sbox[s2 & 0xff]) ^ rk[3]);
+}
+
+/* CFB-128 in place, the last block may be partial */
+void
+aes_cfb_encrypt(const struct aes_key *key, const uint8_t *iv, uint8_t *data, uint32_t len)
+{
+  uint8_t fb[AES_BLOCK_LEN];
+  uint32_t i, n;
+
+  memcpy(fb, iv, AES_BLOCK_LEN);
+  while (len > 0) {
+    aes_encrypt(key, fb, fb);
+    n = len < AES_BLOCK_LEN ? len : AES_BLOCK_LEN;
+    for (i = 0; i < n; i++) {
+      data[i] ^= fb[i];
+      fb[i] = data[i];
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+void
+aes_cfb_decrypt(const struct aes_key *key, const uint8_t *iv, uint8_t *data, uint32_t len)
+{
+  uint8_t fb[AES_BLOCK_LEN], c;
+  uint32_t i, n;
+
+  memcpy(fb, iv, AES_BLOCK_LEN);
+  while (len > 0) {
+    aes_encrypt(key, fb, fb);
+    n = len < AES_BLOCK_LEN ? len : AES_BLOCK_LEN;
+    for (i = 0; i < n; i++) {
+      c = data[i];
+      data[i] ^= fb[i];
+      fb[i] = c;
+    }
+    data += n;
+    len -= n;
+  }
+}
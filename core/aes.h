@@ -0,0 +1,39 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef _AES_H_
+#define _AES_H_
+
+#include <stdint.h>
+
+#define AES_BLOCK_LEN  16
+
+/* Expanded encryption key, CFB mode never needs the inverse cipher */
+struct aes_key {
+  uint32_t rk[60];
+  int rounds;
+};
+
+void aes_key_init(struct aes_key *key, const uint8_t *k, uint32_t key_len);
+void aes_encrypt(const struct aes_key *key, const uint8_t *in, uint8_t *out);
+void aes_cfb_encrypt(const struct aes_key *key, const uint8_t *iv, uint8_t *data, uint32_t len);
+void aes_cfb_decrypt(const struct aes_key *key, const uint8_t *iv, uint8_t *data, uint32_t len);
+
+#endif /* _AES_H_ */
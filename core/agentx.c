@@ -32,93 +32,447 @@
 #include "transport.h"
 #include "protocol.h"
 #include "mib.h"
+#include "ev_loop.h"
 #include "util.h"
 
-struct agentx_datagram agentx_datagram;
+struct agentx_conn agentx_conn = { -1, NULL, LIST_HEAD_INIT(agentx_conn.sessions) };
+
+/* Add a session registering groups in context, NULL for the default one */
+struct agentx_session *
+agentx_session_add(const char *context)
+{
+  struct agentx_session *session;
+  uint32_t ctx_len = context != NULL ? strlen(context) : 0;
+
+  if (ctx_len + 1 > sizeof(session->context)) {
+    SMARTSNMP_LOG(L_ERROR, "AgentX context %s is too long!\n", context);
+    return NULL;
+  }
+
+  session = xcalloc(1, sizeof(*session));
+  if (ctx_len > 0) {
+    memcpy(session->context, context, ctx_len);
+  }
+  session->ctx_len = ctx_len;
+  /* Header of administrative PDUs until the session is open */
+  session->pdu_hdr.version = 1;
+#ifdef LITTLE_ENDIAN
+  session->pdu_hdr.flags = 0;
+#else
+  session->pdu_hdr.flags = NETWORD_BYTE_ORDER;
+#endif
+  INIT_LIST_HEAD(&session->set_txn.groups);
+  list_add_tail(&session->link, &agentx_conn.sessions);
+  return session;
+}
+
+struct agentx_session *
+agentx_session_search(uint32_t session_id)
+{
+  struct list_head *curr;
+
+  list_for_each(curr, &agentx_conn.sessions) {
+    struct agentx_session *session = list_entry(curr, struct agentx_session, link);
+    if (session->opened && session->pdu_hdr.session_id == session_id) {
+      return session;
+    }
+  }
+  return NULL;
+}
+
+/* Answer to the open PDU, which carries the session for later ones */
+void
+agentx_session_opened(uint32_t packet_id, uint32_t session_id)
+{
+  struct list_head *curr;
+
+  list_for_each(curr, &agentx_conn.sessions) {
+    struct agentx_session *session = list_entry(curr, struct agentx_session, link);
+    if (!session->opened && session->pdu_hdr.packet_id == packet_id) {
+      session->pdu_hdr.session_id = session_id;
+      session->opened = 1;
+      return;
+    }
+  }
+}
 
 /* Receive agentX request datagram from transport layer */
 static void
-agentx_receive(uint8_t *buf, int len)
+agentx_receive(uint8_t *buf, int len, void *addr)
 {
   agentx_recv(buf, len);
 }
 
 /* Send agentX response datagram to transport layer */
 static void
-agentx_send(uint8_t *buf, int len)
+agentx_send(uint8_t *buf, int len, const void *addr)
 {
-  agentx_trans_ops.send(buf, len);
+  agentx_trans_ops.send(buf, len, addr);
 }
 
-/* Register mib group node */
+/* Requests of all managers come through the master agent */
+static const char *
+agentx_peer(void)
+{
+  return NULL;
+}
+
+/* Context the master agent sends the request in process in */
+static const char *
+agentx_context(void)
+{
+  if (agentx_datagram_curr == NULL) {
+    return "";
+  }
+  return (const char *)agentx_datagram_curr->context;
+}
+
+/* Group registered in all sessions */
+struct agentx_reg_group {
+  oid_t grp_id[MIB_OID_MAX_LEN];
+  uint32_t id_len;
+  /* Sessions registered in, yet to answer and which have refused */
+  uint32_t sessions;
+  uint32_t pending;
+  uint32_t refused;
+};
+
+/* Register or unregister PDU waiting for the response of master agent */
+struct agentx_reg {
+  struct list_head link;
+  struct agentx_session *session;
+  uint32_t packet_id;
+  int unreg;
+  struct agentx_reg_group *group;
+};
+
+static LIST_HEAD(agentx_reg_list);
+
+/* Send agentX register or unregister PDU in every session without waiting
+ * for the responses, so that registrations are pipelined. */
 static int
-agentx_mib_node_reg(const oid_t *grp_id, int id_len, int grp_cb)
+agentx_register(const oid_t *grp_id, int id_len, int unreg)
 {
+  struct list_head *curr;
   struct x_pdu_buf x_pdu;
+  struct agentx_reg *reg;
+  struct agentx_reg_group *group;
 
   /* Check oid prefix */
-  if (id_len < 4 || grp_id[0] != 1 || grp_id[1] != 3 || grp_id[2] != 6 || grp_id[3] != 1) {
+  if (id_len < 5 || id_len > MIB_OID_MAX_LEN || grp_id[0] != 1 || grp_id[1] != 3 || grp_id[2] != 6 || grp_id[3] != 1) {
     SMARTSNMP_LOG(L_ERROR, "Oid prefix must be .1.3.6.1!\n");
     return -1;
   }
 
-  /* Send agentX register PDU */
-  x_pdu = agentx_register_pdu(&agentx_datagram, grp_id, id_len, NULL, 0, 0, 127, 0, 0);
-  if (send(agentx_datagram.sock, x_pdu.buf, x_pdu.len, 0) == -1) {
-    SMARTSNMP_LOG(L_ERROR, "Send agentX register PDU failure!\n");
-    return -1;
+  group = xcalloc(1, sizeof(*group));
+  group->id_len = id_len;
+  oid_cpy(group->grp_id, grp_id, id_len);
+
+  list_for_each(curr, &agentx_conn.sessions) {
+    struct agentx_session *session = list_entry(curr, struct agentx_session, link);
+    const char *context = session->ctx_len > 0 ? session->context : NULL;
+
+    if (unreg) {
+      x_pdu = agentx_unregister_pdu(session, grp_id, id_len, context, session->ctx_len, 0, 127, 0, 0);
+    } else {
+      x_pdu = agentx_register_pdu(session, grp_id, id_len, context, session->ctx_len, 0, 127, 0, 0);
+    }
+
+    reg = xmalloc(sizeof(*reg));
+    reg->session = session;
+    reg->packet_id = ((struct x_pdu_hdr *)x_pdu.buf)->packet_id;
+    reg->unreg = unreg;
+    reg->group = group;
+    group->sessions++;
+    group->pending++;
+    list_add_tail(&reg->link, &agentx_reg_list);
+
+    /* The callback will free the PDU */
+    agentx_trans_ops.send(x_pdu.buf, x_pdu.len, NULL);
   }
 
-  /* Receive agentX resoponse PDU */
-  x_pdu.len = TRANS_BUF_SIZ;
-  x_pdu.buf = xrealloc(x_pdu.buf, x_pdu.len);
-  x_pdu.len = recv(agentx_datagram.sock, x_pdu.buf, x_pdu.len, 0);
-  if (x_pdu.len == -1) {
-    SMARTSNMP_LOG(L_ERROR, "Receive agentX register response PDU failure!\n");
-    return -1;
+  if (group->pending == 0) {
+    free(group);
   }
+  return 0;
+}
 
-  /* Verify register response PDU */
-  if (agentx_recv(x_pdu.buf, x_pdu.len) != AGENTX_ERR_OK) {
-    SMARTSNMP_LOG(L_ERROR, "Parse agentX rigister response PDU error!\n");
-    return -1;
+/* Match response PDU with registration sent, return -1 if none */
+int
+agentx_reg_response(uint32_t session_id, uint32_t packet_id, uint16_t error)
+{
+  struct list_head *curr, *next;
+
+  list_for_each_safe(curr, next, &agentx_reg_list) {
+    struct agentx_reg *reg = list_entry(curr, struct agentx_reg, link);
+    struct agentx_reg_group *group = reg->group;
+
+    if (reg->packet_id != packet_id || reg->session->pdu_hdr.session_id != session_id) {
+      continue;
+    }
+
+    if (error) {
+      SMARTSNMP_LOG(L_ERROR, "AgentX %sregister refused by master agent in context '%s', error %u!\n",
+                    reg->unreg ? "un" : "", reg->session->context, error);
+      group->refused++;
+    }
+
+    /* Served locally in hope of success, take it back if no session has it */
+    if (--group->pending == 0) {
+      if (!reg->unreg && group->refused == group->sessions) {
+        mib_node_unreg(group->grp_id, group->id_len);
+      }
+      free(group);
+    }
+
+    list_del(&reg->link);
+    free(reg);
+    return 0;
   }
 
-  /* Register node */
-  return mib_node_reg(grp_id, id_len, grp_cb);
+  return -1;
 }
 
-/* Unregister mib group node */
-static int
-agentx_mib_node_unreg(const oid_t *grp_id, int id_len)
+/* Notify PDUs sent without waiting for responses at most, and raised ones
+ * kept waiting for room, the oldest ones go first */
+#define AGENTX_NOTIFY_WINDOW     32
+#define AGENTX_NOTIFY_QUEUE_MAX  256
+/* Notify PDUs unanswered for ms are given up */
+#define AGENTX_NOTIFY_TIMEOUT    5000
+
+/* Notification raised, then sent and waiting for the response */
+struct agentx_notify {
+  struct list_head link;
+  struct agentx_session *session;
+  uint32_t packet_id;
+  uint64_t sent;
+  struct list_head vb_list;
+};
+
+static struct {
+  struct list_head queue;
+  uint32_t queue_cnt;
+  struct list_head pending;
+  uint32_t pending_cnt;
+  int flush_timer;
+} agentx_notify_list = {
+  LIST_HEAD_INIT(agentx_notify_list.queue), 0,
+  LIST_HEAD_INIT(agentx_notify_list.pending), 0,
+  -1,
+};
+
+static const oid_t snmp_trap_oid[] = { 1, 3, 6, 1, 6, 3, 1, 1, 4, 1, 0 };
+
+static void
+agentx_notify_free(struct agentx_notify *notify)
+{
+  struct list_head *curr, *next;
+
+  list_for_each_safe(curr, next, &notify->vb_list) {
+    free(list_entry(curr, struct x_var_bind, link));
+  }
+  free(notify);
+}
+
+/* Notification of trap_oid in the session of context, NULL if none serves
+ * it. Varbinds are to be added before it is sent. */
+struct agentx_notify *
+agentx_notify_new(const char *context, const oid_t *trap_oid, uint32_t oid_len)
+{
+  struct list_head *curr;
+  struct agentx_notify *notify;
+
+  list_for_each(curr, &agentx_conn.sessions) {
+    struct agentx_session *session = list_entry(curr, struct agentx_session, link);
+    if (session->opened && !strcmp(session->context, context)) {
+      notify = xmalloc(sizeof(*notify));
+      notify->session = session;
+      INIT_LIST_HEAD(&notify->vb_list);
+      agentx_notify_vb_add(notify, snmp_trap_oid, elem_num(snmp_trap_oid), ASN1_TAG_OBJID, trap_oid, oid_len);
+      return notify;
+    }
+  }
+
+  SMARTSNMP_LOG(L_ERROR, "No AgentX session for notification in context '%s'\n", context);
+  return NULL;
+}
+
+/* Varbind of value with len elements as in ber_value_enc() */
+void
+agentx_notify_vb_add(struct agentx_notify *notify, const oid_t *oid, uint32_t oid_len, uint8_t tag, const void *value, uint32_t len)
+{
+  struct x_var_bind *vb;
+  uint32_t size;
+
+  switch (tag) {
+    case ASN1_TAG_INT:
+    case ASN1_TAG_CNT:
+    case ASN1_TAG_GAU:
+    case ASN1_TAG_TIMETICKS:
+      size = sizeof(uint32_t);
+      break;
+    case ASN1_TAG_CNT64:
+      size = sizeof(uint64_t);
+      break;
+    case ASN1_TAG_OBJID:
+      size = len * sizeof(oid_t);
+      break;
+    default:
+      size = len;
+      break;
+  }
+
+  vb = agentx_vb_new(oid_len, size);
+  oid_cpy(vb->oid, oid, oid_len);
+  vb->oid_len = oid_len;
+  vb->val_type = tag;
+  vb->val_len = size;
+  memcpy(vb->value, value, size);
+  list_add_tail(&vb->link, &notify->vb_list);
+}
+
+/* Send what the window has room for in one write */
+static void
+agentx_notify_flush(void)
 {
+  struct list_head *curr, *next;
+  struct agentx_notify *notify;
   struct x_pdu_buf x_pdu;
+  uint8_t *buf = NULL;
+  uint32_t len = 0;
+  uint64_t now = snmp_event_time();
 
-  /* Check oid prefix */
-  if (id_len < 4 || grp_id[0] != 1 || grp_id[1] != 3 || grp_id[2] != 6 || grp_id[3] != 1) {
-    SMARTSNMP_LOG(L_ERROR, "Oid prefix must be .1.3.6.1!");
-    return -1;
+  /* Master agent has not answered these */
+  list_for_each_safe(curr, next, &agentx_notify_list.pending) {
+    notify = list_entry(curr, struct agentx_notify, link);
+    if (now - notify->sent < AGENTX_NOTIFY_TIMEOUT) {
+      break;
+    }
+    SMARTSNMP_LOG(L_WARNING, "AgentX notify %u unanswered, given up\n", notify->packet_id);
+    list_del(&notify->link);
+    agentx_notify_list.pending_cnt--;
+    agentx_notify_free(notify);
+  }
+
+  list_for_each_safe(curr, next, &agentx_notify_list.queue) {
+    if (agentx_notify_list.pending_cnt == AGENTX_NOTIFY_WINDOW) {
+      break;
+    }
+    notify = list_entry(curr, struct agentx_notify, link);
+    x_pdu = agentx_notify_pdu(notify->session, &notify->vb_list);
+    buf = xrealloc(buf, len + x_pdu.len);
+    memcpy(buf + len, x_pdu.buf, x_pdu.len);
+    len += x_pdu.len;
+    free(x_pdu.buf);
+
+    notify->packet_id = notify->session->pdu_hdr.packet_id;
+    notify->sent = now;
+    list_del(&notify->link);
+    agentx_notify_list.queue_cnt--;
+    list_add_tail(&notify->link, &agentx_notify_list.pending);
+    agentx_notify_list.pending_cnt++;
   }
 
-  /* Send angentX register PDU */
-  x_pdu = agentx_unregister_pdu(&agentx_datagram, grp_id, id_len, NULL, 0, 0, 127, 0, 0);
-  if (send(agentx_datagram.sock, x_pdu.buf, x_pdu.len, 0) == -1) {
-    SMARTSNMP_LOG(L_ERROR, "Send agentX unregister PDU failure!");
+  if (len > 0) {
+    /* The callback will free the PDUs */
+    agentx_trans_ops.send(buf, len, NULL);
+  }
+}
+
+static void
+agentx_notify_flush_handler(void *ud)
+{
+  agentx_notify_list.flush_timer = -1;
+  agentx_notify_flush();
+}
+
+static void
+agentx_notify_flush_later(void)
+{
+  /* Notifications of this turn go together */
+  if (agentx_notify_list.flush_timer < 0) {
+    agentx_notify_list.flush_timer = snmp_event_timer_add(0, 0, agentx_notify_flush_handler, NULL);
+    if (agentx_notify_list.flush_timer < 0) {
+      agentx_notify_flush();
+    }
+  }
+}
+
+/* Queue notify and release it */
+void
+agentx_notify_send(struct agentx_notify *notify)
+{
+  struct agentx_notify *oldest;
+
+  if (agentx_notify_list.queue_cnt == AGENTX_NOTIFY_QUEUE_MAX) {
+    oldest = list_first_entry(&agentx_notify_list.queue, struct agentx_notify, link);
+    SMARTSNMP_LOG(L_WARNING, "AgentX notification queue full, oldest one dropped\n");
+    list_del(&oldest->link);
+    agentx_notify_list.queue_cnt--;
+    agentx_notify_free(oldest);
+  }
+
+  list_add_tail(&notify->link, &agentx_notify_list.queue);
+  agentx_notify_list.queue_cnt++;
+  agentx_notify_flush_later();
+}
+
+/* Match response PDU with notify sent, return -1 if none */
+int
+agentx_notify_response(uint32_t session_id, uint32_t packet_id, uint16_t error)
+{
+  struct list_head *curr;
+
+  list_for_each(curr, &agentx_notify_list.pending) {
+    struct agentx_notify *notify = list_entry(curr, struct agentx_notify, link);
+
+    if (notify->packet_id != packet_id || notify->session->pdu_hdr.session_id != session_id) {
+      continue;
+    }
+
+    if (error) {
+      SMARTSNMP_LOG(L_ERROR, "AgentX notify refused by master agent in context '%s', error %u!\n",
+                    notify->session->context, error);
+    }
+    list_del(&notify->link);
+    agentx_notify_list.pending_cnt--;
+    agentx_notify_free(notify);
+
+    /* Room for queued ones */
+    if (agentx_notify_list.queue_cnt > 0) {
+      agentx_notify_flush_later();
+    }
+    return 0;
+  }
+
+  return -1;
+}
+
+/* Register mib group node */
+static int
+agentx_mib_node_reg(const oid_t *grp_id, int id_len, int grp_cb)
+{
+  if (agentx_register(grp_id, id_len, 0) < 0) {
     return -1;
   }
+  return mib_node_reg(grp_id, id_len, grp_cb);
+}
 
-  /* Receive agentX response PDU */
-  x_pdu.len = TRANS_BUF_SIZ;
-  x_pdu.buf = xrealloc(x_pdu.buf, x_pdu.len);
-  x_pdu.len = recv(agentx_datagram.sock, x_pdu.buf, x_pdu.len, 0);
-  if (x_pdu.len == -1) {
-    SMARTSNMP_LOG(L_ERROR, "Receive agentX unregister response PDU failure!\n");
+/* Register mib group node implemented in C */
+static int
+agentx_mib_native_node_reg(const oid_t *grp_id, int id_len, mib_native_handler handler)
+{
+  if (agentx_register(grp_id, id_len, 0) < 0) {
     return -1;
   }
+  return mib_native_node_reg(grp_id, id_len, handler);
+}
 
-  /* Verify register response PDU */
-  if (agentx_recv(x_pdu.buf, x_pdu.len) != AGENTX_ERR_OK) {
-    SMARTSNMP_LOG(L_ERROR, "Unregister response error!");
+/* Unregister mib group node */
+static int
+agentx_mib_node_unreg(const oid_t *grp_id, int id_len)
+{
+  if (agentx_register(grp_id, id_len, 1) < 0) {
     return -1;
   }
 
@@ -130,73 +484,93 @@ agentx_mib_node_unreg(const oid_t *grp_id, int id_len)
 static int
 agentx_init(int port)
 {
-  INIT_LIST_HEAD(&agentx_datagram.vb_in_list);
-  INIT_LIST_HEAD(&agentx_datagram.vb_out_list);
-  INIT_LIST_HEAD(&agentx_datagram.sr_in_list);
-  INIT_LIST_HEAD(&agentx_datagram.sr_out_list);
+  /* Default context only, unless contexts are configured */
+  if (list_empty(&agentx_conn.sessions) && agentx_session_add(NULL) == NULL) {
+    return -1;
+  }
   return agentx_trans_ops.init(port);
 }
 
+/* Send administrative PDU and wait for its response */
 static int
-agentx_open(void)
+agentx_admin_call(struct x_pdu_buf x_pdu, const char *what)
 {
-  struct x_pdu_buf x_pdu;
-  const char *descr = "SmartSNMP AgentX sub-agent";
+  uint32_t len = 0, pdu_len;
+  uint8_t *rsp;
+  int ret = -1;
 
-  /* Send agentX open PDU */
-  x_pdu = agentx_open_pdu(&agentx_datagram, NULL, 0, descr, strlen(descr));
-  if (send(agentx_datagram.sock, x_pdu.buf, x_pdu.len, 0) == -1) {
-    SMARTSNMP_LOG(L_ERROR, "Send agentX open PDU failure!\n");
-    return -1;
+  if (send(agentx_conn.sock, x_pdu.buf, x_pdu.len, 0) == -1) {
+    SMARTSNMP_LOG(L_ERROR, "Send agentX %s PDU failure!\n", what);
+    goto CALL_FINISH;
   }
 
-  /* Receive agentX open response PDU */
-  x_pdu.len = TRANS_BUF_SIZ;
-  x_pdu.buf = xrealloc(x_pdu.buf, x_pdu.len);
-  x_pdu.len = recv(agentx_datagram.sock, x_pdu.buf, x_pdu.len, 0);
-  if (x_pdu.len == -1) {
-    SMARTSNMP_LOG(L_ERROR, "Receive agentX open response PDU failure!\n");
-    return -1;
+  /* Receive agentX response PDU, as a whole */
+  x_pdu.buf = xrealloc(x_pdu.buf, TRANS_BUF_SIZ);
+  do {
+    int n = recv(agentx_conn.sock, x_pdu.buf + len, TRANS_BUF_SIZ - len, 0);
+    if (n <= 0) {
+      SMARTSNMP_LOG(L_ERROR, "Receive agentX %s response PDU failure!\n", what);
+      goto CALL_FINISH;
+    }
+    len += n;
+    pdu_len = len >= sizeof(struct x_pdu_hdr) ? agentx_pdu_len(x_pdu.buf) : TRANS_BUF_SIZ;
+  } while (len < pdu_len && pdu_len <= TRANS_BUF_SIZ);
+
+  if (len != pdu_len) {
+    SMARTSNMP_LOG(L_ERROR, "Parse agentX %s response PDU error!\n", what);
+    goto CALL_FINISH;
   }
 
-  /* Verify open response PDU */
-  if (agentx_recv(x_pdu.buf, x_pdu.len) != AGENTX_ERR_OK) {
-    SMARTSNMP_LOG(L_ERROR, "Parse agentX open response PDU error!\n");
-    return -1;
+  /* Verify response PDU, which agentx_recv takes whether good or not */
+  rsp = x_pdu.buf;
+  x_pdu.buf = NULL;
+  if (agentx_recv(rsp, len) != AGENTX_ERR_OK) {
+    SMARTSNMP_LOG(L_ERROR, "Parse agentX %s response PDU error!\n", what);
+    goto CALL_FINISH;
   }
+  ret = 0;
 
-  return 0;
+CALL_FINISH:
+  free(x_pdu.buf);
+  return ret;
 }
 
 static int
-agentx_close(void)
+agentx_open(void)
 {
-  struct x_pdu_buf x_pdu;
+  struct list_head *curr;
+  const char *descr = "SmartSNMP AgentX sub-agent";
 
-  /* Send agentX close PDU */
-  x_pdu = agentx_close_pdu(&agentx_datagram, R_SHUTDOWN);
-  if (send(agentx_datagram.sock, x_pdu.buf, x_pdu.len, 0) == -1) {
-    SMARTSNMP_LOG(L_ERROR, "Send agentX close PDU failure!\n");
-    return -1;
+  /* Open sessions one by one, the response tells which it is by packet id */
+  list_for_each(curr, &agentx_conn.sessions) {
+    struct agentx_session *session = list_entry(curr, struct agentx_session, link);
+    if (agentx_admin_call(agentx_open_pdu(session, NULL, 0, descr, strlen(descr)), "open") < 0) {
+      return -1;
+    }
+    if (!session->opened) {
+      SMARTSNMP_LOG(L_ERROR, "AgentX session of context '%s' not opened!\n", session->context);
+      return -1;
+    }
   }
 
-  /* Receive agentX close response PDU */
-  x_pdu.len = TRANS_BUF_SIZ;
-  x_pdu.buf = xrealloc(x_pdu.buf, x_pdu.len);
-  x_pdu.len = recv(agentx_datagram.sock, x_pdu.buf, x_pdu.len, 0);
-  if (x_pdu.len == -1) {
-    SMARTSNMP_LOG(L_ERROR, "Receive agentX close response PDU failure!\n");
-    return -1;
-  }
+  return 0;
+}
 
-  /* Verify close response PDU */
-  if (agentx_recv(x_pdu.buf, x_pdu.len) != AGENTX_ERR_OK) {
-    SMARTSNMP_LOG(L_ERROR, "Parse agentX close response PDU error!\n");
-    return -1;
+static int
+agentx_close(void)
+{
+  struct list_head *curr;
+  int ret = 0;
+
+  list_for_each(curr, &agentx_conn.sessions) {
+    struct agentx_session *session = list_entry(curr, struct agentx_session, link);
+    if (session->opened && agentx_admin_call(agentx_close_pdu(session, R_SHUTDOWN), "close") < 0) {
+      ret = -1;
+    }
   }
-  
+
   agentx_trans_ops.stop();
-  return 0;
+  return ret;
 }
 
 static void
@@ -212,7 +586,10 @@ struct protocol_operation agentx_prot_ops = {
   agentx_close,
   agentx_run,
   agentx_mib_node_reg,
+  agentx_mib_native_node_reg,
   agentx_mib_node_unreg,
   agentx_receive,
   agentx_send,
+  agentx_peer,
+  agentx_context,
 };
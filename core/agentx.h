@@ -31,6 +31,9 @@
 #define NON_DEFAULT_CONTEXT    0x8
 #define NETWORD_BYTE_ORDER     0x10
 
+/* Varbinds of GETBULK response stop at this size */
+#define AGENTX_BULK_MAX_LEN    (32 * 1024)
+
 /* AgentX PDU tags */
 typedef enum agentx_pdu_type {
   AGENTX_PDU_OPEN = 1,
@@ -58,6 +61,7 @@ typedef enum agentx_err_code {
   AGENTX_ERR_OK                 = 0,
 
   AGENTX_ERR_PDU_CTX_LEN        = -100,
+  AGENTX_ERR_PDU_LEN            = -101,
 
   AGENTX_ERR_VB_VAR             = -200,
   AGENTX_ERR_VB_VALUE_LEN       = -201,
@@ -65,6 +69,8 @@ typedef enum agentx_err_code {
 
   AGENTX_ERR_SR_VAR             = -300,
   AGENTX_ERR_SR_OID_LEN         = -301,
+
+  AGENTX_ERR_REG_OID_LEN        = -400,
 } AGENTX_ERR_CODE_E;
 
 /* AgentX error status */
@@ -161,6 +167,7 @@ struct x_search_range {
 
 struct x_var_bind {
   struct list_head link;
+  /* Stored after the value in the same block */
   oid_t *oid;
   uint32_t oid_len;
   uint16_t val_type;
@@ -170,9 +177,36 @@ struct x_var_bind {
   uint8_t value[0];
 };
 
-struct agentx_datagram {
+/* Set transaction, staged at TestSet and applied at CommitSet */
+struct agentx_set_txn {
+  int active;
+  uint32_t transaction_id;
+  /* Groups written in the transaction */
+  struct list_head groups;
+};
+
+/* Session with the master agent, one per context served */
+struct agentx_session {
+  struct list_head link;
+  /* Context the groups are registered in, empty for the default one */
+  char context[41];
+  uint32_t ctx_len;
+  /* Header of administrative PDUs, the session id is given on open */
+  struct x_pdu_hdr pdu_hdr;
+  int opened;
+  struct agentx_set_txn set_txn;
+};
+
+/* Connection to the master agent, shared by all sessions */
+struct agentx_conn {
   int sock;
-  
+  /* Unix domain socket of the master agent, TCP port is used if NULL */
+  char *path;
+  struct list_head sessions;
+};
+
+/* Request context, one per PDU in flight */
+struct agentx_datagram {
   void *recv_buf;
   void *send_buf;
 
@@ -183,9 +217,20 @@ struct agentx_datagram {
   struct x_pdu_hdr pdu_hdr;
 
   union {
+    struct {
+      uint8_t timeout;
+    } open;
     struct {
       uint8_t reason;
     } close;
+    struct {
+      uint8_t timeout;
+      uint8_t priority;
+      uint8_t range_subid;
+      uint32_t upper_bound;
+      oid_t subtree[MIB_OID_MAX_LEN];
+      uint32_t subtree_len;
+    } reg;
     struct {
       uint16_t non_rep;
       uint16_t max_rep;
@@ -208,26 +253,51 @@ struct agentx_datagram {
   struct list_head sr_out_list;
 };
 
-extern struct agentx_datagram agentx_datagram;
+struct agentx_notify;
+
+extern struct agentx_conn agentx_conn;
+extern struct agentx_datagram *agentx_datagram_curr;
+
+struct agentx_session *agentx_session_add(const char *context);
+struct agentx_session *agentx_session_search(uint32_t session_id);
+void agentx_session_opened(uint32_t packet_id, uint32_t session_id);
 
 uint32_t agentx_value_dec(uint8_t **buffer, uint8_t flag, uint8_t type, void *value);
 uint32_t agentx_value_dec_try(const uint8_t *buf, uint8_t flag, uint8_t type);
+int agentx_value_size(const uint8_t *buf, const uint8_t *end, uint8_t type);
 uint32_t agentx_value_enc(const void *value, uint32_t len, uint8_t type, uint8_t *buf);
 uint32_t agentx_value_enc_try(uint32_t len, uint8_t type);
 
+struct agentx_datagram *agentx_datagram_decode(uint8_t *buf);
+int agentx_master_init(int port, const char *path);
 int agentx_recv(uint8_t *buf, int len);
+int agentx_reg_response(uint32_t session_id, uint32_t packet_id, uint16_t error);
+struct agentx_notify *agentx_notify_new(const char *context, const oid_t *trap_oid, uint32_t oid_len);
+void agentx_notify_vb_add(struct agentx_notify *notify, const oid_t *oid, uint32_t oid_len, uint8_t tag, const void *value, uint32_t len);
+void agentx_notify_send(struct agentx_notify *notify);
+int agentx_notify_response(uint32_t session_id, uint32_t packet_id, uint16_t error);
+uint32_t agentx_pdu_len(const uint8_t *buf);
+void agentx_datagram_free(struct agentx_datagram *xdg);
+struct x_var_bind *agentx_vb_new(uint32_t oid_len, uint32_t val_len);
 void agentx_response(struct agentx_datagram *xdg);
 void agentx_get(struct agentx_datagram *xdg);
 void agentx_getnext(struct agentx_datagram *xdg);
-void agentx_set(struct agentx_datagram *xdg);
+void agentx_getbulk(struct agentx_datagram *xdg);
+void agentx_testset(struct agentx_datagram *xdg);
+void agentx_commitset(struct agentx_datagram *xdg);
+void agentx_undoset(struct agentx_datagram *xdg);
+void agentx_cleanupset(struct agentx_datagram *xdg);
 
-struct x_pdu_buf agentx_open_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len, const char *descr, uint32_t descr_len);
-struct x_pdu_buf agentx_close_pdu(struct agentx_datagram *xdg, uint32_t reason);
-struct x_pdu_buf agentx_register_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len, const char *community, uint32_t comm_len,
+struct x_pdu_buf agentx_open_pdu(struct agentx_session *session, const oid_t *oid, uint32_t oid_len, const char *descr, uint32_t descr_len);
+struct x_pdu_buf agentx_close_pdu(struct agentx_session *session, uint32_t reason);
+struct x_pdu_buf agentx_register_pdu(struct agentx_session *session, const oid_t *oid, uint32_t oid_len, const char *community, uint32_t comm_len,
                                      uint8_t timeout, uint8_t priority, uint8_t range_subid, uint32_t upper_bound);
-struct x_pdu_buf agentx_unregister_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len, const char *community, uint32_t comm_len,
+struct x_pdu_buf agentx_unregister_pdu(struct agentx_session *session, const oid_t *oid, uint32_t oid_len, const char *community, uint32_t comm_len,
                                        uint8_t timeout, uint8_t priority, uint8_t range_subid, uint32_t upper_bound);
-struct x_pdu_buf agentx_ping_pdu(struct agentx_datagram *xdg, const char *context, uint32_t context_len);
+struct x_pdu_buf agentx_notify_pdu(struct agentx_session *session, struct list_head *vb_list);
+struct x_pdu_buf agentx_ping_pdu(struct agentx_session *session, const char *context, uint32_t context_len);
 struct x_pdu_buf agentx_response_pdu(struct agentx_datagram *xdg);
+struct x_pdu_buf agentx_request_pdu(const struct x_pdu_hdr *hdr, struct list_head *sr_list, struct list_head *vb_list);
+uint32_t agentx_vb_enc_len(const struct x_var_bind *vb_out);
 
 #endif /* _AGENTX_H_ */
@@ -40,6 +40,7 @@ agentx_value_dec_try(const uint8_t *buf, uint8_t flag, uint8_t type)
     case ASN1_TAG_GAU:
     case ASN1_TAG_TIMETICKS:
       ret = sizeof(uint32_t);
+      break;
     case ASN1_TAG_CNT64:
       ret = sizeof(uint64_t);
       break;
@@ -63,6 +64,55 @@ agentx_value_dec_try(const uint8_t *buf, uint8_t flag, uint8_t type)
   return ret;
 }
 
+/* Input:  buffer, end of buffer, value type;
+ * Output: none
+ * Return: bytes the value takes in buffer, -1 if it runs past the end
+ */
+int
+agentx_value_size(const uint8_t *buf, const uint8_t *end, uint8_t type)
+{
+  uint32_t len, room;
+
+  if (buf > end) {
+    return -1;
+  }
+  room = end - buf;
+
+  switch (type) {
+    case ASN1_TAG_INT:
+    case ASN1_TAG_CNT:
+    case ASN1_TAG_GAU:
+    case ASN1_TAG_TIMETICKS:
+      len = sizeof(uint32_t);
+      break;
+    case ASN1_TAG_CNT64:
+      len = sizeof(uint64_t);
+      break;
+    case ASN1_TAG_OCTSTR:
+    case ASN1_TAG_IPADDR:
+      if (room < sizeof(uint32_t)) {
+        return -1;
+      }
+      len = *(const uint32_t *)buf;
+      if (len > room - sizeof(uint32_t)) {
+        return -1;
+      }
+      len = sizeof(uint32_t) + uint_sizeof(len);
+      break;
+    case ASN1_TAG_OBJID:
+      if (room < sizeof(uint32_t)) {
+        return -1;
+      }
+      len = sizeof(uint32_t) + buf[0] * sizeof(uint32_t);
+      break;
+    default:
+      len = 0;
+      break;
+  }
+
+  return len <= room ? len : -1;
+}
+
 /* Input:  buffer, flag, value type;
  * Output: value pointer
  * Return: number of elements
@@ -0,0 +1,1080 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mib.h"
+#include "agentx.h"
+#include "snmp.h"
+#include "transport.h"
+#include "ev_loop.h"
+#include "util.h"
+
+/* Master agent side of AgentX (RFC 2741). Sub-agents connect over TCP
+ * loopback or a Unix domain socket, and the subtrees they register become
+ * remote nodes of the MIB tree. Searches reaching a remote node park the
+ * request and are forwarded to the sub-agent; Get and GetNext searches of
+ * one event loop turn go out together, one PDU per session and type. The
+ * writes of a Set request to one session make a single transaction. */
+
+/* Response timeout of sessions opened without one, in seconds */
+#define AGENTX_MASTER_TIMEOUT  5
+/* Period of timeout checks, in milliseconds */
+#define AGENTX_MASTER_TICK     100
+/* Searches forwarded in one PDU at most */
+#define AGENTX_MASTER_BATCH    64
+
+struct agentx_peer {
+  struct list_head link;
+  int sock;
+  /* Received bytes not making up a whole PDU yet */
+  uint8_t *rx_buf;
+  uint32_t rx_len;
+  /* PDUs waiting to be sent */
+  uint8_t *tx_buf;
+  uint32_t tx_len;
+  uint32_t tx_size;
+  /* Set while received PDUs are processed, so their responses go in one send */
+  int corked;
+  int writing;
+  struct list_head sessions;
+};
+
+struct agentx_fwd_pdu;
+
+/* Session opened by a sub-agent */
+struct agentx_master_session {
+  struct list_head link;
+  struct agentx_peer *peer;
+  uint32_t session_id;
+  uint32_t packet_id;
+  /* Response timeout in milliseconds */
+  uint32_t timeout;
+  /* Get, GetNext and TestSet PDUs being filled in this turn */
+  struct agentx_fwd_pdu *batch[3];
+  /* PDUs waiting for response */
+  struct list_head sent;
+};
+
+/* Subtree registered by a session */
+struct agentx_master_reg {
+  struct list_head link;
+  struct agentx_master_session *session;
+  oid_t oid[MIB_OID_MAX_LEN];
+  uint32_t oid_len;
+  /* Response timeout in milliseconds, 0 for the one of session */
+  uint32_t timeout;
+};
+
+/* PDU forwarded to a sub-agent, its varbinds answer calls in order */
+struct agentx_fwd_pdu {
+  struct list_head link;
+  struct agentx_master_session *session;
+  uint8_t type;
+  uint32_t transaction_id;
+  uint32_t packet_id;
+  uint32_t timeout;
+  uint64_t expire;
+  /* Request the writes of a set transaction come from */
+  struct mib_async *async;
+  /* Varbind the commit failed at, 1-based */
+  uint16_t fail_index;
+  int call_cnt;
+  struct mib_async_call *calls[AGENTX_MASTER_BATCH];
+  /* Length of the registered subtree each call is in */
+  uint8_t node_len[AGENTX_MASTER_BATCH];
+};
+
+struct agentx_master {
+  int sock;
+  /* Unix domain socket path, NULL for TCP */
+  char *path;
+  struct list_head peers;
+  struct list_head regs;
+  uint32_t session_id;
+  uint32_t transaction_id;
+  int flush_timer;
+  int tick_timer;
+  /* PDUs waiting for response in all sessions */
+  int sent_cnt;
+};
+
+static struct agentx_master agentx_master = {
+  .sock = -1,
+  .flush_timer = -1,
+  .tick_timer = -1,
+};
+
+static void peer_write_handler(int sock, unsigned char flag, void *ud);
+
+static uint8_t
+host_order_flag(void)
+{
+#ifdef LITTLE_ENDIAN
+  return 0;
+#else
+  return NETWORD_BYTE_ORDER;
+#endif
+}
+
+/* Send as much as the socket takes, wait for it to be writable for the rest */
+static void
+peer_flush(struct agentx_peer *peer)
+{
+  ssize_t len;
+
+  while (peer->tx_len > 0) {
+    len = send(peer->sock, peer->tx_buf, peer->tx_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      /* Sub-agent is gone, the read handler closes it */
+      peer->tx_len = 0;
+      break;
+    }
+    memmove(peer->tx_buf, peer->tx_buf + len, peer->tx_len - len);
+    peer->tx_len -= len;
+  }
+
+  if (peer->tx_len > 0 && !peer->writing) {
+    snmp_event_add(peer->sock, SNMP_EV_WRITE, peer_write_handler, peer);
+    peer->writing = 1;
+  } else if (peer->tx_len == 0 && peer->writing) {
+    snmp_event_remove(peer->sock, SNMP_EV_WRITE);
+    peer->writing = 0;
+  }
+}
+
+static void
+peer_write_handler(int sock, unsigned char flag, void *ud)
+{
+  peer_flush(ud);
+}
+
+/* Queue PDU to the sub-agent, buf is freed */
+static void
+peer_send(struct agentx_peer *peer, struct x_pdu_buf x_pdu)
+{
+  if (peer->tx_len + x_pdu.len > peer->tx_size) {
+    peer->tx_size = alloc_nr(peer->tx_len + x_pdu.len);
+    peer->tx_buf = xrealloc(peer->tx_buf, peer->tx_size);
+  }
+  memcpy(peer->tx_buf + peer->tx_len, x_pdu.buf, x_pdu.len);
+  peer->tx_len += x_pdu.len;
+  free(x_pdu.buf);
+
+  if (!peer->corked) {
+    peer_flush(peer);
+  }
+}
+
+/* Answer administrative PDU of the sub-agent, xdg is done with */
+static void
+master_respond(struct agentx_peer *peer, struct agentx_datagram *xdg, uint16_t error)
+{
+  xdg->pdu_hdr.flags &= NETWORD_BYTE_ORDER;
+  xdg->u.response.sys_up_time = 0;
+  xdg->u.response.error = error;
+  xdg->u.response.index = 0;
+  peer_send(peer, agentx_response_pdu(xdg));
+  agentx_datagram_free(xdg);
+}
+
+/* Registration whose subtree is exactly oid */
+static struct agentx_master_reg *
+reg_search(const oid_t *oid, uint32_t oid_len)
+{
+  struct list_head *curr;
+
+  list_for_each(curr, &agentx_master.regs) {
+    struct agentx_master_reg *reg = list_entry(curr, struct agentx_master_reg, link);
+    if (!oid_cmp(reg->oid, reg->oid_len, oid, oid_len)) {
+      return reg;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+reg_delete(struct agentx_master_reg *reg)
+{
+  mib_node_unreg(reg->oid, reg->oid_len);
+  list_del(&reg->link);
+  free(reg);
+}
+
+/* Request of the call is done with before the sub-agent answered */
+static void
+fwd_cancel(struct mib_async_call *call)
+{
+  struct agentx_fwd_pdu *pdu = call->ud;
+  int i;
+
+  for (i = 0; i < pdu->call_cnt; i++) {
+    if (pdu->calls[i] == call) {
+      pdu->calls[i] = NULL;
+    }
+  }
+}
+
+/* Answer of call i is in, the request may be done with before we return */
+static void
+fwd_done(struct agentx_fwd_pdu *pdu, int i)
+{
+  struct mib_async_call *call = pdu->calls[i];
+
+  pdu->calls[i] = NULL;
+  mib_async_answer(call);
+}
+
+/* Fail call i, answered with no value */
+static void
+fwd_fail(struct agentx_fwd_pdu *pdu, int i, int err_stat)
+{
+  struct mib_async_call *call = pdu->calls[i];
+
+  call->err_stat = err_stat;
+  tag(&call->var) = ASN1_TAG_NUL;
+  length(&call->var) = 0;
+  call->ret_id_len = 0;
+  fwd_done(pdu, i);
+}
+
+static void
+fwd_pdu_free(struct agentx_fwd_pdu *pdu)
+{
+  int i;
+
+  /* Calls left are not waiting on the pdu any more */
+  for (i = 0; i < pdu->call_cnt; i++) {
+    if (pdu->calls[i] != NULL) {
+      pdu->calls[i]->ud = NULL;
+      pdu->calls[i]->cancel = NULL;
+    }
+  }
+  free(pdu);
+}
+
+/* Set transaction of the pdu ends, the sub-agent does not respond */
+static void
+fwd_cleanupset(struct agentx_fwd_pdu *pdu)
+{
+  struct x_pdu_hdr hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.version = 1;
+  hdr.type = AGENTX_PDU_CLEANUPSET;
+  hdr.flags = host_order_flag();
+  hdr.session_id = pdu->session->session_id;
+  hdr.transaction_id = pdu->transaction_id;
+  hdr.packet_id = ++pdu->session->packet_id;
+  peer_send(pdu->session->peer, agentx_request_pdu(&hdr, NULL, NULL));
+}
+
+static void
+master_tick_handler(void *ud);
+
+/* Send pdu and wait for its response */
+static void
+fwd_send(struct agentx_fwd_pdu *pdu)
+{
+  static struct x_search_range sr[AGENTX_MASTER_BATCH];
+  static oid_t sr_end[AGENTX_MASTER_BATCH][MIB_OID_MAX_LEN];
+  struct agentx_master_session *session = pdu->session;
+  struct list_head sr_list, vb_list, *curr, *next;
+  struct x_pdu_hdr hdr;
+  int i, n;
+
+  /* Calls of requests done with meanwhile are left out. A transaction
+   * going on keeps them, error indexes are of the varbinds tested. */
+  n = pdu->call_cnt;
+  if (pdu->type != AGENTX_PDU_COMMITSET && pdu->type != AGENTX_PDU_UNDOSET) {
+    for (i = n = 0; i < pdu->call_cnt; i++) {
+      if (pdu->calls[i] != NULL) {
+        pdu->node_len[n] = pdu->node_len[i];
+        pdu->calls[n++] = pdu->calls[i];
+      }
+    }
+    pdu->call_cnt = n;
+    if (n == 0) {
+      free(pdu);
+      return;
+    }
+  }
+
+  INIT_LIST_HEAD(&sr_list);
+  INIT_LIST_HEAD(&vb_list);
+
+  if (pdu->type == AGENTX_PDU_TESTSET) {
+    for (i = 0; i < n; i++) {
+      struct mib_async_call *call = pdu->calls[i];
+      uint32_t val_len = agentx_value_enc_try(length(&call->var), tag(&call->var));
+      struct x_var_bind *vb = agentx_vb_new(call->inst_id_len, val_len);
+
+      vb->oid_len = call->inst_id_len;
+      oid_cpy(vb->oid, call->inst_id, call->inst_id_len);
+      vb->val_type = tag(&call->var);
+      vb->val_len = agentx_value_enc(value(&call->var), length(&call->var), tag(&call->var), vb->value);
+      list_add_tail(&vb->link, &vb_list);
+    }
+  } else if (pdu->type != AGENTX_PDU_COMMITSET && pdu->type != AGENTX_PDU_UNDOSET) {
+    for (i = 0; i < n; i++) {
+      struct mib_async_call *call = pdu->calls[i];
+
+      sr[i].start = call->inst_id;
+      sr[i].start_len = call->inst_id_len;
+      sr[i].end = sr_end[i];
+      sr[i].end_len = 0;
+      if (pdu->type == AGENTX_PDU_GET) {
+        sr[i].start_include = 1;
+      } else {
+        /* First instance of the subtree may be at the subtree oid itself */
+        sr[i].start_include = call->inst_id_len == pdu->node_len[i];
+        /* Stop at the end of the subtree */
+        oid_cpy(sr_end[i], call->inst_id, pdu->node_len[i]);
+        if (++sr_end[i][pdu->node_len[i] - 1] != 0) {
+          sr[i].end_len = pdu->node_len[i];
+        }
+      }
+      list_add_tail(&sr[i].link, &sr_list);
+    }
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.version = 1;
+  hdr.type = pdu->type;
+  hdr.flags = host_order_flag();
+  hdr.session_id = session->session_id;
+  hdr.transaction_id = pdu->transaction_id;
+  hdr.packet_id = pdu->packet_id = ++session->packet_id;
+  peer_send(session->peer, agentx_request_pdu(&hdr, &sr_list, &vb_list));
+  list_for_each_safe(curr, next, &vb_list) {
+    list_del(curr);
+    free(list_entry(curr, struct x_var_bind, link));
+  }
+
+  pdu->expire = snmp_event_time() + pdu->timeout;
+  list_add_tail(&pdu->link, &session->sent);
+  agentx_master.sent_cnt++;
+
+  if (agentx_master.tick_timer < 0) {
+    agentx_master.tick_timer = snmp_event_timer_add(AGENTX_MASTER_TICK, AGENTX_MASTER_TICK, master_tick_handler, NULL);
+  }
+}
+
+static struct agentx_fwd_pdu *
+fwd_pdu_new(struct agentx_master_session *session, uint8_t type)
+{
+  struct agentx_fwd_pdu *pdu = xmalloc(sizeof(*pdu));
+
+  pdu->session = session;
+  pdu->type = type;
+  pdu->transaction_id = ++agentx_master.transaction_id;
+  pdu->timeout = 0;
+  pdu->async = NULL;
+  pdu->fail_index = 0;
+  pdu->call_cnt = 0;
+  return pdu;
+}
+
+static void
+fwd_pdu_add(struct agentx_fwd_pdu *pdu, struct agentx_master_reg *reg, struct mib_async_call *call)
+{
+  uint32_t timeout = reg->timeout ? reg->timeout : pdu->session->timeout;
+
+  if (timeout > pdu->timeout) {
+    pdu->timeout = timeout;
+  }
+  pdu->node_len[pdu->call_cnt] = reg->oid_len;
+  pdu->calls[pdu->call_cnt++] = call;
+  call->ud = pdu;
+  call->cancel = fwd_cancel;
+}
+
+/* Send the PDUs filled in this turn */
+static void
+master_flush_handler(void *ud)
+{
+  struct list_head *curr, *pos;
+  int i;
+
+  agentx_master.flush_timer = -1;
+
+  list_for_each(curr, &agentx_master.peers) {
+    struct agentx_peer *peer = list_entry(curr, struct agentx_peer, link);
+    list_for_each(pos, &peer->sessions) {
+      struct agentx_master_session *session = list_entry(pos, struct agentx_master_session, link);
+      for (i = 0; i < elem_num(session->batch); i++) {
+        if (session->batch[i] != NULL) {
+          fwd_send(session->batch[i]);
+          session->batch[i] = NULL;
+        }
+      }
+    }
+  }
+}
+
+/* Forward the search of call to the sub-agent of reg */
+static void
+fwd_queue(struct agentx_master_reg *reg, struct mib_async_call *call)
+{
+  static const uint8_t types[] = { AGENTX_PDU_GET, AGENTX_PDU_GETNEXT, AGENTX_PDU_TESTSET };
+  struct agentx_master_session *session = reg->session;
+  struct agentx_fwd_pdu *pdu;
+  int i;
+
+  i = call->request == MIB_REQ_GET ? 0 : call->request == MIB_REQ_GETNEXT ? 1 : 2;
+  pdu = session->batch[i];
+
+  /* Writes of another request are another transaction */
+  if (pdu != NULL && i == 2 && pdu->async != call->async) {
+    session->batch[i] = NULL;
+    fwd_send(pdu);
+    pdu = NULL;
+  }
+  if (pdu == NULL) {
+    pdu = session->batch[i] = fwd_pdu_new(session, types[i]);
+    pdu->async = call->async;
+  }
+  fwd_pdu_add(pdu, reg, call);
+
+  if (pdu->call_cnt == AGENTX_MASTER_BATCH) {
+    session->batch[i] = NULL;
+    fwd_send(pdu);
+  } else if (agentx_master.flush_timer < 0) {
+    /* Searches of this turn go together */
+    agentx_master.flush_timer = snmp_event_timer_add(0, 0, master_flush_handler, NULL);
+    if (agentx_master.flush_timer < 0) {
+      session->batch[i] = NULL;
+      fwd_send(pdu);
+    }
+  }
+}
+
+/* Search handler of remote nodes */
+static int
+agentx_master_search(struct oid_search_res *ret_oid)
+{
+  struct mib_async_call *call;
+  struct agentx_master_reg *reg;
+  int created;
+
+  reg = reg_search(ret_oid->oid, ret_oid->inst_id - ret_oid->oid);
+  if (reg == NULL) {
+    tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+    return 0;
+  }
+
+  if (ret_oid->request != MIB_REQ_GET && ret_oid->request != MIB_REQ_GETNEXT && ret_oid->request != MIB_REQ_SET) {
+    tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+    return 0;
+  }
+
+  call = mib_async_remote(ret_oid, &created);
+  if (call == NULL) {
+    /* Nowhere to wait for the sub-agent */
+    tag(&ret_oid->var) = ASN1_TAG_NUL;
+    length(&ret_oid->var) = 0;
+    return AGENTX_ERR_STAT_GEN_ERR;
+  }
+
+  if (created) {
+    fwd_queue(reg, call);
+  }
+  if (call->status == LUA_YIELD) {
+    /* Parked, the request will be replayed */
+    return 0;
+  }
+
+  memcpy(&ret_oid->var, &call->var, sizeof(ret_oid->var));
+  if (ret_oid->request == MIB_REQ_GETNEXT) {
+    ret_oid->inst_id_len = call->ret_id_len;
+    oid_cpy(ret_oid->inst_id, call->ret_id, call->ret_id_len);
+  }
+  return call->err_stat;
+}
+
+/* Value of varbind from the sub-agent as the answer of call */
+static void
+fwd_answer(struct agentx_fwd_pdu *pdu, int i, struct x_var_bind *vb)
+{
+  struct mib_async_call *call = pdu->calls[i];
+  uint32_t node_len = pdu->node_len[i];
+
+  call->err_stat = 0;
+  tag(&call->var) = vb->val_type;
+  length(&call->var) = vb->val_len;
+  memcpy(value(&call->var), vb->value, agentx_value_enc_try(vb->val_len, vb->val_type));
+
+  if (pdu->type == AGENTX_PDU_GETNEXT) {
+    /* Instance must be in the subtree, after the oid searched */
+    if (!MIB_TAG_VALID(vb->val_type) || oid_cover(call->inst_id, node_len, vb->oid, vb->oid_len) <= 0 ||
+        oid_cmp(vb->oid, vb->oid_len, call->inst_id, call->inst_id_len) < 0 ||
+        (call->inst_id_len > node_len && !oid_cmp(vb->oid, vb->oid_len, call->inst_id, call->inst_id_len))) {
+      tag(&call->var) = ASN1_TAG_NO_SUCH_INST;
+      call->ret_id_len = 0;
+    } else {
+      call->ret_id_len = vb->oid_len - node_len;
+      oid_cpy(call->ret_id, vb->oid + node_len, call->ret_id_len);
+    }
+  }
+
+  fwd_done(pdu, i);
+}
+
+/* Calls of pdu whose requests still wait for them */
+static int
+fwd_pdu_waited(struct agentx_fwd_pdu *pdu)
+{
+  int i, cnt = 0;
+
+  for (i = 0; i < pdu->call_cnt; i++) {
+    if (pdu->calls[i] != NULL) {
+      cnt++;
+    }
+  }
+  return cnt;
+}
+
+/* End of a set transaction. The write at 1-based index fails with err_stat,
+ * the first one if index is out of range, and the others echo their value. */
+static void
+fwd_set_answer(struct agentx_fwd_pdu *pdu, int index, int err_stat)
+{
+  int i;
+
+  if (err_stat && (index < 1 || index > pdu->call_cnt)) {
+    index = 1;
+  }
+
+  /* Answering the last call may finish the request, which drops the others */
+  for (i = 0; i < pdu->call_cnt; i++) {
+    if (pdu->calls[i] == NULL) {
+      continue;
+    }
+    if (err_stat && i == index - 1) {
+      fwd_fail(pdu, i, err_stat);
+    } else {
+      pdu->calls[i]->err_stat = 0;
+      fwd_done(pdu, i);
+    }
+  }
+}
+
+/* Response of the sub-agent to a forwarded PDU */
+static void
+fwd_response(struct agentx_master_session *session, struct agentx_datagram *xdg)
+{
+  struct agentx_fwd_pdu *pdu = NULL;
+  struct list_head *curr, *vb_curr;
+  uint16_t error = xdg->u.response.error;
+  int i;
+
+  list_for_each(curr, &session->sent) {
+    struct agentx_fwd_pdu *p = list_entry(curr, struct agentx_fwd_pdu, link);
+    if (p->packet_id == xdg->pdu_hdr.packet_id) {
+      pdu = p;
+      break;
+    }
+  }
+  if (pdu == NULL) {
+    /* Timed out already */
+    return;
+  }
+  list_del(&pdu->link);
+  agentx_master.sent_cnt--;
+
+  switch (pdu->type) {
+    case AGENTX_PDU_TESTSET:
+      if (error || !fwd_pdu_waited(pdu)) {
+        fwd_cleanupset(pdu);
+        fwd_set_answer(pdu, xdg->u.response.index, error);
+        break;
+      }
+      /* Test passed, write them all */
+      pdu->type = AGENTX_PDU_COMMITSET;
+      fwd_send(pdu);
+      return;
+
+    case AGENTX_PDU_COMMITSET:
+      if (error) {
+        /* Take back what the sub-agent has written */
+        pdu->fail_index = xdg->u.response.index;
+        pdu->type = AGENTX_PDU_UNDOSET;
+        fwd_send(pdu);
+        return;
+      }
+      fwd_cleanupset(pdu);
+      fwd_set_answer(pdu, 0, 0);
+      break;
+
+    case AGENTX_PDU_UNDOSET:
+      fwd_cleanupset(pdu);
+      fwd_set_answer(pdu, pdu->fail_index, error ? AGENTX_ERR_STAT_UNDO_FAILED : AGENTX_ERR_STAT_COMMIT_FAILED);
+      break;
+
+    default:
+      vb_curr = xdg->vb_in_list.next;
+      for (i = 0; i < pdu->call_cnt; i++) {
+        struct x_var_bind *vb = NULL;
+
+        if (vb_curr != &xdg->vb_in_list) {
+          vb = list_entry(vb_curr, struct x_var_bind, link);
+          vb_curr = vb_curr->next;
+        }
+        /* Answering may finish requests, which drop their other calls */
+        if (pdu->calls[i] == NULL) {
+          continue;
+        }
+        if (error || vb == NULL) {
+          fwd_fail(pdu, i, error ? error : AGENTX_ERR_STAT_GEN_ERR);
+        } else {
+          fwd_answer(pdu, i, vb);
+        }
+      }
+      break;
+  }
+
+  fwd_pdu_free(pdu);
+}
+
+/* Fail every call waiting on pdu */
+static void
+fwd_pdu_fail(struct agentx_fwd_pdu *pdu)
+{
+  int i;
+
+  for (i = 0; i < pdu->call_cnt; i++) {
+    if (pdu->calls[i] != NULL) {
+      fwd_fail(pdu, i, AGENTX_ERR_STAT_GEN_ERR);
+    }
+  }
+  fwd_pdu_free(pdu);
+}
+
+/* Fail PDUs not responded in time */
+static void
+master_tick_handler(void *ud)
+{
+  struct list_head *curr, *pos, *next, *n;
+  uint64_t now = snmp_event_time();
+
+  list_for_each(curr, &agentx_master.peers) {
+    struct agentx_peer *peer = list_entry(curr, struct agentx_peer, link);
+    list_for_each(pos, &peer->sessions) {
+      struct agentx_master_session *session = list_entry(pos, struct agentx_master_session, link);
+      list_for_each_safe(next, n, &session->sent) {
+        struct agentx_fwd_pdu *pdu = list_entry(next, struct agentx_fwd_pdu, link);
+        if (pdu->expire > now) {
+          continue;
+        }
+        SMARTSNMP_LOG(L_WARNING, "AgentX session %u timed out on packet %u\n", session->session_id, pdu->packet_id);
+        list_del(&pdu->link);
+        agentx_master.sent_cnt--;
+        if (pdu->type == AGENTX_PDU_TESTSET || pdu->type == AGENTX_PDU_COMMITSET || pdu->type == AGENTX_PDU_UNDOSET) {
+          fwd_cleanupset(pdu);
+        }
+        fwd_pdu_fail(pdu);
+      }
+    }
+  }
+
+  if (agentx_master.sent_cnt == 0 && agentx_master.tick_timer >= 0) {
+    snmp_event_timer_remove(agentx_master.tick_timer);
+    agentx_master.tick_timer = -1;
+  }
+}
+
+static struct agentx_master_session *
+session_search(struct agentx_peer *peer, uint32_t session_id)
+{
+  struct list_head *curr;
+
+  list_for_each(curr, &peer->sessions) {
+    struct agentx_master_session *session = list_entry(curr, struct agentx_master_session, link);
+    if (session->session_id == session_id) {
+      return session;
+    }
+  }
+
+  return NULL;
+}
+
+/* Drop the registrations of session and fail the searches waiting on it */
+static void
+session_close(struct agentx_master_session *session)
+{
+  struct list_head *curr, *next;
+  int i;
+
+  list_for_each_safe(curr, next, &agentx_master.regs) {
+    struct agentx_master_reg *reg = list_entry(curr, struct agentx_master_reg, link);
+    if (reg->session == session) {
+      reg_delete(reg);
+    }
+  }
+
+  list_del(&session->link);
+
+  for (i = 0; i < elem_num(session->batch); i++) {
+    if (session->batch[i] != NULL) {
+      fwd_pdu_fail(session->batch[i]);
+    }
+  }
+  list_for_each_safe(curr, next, &session->sent) {
+    struct agentx_fwd_pdu *pdu = list_entry(curr, struct agentx_fwd_pdu, link);
+    list_del(&pdu->link);
+    agentx_master.sent_cnt--;
+    fwd_pdu_fail(pdu);
+  }
+
+  free(session);
+}
+
+static uint16_t
+master_open(struct agentx_peer *peer, struct agentx_datagram *xdg)
+{
+  struct agentx_master_session *session;
+
+  /* Values are taken in host byte order */
+  if ((xdg->pdu_hdr.flags & NETWORD_BYTE_ORDER) != host_order_flag()) {
+    return E_OPEN_FAILED;
+  }
+
+  session = xmalloc(sizeof(*session));
+  session->peer = peer;
+  session->session_id = ++agentx_master.session_id;
+  session->packet_id = 0;
+  session->timeout = (xdg->u.open.timeout ? xdg->u.open.timeout : AGENTX_MASTER_TIMEOUT) * 1000;
+  memset(session->batch, 0, sizeof(session->batch));
+  INIT_LIST_HEAD(&session->sent);
+  list_add_tail(&session->link, &peer->sessions);
+
+  xdg->pdu_hdr.session_id = session->session_id;
+  return 0;
+}
+
+static uint16_t
+master_register(struct agentx_master_session *session, struct agentx_datagram *xdg)
+{
+  struct agentx_master_reg *reg;
+
+  /* Only the default context is served */
+  if (xdg->ctx_len > 0) {
+    return E_UNSUPPORTED_CONTEXT;
+  }
+  if (xdg->u.reg.range_subid) {
+    return E_REQUEST_DENIED;
+  }
+  if (xdg->u.reg.subtree_len == 0) {
+    return E_PARSE_ERROR;
+  }
+
+  /* Subtrees overlapping others are refused, there are no priorities */
+  if (mib_native_node_reg(xdg->u.reg.subtree, xdg->u.reg.subtree_len, agentx_master_search) < 0) {
+    return E_DUPLICATE_REGISTRATION;
+  }
+
+  reg = xmalloc(sizeof(*reg));
+  reg->session = session;
+  reg->oid_len = xdg->u.reg.subtree_len;
+  oid_cpy(reg->oid, xdg->u.reg.subtree, reg->oid_len);
+  reg->timeout = xdg->u.reg.timeout * 1000;
+  list_add_tail(&reg->link, &agentx_master.regs);
+  return 0;
+}
+
+static uint16_t
+master_unregister(struct agentx_master_session *session, struct agentx_datagram *xdg)
+{
+  struct agentx_master_reg *reg = reg_search(xdg->u.reg.subtree, xdg->u.reg.subtree_len);
+
+  if (reg == NULL || reg->session != session || xdg->ctx_len > 0) {
+    return E_UNKNOWN_REGISTRATION;
+  }
+  reg_delete(reg);
+  return 0;
+}
+
+/* Notification of a sub-agent to the trap targets, snmpTrapOID.0 may come
+ * after sysUpTime.0 */
+static uint16_t
+master_notify(struct agentx_datagram *xdg)
+{
+  static const oid_t sys_uptime_oid[] = { 1, 3, 6, 1, 2, 1, 1, 3, 0 };
+  static const oid_t snmp_trap_oid[] = { 1, 3, 6, 1, 6, 3, 1, 1, 4, 1, 0 };
+  struct snmp_trap *trap = NULL;
+  struct list_head *curr;
+
+  list_for_each(curr, &xdg->vb_in_list) {
+    struct x_var_bind *vb = list_entry(curr, struct x_var_bind, link);
+
+    if (trap != NULL) {
+      snmp_trap_vb_add(trap, vb->oid, vb->oid_len, vb->val_type, vb->value, vb->val_len);
+    } else if (!oid_cmp(vb->oid, vb->oid_len, snmp_trap_oid, elem_num(snmp_trap_oid)) && vb->val_type == ASN1_TAG_OBJID) {
+      trap = snmp_trap_new((const oid_t *)vb->value, vb->val_len);
+    } else if (oid_cmp(vb->oid, vb->oid_len, sys_uptime_oid, elem_num(sys_uptime_oid)) || curr != xdg->vb_in_list.next) {
+      break;
+    }
+  }
+
+  if (trap == NULL) {
+    return E_PROCESSING_ERROR;
+  }
+  snmp_trap_send(trap);
+  return 0;
+}
+
+/* PDU from the sub-agent */
+static void
+master_recv(struct agentx_peer *peer, uint8_t *buf)
+{
+  struct agentx_datagram *xdg;
+  struct agentx_master_session *session;
+  uint16_t error = 0;
+
+  xdg = agentx_datagram_decode(buf);
+  if (xdg == NULL) {
+    return;
+  }
+
+  if (xdg->pdu_hdr.type == AGENTX_PDU_OPEN) {
+    master_respond(peer, xdg, master_open(peer, xdg));
+    return;
+  }
+
+  session = session_search(peer, xdg->pdu_hdr.session_id);
+  if (session == NULL) {
+    if (xdg->pdu_hdr.type == AGENTX_PDU_RESPONSE) {
+      agentx_datagram_free(xdg);
+    } else {
+      master_respond(peer, xdg, E_NOT_OPEN);
+    }
+    return;
+  }
+
+  switch (xdg->pdu_hdr.type) {
+    case AGENTX_PDU_CLOSE:
+      session_close(session);
+      break;
+    case AGENTX_PDU_REG:
+      error = master_register(session, xdg);
+      break;
+    case AGENTX_PDU_UNREG:
+      error = master_unregister(session, xdg);
+      break;
+    case AGENTX_PDU_RESPONSE:
+      fwd_response(session, xdg);
+      agentx_datagram_free(xdg);
+      return;
+    case AGENTX_PDU_NOTIFY:
+      error = master_notify(xdg);
+      break;
+    case AGENTX_PDU_PING:
+    case AGENTX_PDU_ADDAGENTCAP:
+    case AGENTX_PDU_REMOVEAGENTCAP:
+      break;
+    case AGENTX_PDU_INDEXALLOC:
+    case AGENTX_PDU_INDEXDEALLOC:
+      error = E_PROCESSING_ERROR;
+      break;
+    default:
+      /* Requests go from master to sub-agents only */
+      error = E_PARSE_ERROR;
+      break;
+  }
+
+  master_respond(peer, xdg, error);
+}
+
+static void
+peer_close(struct agentx_peer *peer)
+{
+  struct list_head *curr, *next;
+
+  list_for_each_safe(curr, next, &peer->sessions) {
+    session_close(list_entry(curr, struct agentx_master_session, link));
+  }
+
+  snmp_event_remove(peer->sock, SNMP_EV_READ | SNMP_EV_WRITE);
+  close(peer->sock);
+  list_del(&peer->link);
+  free(peer->rx_buf);
+  free(peer->tx_buf);
+  free(peer);
+}
+
+static void
+peer_read_handler(int sock, unsigned char flag, void *ud)
+{
+  struct agentx_peer *peer = ud;
+  uint32_t pos, pdu_len;
+  uint8_t *buf;
+  int len;
+
+  /* Receive agentx PDUs, the last one may be partial */
+  len = recv(sock, peer->rx_buf + peer->rx_len, TRANS_BUF_SIZ - peer->rx_len, 0);
+  if (len <= 0) {
+    if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+      return;
+    }
+    /* Sub-agent is gone */
+    peer_close(peer);
+    return;
+  }
+  peer->rx_len += len;
+
+  /* Hand over every whole PDU */
+  peer->corked = 1;
+  for (pos = 0; peer->rx_len - pos >= sizeof(struct x_pdu_hdr); pos += pdu_len) {
+    pdu_len = agentx_pdu_len(peer->rx_buf + pos);
+    if (pdu_len > TRANS_BUF_SIZ) {
+      SMARTSNMP_LOG(L_ERROR, "AgentX PDU length %u exceeds!\n", pdu_len);
+      peer_close(peer);
+      return;
+    }
+    if (peer->rx_len - pos < pdu_len) {
+      break;
+    }
+    buf = xmalloc(pdu_len);
+    memcpy(buf, peer->rx_buf + pos, pdu_len);
+    master_recv(peer, buf);
+  }
+  peer->corked = 0;
+
+  /* Keep the partial PDU for the next read */
+  memmove(peer->rx_buf, peer->rx_buf + pos, peer->rx_len - pos);
+  peer->rx_len -= pos;
+
+  peer_flush(peer);
+}
+
+static void
+master_accept_handler(int sock, unsigned char flag, void *ud)
+{
+  struct agentx_peer *peer;
+  int fd, on = 1;
+
+  fd = accept(sock, NULL, NULL);
+  if (fd < 0) {
+    perror("accept()");
+    return;
+  }
+
+  if (agentx_master.path == NULL) {
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+
+  peer = xcalloc(1, sizeof(*peer));
+  peer->sock = fd;
+  peer->rx_buf = xmalloc(TRANS_BUF_SIZ);
+  INIT_LIST_HEAD(&peer->sessions);
+
+  if (snmp_event_add(fd, SNMP_EV_READ, peer_read_handler, peer) < 0) {
+    SMARTSNMP_LOG(L_WARNING, "No room for AgentX sub-agent in event loop\n");
+    close(fd);
+    free(peer->rx_buf);
+    free(peer);
+    return;
+  }
+  list_add_tail(&peer->link, &agentx_master.peers);
+}
+
+/* Listen for sub-agents on Unix domain socket path, or on TCP loopback port
+ * if path is NULL. The event loop transport must be in use. */
+int
+agentx_master_init(int port, const char *path)
+{
+  struct sockaddr_in sin;
+  struct sockaddr_un sun;
+  int sock, on = 1;
+
+  /* The listener and sub-agent sockets are served by the built-in loop */
+  if (!snmp_trans_ops.evloop) {
+    SMARTSNMP_LOG(L_ERROR, "AgentX master needs the built-in event loop, not the %s transport!\n", snmp_trans_ops.name);
+    return -1;
+  }
+
+  INIT_LIST_HEAD(&agentx_master.peers);
+  INIT_LIST_HEAD(&agentx_master.regs);
+
+  if (path != NULL) {
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+      SMARTSNMP_LOG(L_ERROR, "AgentX socket path %s is too long!\n", path);
+      return -1;
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+      perror("usock");
+      return -1;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    /* Left over by a master run before */
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+      perror("bind()");
+      close(sock);
+      return -1;
+    }
+    agentx_master.path = strdup(path);
+  } else {
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+      perror("usock");
+      return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+      perror("bind()");
+      close(sock);
+      return -1;
+    }
+  }
+
+  if (listen(sock, 16) == -1 || snmp_event_add(sock, SNMP_EV_READ, master_accept_handler, NULL) < 0) {
+    perror("listen()");
+    close(sock);
+    return -1;
+  }
+
+  agentx_master.sock = sock;
+  return 0;
+}
@@ -34,6 +34,7 @@ static struct err_msg_map agentx_err_msg[] = {
   { AGENTX_ERR_OK, "Every thing is OK!" },
 
   { AGENTX_ERR_PDU_CTX_LEN, "AgentX PDU context length exceeds!" },
+  { AGENTX_ERR_PDU_LEN, "AgentX PDU length not match!" },
 
   { AGENTX_ERR_VB_VAR, "AgentX varbind allocation fail!" },
   { AGENTX_ERR_VB_VALUE_LEN, "AgentX varbind value length exceeds!" },
@@ -41,20 +42,23 @@ static struct err_msg_map agentx_err_msg[] = {
 
   { AGENTX_ERR_SR_VAR, "AgentX search range allocation fail!" },
   { AGENTX_ERR_SR_OID_LEN, "AgentX search range oid length exceeds!" },
+
+  { AGENTX_ERR_REG_OID_LEN, "AgentX registration oid length exceeds!" },
 };
 
-static struct x_var_bind *
-vb_new(uint32_t oid_len, uint32_t val_len)
+/* Varbind with room for oid_len sub-ids after val_len bytes of value */
+struct x_var_bind *
+agentx_vb_new(uint32_t oid_len, uint32_t val_len)
 {
-  struct x_var_bind *vb = xmalloc(sizeof(*vb) + val_len);
-  vb->oid = xmalloc(oid_len);
+  uint32_t val_size = ARENA_ALIGN(val_len);
+  struct x_var_bind *vb = xmalloc(sizeof(*vb) + val_size + oid_len * sizeof(oid_t));
+  vb->oid = (oid_t *)(vb->value + val_size);
   return vb;
 }
 
 static void
 vb_delete(struct x_var_bind *vb)
 {
-  free(vb->oid);
   free(vb);
 }
 
@@ -99,39 +103,67 @@ sr_list_free(struct list_head *sr_list)
   }
 }
 
-static void
-agentx_datagram_clear(struct agentx_datagram *xdg)
+/* Contexts of finished requests kept for reuse */
+#define AGENTX_DATAGRAM_POOL_SIZE  16
+
+static struct agentx_datagram *xdg_pool[AGENTX_DATAGRAM_POOL_SIZE];
+static int xdg_pool_cnt;
+
+static struct agentx_datagram *
+agentx_datagram_new(uint8_t *buf)
+{
+  struct agentx_datagram *xdg;
+
+  if (xdg_pool_cnt > 0) {
+    xdg = xdg_pool[--xdg_pool_cnt];
+  } else {
+    xdg = xmalloc(sizeof(*xdg));
+  }
+
+  memset(xdg, 0, sizeof(*xdg));
+  INIT_LIST_HEAD(&xdg->vb_in_list);
+  INIT_LIST_HEAD(&xdg->vb_out_list);
+  INIT_LIST_HEAD(&xdg->sr_in_list);
+  INIT_LIST_HEAD(&xdg->sr_out_list);
+  xdg->recv_buf = buf;
+  return xdg;
+}
+
+void
+agentx_datagram_free(struct agentx_datagram *xdg)
 {
   /* free varbind list */
   vb_list_free(&xdg->vb_in_list);
   vb_list_free(&xdg->vb_out_list);
-  xdg->vb_in_cnt = 0;
-  xdg->vb_out_cnt = 0;
   /* free search range list */
   sr_list_free(&xdg->sr_in_list);
   sr_list_free(&xdg->sr_out_list);
-  xdg->sr_in_cnt = 0;
-  xdg->sr_out_cnt = 0;
-  /* clear some fields */
-  xdg->u.response.sys_up_time = 0;
-  xdg->u.response.error = 0;
-  xdg->u.response.index = 0;
-  memset(xdg->context, 0, sizeof(xdg->context));
-  xdg->ctx_len = 0;
+  free(xdg->recv_buf);
+
+  if (xdg_pool_cnt < AGENTX_DATAGRAM_POOL_SIZE) {
+    xdg_pool[xdg_pool_cnt++] = xdg;
+  } else {
+    free(xdg);
+  }
 }
 
 /* Alloc buffer for var bind decoding */
 static struct x_var_bind *
-var_bind_alloc(uint8_t **buffer, uint8_t flag, enum agentx_err_code *err)
+var_bind_alloc(uint8_t **buffer, const uint8_t *end, uint8_t flag, enum agentx_err_code *err)
 {
   struct x_var_bind *vb;
   uint16_t type;
   uint32_t oid_len, val_len;
   uint8_t *buf, *buf1;
+  int oid_size;
 
   buf = *buffer;
 
   /* value type */
+  if (end - buf < 4) {
+    *err = AGENTX_ERR_PDU_LEN;
+    return NULL;
+  }
   if (flag & NETWORD_BYTE_ORDER) {
     type = NTOH16(*(uint16_t *)buf);
   } else {
@@ -139,6 +171,13 @@ var_bind_alloc(uint8_t **buffer, uint8_t flag, enum agentx_err_code *err)
   }
   buf += 4;
 
+  /* name and value have to be there */
+  oid_size = agentx_value_size(buf, end, ASN1_TAG_OBJID);
+  if (oid_size < 0 || agentx_value_size(buf + oid_size, end, type) < 0) {
+    *err = AGENTX_ERR_PDU_LEN;
+    return NULL;
+  }
+
   /* oid length */
   buf1 = buf;
   oid_len = agentx_value_dec_try(buf1, flag, ASN1_TAG_OBJID);
@@ -160,11 +199,7 @@ var_bind_alloc(uint8_t **buffer, uint8_t flag, enum agentx_err_code *err)
   }
 
   /* varbind allocation */
-  vb = vb_new(oid_len, val_len);
-  if (vb == NULL) {
-    *err = AGENTX_ERR_VB_VAR;
-    return NULL;
-  }
+  vb = agentx_vb_new(oid_len / sizeof(uint32_t), val_len);
 
   /* OID assignment */
   vb->oid_len = agentx_value_dec(&buf1, flag, ASN1_TAG_OBJID, vb->oid);
@@ -180,15 +215,23 @@ var_bind_alloc(uint8_t **buffer, uint8_t flag, enum agentx_err_code *err)
 
 /* Alloc buffer for search range decoding */
 static struct x_search_range *
-search_range_alloc(uint8_t **buffer, uint8_t flag, enum agentx_err_code *err)
+search_range_alloc(uint8_t **buffer, const uint8_t *end, uint8_t flag, enum agentx_err_code *err)
 {
   uint8_t *buf, *buf1;
   uint8_t start_include, end_include;
   uint32_t start_len, end_len;
   struct x_search_range *sr;
+  int start_size;
 
   buf1 = buf = *buffer;
 
+  /* start and end oids have to be there */
+  start_size = agentx_value_size(buf, end, ASN1_TAG_OBJID);
+  if (start_size < 0 || agentx_value_size(buf + start_size, end, ASN1_TAG_OBJID) < 0) {
+    *err = AGENTX_ERR_PDU_LEN;
+    return NULL;
+  }
+
   /* start oid length */
   start_len = agentx_value_dec_try(buf, flag, ASN1_TAG_OBJID);
   if (start_len / sizeof(uint32_t) > MIB_OID_MAX_LEN) {
@@ -229,7 +272,7 @@ search_range_alloc(uint8_t **buffer, uint8_t flag, enum agentx_err_code *err)
 
 /* Parse varbind */
 static AGENTX_ERR_CODE_E
-var_bind_parse(struct agentx_datagram *xdg, uint8_t **buffer)
+var_bind_parse(struct agentx_datagram *xdg, uint8_t **buffer, const uint8_t *end)
 {
   AGENTX_ERR_CODE_E err;
   uint8_t *buf;
@@ -237,9 +280,9 @@ var_bind_parse(struct agentx_datagram *xdg, uint8_t **buffer)
   err = AGENTX_ERR_OK;
   buf = *buffer;
 
-  while (xdg->pdu_hdr.payload_length > 0) {
+  while (buf < end) {
     /* Alloc a new var_bind and add into var_bind list. */
-    struct x_var_bind *vb = var_bind_alloc(&buf, xdg->pdu_hdr.flags, &err);
+    struct x_var_bind *vb = var_bind_alloc(&buf, end, xdg->pdu_hdr.flags, &err);
     if (vb == NULL) {
       SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(agentx_err_msg, elem_num(agentx_err_msg), err));
       *buffer = buf;
@@ -247,7 +290,6 @@ var_bind_parse(struct agentx_datagram *xdg, uint8_t **buffer)
     }
     list_add_tail(&vb->link, &xdg->vb_in_list);
     xdg->vb_in_cnt++;
-    xdg->pdu_hdr.payload_length -= buf - *buffer;
     *buffer = buf;
   }
 
@@ -256,7 +298,7 @@ var_bind_parse(struct agentx_datagram *xdg, uint8_t **buffer)
 
 /* Parse search range */
 static AGENTX_ERR_CODE_E
-search_range_parse(struct agentx_datagram *xdg, uint8_t **buffer)
+search_range_parse(struct agentx_datagram *xdg, uint8_t **buffer, const uint8_t *end)
 {
   AGENTX_ERR_CODE_E err;
   uint8_t *buf;
@@ -264,9 +306,9 @@ search_range_parse(struct agentx_datagram *xdg, uint8_t **buffer)
   err = AGENTX_ERR_OK;
   buf = *buffer;
 
-  while (xdg->pdu_hdr.payload_length > 0) {
+  while (buf < end) {
     /* Alloc a new search range and add into search range list. */
-    struct x_search_range *sr = search_range_alloc(&buf, xdg->pdu_hdr.flags, &err);
+    struct x_search_range *sr = search_range_alloc(&buf, end, xdg->pdu_hdr.flags, &err);
     if (sr == NULL) {
       SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(agentx_err_msg, elem_num(agentx_err_msg), err));
       *buffer = buf;
@@ -274,19 +316,53 @@ search_range_parse(struct agentx_datagram *xdg, uint8_t **buffer)
     }
     list_add_tail(&sr->link, &xdg->sr_in_list);
     xdg->sr_in_cnt++;
-    xdg->pdu_hdr.payload_length -= buf - *buffer;
     *buffer = buf;
   }
 
   return err;
 }
 
+/* Whole length of PDU from its header, as stream framing */
+uint32_t
+agentx_pdu_len(const uint8_t *buf)
+{
+  uint32_t payload_length = *(const uint32_t *)(buf + 16);
+
+  if (buf[2] & NETWORD_BYTE_ORDER) {
+    payload_length = NTOH32(payload_length);
+  }
+  /* Longer than any buffer rather than wrapped around */
+  if (payload_length > UINT32_MAX - sizeof(struct x_pdu_hdr)) {
+    return UINT32_MAX;
+  }
+  return sizeof(struct x_pdu_hdr) + payload_length;
+}
+
+/* Bytes of fixed fields after the header and context of PDU type */
+static int
+agentx_hdr_data_len(uint8_t type)
+{
+  switch (type) {
+    case AGENTX_PDU_CLOSE:
+    case AGENTX_PDU_GETBULK:
+    case AGENTX_PDU_OPEN:
+    case AGENTX_PDU_REG:
+    case AGENTX_PDU_UNREG:
+      return sizeof(uint32_t);
+    case AGENTX_PDU_RESPONSE:
+      return sizeof(uint32_t) + 2 * sizeof(uint16_t);
+    default:
+      return 0;
+  }
+}
+
 /* Parse PDU header */
 static AGENTX_ERR_CODE_E
-pdu_hdr_parse(struct agentx_datagram *xdg, uint8_t **buffer)
+pdu_hdr_parse(struct agentx_datagram *xdg, uint8_t **buffer, const uint8_t *end)
 {
   AGENTX_ERR_CODE_E err;
   uint8_t *buf;
+  int size;
 
   err = AGENTX_ERR_OK;
   buf = *buffer;
@@ -318,6 +394,11 @@ pdu_hdr_parse(struct agentx_datagram *xdg, uint8_t **buffer)
 
   /* Optinal context */
   if (xdg->pdu_hdr.flags & NON_DEFAULT_CONTEXT) {
+    if (end - buf < sizeof(uint32_t)) {
+      err = AGENTX_ERR_PDU_LEN;
+      *buffer = buf;
+      return err;
+    }
     if (xdg->pdu_hdr.flags & NETWORD_BYTE_ORDER) {
       xdg->ctx_len = NTOH32(*(uint32_t *)buf);
     } else {
@@ -329,12 +410,22 @@ pdu_hdr_parse(struct agentx_datagram *xdg, uint8_t **buffer)
       return err;
     }
     buf += sizeof(uint32_t);
+    if (end - buf < uint_sizeof(xdg->ctx_len)) {
+      err = AGENTX_ERR_PDU_LEN;
+      *buffer = buf;
+      return err;
+    }
     memcpy(xdg->context, buf, xdg->ctx_len);
     buf += uint_sizeof(xdg->ctx_len);
     xdg->pdu_hdr.payload_length -= 4 + uint_sizeof(xdg->ctx_len);
   }
 
-  /* additional data */
+  /* additional data, fixed fields checked here */
+  if (end - buf < agentx_hdr_data_len(xdg->pdu_hdr.type)) {
+    err = AGENTX_ERR_PDU_LEN;
+    *buffer = buf;
+    return err;
+  }
   switch (xdg->pdu_hdr.type) {
     case AGENTX_PDU_CLOSE:
       xdg->u.close.reason = *buf;
@@ -377,6 +468,39 @@ pdu_hdr_parse(struct agentx_datagram *xdg, uint8_t **buffer)
       }
       buf += sizeof(uint16_t);
       xdg->pdu_hdr.payload_length -= sizeof(uint32_t) + 2 * sizeof(uint16_t);
+      break;
+    case AGENTX_PDU_OPEN:
+      xdg->u.open.timeout = *buf;
+      buf += sizeof(uint32_t);
+      xdg->pdu_hdr.payload_length -= sizeof(uint32_t);
+      break;
+    case AGENTX_PDU_REG:
+    case AGENTX_PDU_UNREG:
+      xdg->u.reg.timeout = buf[0];
+      xdg->u.reg.priority = buf[1];
+      xdg->u.reg.range_subid = buf[2];
+      buf += sizeof(uint32_t);
+      /* Subtree, then the upper bound of a range */
+      size = agentx_value_size(buf, end, ASN1_TAG_OBJID);
+      if (size < 0 || (xdg->u.reg.range_subid && end - buf - size < sizeof(uint32_t))) {
+        err = AGENTX_ERR_PDU_LEN;
+        break;
+      }
+      if (*buf + 5 > MIB_OID_MAX_LEN) {
+        err = AGENTX_ERR_REG_OID_LEN;
+        break;
+      }
+      xdg->u.reg.subtree_len = agentx_value_dec(&buf, xdg->pdu_hdr.flags, ASN1_TAG_OBJID, xdg->u.reg.subtree);
+      if (xdg->u.reg.range_subid) {
+        if (xdg->pdu_hdr.flags & NETWORD_BYTE_ORDER) {
+          xdg->u.reg.upper_bound = NTOH32(*(uint32_t *)buf);
+        } else {
+          xdg->u.reg.upper_bound = *(uint32_t *)buf;
+        }
+        buf += sizeof(uint32_t);
+      }
+      xdg->pdu_hdr.payload_length = 0;
+      break;
     default:
       break;
   }
@@ -390,15 +514,16 @@ static AGENTX_ERR_CODE_E
 agentx_decode(struct agentx_datagram *xdg)
 {
   AGENTX_ERR_CODE_E err;
-  uint8_t *buf, dec_fail = 0;
+  uint8_t *buf, *end;
 
+  /* Whole PDU as framed by its header */
   buf = xdg->recv_buf;
+  end = buf + agentx_pdu_len(buf);
 
   /* PDU header */
-  err = pdu_hdr_parse(xdg, &buf);
+  err = pdu_hdr_parse(xdg, &buf, end);
   if (err) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(agentx_err_msg, elem_num(agentx_err_msg), err));
-    dec_fail = 1;
     goto DECODE_FINISH;
   }
 
@@ -408,19 +533,18 @@ agentx_decode(struct agentx_datagram *xdg)
     case AGENTX_PDU_GETNEXT:
     case AGENTX_PDU_GETBULK:
       /* search range */
-      err = search_range_parse(xdg, &buf);
+      err = search_range_parse(xdg, &buf, end);
       if (err) {
         SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(agentx_err_msg, elem_num(agentx_err_msg), err));
-        dec_fail = 1;
       }
       break;
     case AGENTX_PDU_TESTSET:
+    case AGENTX_PDU_NOTIFY:
     case AGENTX_PDU_RESPONSE:
       /* var bind */
-      err = var_bind_parse(xdg, &buf);
+      err = var_bind_parse(xdg, &buf, end);
       if (err) {
         SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(agentx_err_msg, elem_num(agentx_err_msg), err));
-        dec_fail = 1;
       }
       break;
     default:
@@ -428,66 +552,98 @@ agentx_decode(struct agentx_datagram *xdg)
   }
 
 DECODE_FINISH:
-  /* If fail, do some clear things */
-  if (dec_fail) {
-    agentx_datagram_clear(xdg);
-  }
-
   /* We should free received buf here */
   free(xdg->recv_buf);
+  xdg->recv_buf = NULL;
 
   return err;
 }
 
+struct agentx_datagram *agentx_datagram_curr;
+
 /* AgentX request dispatch */
 static void
 agentx_request_dispatch(struct agentx_datagram *xdg)
 {
+  agentx_datagram_curr = xdg;
+
   switch (xdg->pdu_hdr.type) {
     case AGENTX_PDU_GET:
       agentx_get(xdg);
       break;
     case AGENTX_PDU_GETNEXT:
-    case AGENTX_PDU_GETBULK:
       agentx_getnext(xdg);
       break;
+    case AGENTX_PDU_GETBULK:
+      agentx_getbulk(xdg);
+      break;
     case AGENTX_PDU_TESTSET:
-      agentx_set(xdg);
+      agentx_testset(xdg);
       break;
     case AGENTX_PDU_COMMITSET:
+      agentx_commitset(xdg);
+      break;
     case AGENTX_PDU_UNDOSET:
+      agentx_undoset(xdg);
+      break;
     case AGENTX_PDU_CLEANUPSET:
-      agentx_response(xdg);
+      agentx_cleanupset(xdg);
+      break;
+    case AGENTX_PDU_RESPONSE:
+      if (agentx_reg_response(xdg->pdu_hdr.session_id, xdg->pdu_hdr.packet_id, xdg->u.response.error) < 0 &&
+          agentx_notify_response(xdg->pdu_hdr.session_id, xdg->pdu_hdr.packet_id, xdg->u.response.error) < 0) {
+        agentx_session_opened(xdg->pdu_hdr.packet_id, xdg->pdu_hdr.session_id);
+      }
+      agentx_datagram_free(xdg);
       break;
     case AGENTX_PDU_INDEXALLOC:
     case AGENTX_PDU_INDEXDEALLOC:
     case AGENTX_PDU_ADDAGENTCAP:
     case AGENTX_PDU_REMOVEAGENTCAP:
-      break;
     default:
+      agentx_datagram_free(xdg);
       break;
   }
+
+  agentx_datagram_curr = NULL;
+}
+
+/* Decode a whole PDU in buffer, which the datagram takes. NULL if it is
+ * malformed, buffer is freed then. */
+struct agentx_datagram *
+agentx_datagram_decode(uint8_t *buffer)
+{
+  struct agentx_datagram *xdg = agentx_datagram_new(buffer);
+
+  if (agentx_decode(xdg)) {
+    agentx_datagram_free(xdg);
+    return NULL;
+  }
+  return xdg;
 }
 
 /* Receive agentx datagram from transport module */
 int
 agentx_recv(uint8_t *buffer, int len)
 {
-  int ret;
+  struct agentx_datagram *xdg;
 
   assert(buffer != NULL && len > 0);
 
-  /* Reset agentX datagram */
-  agentx_datagram_clear(&agentx_datagram);
-  agentx_datagram.recv_buf = buffer;
+  /* Length in header has to match */
+  if (len < sizeof(struct x_pdu_hdr) || agentx_pdu_len(buffer) != len) {
+    SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", AGENTX_ERR_PDU_LEN, error_message(agentx_err_msg, elem_num(agentx_err_msg), AGENTX_ERR_PDU_LEN));
+    free(buffer);
+    return -1;
+  }
 
   /* Decode agentX datagram */
-  ret = agentx_decode(&agentx_datagram);
-
-  if (!ret) {
-    /* Dispatch agentX request */
-    agentx_request_dispatch(&agentx_datagram);
+  xdg = agentx_datagram_decode(buffer);
+  if (xdg == NULL) {
+    return -1;
   }
 
-  return ret;
+  /* Dispatch agentX request */
+  agentx_request_dispatch(xdg);
+  return 0;
 }
@@ -27,10 +27,11 @@
 #include <sys/socket.h>
 
 #include "agentx.h"
+#include "protocol.h"
 #include "util.h"
 
 struct x_pdu_buf
-agentx_open_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len, const char *descr, uint32_t descr_len)
+agentx_open_pdu(struct agentx_session *session, const oid_t *oid, uint32_t oid_len, const char *descr, uint32_t descr_len)
 {
   uint8_t i, *pdu, *buf;
   uint32_t *timeout, len;
@@ -40,12 +41,11 @@ agentx_open_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len,
   struct x_octstr_t *octstr;
 
   assert(oid_len == 0 || (oid_len > 4 && oid_len + 5 <= MIB_OID_MAX_LEN && descr_len <= MIB_VALUE_MAX_LEN));
-  descr_len = uint_sizeof(descr_len);
 
   /* PDU length */
   len = sizeof(*ph) + sizeof(*timeout) + 4;
   len += oid_len == 0 ? 0: (oid_len - 5) * sizeof(uint32_t);
-  len += 4 + descr_len;
+  len += 4 + uint_sizeof(descr_len);
   pdu = buf = xmalloc(len);
   memset(buf, 0, len);
 
@@ -58,9 +58,10 @@ agentx_open_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len,
 #else
   ph->flags = NETWORD_BYTE_ORDER;
 #endif
-  ph->session_id = xdg->pdu_hdr.session_id;
-  ph->transaction_id = xdg->pdu_hdr.transaction_id;
-  ph->packet_id = 1;
+  session->pdu_hdr.packet_id += 1;
+  ph->session_id = session->pdu_hdr.session_id;
+  ph->transaction_id = session->pdu_hdr.transaction_id;
+  ph->packet_id = session->pdu_hdr.packet_id;
   ph->payload_length = len - sizeof(*ph);
 
   /* time out == 0 */
@@ -80,7 +81,7 @@ agentx_open_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len,
   /* octet string */
   octstr = (struct x_octstr_t *)buf;
   octstr->len = descr_len;
-  memcpy(octstr->str, descr, strlen(descr));
+  memcpy(octstr->str, descr, descr_len);
 
   x_pdu.buf = pdu;
   x_pdu.len = len;
@@ -88,7 +89,7 @@ agentx_open_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len,
 }
 
 struct x_pdu_buf
-agentx_close_pdu(struct agentx_datagram *xdg, uint32_t reason)
+agentx_close_pdu(struct agentx_session *session, uint32_t reason)
 {
   uint8_t *pdu, *buf;
   uint32_t len;
@@ -102,13 +103,13 @@ agentx_close_pdu(struct agentx_datagram *xdg, uint32_t reason)
 
   /* PDU header */
   ph = (struct x_pdu_hdr *)buf;
-  ph->version = xdg->pdu_hdr.version;
+  ph->version = session->pdu_hdr.version;
   ph->type = AGENTX_PDU_CLOSE;
-  ph->flags = xdg->pdu_hdr.flags;
-  xdg->pdu_hdr.packet_id += 1;
-  ph->session_id = xdg->pdu_hdr.session_id;
-  ph->transaction_id = xdg->pdu_hdr.transaction_id;
-  ph->packet_id = xdg->pdu_hdr.packet_id;
+  ph->flags = session->pdu_hdr.flags;
+  session->pdu_hdr.packet_id += 1;
+  ph->session_id = session->pdu_hdr.session_id;
+  ph->transaction_id = session->pdu_hdr.transaction_id;
+  ph->packet_id = session->pdu_hdr.packet_id;
   ph->payload_length = len - sizeof(*ph);
   buf += sizeof(*ph);
 
@@ -121,7 +122,7 @@ agentx_close_pdu(struct agentx_datagram *xdg, uint32_t reason)
 }
 
 struct x_pdu_buf
-agentx_register_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len, const char *context, uint32_t ctx_len,
+agentx_register_pdu(struct agentx_session *session, const oid_t *oid, uint32_t oid_len, const char *context, uint32_t ctx_len,
                     uint8_t timeout, uint8_t priority, uint8_t range_subid, uint32_t upper_bound)
 {
   uint8_t i, *pdu, *buf;
@@ -132,12 +133,11 @@ agentx_register_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_
   struct x_octstr_t *octstr;
 
   assert(oid_len > 4 && oid_len + 5 <= MIB_OID_MAX_LEN && ctx_len <= 40);
-  ctx_len = uint_sizeof(ctx_len);
 
   /* PDU length */
   len = sizeof(*ph);
   if (ctx_len) {
-    len += 4 + ctx_len;
+    len += 4 + uint_sizeof(ctx_len);
   }
   len += 4 + 4 + (oid_len - 5) * sizeof(uint32_t);
   if (range_subid) {
@@ -148,13 +148,16 @@ agentx_register_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_
 
   /* PDU header */
   ph = (struct x_pdu_hdr *)buf;
-  ph->version = xdg->pdu_hdr.version;
+  ph->version = session->pdu_hdr.version;
   ph->type = AGENTX_PDU_REG;
-  ph->flags = xdg->pdu_hdr.flags | INSTANCE_REGISTRATION;
-  xdg->pdu_hdr.packet_id += 1;
-  ph->session_id = xdg->pdu_hdr.session_id;
-  ph->transaction_id = xdg->pdu_hdr.transaction_id;
-  ph->packet_id = xdg->pdu_hdr.packet_id;
+  ph->flags = session->pdu_hdr.flags | INSTANCE_REGISTRATION;
+  if (ctx_len > 0) {
+    ph->flags |= NON_DEFAULT_CONTEXT;
+  }
+  session->pdu_hdr.packet_id += 1;
+  ph->session_id = session->pdu_hdr.session_id;
+  ph->transaction_id = session->pdu_hdr.transaction_id;
+  ph->packet_id = session->pdu_hdr.packet_id;
   ph->payload_length = len - sizeof(*ph);
   buf = (uint8_t *)pdu + sizeof(*ph);
 
@@ -162,8 +165,8 @@ agentx_register_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_
   if (ctx_len > 0) {
     octstr = (struct x_octstr_t *)buf;
     octstr->len = ctx_len;
-    memcpy(octstr->str, context, strlen(context));
-    buf += 4 + ctx_len;
+    memcpy(octstr->str, context, ctx_len);
+    buf += 4 + uint_sizeof(ctx_len);
   }
 
   /* special fields */
@@ -193,7 +196,7 @@ agentx_register_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_
 }
 
 struct x_pdu_buf
-agentx_unregister_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oid_len, const char *context, uint32_t ctx_len,
+agentx_unregister_pdu(struct agentx_session *session, const oid_t *oid, uint32_t oid_len, const char *context, uint32_t ctx_len,
                       uint8_t timeout, uint8_t priority, uint8_t range_subid, uint32_t upper_bound)
 {
   uint8_t i, *pdu, *buf;
@@ -204,12 +207,11 @@ agentx_unregister_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oi
   struct x_octstr_t *octstr;
 
   assert(oid_len > 4 && oid_len + 5 <= MIB_OID_MAX_LEN && ctx_len <= 40);
-  ctx_len = uint_sizeof(ctx_len);
 
   /* PDU length */
   len = sizeof(*ph);
   if (ctx_len) {
-    len += 4 + ctx_len;
+    len += 4 + uint_sizeof(ctx_len);
   }
   len += 4 + 4 + (oid_len - 5) * sizeof(uint32_t);
   if (range_subid) {
@@ -220,13 +222,16 @@ agentx_unregister_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oi
 
   /* PDU header */
   ph = (struct x_pdu_hdr *)buf;
-  ph->version = xdg->pdu_hdr.version;
+  ph->version = session->pdu_hdr.version;
   ph->type = AGENTX_PDU_UNREG;
-  ph->flags = xdg->pdu_hdr.flags | INSTANCE_REGISTRATION;
-  xdg->pdu_hdr.packet_id += 1;
-  ph->session_id = xdg->pdu_hdr.session_id;
-  ph->transaction_id = xdg->pdu_hdr.transaction_id;
-  ph->packet_id = xdg->pdu_hdr.packet_id;
+  ph->flags = session->pdu_hdr.flags | INSTANCE_REGISTRATION;
+  if (ctx_len > 0) {
+    ph->flags |= NON_DEFAULT_CONTEXT;
+  }
+  session->pdu_hdr.packet_id += 1;
+  ph->session_id = session->pdu_hdr.session_id;
+  ph->transaction_id = session->pdu_hdr.transaction_id;
+  ph->packet_id = session->pdu_hdr.packet_id;
   ph->payload_length = len - sizeof(*ph);
   buf += sizeof(*ph);
 
@@ -234,8 +239,8 @@ agentx_unregister_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oi
   if (ctx_len) {
     octstr = (struct x_octstr_t *)buf;
     octstr->len = ctx_len;
-    memcpy(octstr->str, context, strlen(context));
-    buf += 4 + ctx_len;
+    memcpy(octstr->str, context, ctx_len);
+    buf += 4 + uint_sizeof(ctx_len);
   }
 
   /* special fields */
@@ -264,153 +269,197 @@ agentx_unregister_pdu(struct agentx_datagram *xdg, const oid_t *oid, uint32_t oi
   return x_pdu;
 }
 
-#if 0
 struct x_pdu_buf
-agentx_notify_pdu(struct agentx_datagram *xdg, const char *context, uint32_t context_len,
-                  uint8_t type, const oid_t *oid, uint32_t oid_len,
-                  uint8_t *data, uint32_t data_len)
+agentx_ping_pdu(struct agentx_session *session, const char *context, uint32_t context_len)
 {
-  uint8_t i, *pdu, *buf;
-  uint32_t *reason, len;
+  uint8_t *pdu, *buf;
+  uint32_t len;
   struct x_pdu_buf x_pdu;
   struct x_pdu_hdr *ph;
   struct x_octstr_t *octstr;
-  struct x_varbind_t *vb;
 
   assert(context_len < 40);
-  context_len = uint_sizeof(context_len);
 
   /* PDU length */
   len = sizeof(*ph);
   if (context_len) {
-    len += 4 + context_len;
+    len += 4 + uint_sizeof(context_len);
   }
   pdu = buf = xmalloc(len);
   memset(buf, 0, len);
 
   /* PDU header */
-  h = (struct x_pdu_hdr *)pdu;
-  ph->version = 1;
-  ph->type = AGENTX_PDU_NOTIFY;
-  ph->flags = 0;
-  xdg->pdu_hdr.packet_id += 1;
-  ph->session_id = xdg->pdu_hdr.session_id;
-  ph->transaction_id = xdg->pdu_hdr.transaction_id;
-  ph->packet_id = xdg->pdu_hdr.packet_id;
+  ph = (struct x_pdu_hdr *)buf;
+  ph->version = session->pdu_hdr.version;
+  ph->type = AGENTX_PDU_PING;
+  ph->flags = session->pdu_hdr.flags;
+  if (context_len > 0) {
+    ph->flags |= NON_DEFAULT_CONTEXT;
+  }
+  session->pdu_hdr.packet_id += 1;
+  ph->session_id = session->pdu_hdr.session_id;
+  ph->transaction_id = session->pdu_hdr.transaction_id;
+  ph->packet_id = session->pdu_hdr.packet_id;
   ph->payload_length = len - sizeof(*ph);
-  buf = (uint8_t *)pdu + sizeof(*ph);
+  buf += sizeof(*ph);
 
   /* context */
   if (context_len) {
     octstr = (struct x_octstr_t *)buf;
     octstr->len = context_len;
-    memcpy(octstr->str, context, strlen(context));
-    buf += 4 + context_len;
-  }
-
-  for (i = 0; i < len; i++) {
-    vb = (struct x_varbind_t *)buf;
-    vb->type = type;
+    memcpy(octstr->str, context, context_len);
   }
 
   x_pdu.buf = pdu;
   x_pdu.len = len;
   return x_pdu;
 }
-#endif
 
-struct x_pdu_buf
-agentx_ping_pdu(struct agentx_datagram *xdg, const char *context, uint32_t context_len)
+/* Encoded length of varbind in response PDU */
+uint32_t
+agentx_vb_enc_len(const struct x_var_bind *vb_out)
 {
-  uint8_t *pdu, *buf;
   uint32_t len;
-  struct x_pdu_buf x_pdu;
-  struct x_pdu_hdr *ph;
-  struct x_octstr_t *octstr;
 
-  assert(context_len < 40);
-  context_len = uint_sizeof(context_len);
+  if (vb_out->oid_len > 5) {
+    len = 4 + 4 + (vb_out->oid_len - 5) * sizeof(uint32_t);
+  } else {
+    len = 4 + 4;
+  }
 
-  /* PDU length */
-  len = sizeof(*ph);
-  if (context_len) {
-    len += 4 + context_len;
+  switch (vb_out->val_type) {
+    case ASN1_TAG_INT:
+    case ASN1_TAG_CNT:
+    case ASN1_TAG_GAU:
+    case ASN1_TAG_TIMETICKS:
+      len += sizeof(uint32_t);
+      break;
+    case ASN1_TAG_CNT64:
+      len += sizeof(uint64_t);
+      break;
+    case ASN1_TAG_OCTSTR:
+    case ASN1_TAG_IPADDR:
+      len += sizeof(uint32_t) + uint_sizeof(vb_out->val_len);
+      break;
+    case ASN1_TAG_OBJID:
+      if (vb_out->val_len > 5 * sizeof(uint32_t)) {
+        len += 4 + vb_out->val_len - 5 * sizeof(uint32_t);
+      } else {
+        len += 4;
+      }
+      break;
+    default:
+      break;
   }
-  pdu = buf = xmalloc(len);
-  memset(buf, 0, len);
 
-  /* PDU header */
-  ph = (struct x_pdu_hdr *)buf;
-  ph->version = xdg->pdu_hdr.version;
-  ph->type = AGENTX_PDU_PING;
-  ph->flags = xdg->pdu_hdr.flags;
-  xdg->pdu_hdr.packet_id += 1;
-  ph->session_id = xdg->pdu_hdr.session_id;
-  ph->transaction_id = xdg->pdu_hdr.transaction_id;
-  ph->packet_id = xdg->pdu_hdr.packet_id;
-  ph->payload_length = len - sizeof(*ph);
-  buf += sizeof(*ph);
+  return len;
+}
 
-  /* context */
-  if (context_len) {
-    octstr = (struct x_octstr_t *)buf;
-    octstr->len = context_len;
-    memcpy(octstr->str, context, strlen(context));
+/* Encode varbind into buf, return where it ends */
+static uint8_t *
+vb_enc(uint8_t *buf, const struct x_var_bind *vb_out)
+{
+  uint32_t i;
+  struct x_objid_t *objid;
+  struct x_octstr_t *octstr;
+  uint32_t *p_tmp32;
+  uint64_t *p_tmp64;
+  oid_t *oid;
+
+  /* type */
+  *(uint16_t *)buf = vb_out->val_type;
+  buf += 2 * sizeof(uint16_t);
+
+  /* oid */
+  objid = (struct x_objid_t *)buf;
+  objid->n_subid = vb_out->oid_len > 5 ? vb_out->oid_len - 5 : 0;
+  objid->prefix = vb_out->oid_len > 4 ? vb_out->oid[4] : 0;
+  objid->include = 0;
+  for (i = 5; i < vb_out->oid_len; i++) {
+    objid->sub_id[i - 5] = vb_out->oid[i];
+  }
+  if (vb_out->oid_len > 5) {
+    buf += sizeof(*objid) + (vb_out->oid_len - 5) * sizeof(uint32_t);
+  } else {
+    buf += sizeof(*objid);
   }
 
-  x_pdu.buf = pdu;
-  x_pdu.len = len;
-  return x_pdu;
+  /* data */
+  switch (vb_out->val_type) {
+    case ASN1_TAG_INT:
+    case ASN1_TAG_CNT:
+    case ASN1_TAG_GAU:
+    case ASN1_TAG_TIMETICKS:
+      p_tmp32 = (uint32_t *)vb_out->value;
+      *(uint32_t *)buf = *p_tmp32;
+      buf += sizeof(uint32_t);
+      break;
+    case ASN1_TAG_CNT64:
+      p_tmp64 = (uint64_t *)vb_out->value;
+      *(uint64_t *)buf = *p_tmp64;
+      buf += sizeof(uint64_t);
+      break;
+    case ASN1_TAG_OCTSTR:
+    case ASN1_TAG_IPADDR:
+      octstr = (struct x_octstr_t *)buf;
+      octstr->len = vb_out->val_len;
+      memcpy(octstr->str, vb_out->value, vb_out->val_len);
+      buf += sizeof(uint32_t) + uint_sizeof(vb_out->val_len);
+      break;
+    case ASN1_TAG_OBJID:
+      objid = (struct x_objid_t *)buf;
+      oid = (oid_t *)vb_out->value;
+      objid->n_subid = vb_out->val_len > 5 * sizeof(uint32_t) ? (vb_out->val_len - 5 * sizeof(uint32_t)) / sizeof(uint32_t) : 0;
+      objid->prefix = vb_out->val_len > 4 * sizeof(uint32_t) ? oid[4] : 0;
+      objid->include = 0;
+      for (i = 5; i < vb_out->val_len / sizeof(uint32_t); i++) {
+        objid->sub_id[i - 5] = oid[i];
+      }
+      if (vb_out->val_len > 5 * sizeof(uint32_t)) {
+        buf += 4 + vb_out->val_len - 5 * sizeof(uint32_t);
+      } else {
+        buf += 4;
+      }
+      break;
+    default:
+      break;
+  }
+
+  return buf;
+}
+
+/* Encode oid with the internet prefix into buf, return where it ends */
+static uint8_t *
+objid_enc(uint8_t *buf, const oid_t *oid, uint32_t oid_len, uint8_t include)
+{
+  uint32_t i;
+  struct x_objid_t *objid = (struct x_objid_t *)buf;
+
+  objid->n_subid = oid_len > 5 ? oid_len - 5 : 0;
+  objid->prefix = oid_len > 4 ? oid[4] : 0;
+  objid->include = include;
+  objid->reserved = 0;
+  for (i = 5; i < oid_len; i++) {
+    objid->sub_id[i - 5] = oid[i];
+  }
+  return buf + sizeof(*objid) + objid->n_subid * sizeof(uint32_t);
 }
 
 struct x_pdu_buf
 agentx_response_pdu(struct agentx_datagram *xdg)
 {
   uint8_t *pdu, *buf;
-  uint32_t i, len;
+  uint32_t len;
   struct x_var_bind *vb_out;
   struct x_pdu_buf x_pdu;
   struct x_pdu_hdr *ph;
-  struct x_objid_t *objid;
-  struct x_octstr_t *octstr;
   struct list_head *curr, *next;
-  uint32_t *p_tmp32;
-  uint64_t *p_tmp64;
-  oid_t *oid;
 
   /* PDU length */
   len = sizeof(*ph) + sizeof(uint32_t) + 2 * sizeof(uint16_t);
   list_for_each_safe(curr, next, &xdg->vb_out_list) {
     vb_out = list_entry(curr, struct x_var_bind, link);
-    if (vb_out->oid_len > 5) {
-      len += 4 + 4 + (vb_out->oid_len - 5) * sizeof(uint32_t);
-    } else {
-      len += 4 + 4;
-    }
-    switch (vb_out->val_type) {
-      case ASN1_TAG_INT:
-      case ASN1_TAG_CNT:
-      case ASN1_TAG_GAU:
-      case ASN1_TAG_TIMETICKS:
-        len += sizeof(uint32_t);
-        break;
-      case ASN1_TAG_CNT64:
-        len += sizeof(uint64_t);
-        break;
-      case ASN1_TAG_OCTSTR:
-      case ASN1_TAG_IPADDR:
-        len += sizeof(uint32_t) + uint_sizeof(vb_out->val_len);
-        break;
-      case ASN1_TAG_OBJID:
-        if (vb_out->val_len > 5 * sizeof(uint32_t)) {
-          len += 4 + vb_out->val_len - 5 * sizeof(uint32_t);
-        } else {
-          len += 4;
-        }
-        break;
-      default:
-        break;
-    }
+    len += agentx_vb_enc_len(vb_out);
   }
   pdu = buf = xmalloc(len);
   memset(buf, 0, len);
@@ -436,64 +485,118 @@ agentx_response_pdu(struct agentx_datagram *xdg)
   /* var binds */
   list_for_each_safe(curr, next, &xdg->vb_out_list) {
     vb_out = list_entry(curr, struct x_var_bind, link);
+    buf = vb_enc(buf, vb_out);
+  }
+
+  x_pdu.buf = pdu;
+  x_pdu.len = len;
+  return x_pdu;
+}
+
+/* Notify PDU in session with varbinds of vb_list, which should start with
+ * snmpTrapOID.0 or sysUpTime.0 */
+struct x_pdu_buf
+agentx_notify_pdu(struct agentx_session *session, struct list_head *vb_list)
+{
+  uint8_t *pdu, *buf;
+  uint32_t len;
+  struct x_pdu_buf x_pdu;
+  struct x_pdu_hdr *ph;
+  struct x_octstr_t *octstr;
+  struct list_head *curr;
+
+  /* PDU length */
+  len = sizeof(*ph);
+  if (session->ctx_len) {
+    len += 4 + uint_sizeof(session->ctx_len);
+  }
+  list_for_each(curr, vb_list) {
+    len += agentx_vb_enc_len(list_entry(curr, struct x_var_bind, link));
+  }
+  pdu = buf = xmalloc(len);
+  memset(buf, 0, len);
 
-    /* type */
-    *(uint16_t *)buf = vb_out->val_type;
-    buf += 2 * sizeof(uint16_t);
-
-    /* oid */
-    objid = (struct x_objid_t *)buf;
-    objid->n_subid = vb_out->oid_len > 5 ? vb_out->oid_len - 5 : 0;
-    objid->prefix = vb_out->oid_len > 4 ? vb_out->oid[4] : 0;
-    objid->include = 0;
-    for (i = 5; i < vb_out->oid_len; i++) {
-      objid->sub_id[i - 5] = vb_out->oid[i];
+  /* PDU header */
+  ph = (struct x_pdu_hdr *)buf;
+  ph->version = session->pdu_hdr.version;
+  ph->type = AGENTX_PDU_NOTIFY;
+  ph->flags = session->pdu_hdr.flags;
+  if (session->ctx_len > 0) {
+    ph->flags |= NON_DEFAULT_CONTEXT;
+  }
+  session->pdu_hdr.packet_id += 1;
+  ph->session_id = session->pdu_hdr.session_id;
+  ph->transaction_id = session->pdu_hdr.transaction_id;
+  ph->packet_id = session->pdu_hdr.packet_id;
+  ph->payload_length = len - sizeof(*ph);
+  buf += sizeof(*ph);
+
+  /* context */
+  if (session->ctx_len) {
+    octstr = (struct x_octstr_t *)buf;
+    octstr->len = session->ctx_len;
+    memcpy(octstr->str, session->context, session->ctx_len);
+    buf += 4 + uint_sizeof(session->ctx_len);
+  }
+
+  /* var binds */
+  list_for_each(curr, vb_list) {
+    buf = vb_enc(buf, list_entry(curr, struct x_var_bind, link));
+  }
+
+  x_pdu.buf = pdu;
+  x_pdu.len = len;
+  return x_pdu;
+}
+
+/* Request from the master agent to a sub-agent, search ranges of Get and
+ * GetNext or varbinds of TestSet follow the header in hdr. */
+struct x_pdu_buf
+agentx_request_pdu(const struct x_pdu_hdr *hdr, struct list_head *sr_list, struct list_head *vb_list)
+{
+  uint8_t *pdu, *buf;
+  uint32_t len;
+  struct x_pdu_buf x_pdu;
+  struct x_pdu_hdr *ph;
+  struct x_search_range *sr;
+  struct list_head *curr;
+
+  /* PDU length */
+  len = sizeof(*ph);
+  if (sr_list != NULL) {
+    list_for_each(curr, sr_list) {
+      sr = list_entry(curr, struct x_search_range, link);
+      len += 4 + (sr->start_len > 5 ? sr->start_len - 5 : 0) * sizeof(uint32_t);
+      len += 4 + (sr->end_len > 5 ? sr->end_len - 5 : 0) * sizeof(uint32_t);
     }
-    if (vb_out->oid_len > 5) {
-      buf += sizeof(*objid) + (vb_out->oid_len - 5) * sizeof(uint32_t);
-    } else {
-      buf += sizeof(*objid);
+  }
+  if (vb_list != NULL) {
+    list_for_each(curr, vb_list) {
+      len += agentx_vb_enc_len(list_entry(curr, struct x_var_bind, link));
     }
+  }
+  pdu = buf = xmalloc(len);
+  memset(buf, 0, len);
 
-    /* data */
-    switch (vb_out->val_type) {
-      case ASN1_TAG_INT:
-      case ASN1_TAG_CNT:
-      case ASN1_TAG_GAU:
-      case ASN1_TAG_TIMETICKS:
-        p_tmp32 = (uint32_t *)vb_out->value;
-        *(uint32_t *)buf = *p_tmp32;
-        buf += sizeof(uint32_t);
-        break;
-      case ASN1_TAG_CNT64:
-        p_tmp64 = (uint64_t *)vb_out->value;
-        *(uint64_t *)buf = *p_tmp64;
-        buf += sizeof(uint64_t);
-        break;
-      case ASN1_TAG_OCTSTR:
-      case ASN1_TAG_IPADDR:
-        octstr = (struct x_octstr_t *)buf;
-        octstr->len = vb_out->val_len;
-        memcpy(octstr->str, vb_out->value, vb_out->val_len);
-        buf += sizeof(uint32_t) + uint_sizeof(vb_out->val_len);
-        break;
-      case ASN1_TAG_OBJID:
-        objid = (struct x_objid_t *)buf;
-        oid = (oid_t *)vb_out->value;
-        objid->n_subid = vb_out->val_len > 5 * sizeof(uint32_t) ? (vb_out->val_len - 5 * sizeof(uint32_t)) / sizeof(uint32_t) : 0;
-        objid->prefix = vb_out->val_len > 4 * sizeof(uint32_t) ? oid[4] : 0;
-        objid->include = 0;
-        for (i = 5; i < vb_out->val_len / sizeof(uint32_t); i++) {
-          objid->sub_id[i - 5] = oid[i];
-        }
-        if (vb_out->val_len > 5 * sizeof(uint32_t)) {
-          buf += 4 + vb_out->val_len - 5 * sizeof(uint32_t);
-        } else {
-          buf += 4;
-        }
-        break;
-      default:
-        break;
+  /* PDU header */
+  ph = (struct x_pdu_hdr *)buf;
+  memcpy(ph, hdr, sizeof(*ph));
+  ph->payload_length = len - sizeof(*ph);
+  buf += sizeof(*ph);
+
+  /* search ranges */
+  if (sr_list != NULL) {
+    list_for_each(curr, sr_list) {
+      sr = list_entry(curr, struct x_search_range, link);
+      buf = objid_enc(buf, sr->start, sr->start_len, sr->start_include);
+      buf = objid_enc(buf, sr->end, sr->end_len, 0);
+    }
+  }
+
+  /* var binds */
+  if (vb_list != NULL) {
+    list_for_each(curr, vb_list) {
+      buf = vb_enc(buf, list_entry(curr, struct x_var_bind, link));
     }
   }
 
@@ -506,10 +609,10 @@ agentx_response_pdu(struct agentx_datagram *xdg)
 void
 agentx_response(struct agentx_datagram *xdg)
 {
-  /* Send response PDU */
+  /* Send response PDU, the callback will free it */
   struct x_pdu_buf x_pdu = agentx_response_pdu(xdg);
-  if (send(xdg->sock, x_pdu.buf, x_pdu.len, 0) == -1) {
-    SMARTSNMP_LOG(L_ERROR, "ERR: Send response PDU failure!\n");
-  }
-  free(x_pdu.buf);
+  agentx_prot_ops.send(x_pdu.buf, x_pdu.len, NULL);
+
+  /* Request is done with */
+  agentx_datagram_free(xdg);
 }
@@ -59,9 +59,9 @@ agentx_get(struct agentx_datagram *xdg)
     mib_get(xdg, sr_in, &ret_oid);
 
     val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out = agentx_vb_new(ret_oid.id_len, val_len);
     vb_out->oid_len = ret_oid.id_len;
+    oid_cpy(vb_out->oid, ret_oid.oid, ret_oid.id_len);
     vb_out->val_type = tag(&ret_oid.var);
     vb_out->val_len = agentx_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
 
@@ -93,17 +93,13 @@ mib_getnext(struct agentx_datagram *xdg, struct x_search_range *sr_in, struct oi
   /* Search at the included start oid */
   if (sr_in->start_include) {
     mib_tree_search(&view, sr_in->start, sr_in->start_len, ret_oid);
-    if (ret_oid->err_stat || !MIB_TAG_VALID(tag(&ret_oid->var))) {
-      /* Invalid query */
-      free(ret_oid->oid);
-    }
   }
 
   /* If start oid not included or not exist, search the next one */
   if (!sr_in->start_include || ret_oid->err_stat || !MIB_TAG_VALID(tag(&ret_oid->var))) {
     mib_tree_search_next(&view, sr_in->start, sr_in->start_len, ret_oid);
-    if (!ret_oid->err_stat && MIB_TAG_VALID(tag(&ret_oid->var))) {
-      /* Check whether return oid exceeds end oid */
+    if (!ret_oid->err_stat && MIB_TAG_VALID(tag(&ret_oid->var)) && sr_in->end_len > 0) {
+      /* Check whether return oid exceeds end oid, null end oid means no bound */
       if ((sr_in->end_include && oid_cmp(ret_oid->oid, ret_oid->id_len, sr_in->end, sr_in->end_len) > 0) ||
           (!sr_in->end_include && oid_cmp(ret_oid->oid, ret_oid->id_len, sr_in->end, sr_in->end_len) >= 0)) {
         /* Oid exceeds, end_of_mib_view */
@@ -117,12 +113,55 @@ mib_getnext(struct agentx_datagram *xdg, struct x_search_range *sr_in, struct oi
   }
 }
 
+/* Response varbind of search result */
+static struct x_var_bind *
+vb_out_new(struct oid_search_res *ret_oid)
+{
+  uint32_t val_len = agentx_value_enc_try(length(&ret_oid->var), tag(&ret_oid->var));
+  struct x_var_bind *vb_out = agentx_vb_new(ret_oid->id_len, val_len);
+
+  vb_out->oid_len = ret_oid->id_len;
+  oid_cpy(vb_out->oid, ret_oid->oid, ret_oid->id_len);
+  vb_out->val_type = tag(&ret_oid->var);
+  vb_out->val_len = agentx_value_enc(value(&ret_oid->var), length(&ret_oid->var), tag(&ret_oid->var), vb_out->value);
+  return vb_out;
+}
+
+/* endOfMibView again at the name of the ended repeater */
+static struct x_var_bind *
+vb_out_end(const struct x_var_bind *last)
+{
+  struct x_var_bind *vb_out = agentx_vb_new(last->oid_len, 0);
+
+  vb_out->oid_len = last->oid_len;
+  oid_cpy(vb_out->oid, last->oid, last->oid_len);
+  vb_out->val_type = ASN1_TAG_END_OF_MIB_VIEW;
+  vb_out->val_len = 0;
+  return vb_out;
+}
+
+static void
+vb_out_add(struct agentx_datagram *xdg, struct x_var_bind *vb_out, struct oid_search_res *ret_oid, uint32_t index)
+{
+  /* Error status */
+  if (ret_oid->err_stat) {
+    if (!xdg->u.response.error) {
+      /* Report the first object error status in search range */
+      xdg->u.response.error = ret_oid->err_stat;
+      xdg->u.response.index = index;
+    }
+  }
+
+  /* Add into list. */
+  list_add_tail(&vb_out->link, &xdg->vb_out_list);
+  xdg->vb_out_cnt++;
+}
+
 void
 agentx_getnext(struct agentx_datagram *xdg)
 {
-  uint32_t val_len, sr_in_cnt = 0;
+  uint32_t sr_in_cnt = 0;
   struct list_head *curr, *next;
-  struct x_var_bind *vb_out;
   struct x_search_range *sr_in;
   struct oid_search_res ret_oid;
 
@@ -135,28 +174,92 @@ agentx_getnext(struct agentx_datagram *xdg)
 
     /* Search at the input next oid */
     mib_getnext(xdg, sr_in, &ret_oid);
+    vb_out_add(xdg, vb_out_new(&ret_oid), &ret_oid, sr_in_cnt);
+  }
 
-    val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
-    vb_out->oid_len = ret_oid.id_len;
-    vb_out->val_type = tag(&ret_oid.var);
-    vb_out->val_len = agentx_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
+  agentx_response(xdg);
+}
 
-    /* Error status */
-    if (ret_oid.err_stat) {
-      if (!xdg->u.response.error) {
-        /* Report the first object error status in search range */
-        xdg->u.response.error = ret_oid.err_stat;
-        xdg->u.response.index = sr_in_cnt;
+/* GETBULK request function, all repetitions go in one response */
+void
+agentx_getbulk(struct agentx_datagram *xdg)
+{
+  uint32_t i, rep_cnt, end_cnt = 0, rsp_len = 0, sr_in_cnt = 0;
+  uint16_t repeat = xdg->u.getbulk.max_rep;
+  struct list_head *curr, *rep_head;
+  struct x_search_range *sr_in, sr;
+  struct x_var_bind *vb_out, **last;
+  struct oid_search_res ret_oid;
+  uint8_t *ended;
+
+  memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.request = MIB_REQ_GETNEXT;
+
+  /* Non-repeaters are searched once */
+  list_for_each(curr, &xdg->sr_in_list) {
+    if (sr_in_cnt == xdg->u.getbulk.non_rep) {
+      break;
+    }
+    sr_in = list_entry(curr, struct x_search_range, link);
+    sr_in_cnt++;
+
+    mib_getnext(xdg, sr_in, &ret_oid);
+    vb_out = vb_out_new(&ret_oid);
+    rsp_len += agentx_vb_enc_len(vb_out);
+    vb_out_add(xdg, vb_out, &ret_oid, sr_in_cnt);
+  }
+
+  /* Repeaters go on from their last answers, within the search range */
+  rep_head = curr;
+  rep_cnt = xdg->sr_in_cnt - sr_in_cnt;
+  last = rep_cnt > 0 ? xcalloc(rep_cnt, sizeof(*last)) : NULL;
+  /* Repeaters at endOfMibView stay there in the repetitions after
+   * (RFC 2741 7.2.3.3), not searched again from their names */
+  ended = rep_cnt > 0 ? xcalloc(rep_cnt, sizeof(*ended)) : NULL;
+
+  while (rep_cnt > 0 && repeat-- > 0) {
+    for (curr = rep_head, i = 0; curr != &xdg->sr_in_list; curr = curr->next, i++) {
+      sr_in = list_entry(curr, struct x_search_range, link);
+
+      if (ended[i]) {
+        ret_oid.err_stat = 0;
+        vb_out = vb_out_end(last[i]);
+      } else {
+        sr = *sr_in;
+        if (last[i] != NULL) {
+          sr.start = last[i]->oid;
+          sr.start_len = last[i]->oid_len;
+          sr.start_include = 0;
+        }
+
+        mib_getnext(xdg, &sr, &ret_oid);
+        vb_out = vb_out_new(&ret_oid);
+      }
+
+      /* Response is full */
+      rsp_len += agentx_vb_enc_len(vb_out);
+      if (rsp_len > AGENTX_BULK_MAX_LEN) {
+        free(vb_out);
+        repeat = 0;
+        break;
+      }
+
+      vb_out_add(xdg, vb_out, &ret_oid, sr_in_cnt + i + 1);
+      last[i] = vb_out;
+      if (!ended[i] && vb_out->val_type == ASN1_TAG_END_OF_MIB_VIEW) {
+        ended[i] = 1;
+        end_cnt++;
       }
     }
 
-    /* Add into list. */
-    list_add_tail(&vb_out->link, &xdg->vb_out_list);
-    xdg->vb_out_cnt++;
+    /* Nothing more to walk */
+    if (end_cnt == rep_cnt) {
+      break;
+    }
   }
 
+  free(ended);
+  free(last);
   agentx_response(xdg);
 }
 
@@ -171,34 +274,196 @@ mib_set(struct agentx_datagram *xdg, struct x_var_bind *vb_in, struct oid_search
   mib_tree_search(&view, vb_in->oid, vb_in->oid_len, ret_oid);
 }
 
+/* Decode the setting value ahead */
+static void
+set_value(struct oid_search_res *ret_oid, const struct x_var_bind *vb_in)
+{
+  uint32_t val_len;
+
+  tag(&ret_oid->var) = vb_in->val_type;
+  length(&ret_oid->var) = vb_in->val_len;
+  val_len = agentx_value_enc_try(length(&ret_oid->var), tag(&ret_oid->var));
+  memcpy(value(&ret_oid->var), vb_in->value, val_len);
+}
+
+/* Group written in the set transaction */
+struct set_txn_group {
+  struct list_head link;
+  int callback;
+  mib_native_handler native;
+  /* Varbinds of a native group, which are written one by one at commit */
+  struct list_head vb_list;
+  int committed;
+};
+
+/* Set transaction of the session the request comes in, NULL if unknown */
+static struct agentx_set_txn *
+set_txn_search(struct agentx_datagram *xdg)
+{
+  struct agentx_session *session = agentx_session_search(xdg->pdu_hdr.session_id);
+  return session != NULL ? &session->set_txn : NULL;
+}
+
+/* Transaction the request goes on with, NULL if not the one staged */
+static struct agentx_set_txn *
+set_txn_current(struct agentx_datagram *xdg)
+{
+  struct agentx_set_txn *txn = set_txn_search(xdg);
+
+  if (txn == NULL || !txn->active || txn->transaction_id != xdg->pdu_hdr.transaction_id) {
+    return NULL;
+  }
+  return txn;
+}
+
+static void
+set_txn_stage(struct agentx_set_txn *txn, const struct oid_search_res *ret_oid, const struct x_var_bind *vb_in)
+{
+  struct list_head *curr, *pos;
+  struct set_txn_group *grp = NULL;
+  struct x_var_bind *vb;
+  uint32_t val_len;
+
+  list_for_each(curr, &txn->groups) {
+    grp = list_entry(curr, struct set_txn_group, link);
+    if (grp->callback == ret_oid->callback && grp->native == ret_oid->native) {
+      break;
+    }
+    grp = NULL;
+  }
+
+  if (grp == NULL) {
+    grp = xmalloc(sizeof(*grp));
+    grp->callback = ret_oid->callback;
+    grp->native = ret_oid->native;
+    grp->committed = 0;
+    INIT_LIST_HEAD(&grp->vb_list);
+    /* Native writes cannot be undone, they are committed after Lua groups */
+    pos = &txn->groups;
+    if (grp->native == NULL) {
+      list_for_each(curr, &txn->groups) {
+        if (list_entry(curr, struct set_txn_group, link)->native != NULL) {
+          pos = curr;
+          break;
+        }
+      }
+    }
+    list_add_tail(&grp->link, pos);
+  }
+
+  /* Lua groups keep their staged writes themselves */
+  if (grp->native != NULL) {
+    val_len = agentx_value_enc_try(vb_in->val_len, vb_in->val_type);
+    vb = agentx_vb_new(vb_in->oid_len, val_len);
+    vb->oid_len = vb_in->oid_len;
+    oid_cpy(vb->oid, vb_in->oid, vb_in->oid_len);
+    vb->val_type = vb_in->val_type;
+    vb->val_len = vb_in->val_len;
+    memcpy(vb->value, vb_in->value, val_len);
+    list_add_tail(&vb->link, &grp->vb_list);
+  }
+}
+
+/* Run a transaction phase in the handler of a Lua group */
+static int
+set_txn_call(struct set_txn_group *grp, int request)
+{
+  struct oid_search_res ret_oid;
+
+  memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.callback = grp->callback;
+  ret_oid.request = request;
+  tag(&ret_oid.var) = ASN1_TAG_NUL;
+
+  /* Handler failure leaves no such object */
+  if (mib_instance_search(&ret_oid) || tag(&ret_oid.var) == ASN1_TAG_NO_SUCH_OBJ) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Write the staged varbinds of a native group */
+static int
+set_txn_native_commit(struct agentx_datagram *xdg, struct set_txn_group *grp)
+{
+  struct list_head *curr;
+  struct x_var_bind *vb;
+  struct oid_search_res ret_oid;
+
+  memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.request = MIB_REQ_SET;
+
+  list_for_each(curr, &grp->vb_list) {
+    vb = list_entry(curr, struct x_var_bind, link);
+    set_value(&ret_oid, vb);
+    mib_set(xdg, vb, &ret_oid);
+    if (ret_oid.err_stat || !MIB_TAG_VALID(tag(&ret_oid.var))) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void
+set_txn_cleanup(struct agentx_set_txn *txn)
+{
+  struct list_head *curr, *next, *pos, *n;
+  struct set_txn_group *grp;
+
+  list_for_each_safe(curr, next, &txn->groups) {
+    grp = list_entry(curr, struct set_txn_group, link);
+    if (grp->native == NULL) {
+      set_txn_call(grp, MIB_REQ_CLEANUPSET);
+    }
+    list_for_each_safe(pos, n, &grp->vb_list) {
+      list_del(pos);
+      free(list_entry(pos, struct x_var_bind, link));
+    }
+    list_del(curr);
+    free(grp);
+  }
+  txn->active = 0;
+}
+
+/* Check and stage the varbinds, nothing is written until commit */
 void
-agentx_set(struct agentx_datagram *xdg)
+agentx_testset(struct agentx_datagram *xdg)
 {
   uint32_t val_len, vb_in_cnt = 0;
   struct list_head *curr, *next;
   struct x_var_bind *vb_in, *vb_out;
   struct oid_search_res ret_oid;
+  struct agentx_set_txn *txn = set_txn_search(xdg);
+
+  if (txn == NULL) {
+    xdg->u.response.error = AGENTX_ERR_STAT_GEN_ERR;
+    agentx_response(xdg);
+    return;
+  }
+
+  /* A new transaction drops what is left of the last one */
+  if (txn->active) {
+    set_txn_cleanup(txn);
+  }
+  txn->active = 1;
+  txn->transaction_id = xdg->pdu_hdr.transaction_id;
 
   memset(&ret_oid, 0, sizeof(ret_oid));
-  ret_oid.request = MIB_REQ_SET;
+  ret_oid.request = MIB_REQ_TESTSET;
 
   list_for_each_safe(curr, next, &xdg->vb_in_list) {
     vb_in = list_entry(curr, struct x_var_bind, link);
     vb_in_cnt++;
 
-    /* Decode the setting value ahead */
-    tag(&ret_oid.var) = vb_in->val_type;
-    length(&ret_oid.var) = vb_in->val_len;
-    val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
-    memcpy(value(&ret_oid.var), vb_in->value, val_len);
+    set_value(&ret_oid, vb_in);
 
-    /* Search at the input oid and set it */
+    /* Search at the input oid and check it */
     mib_set(xdg, vb_in, &ret_oid);
     
     val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out = agentx_vb_new(ret_oid.id_len, val_len);
     vb_out->oid_len = ret_oid.id_len;
+    oid_cpy(vb_out->oid, ret_oid.oid, ret_oid.id_len);
     vb_out->val_type = vb_in->val_type;
     vb_out->val_len = agentx_value_enc(value(&ret_oid.var), val_len, tag(&ret_oid.var), vb_out->value);
 
@@ -214,6 +479,8 @@ agentx_set(struct agentx_datagram *xdg)
         xdg->u.response.error = ret_oid.err_stat;
         xdg->u.response.index = vb_in_cnt;
       }
+    } else {
+      set_txn_stage(txn, &ret_oid, vb_in);
     }
 
     /* Add into list. */
@@ -223,3 +490,76 @@ agentx_set(struct agentx_datagram *xdg)
 
   agentx_response(xdg);
 }
+
+/* Apply the staged writes, once per group */
+void
+agentx_commitset(struct agentx_datagram *xdg)
+{
+  struct list_head *curr;
+  struct set_txn_group *grp;
+  struct agentx_set_txn *txn = set_txn_current(xdg);
+  int ret;
+
+  if (txn == NULL) {
+    xdg->u.response.error = AGENTX_ERR_STAT_COMMIT_FAILED;
+    agentx_response(xdg);
+    return;
+  }
+
+  list_for_each(curr, &txn->groups) {
+    grp = list_entry(curr, struct set_txn_group, link);
+    if (grp->native != NULL) {
+      ret = set_txn_native_commit(xdg, grp);
+    } else {
+      ret = set_txn_call(grp, MIB_REQ_COMMITSET);
+    }
+    /* Partially written groups are undone too */
+    grp->committed = 1;
+    if (ret < 0) {
+      xdg->u.response.error = AGENTX_ERR_STAT_COMMIT_FAILED;
+      break;
+    }
+  }
+
+  agentx_response(xdg);
+}
+
+/* Roll back the committed groups */
+void
+agentx_undoset(struct agentx_datagram *xdg)
+{
+  struct list_head *curr;
+  struct set_txn_group *grp;
+  struct agentx_set_txn *txn = set_txn_current(xdg);
+
+  if (txn == NULL) {
+    xdg->u.response.error = AGENTX_ERR_STAT_UNDO_FAILED;
+    agentx_response(xdg);
+    return;
+  }
+
+  list_for_each(curr, &txn->groups) {
+    grp = list_entry(curr, struct set_txn_group, link);
+    if (!grp->committed) {
+      continue;
+    }
+    /* Native writes cannot be taken back */
+    if (grp->native != NULL || set_txn_call(grp, MIB_REQ_UNDOSET) < 0) {
+      xdg->u.response.error = AGENTX_ERR_STAT_UNDO_FAILED;
+    }
+  }
+
+  agentx_response(xdg);
+}
+
+/* End of the transaction, which is not answered */
+void
+agentx_cleanupset(struct agentx_datagram *xdg)
+{
+  struct agentx_set_txn *txn = set_txn_current(xdg);
+
+  if (txn != NULL) {
+    set_txn_cleanup(txn);
+  }
+  agentx_datagram_free(xdg);
+}
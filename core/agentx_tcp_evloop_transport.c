@@ -20,8 +20,11 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,60 +38,136 @@
 
 struct agentx_data_entry {
   int sock;
-  uint8_t *buf;
-  int len;
+  /* Received bytes not making up a whole PDU yet */
+  uint8_t *rx_buf;
+  uint32_t rx_len;
+  /* PDUs waiting to be sent */
+  uint8_t *tx_buf;
+  uint32_t tx_len;
+  uint32_t tx_size;
+  /* Set while received PDUs are processed, so their responses go in one send */
+  int corked;
+  int writing;
 };
 
 static struct agentx_data_entry agentx_entry;
 
+static void agentx_write_handler(int sock, unsigned char flag, void *ud);
+
+/* Send as much as the socket takes, wait for it to be writable for the rest */
 static void
-agentx_write_handler(int sock, unsigned char flag, void *ud)
+transport_flush(struct agentx_data_entry *entry)
 {
-  struct agentx_data_entry *entry = ud;
+  ssize_t len;
 
-  if (send(sock, entry->buf, entry->len, 0) == -1) {
-    perror("send()");
-    snmp_event_done();
+  while (entry->tx_len > 0) {
+    len = send(entry->sock, entry->tx_buf, entry->tx_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      perror("send()");
+      entry->tx_len = 0;
+      snmp_event_done();
+      break;
+    }
+    memmove(entry->tx_buf, entry->tx_buf + len, entry->tx_len - len);
+    entry->tx_len -= len;
   }
 
-  free(entry->buf);
+  if (entry->tx_len > 0 && !entry->writing) {
+    snmp_event_add(entry->sock, SNMP_EV_WRITE, agentx_write_handler, entry);
+    entry->writing = 1;
+  } else if (entry->tx_len == 0 && entry->writing) {
+    snmp_event_remove(entry->sock, SNMP_EV_WRITE);
+    entry->writing = 0;
+  }
+}
 
-  snmp_event_remove(sock, flag);
+static void
+agentx_write_handler(int sock, unsigned char flag, void *ud)
+{
+  transport_flush(ud);
 }
 
 static void
 agentx_read_handler(int sock, unsigned char flag, void *ud)
 {
+  struct agentx_data_entry *entry = ud;
+  uint32_t pos, pdu_len;
   uint8_t *buf;
   int len;
 
-  buf = xmalloc(TRANS_BUF_SIZ);
-
-  /* Receive agentx PDU */
-  len = recv(sock, buf, TRANS_BUF_SIZ - 1, 0);
-  if (len == -1) {
-    perror("recv()");
+  /* Receive agentx PDUs, the last one may be partial */
+  len = recv(sock, entry->rx_buf + entry->rx_len, TRANS_BUF_SIZ - entry->rx_len, 0);
+  if (len <= 0) {
+    /* Master agent is gone */
+    if (len < 0) {
+      perror("recv()");
+    }
     snmp_event_done();
+    return;
   }
+  entry->rx_len += len;
 
-  /* Parse agentX PDU in decoder */
-  agentx_prot_ops.receive(buf, len);
+  /* Hand over every whole PDU to the decoder */
+  entry->corked = 1;
+  for (pos = 0; entry->rx_len - pos >= sizeof(struct x_pdu_hdr); pos += pdu_len) {
+    pdu_len = agentx_pdu_len(entry->rx_buf + pos);
+    if (pdu_len > TRANS_BUF_SIZ) {
+      SMARTSNMP_LOG(L_ERROR, "AgentX PDU length %u exceeds!\n", pdu_len);
+      entry->rx_len = pos = 0;
+      snmp_event_done();
+      break;
+    }
+    if (entry->rx_len - pos < pdu_len) {
+      break;
+    }
+    buf = xmalloc(pdu_len);
+    memcpy(buf, entry->rx_buf + pos, pdu_len);
+    agentx_prot_ops.receive(buf, pdu_len, NULL);
+  }
+  entry->corked = 0;
+
+  /* Keep the partial PDU for the next read */
+  memmove(entry->rx_buf, entry->rx_buf + pos, entry->rx_len - pos);
+  entry->rx_len -= pos;
+
+  transport_flush(entry);
 }
 
 /* Send angentX PDU to the remote */
 static void
-transport_send(uint8_t *buf, int len)
+transport_send(uint8_t *buf, int len, const void *addr)
 {
-  agentx_entry.buf = buf;
-  agentx_entry.len = len;
-  snmp_event_add(agentx_entry.sock, SNMP_EV_WRITE, agentx_write_handler, &agentx_entry);
+  struct agentx_data_entry *entry = &agentx_entry;
+
+  if (entry->tx_len + len > entry->tx_size) {
+    entry->tx_size = alloc_nr(entry->tx_len + len);
+    entry->tx_buf = xrealloc(entry->tx_buf, entry->tx_size);
+  }
+  memcpy(entry->tx_buf + entry->tx_len, buf, len);
+  entry->tx_len += len;
+  free(buf);
+
+  if (!entry->corked) {
+    transport_flush(entry);
+  }
 }
 
 static void
 transport_running(void)
 {
   snmp_event_init();
-  snmp_event_add(agentx_entry.sock, SNMP_EV_READ, agentx_read_handler, NULL);
+  snmp_event_add(agentx_entry.sock, SNMP_EV_READ, agentx_read_handler, &agentx_entry);
+
+  /* Send PDUs queued at startup, e.g. registrations, all at once */
+  agentx_entry.corked = 0;
+  transport_flush(&agentx_entry);
+
   snmp_event_run();
 }
 
@@ -99,28 +178,84 @@ transport_stop(void)
   close(agentx_entry.sock);
 }
 
+/* Connect to the master agent on TCP loopback port */
 static int
-transport_init(int port)
+tcp_connect(int port)
 {
   struct sockaddr_in sin;
+  int sock, on = 1;
 
-  agentx_datagram.sock = agentx_entry.sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (agentx_entry.sock < 0) {
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0) {
     perror("usock");
     return -1;
   }
 
+  /* Responses are batched already, do not hold them back */
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
   memset(&sin, 0, sizeof(sin));
   sin.sin_family = AF_INET;
   sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
   sin.sin_port = htons(port);
 
-  if (connect(agentx_entry.sock, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
+  if (connect(sock, (struct sockaddr *)&sin, sizeof(sin)) == -1) {
     perror("connect()");
-    close(agentx_datagram.sock);
+    close(sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+/* Connect to the master agent on Unix domain socket path */
+static int
+unix_connect(const char *path)
+{
+  struct sockaddr_un sun;
+  int sock;
+
+  if (strlen(path) >= sizeof(sun.sun_path)) {
+    SMARTSNMP_LOG(L_ERROR, "AgentX socket path %s is too long!\n", path);
+    return -1;
+  }
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    perror("usock");
+    return -1;
+  }
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, path);
+
+  if (connect(sock, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+    perror("connect()");
+    close(sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+static int
+transport_init(int port)
+{
+  if (agentx_conn.path != NULL) {
+    agentx_entry.sock = unix_connect(agentx_conn.path);
+  } else {
+    agentx_entry.sock = tcp_connect(port);
+  }
+  if (agentx_entry.sock < 0) {
     return -1;
   }
+  agentx_conn.sock = agentx_entry.sock;
 
+  agentx_entry.rx_buf = xmalloc(TRANS_BUF_SIZ);
+  agentx_entry.rx_len = 0;
+  /* Nothing is sent until the event loop runs */
+  agentx_entry.corked = 1;
   return 0;
 }
 
@@ -130,4 +265,6 @@ struct transport_operation agentx_trans_ops = {
   transport_running,
   transport_stop,
   transport_send,
+  NULL,
+  1,
 };
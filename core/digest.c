@@ -0,0 +1,558 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "digest.h"
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+static inline uint32_t
+load_le32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint32_t
+load_be32(const uint8_t *p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static inline uint64_t
+load_be64(const uint8_t *p)
+{
+  return (uint64_t)load_be32(p) << 32 | load_be32(p + 4);
+}
+
+static inline void
+store_le32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static inline void
+store_be32(uint8_t *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static inline void
+store_be64(uint8_t *p, uint64_t v)
+{
+  store_be32(p, v >> 32);
+  store_be32(p + 4, v);
+}
+
+/* MD5 (RFC 1321) */
+static const uint32_t md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static void
+md5_compress(uint32_t *h, const uint8_t *blk)
+{
+  uint32_t w[16], a, b, c, d, f, t;
+  int i, g;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = load_le32(blk + i * 4);
+  }
+
+  a = h[0];
+  b = h[1];
+  c = h[2];
+  d = h[3];
+  for (i = 0; i < 64; i++) {
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) & 15;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) & 15;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) & 15;
+    }
+    t = d;
+    d = c;
+    c = b;
+    b += ROL32(a + f + md5_k[i] + w[g], md5_r[i]);
+    a = t;
+  }
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+}
+
+/* SHA-1 (RFC 3174) */
+static void
+sha1_compress(uint32_t *h, const uint8_t *blk)
+{
+  uint32_t w[80], a, b, c, d, e, f, k, t;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = load_be32(blk + i * 4);
+  }
+  for (; i < 80; i++) {
+    w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  a = h[0];
+  b = h[1];
+  c = h[2];
+  d = h[3];
+  e = h[4];
+  for (i = 0; i < 80; i++) {
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    t = ROL32(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ROL32(b, 30);
+    b = a;
+    a = t;
+  }
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+}
+
+/* SHA-224 and SHA-256 (FIPS 180-4) */
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void
+sha256_compress(uint32_t *h, const uint8_t *blk)
+{
+  uint32_t w[64], s[8], t1, t2;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = load_be32(blk + i * 4);
+  }
+  for (; i < 64; i++) {
+    t1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    t2 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+  }
+
+  memcpy(s, h, sizeof(s));
+  for (i = 0; i < 64; i++) {
+    t1 = s[7] + (ROR32(s[4], 6) ^ ROR32(s[4], 11) ^ ROR32(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+    t2 = (ROR32(s[0], 2) ^ ROR32(s[0], 13) ^ ROR32(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    memmove(s + 1, s, 7 * sizeof(s[0]));
+    s[4] += t1;
+    s[0] = t1 + t2;
+  }
+  for (i = 0; i < 8; i++) {
+    h[i] += s[i];
+  }
+}
+
+/* SHA-384 and SHA-512 (FIPS 180-4) */
+static const uint64_t sha512_k[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static void
+sha512_compress(uint64_t *h, const uint8_t *blk)
+{
+  uint64_t w[80], s[8], t1, t2;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = load_be64(blk + i * 8);
+  }
+  for (; i < 80; i++) {
+    t1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+    t2 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+    w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+  }
+
+  memcpy(s, h, sizeof(s));
+  for (i = 0; i < 80; i++) {
+    t1 = s[7] + (ROR64(s[4], 14) ^ ROR64(s[4], 18) ^ ROR64(s[4], 41)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha512_k[i] + w[i];
+    t2 = (ROR64(s[0], 28) ^ ROR64(s[0], 34) ^ ROR64(s[0], 39)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    memmove(s + 1, s, 7 * sizeof(s[0]));
+    s[4] += t1;
+    s[0] = t1 + t2;
+  }
+  for (i = 0; i < 8; i++) {
+    h[i] += s[i];
+  }
+}
+
+/* Feed 64-byte blocks of 32-bit word algorithms */
+static void
+s32_update(union digest_ctx *ctx, const uint8_t *data, uint32_t len,
+           void (*compress)(uint32_t *, const uint8_t *))
+{
+  uint32_t used = ctx->s32.len & 63;
+
+  ctx->s32.len += len;
+  if (used) {
+    uint32_t n = 64 - used < len ? 64 - used : len;
+    memcpy(ctx->s32.buf + used, data, n);
+    data += n;
+    len -= n;
+    if (used + n < 64) {
+      return;
+    }
+    compress(ctx->s32.h, ctx->s32.buf);
+  }
+  for (; len >= 64; data += 64, len -= 64) {
+    compress(ctx->s32.h, data);
+  }
+  memcpy(ctx->s32.buf, data, len);
+}
+
+/* Pad with the bit length in little or big endian */
+static void
+s32_final(union digest_ctx *ctx, int big_endian, void (*compress)(uint32_t *, const uint8_t *))
+{
+  uint32_t used = ctx->s32.len & 63;
+  uint64_t bits = ctx->s32.len << 3;
+
+  ctx->s32.buf[used++] = 0x80;
+  if (used > 56) {
+    memset(ctx->s32.buf + used, 0, 64 - used);
+    compress(ctx->s32.h, ctx->s32.buf);
+    used = 0;
+  }
+  memset(ctx->s32.buf + used, 0, 56 - used);
+  if (big_endian) {
+    store_be64(ctx->s32.buf + 56, bits);
+  } else {
+    store_le32(ctx->s32.buf + 56, bits);
+    store_le32(ctx->s32.buf + 60, bits >> 32);
+  }
+  compress(ctx->s32.h, ctx->s32.buf);
+}
+
+static void
+md5_init(union digest_ctx *ctx)
+{
+  static const uint32_t iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  memcpy(ctx->s32.h, iv, sizeof(iv));
+  ctx->s32.len = 0;
+}
+
+static void
+md5_update(union digest_ctx *ctx, const uint8_t *data, uint32_t len)
+{
+  s32_update(ctx, data, len, md5_compress);
+}
+
+static void
+md5_final(union digest_ctx *ctx, uint8_t *digest)
+{
+  int i;
+
+  s32_final(ctx, 0, md5_compress);
+  for (i = 0; i < 4; i++) {
+    store_le32(digest + i * 4, ctx->s32.h[i]);
+  }
+}
+
+static void
+sha1_init(union digest_ctx *ctx)
+{
+  static const uint32_t iv[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+  memcpy(ctx->s32.h, iv, sizeof(iv));
+  ctx->s32.len = 0;
+}
+
+static void
+sha1_update(union digest_ctx *ctx, const uint8_t *data, uint32_t len)
+{
+  s32_update(ctx, data, len, sha1_compress);
+}
+
+static void
+sha1_final(union digest_ctx *ctx, uint8_t *digest)
+{
+  int i;
+
+  s32_final(ctx, 1, sha1_compress);
+  for (i = 0; i < 5; i++) {
+    store_be32(digest + i * 4, ctx->s32.h[i]);
+  }
+}
+
+static void
+sha224_init(union digest_ctx *ctx)
+{
+  static const uint32_t iv[8] = {
+    0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4,
+  };
+  memcpy(ctx->s32.h, iv, sizeof(iv));
+  ctx->s32.len = 0;
+}
+
+static void
+sha256_init(union digest_ctx *ctx)
+{
+  static const uint32_t iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(ctx->s32.h, iv, sizeof(iv));
+  ctx->s32.len = 0;
+}
+
+static void
+sha256_update(union digest_ctx *ctx, const uint8_t *data, uint32_t len)
+{
+  s32_update(ctx, data, len, sha256_compress);
+}
+
+static void
+sha224_final(union digest_ctx *ctx, uint8_t *digest)
+{
+  int i;
+
+  s32_final(ctx, 1, sha256_compress);
+  for (i = 0; i < 7; i++) {
+    store_be32(digest + i * 4, ctx->s32.h[i]);
+  }
+}
+
+static void
+sha256_final(union digest_ctx *ctx, uint8_t *digest)
+{
+  int i;
+
+  s32_final(ctx, 1, sha256_compress);
+  for (i = 0; i < 8; i++) {
+    store_be32(digest + i * 4, ctx->s32.h[i]);
+  }
+}
+
+static void
+sha384_init(union digest_ctx *ctx)
+{
+  static const uint64_t iv[8] = {
+    0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+    0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+  };
+  memcpy(ctx->s64.h, iv, sizeof(iv));
+  ctx->s64.len = 0;
+}
+
+static void
+sha512_init(union digest_ctx *ctx)
+{
+  static const uint64_t iv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+  };
+  memcpy(ctx->s64.h, iv, sizeof(iv));
+  ctx->s64.len = 0;
+}
+
+static void
+sha512_update(union digest_ctx *ctx, const uint8_t *data, uint32_t len)
+{
+  uint32_t used = ctx->s64.len & 127;
+
+  ctx->s64.len += len;
+  if (used) {
+    uint32_t n = 128 - used < len ? 128 - used : len;
+    memcpy(ctx->s64.buf + used, data, n);
+    data += n;
+    len -= n;
+    if (used + n < 128) {
+      return;
+    }
+    sha512_compress(ctx->s64.h, ctx->s64.buf);
+  }
+  for (; len >= 128; data += 128, len -= 128) {
+    sha512_compress(ctx->s64.h, data);
+  }
+  memcpy(ctx->s64.buf, data, len);
+}
+
+/* Digest of len 64-bit words, messages are shorter than 2^61 bytes */
+static void
+sha512_finish(union digest_ctx *ctx, uint8_t *digest, int len)
+{
+  uint32_t used = ctx->s64.len & 127;
+  int i;
+
+  ctx->s64.buf[used++] = 0x80;
+  if (used > 112) {
+    memset(ctx->s64.buf + used, 0, 128 - used);
+    sha512_compress(ctx->s64.h, ctx->s64.buf);
+    used = 0;
+  }
+  memset(ctx->s64.buf + used, 0, 120 - used);
+  store_be64(ctx->s64.buf + 120, ctx->s64.len << 3);
+  sha512_compress(ctx->s64.h, ctx->s64.buf);
+
+  for (i = 0; i < len; i++) {
+    store_be64(digest + i * 8, ctx->s64.h[i]);
+  }
+}
+
+static void
+sha384_final(union digest_ctx *ctx, uint8_t *digest)
+{
+  sha512_finish(ctx, digest, 6);
+}
+
+static void
+sha512_final(union digest_ctx *ctx, uint8_t *digest)
+{
+  sha512_finish(ctx, digest, 8);
+}
+
+const struct digest_alg digest_md5 = { "MD5", 64, 16, md5_init, md5_update, md5_final };
+const struct digest_alg digest_sha1 = { "SHA", 64, 20, sha1_init, sha1_update, sha1_final };
+const struct digest_alg digest_sha224 = { "SHA-224", 64, 28, sha224_init, sha256_update, sha224_final };
+const struct digest_alg digest_sha256 = { "SHA-256", 64, 32, sha256_init, sha256_update, sha256_final };
+const struct digest_alg digest_sha384 = { "SHA-384", 128, 48, sha384_init, sha512_update, sha384_final };
+const struct digest_alg digest_sha512 = { "SHA-512", 128, 64, sha512_init, sha512_update, sha512_final };
+
+void
+digest(const struct digest_alg *alg, const uint8_t *data, uint32_t len, uint8_t *out)
+{
+  union digest_ctx ctx;
+
+  alg->init(&ctx);
+  alg->update(&ctx, data, len);
+  alg->final(&ctx, out);
+}
+
+/* Hash the padded key blocks once, every MAC then starts from copies */
+void
+hmac_key_init(struct hmac_key *hk, const struct digest_alg *alg, const uint8_t *key, uint32_t key_len)
+{
+  uint8_t pad[DIGEST_BLOCK_MAX], hashed[DIGEST_MAX_LEN];
+  uint32_t i;
+
+  if (key_len > alg->block_len) {
+    digest(alg, key, key_len, hashed);
+    key = hashed;
+    key_len = alg->digest_len;
+  }
+
+  hk->alg = alg;
+
+  memset(pad, 0x36, alg->block_len);
+  for (i = 0; i < key_len; i++) {
+    pad[i] ^= key[i];
+  }
+  alg->init(&hk->inner);
+  alg->update(&hk->inner, pad, alg->block_len);
+
+  memset(pad, 0x5c, alg->block_len);
+  for (i = 0; i < key_len; i++) {
+    pad[i] ^= key[i];
+  }
+  alg->init(&hk->outer);
+  alg->update(&hk->outer, pad, alg->block_len);
+
+  memset(pad, 0, sizeof(pad));
+  memset(hashed, 0, sizeof(hashed));
+}
+
+/* Full length MAC of data, callers truncate it */
+void
+hmac(const struct hmac_key *hk, const uint8_t *data, uint32_t len, uint8_t *mac)
+{
+  const struct digest_alg *alg = hk->alg;
+  union digest_ctx ctx;
+
+  ctx = hk->inner;
+  alg->update(&ctx, data, len);
+  alg->final(&ctx, mac);
+
+  ctx = hk->outer;
+  alg->update(&ctx, mac, alg->digest_len);
+  alg->final(&ctx, mac);
+}
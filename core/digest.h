@@ -0,0 +1,70 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef _DIGEST_H_
+#define _DIGEST_H_
+
+#include <stdint.h>
+
+#define DIGEST_MAX_LEN    64
+#define DIGEST_BLOCK_MAX  128
+
+/* Hash state of any supported algorithm */
+union digest_ctx {
+  struct {
+    uint32_t h[8];
+    uint64_t len;
+    uint8_t buf[64];
+  } s32;
+  struct {
+    uint64_t h[8];
+    uint64_t len;
+    uint8_t buf[128];
+  } s64;
+};
+
+struct digest_alg {
+  const char *name;
+  uint32_t block_len;
+  uint32_t digest_len;
+  void (*init)(union digest_ctx *ctx);
+  void (*update)(union digest_ctx *ctx, const uint8_t *data, uint32_t len);
+  void (*final)(union digest_ctx *ctx, uint8_t *digest);
+};
+
+extern const struct digest_alg digest_md5;
+extern const struct digest_alg digest_sha1;
+extern const struct digest_alg digest_sha224;
+extern const struct digest_alg digest_sha256;
+extern const struct digest_alg digest_sha384;
+extern const struct digest_alg digest_sha512;
+
+/* HMAC key with the padded key blocks already hashed */
+struct hmac_key {
+  const struct digest_alg *alg;
+  union digest_ctx inner;
+  union digest_ctx outer;
+};
+
+void digest(const struct digest_alg *alg, const uint8_t *data, uint32_t len, uint8_t *out);
+void hmac_key_init(struct hmac_key *hk, const struct digest_alg *alg, const uint8_t *key, uint32_t key_len);
+void hmac(const struct hmac_key *hk, const uint8_t *data, uint32_t len, uint8_t *mac);
+
+#endif /* _DIGEST_H_ */
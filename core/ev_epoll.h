@@ -41,12 +41,14 @@ __ev_done(void)
   close(env.epfd);  
 }
 
+/* Interest is the union of what is already added and the new flag */
 static void
 __ev_add(struct snmp_event *event, unsigned char flag)
 {
   struct epoll_event ee;
   int op = event->flag == SNMP_EV_NONE ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
 
+  flag |= event->flag;
   ee.events = 0;
   ee.data.fd = event->fd;
   if (flag & SNMP_EV_READ) {
@@ -63,13 +65,14 @@ __ev_remove(struct snmp_event *event, unsigned char flag)
 {
   struct epoll_event ee;
 
-  ee.events = EPOLLIN | EPOLLOUT;
+  flag = event->flag & ~flag;
+  ee.events = 0;
   ee.data.fd = event->fd;
   if (flag & SNMP_EV_READ) {
-    ee.events &= ~EPOLLIN;
+    ee.events |= EPOLLIN;
   }
   if (flag & SNMP_EV_WRITE) {
-    ee.events &= ~EPOLLOUT;
+    ee.events |= EPOLLOUT;
   } 
   if (ee.events == 0) {
     epoll_ctl(env.epfd, EPOLL_CTL_DEL, event->fd, &ee);
@@ -79,16 +82,20 @@ __ev_remove(struct snmp_event *event, unsigned char flag)
 }
 
 static int
-__ev_poll(struct snmp_event_loop *ev_loop)
+__ev_poll(struct snmp_event_loop *ev_loop, int timeout)
 {
   int i;
 
-  int nfds = epoll_wait(env.epfd, env.event, SNMP_MAX_EVENTS, -1);
+  int nfds = epoll_wait(env.epfd, env.event, SNMP_MAX_EVENTS, timeout);
   if (nfds > 0) {
-    for (i = 0; i < SNMP_MAX_EVENTS; i++) {
+    for (i = 0; i < nfds; i++) {
       struct epoll_event *ee = &env.event[i];
-      struct snmp_event *event = &ev_loop->event[i];
-      if (ee->events & EPOLLIN) {
+      struct snmp_event *event = snmp_event_find(ev_loop, ee->data.fd);
+      if (event == NULL) {
+        continue;
+      }
+      /* Hang-up of pipes comes without EPOLLIN, read() tells it */
+      if (ee->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
         event->read = 1;
       }
       if (ee->events & EPOLLOUT) {
@@ -66,19 +66,26 @@ __ev_remove(struct snmp_event *event, unsigned char flag)
   if (flag & SNMP_EV_WRITE) {
     EV_SET(&ke, event->fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
   } 
-  kevent(state->kqfd, &ke, 1, NULL, 0, NULL);
+  kevent(env.kqfd, &ke, 1, NULL, 0, NULL);
 }
 
 static int
-__ev_poll(struct snmp_event_loop *ev_loop)
+__ev_poll(struct snmp_event_loop *ev_loop, int timeout)
 {
   int i;
+  struct timespec ts;
+
+  ts.tv_sec = timeout / 1000;
+  ts.tv_nsec = timeout % 1000 * 1000000;
 
-  int nfds = kevent(kqfd, NULL, 0, env.event, SNMP_MAX_EVENTS, NULL);
+  int nfds = kevent(env.kqfd, NULL, 0, env.event, SNMP_MAX_EVENTS, timeout < 0 ? NULL : &ts);
   if (nfds > 0) {
-    for (i = 0; i < SNMP_MAX_EVENTS; i++) {
+    for (i = 0; i < nfds; i++) {
       struct kevent *ke = &env.event[i];
-      struct snmp_event *event = &ev_loop->event[i];
+      struct snmp_event *event = snmp_event_find(ev_loop, ke->ident);
+      if (event == NULL) {
+        continue;
+      }
       if (ke->filter == EVFILT_READ) {
         event->read = 1;
       }
@@ -19,9 +19,11 @@
  */
 
 #include <stdio.h>
+#include <time.h>
 #include "ev_loop.h"
 
-#define SNMP_MAX_EVENTS  5
+#define SNMP_MAX_EVENTS  32
+#define SNMP_MAX_TIMERS  32
 
 struct snmp_event {
   int fd;
@@ -34,15 +36,39 @@ struct snmp_event {
   unsigned char write;
 };
 
+struct snmp_timer {
+  timer_handler cb;
+  void *ud;
+  /* absolute expiration in milliseconds */
+  uint64_t expire;
+  /* period in milliseconds, 0 for one-shot */
+  uint32_t interval;
+};
+
 struct snmp_event_loop {
+  int inited;
   int start;
+  int running;
   int ev_no;
   int max_fd;
   struct snmp_event event[SNMP_MAX_EVENTS];
+  struct snmp_timer timer[SNMP_MAX_TIMERS];
 };
 
 static struct snmp_event_loop ev_loop;
 
+static inline struct snmp_event *
+snmp_event_find(struct snmp_event_loop *ev_loop, int fd)
+{
+  int i;
+  for (i = 0; i < SNMP_MAX_EVENTS; i++) {
+    if (ev_loop->event[i].fd == fd) {
+      return &ev_loop->event[i];
+    }
+  }
+  return NULL;
+}
+
 #ifdef USE_EPOLL
 #include "ev_epoll.h"
 #else
@@ -53,10 +79,26 @@ static struct snmp_event_loop ev_loop;
     #endif
 #endif
 
+/* Monotonic clock in milliseconds */
+uint64_t
+snmp_event_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Event loop can be initialized by whoever comes first, transports or
+ * modules that add fds and timers before running. */
 void
 snmp_event_init(void)
 {
   int i;
+
+  if (ev_loop.inited) {
+    return;
+  }
+
   for (i = 0; i < SNMP_MAX_EVENTS; i++) {
     struct snmp_event *event = &ev_loop.event[i];
     event->fd = -1;
@@ -64,6 +106,7 @@ snmp_event_init(void)
     event->read = 0;
     event->write = 0;
   }
+  ev_loop.inited = 1;
   ev_loop.start = 1;
   ev_loop.ev_no = 0;
   ev_loop.max_fd = -1;
@@ -81,6 +124,10 @@ snmp_event_done(void)
     event->read = 0;
     event->write = 0;
   }
+  for (i = 0; i < SNMP_MAX_TIMERS; i++) {
+    ev_loop.timer[i].cb = NULL;
+  }
+  ev_loop.inited = 0;
   ev_loop.start = 0;
   ev_loop.ev_no = 0;
   ev_loop.max_fd = -1;
@@ -90,36 +137,36 @@ snmp_event_done(void)
 int
 snmp_event_add(int fd, unsigned char flag, transport_handler cb, void *ud)
 {
-  int i;
+  struct snmp_event *event;
 
-  for (i = 0; i < SNMP_MAX_EVENTS; i++) {
-    struct snmp_event *event = &ev_loop.event[i];
-    if (event->fd == fd) {
-      __ev_add(event, flag);
-      event->flag |= flag;
-    } else if (event->fd == -1) {
-      if (fd > ev_loop.max_fd) {
-        ev_loop.max_fd = fd;
-      }
-      event->fd = fd;
-      __ev_add(event, flag);
-      event->flag = flag;
-    } else {
-      continue;
-    }
+  snmp_event_init();
 
-    if (flag & SNMP_EV_READ) {
-      event->rcb = cb;
-      event->rud = ud;
+  /* Slot of the fd if added before, otherwise a free one */
+  event = snmp_event_find(&ev_loop, fd);
+  if (event == NULL) {
+    event = snmp_event_find(&ev_loop, -1);
+    if (event == NULL) {
+      return -1;
     }
-    if (flag & SNMP_EV_WRITE) {
-      event->wcb = cb;
-      event->wud = ud;
+    if (fd > ev_loop.max_fd) {
+      ev_loop.max_fd = fd;
     }
-    return 0;
+    event->fd = fd;
+    event->flag = SNMP_EV_NONE;
   }
 
-  return -1;
+  __ev_add(event, flag);
+  event->flag |= flag;
+
+  if (flag & SNMP_EV_READ) {
+    event->rcb = cb;
+    event->rud = ud;
+  }
+  if (flag & SNMP_EV_WRITE) {
+    event->wcb = cb;
+    event->wud = ud;
+  }
+  return 0;
 }
 
 void
@@ -152,12 +199,86 @@ snmp_event_remove(int fd, unsigned char flag)
   }
 }
 
+/* Add a timer expiring in 'expire' ms, then every 'interval' ms if not zero. */
+int
+snmp_event_timer_add(uint32_t expire, uint32_t interval, timer_handler cb, void *ud)
+{
+  int i;
+
+  snmp_event_init();
+
+  for (i = 0; i < SNMP_MAX_TIMERS; i++) {
+    struct snmp_timer *timer = &ev_loop.timer[i];
+    if (timer->cb == NULL) {
+      timer->cb = cb;
+      timer->ud = ud;
+      timer->expire = snmp_event_time() + expire;
+      timer->interval = interval;
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+void
+snmp_event_timer_remove(int timer)
+{
+  if (timer >= 0 && timer < SNMP_MAX_TIMERS) {
+    ev_loop.timer[timer].cb = NULL;
+  }
+}
+
+/* Milliseconds to wait until the nearest timer, -1 for none. */
+static int
+snmp_event_timeout(void)
+{
+  int i, found = 0;
+  uint64_t now, expire = 0;
+
+  for (i = 0; i < SNMP_MAX_TIMERS; i++) {
+    struct snmp_timer *timer = &ev_loop.timer[i];
+    if (timer->cb != NULL && (!found || timer->expire < expire)) {
+      expire = timer->expire;
+      found = 1;
+    }
+  }
+
+  if (!found) {
+    return -1;
+  }
+
+  now = snmp_event_time();
+  return expire > now ? (int)(expire - now) : 0;
+}
+
+static void
+snmp_event_timer_expire(void)
+{
+  int i;
+  uint64_t now = snmp_event_time();
+
+  for (i = 0; i < SNMP_MAX_TIMERS; i++) {
+    struct snmp_timer *timer = &ev_loop.timer[i];
+    if (timer->cb != NULL && timer->expire <= now) {
+      timer_handler cb = timer->cb;
+      void *ud = timer->ud;
+      if (timer->interval) {
+        timer->expire = now + timer->interval;
+      } else {
+        timer->cb = NULL;
+      }
+      cb(ud);
+    }
+  }
+}
+
 static void
 snmp_event_poll(void)
 {
   int i;
 
-  __ev_poll(&ev_loop);
+  __ev_poll(&ev_loop, snmp_event_timeout());
   for (i = 0; i < SNMP_MAX_EVENTS; i++) {
     struct snmp_event *event = &ev_loop.event[i];
     if (event->read && event->rcb != NULL) {
@@ -169,12 +290,22 @@ snmp_event_poll(void)
       event->write = 0;
     }
   }
+  snmp_event_timer_expire();
 }
 
 void
 snmp_event_run(void)
 {
+  ev_loop.running = 1;
   while (ev_loop.start) {
     snmp_event_poll();
   }
+  ev_loop.running = 0;
+}
+
+/* Whether fds and timers added now will ever be served */
+int
+snmp_event_running(void)
+{
+  return ev_loop.running && ev_loop.start;
 }
@@ -25,12 +25,19 @@
 #define SNMP_EV_READ  1
 #define SNMP_EV_WRITE 2
 
+#include <stdint.h>
+
 typedef void (*transport_handler)(int sock, unsigned char flag, void *ud);
+typedef void (*timer_handler)(void *ud);
 
 void snmp_event_init(void);
 void snmp_event_done(void);
 void snmp_event_run(void);
+int snmp_event_running(void);
 int snmp_event_add(int fd, unsigned char flag, transport_handler cb, void *ud);
 void snmp_event_remove(int fd, unsigned char flag);
+int snmp_event_timer_add(uint32_t expire, uint32_t interval, timer_handler cb, void *ud);
+void snmp_event_timer_remove(int timer);
+uint64_t snmp_event_time(void);
 
 #endif /* _SNMP_EVENT_LOOP_H_ */
@@ -65,14 +65,18 @@ __ev_remove(struct snmp_event *event, unsigned char flag)
 }
 
 static int
-__ev_poll(struct snmp_event_loop *ev_loop)
+__ev_poll(struct snmp_event_loop *ev_loop, int timeout)
 {
   int i;
+  struct timeval tv;
 
   memcpy(&env.rfds_, &env.rfds, sizeof(fd_set));
   memcpy(&env.wfds_, &env.wfds, sizeof(fd_set));
 
-  int nfds = select(ev_loop->max_fd + 1, &env.rfds_, &env.wfds_, NULL, NULL);
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = timeout % 1000 * 1000;
+
+  int nfds = select(ev_loop->max_fd + 1, &env.rfds_, &env.wfds_, NULL, timeout < 0 ? NULL : &tv);
   if (nfds > 0) {
     for (i = 0; i < SNMP_MAX_EVENTS; i++) {
       struct snmp_event *event = &ev_loop->event[i];
@@ -0,0 +1,101 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdint.h>
+
+#include "asn1.h"
+
+/* Stages of a request, rows 1 to LATENCY_STAGE_NUM of the latency table */
+enum latency_stage {
+  LATENCY_DECODE,
+  /* MIB tree search net of handlers */
+  LATENCY_SEARCH,
+  LATENCY_ENCODE,
+  LATENCY_SEND,
+  /* Received to responded, parked time included */
+  LATENCY_REQUEST,
+  LATENCY_STAGE_NUM,
+};
+
+/* Log-linear buckets: exact below 2^LATENCY_SUB_BITS ns, then
+ * 2^LATENCY_SUB_BITS buckets per power of two up to 2^LATENCY_MAG_MAX ns */
+#define LATENCY_SUB_BITS  4
+#define LATENCY_MAG_MAX   36
+#define LATENCY_BUCKETS   ((LATENCY_MAG_MAX - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+struct latency_hist {
+  /* Row index, fixed while registered */
+  uint32_t id;
+  /* Stage name or dotted oid of the group */
+  char *name;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint32_t buckets[LATENCY_BUCKETS];
+};
+
+#ifdef SMARTSNMP_LATENCY
+
+extern struct latency_hist latency_stages[LATENCY_STAGE_NUM];
+/* Time spent in handlers so far, taken out of the search stage */
+extern uint64_t latency_handler_ns;
+
+uint64_t latency_now(void);
+void latency_record(struct latency_hist *h, uint64_t ns);
+void latency_handler_record(struct latency_hist *h, uint64_t ns);
+struct latency_hist *latency_group_new(const oid_t *oid, uint32_t len);
+void latency_group_free(struct latency_hist *h);
+
+#define LATENCY_STAMP(t)          uint64_t t = latency_now()
+#define LATENCY_STAMP_SET(t)      ((t) = latency_now())
+#define LATENCY_STAGE(s, t)       latency_record(&latency_stages[s], latency_now() - (t))
+#define LATENCY_HANDLER(h, t)     latency_handler_record(h, latency_now() - (t))
+#define LATENCY_NET_STAMP(t)      uint64_t t = latency_now() - latency_handler_ns
+#define LATENCY_NET_STAGE(s, t)   latency_record(&latency_stages[s], latency_now() - latency_handler_ns - (t))
+#define LATENCY_GROUP_NEW(oid, len)  latency_group_new(oid, len)
+#define LATENCY_GROUP_FREE(h)     latency_group_free(h)
+
+#else
+
+/* Compiled out, nothing left on the request path */
+#define LATENCY_STAMP(t)
+#define LATENCY_STAMP_SET(t)      do {} while (0)
+#define LATENCY_STAGE(s, t)       do {} while (0)
+#define LATENCY_HANDLER(h, t)     do {} while (0)
+#define LATENCY_NET_STAMP(t)
+#define LATENCY_NET_STAGE(s, t)   do {} while (0)
+#define LATENCY_GROUP_NEW(oid, len)  NULL
+#define LATENCY_GROUP_FREE(h)     do {} while (0)
+
+#endif /* SMARTSNMP_LATENCY */
+
+/* Histograms of stages and groups in row order, there are none when
+ * compiled out. Percentiles in permille, values in ns. */
+int latency_hist_cnt(void);
+const struct latency_hist *latency_hist_at(int row);
+uint32_t latency_hist_gen(void);
+uint64_t latency_percentile(const struct latency_hist *h, uint32_t permille);
+int latency_dump(const char *path);
+int latency_dump_start(const char *path, uint32_t interval);
+
+#endif /* _LATENCY_H_ */
@@ -41,6 +41,12 @@ typedef enum mib_request {
   MIB_REQ_INF     = 0xA6,
   MIB_TRAP        = 0xA7,
   MIB_REPO        = 0xA8,
+  /* Phases of a set transaction, writes are staged at test and applied
+   * at commit, the others are called once per group with no instance. */
+  MIB_REQ_TESTSET    = 0x100,
+  MIB_REQ_COMMITSET,
+  MIB_REQ_UNDOSET,
+  MIB_REQ_CLEANUPSET,
 } MIB_REQ_E;
 
 /* MIB access attribute */
@@ -49,8 +55,64 @@ typedef enum mib_aces_attr {
   MIB_ACES_WRITE
 } MIB_ACES_ATTR_E;
 
+struct oid_search_res;
+
+/* Instance search handler in C, with the same semantic as the Lua one */
+typedef int (*mib_native_handler)(struct oid_search_res *ret_oid);
+
+struct mib_async;
+struct latency_hist;
+
+/* Lua handler call running in a coroutine on behalf of a request */
+struct mib_async_call {
+  struct list_head link;
+  struct mib_async *async;
+  lua_State *co;
+  int co_ref;
+  /* The search this call answers */
+  int callback;
+  int request;
+  oid_t inst_id[MIB_OID_MAX_LEN];
+  uint32_t inst_id_len;
+  /* What the coroutine waits on, -1 for none */
+  int fd;
+  int timer;
+  /* In the list of calls waiting on fds while fd is set */
+  struct list_head fd_link;
+  /* Coroutine status, LUA_YIELD while waiting */
+  int status;
+  /* Remote calls have no coroutine, they are answered from outside, e.g.
+   * by an AgentX sub-agent. The search is keyed by native and the whole
+   * oid searched in inst_id, the answer comes in err_stat, var and ret_id. */
+  mib_native_handler native;
+  int err_stat;
+  Variable var;
+  oid_t ret_id[MIB_OID_MAX_LEN];
+  uint32_t ret_id_len;
+  /* Owner of the remote call, told if the request drops it unanswered */
+  void *ud;
+  void (*cancel)(struct mib_async_call *call);
+};
+
+/* Request in which Lua handlers may yield. The request is parked while a
+ * call is pending and replayed through 'resume' when it finishes, searches
+ * of the replay are answered by finished calls. */
+struct mib_async {
+  struct list_head calls;
+  struct mib_async_call *pending;
+  /* Remote calls not answered yet, the request is replayed when none is left */
+  int remote;
+  /* Searches only place remote calls and stop at the first instance node */
+  int prefetch;
+  void (*resume)(struct mib_async *async);
+};
+
+/* Search stopped at a parked handler */
+#define MIB_SEARCH_PENDING(ret_oid) ((ret_oid)->async != NULL && \
+  ((ret_oid)->async->pending != NULL || (ret_oid)->async->remote > 0 || (ret_oid)->async->prefetch))
+
 struct oid_search_res {
-  /* Return oid */
+  /* Return oid, kept in oid_buf */
   oid_t *oid;
   uint32_t id_len;
   /* Instance oid of return */
@@ -58,12 +120,19 @@ struct oid_search_res {
   uint32_t inst_id_len;
   /* Instance search callback in Lua */
   int callback;
+  /* Instance search handler in C, NULL for Lua callback */
+  mib_native_handler native;
+  /* Handler timing of the group, NULL for none */
+  struct latency_hist *latency;
   /* Request id */
   int request;
   /* Error status */
   int err_stat;
   /* Search return value */
   Variable var;
+  /* Request context to park yielding handlers, NULL to wait in place */
+  struct mib_async *async;
+  oid_t oid_buf[MIB_OID_MAX_LEN];
 };
 
 struct mib_node {
@@ -81,6 +150,39 @@ struct mib_group_node {
 struct mib_instance_node {
   uint8_t type;
   int callback;
+  mib_native_handler native;
+  struct latency_hist *latency;
+};
+
+/* MIB group implemented in C, looked up by name from Lua */
+struct mib_native_group {
+  const char *name;
+  int (*init)(void);
+  mib_native_handler handler;
+};
+
+/* Position of the last GETNEXT answer, lets a walk step to the next row
+ * without searching the table again. */
+struct mib_native_cursor {
+  uint32_t gen;
+  int col;
+  int row;
+  uint32_t inst_id_len;
+  oid_t inst_id[MIB_OID_MAX_LEN];
+};
+
+/* Conceptual table served by a native handler, rows sorted by index */
+struct mib_native_table {
+  /* sorted column numbers */
+  const oid_t *cols;
+  int col_cnt;
+  int row_cnt;
+  /* fill in index of row, return its length */
+  uint32_t (*row_index)(void *ud, int row, oid_t *idx);
+  void *ud;
+  /* generation of rows, cursor is dropped on change, may be NULL */
+  uint32_t gen;
+  struct mib_native_cursor *cursor;
 };
 
 struct mib_view {
@@ -138,10 +240,20 @@ int oid_cover(const oid_t *oid1, uint32_t len1, const oid_t *oid2, uint32_t len2
 
 void mib_handler_unref(int handler);
 int mib_instance_search(struct oid_search_res *ret_oid);
+
+void mib_async_init(struct mib_async *async, void (*resume)(struct mib_async *async));
+void mib_async_reset(struct mib_async *async);
+void mib_async_free(struct mib_async *async);
+struct mib_async_call *mib_async_remote(struct oid_search_res *ret_oid, int *created);
+void mib_async_answer(struct mib_async_call *call);
+lua_State *mib_async_thread(void);
+lua_State *mib_async_done(struct oid_search_res *ret_oid, int *status);
+int mib_async_run(struct oid_search_res *ret_oid, lua_State *co, int nargs);
 struct mib_node *mib_tree_search(struct mib_view *view, const oid_t *oid, uint32_t id_len, struct oid_search_res *ret_oid);
 void mib_tree_search_next(struct mib_view *view, const oid_t *oid, uint32_t id_len, struct oid_search_res *ret_oid);
 
 int mib_node_reg(const oid_t *oid, uint32_t id_len, int callback);
+int mib_native_node_reg(const oid_t *oid, uint32_t id_len, mib_native_handler handler);
 void mib_node_unreg(const oid_t *oid, uint32_t id_len);
 void mib_community_reg(const oid_t *oid, uint32_t len, const char *community, MIB_ACES_ATTR_E attribute);
 void mib_community_unreg(const char *community, MIB_ACES_ATTR_E attribute);
@@ -154,6 +266,25 @@ struct mib_user *mib_user_search(const char *user);
 struct mib_view *mib_user_next_view(struct mib_user *u, MIB_ACES_ATTR_E attribute, struct mib_view *v);
 int mib_user_view_cover(struct mib_user *u, MIB_ACES_ATTR_E attribute, const oid_t *oid, uint32_t id_len);
 
+const struct mib_native_group *mib_native_group_search(const char *name);
+int mib_native_table_get(const struct mib_native_table *tab, const oid_t *inst_id, uint32_t inst_id_len, int *col, int *row);
+int mib_native_table_next(const struct mib_native_table *tab, oid_t *inst_id, uint32_t *inst_id_len, int *col, int *row);
+
 void mib_init(void);
 
+/* Native groups */
+int mib_if_init(void);
+int mib_if_handler(struct oid_search_res *ret_oid);
+int mib_ifx_handler(struct oid_search_res *ret_oid);
+int mib_tcp_init(void);
+int mib_tcp_handler(struct oid_search_res *ret_oid);
+int mib_udp_init(void);
+int mib_udp_handler(struct oid_search_res *ret_oid);
+int mib_snmp_init(void);
+int mib_snmp_handler(struct oid_search_res *ret_oid);
+int mib_mpd_stats_handler(struct oid_search_res *ret_oid);
+int mib_usm_stats_handler(struct oid_search_res *ret_oid);
+int mib_latency_init(void);
+int mib_latency_handler(struct oid_search_res *ret_oid);
+
 #endif /* _MIB_H_ */
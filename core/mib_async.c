@@ -0,0 +1,380 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "mib.h"
+#include "ev_loop.h"
+#include "util.h"
+
+/* Lua handlers run in coroutines. A handler yields (fd, timeout) to wait
+ * for fd to be readable or timeout ms to elapse, -1 for either means not
+ * to wait on it. It is resumed with true if fd is readable, false if not. */
+
+/* Coroutine for the next handler call, kept until some call parks in it */
+static lua_State *idle_co;
+static int idle_co_ref = LUA_NOREF;
+
+lua_State *
+mib_async_thread(void)
+{
+  lua_State *L = mib_lua_state;
+
+  /* Coroutines dead of errors cannot be reused */
+  if (idle_co != NULL && lua_status(idle_co) != 0) {
+    luaL_unref(L, LUA_REGISTRYINDEX, idle_co_ref);
+    idle_co = NULL;
+  }
+
+  if (idle_co == NULL) {
+    idle_co = lua_newthread(L);
+    idle_co_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  lua_settop(idle_co, 0);
+  return idle_co;
+}
+
+/* What the coroutine yields on, a bare yield waits for nothing but a turn */
+static void
+yield_args(lua_State *co, int *fd, int *timeout)
+{
+  *fd = lua_isnumber(co, 1) ? lua_tointeger(co, 1) : -1;
+  *timeout = lua_isnumber(co, 2) ? lua_tointeger(co, 2) : -1;
+  if (*fd < 0 && *timeout < 0) {
+    *timeout = 0;
+  }
+}
+
+/* Wait in place when the call cannot be parked, return 1 if fd is readable */
+static int
+mib_async_block(lua_State *co)
+{
+  struct pollfd pfd;
+  int fd, timeout;
+
+  yield_args(co, &fd, &timeout);
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return poll(&pfd, fd >= 0 ? 1 : 0, timeout) > 0;
+}
+
+/* Calls parked on fds, an fd has one callback in the event loop so it is
+ * waited on by one call at a time */
+static LIST_HEAD(fd_waiters);
+
+static void mib_async_wakeup(struct mib_async_call *call, int ready);
+
+static void
+mib_async_fd_handler(int fd, unsigned char flag, void *ud)
+{
+  mib_async_wakeup(ud, 1);
+}
+
+static void
+mib_async_timer_handler(void *ud)
+{
+  struct mib_async_call *call = ud;
+  /* One-shot timer is gone */
+  call->timer = -1;
+  mib_async_wakeup(call, 0);
+}
+
+/* Stop waiting on fd and timer */
+static void
+mib_async_unwait(struct mib_async_call *call)
+{
+  if (call->fd >= 0) {
+    snmp_event_remove(call->fd, SNMP_EV_READ);
+    list_del(&call->fd_link);
+    call->fd = -1;
+  }
+  if (call->timer >= 0) {
+    snmp_event_timer_remove(call->timer);
+    call->timer = -1;
+  }
+}
+
+/* Hook the yielded coroutine to the event loop, return -1 if out of slots
+ * or fd is waited on by another call */
+static int
+mib_async_park(struct mib_async_call *call)
+{
+  struct list_head *curr;
+  int fd, timeout;
+
+  yield_args(call->co, &fd, &timeout);
+
+  if (fd >= 0) {
+    list_for_each(curr, &fd_waiters) {
+      if (list_entry(curr, struct mib_async_call, fd_link)->fd == fd) {
+        return -1;
+      }
+    }
+    if (snmp_event_add(fd, SNMP_EV_READ, mib_async_fd_handler, call) < 0) {
+      return -1;
+    }
+    call->fd = fd;
+    list_add_tail(&call->fd_link, &fd_waiters);
+  }
+
+  if (timeout >= 0) {
+    call->timer = snmp_event_timer_add(timeout, 0, mib_async_timer_handler, call);
+    if (call->timer < 0) {
+      mib_async_unwait(call);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Resume the coroutine until it finishes or parks, return its status */
+static int
+mib_async_step(struct mib_async_call *call, lua_State *co, int status)
+{
+  while (status == LUA_YIELD) {
+    int ready;
+
+    if (call != NULL && mib_async_park(call) == 0) {
+      return LUA_YIELD;
+    }
+
+    ready = mib_async_block(co);
+    lua_settop(co, 0);
+    lua_pushboolean(co, ready);
+    status = lua_resume(co, 1);
+  }
+
+  return status;
+}
+
+static void
+mib_async_wakeup(struct mib_async_call *call, int ready)
+{
+  struct mib_async *async = call->async;
+  lua_State *co = call->co;
+
+  mib_async_unwait(call);
+
+  lua_settop(co, 0);
+  lua_pushboolean(co, ready);
+  call->status = mib_async_step(call, co, lua_resume(co, 1));
+  if (call->status == LUA_YIELD) {
+    return;
+  }
+
+  /* Request goes on and may be done with, leave the call alone. */
+  async->pending = NULL;
+  if (async->remote == 0) {
+    async->resume(async);
+  }
+}
+
+/* Run the handler pushed on co with nargs arguments. Return LUA_YIELD if it
+ * is parked in the request of ret_oid, otherwise the coroutine status and
+ * results are left on co. */
+int
+mib_async_run(struct oid_search_res *ret_oid, lua_State *co, int nargs)
+{
+  struct mib_async_call *call = NULL;
+  int status;
+
+  status = lua_resume(co, nargs);
+  if (status != LUA_YIELD) {
+    return status;
+  }
+
+  /* No event loop to resume it, nor request to replay */
+  if (ret_oid->async == NULL || !snmp_event_running()) {
+    return mib_async_step(NULL, co, status);
+  }
+
+  call = xmalloc(sizeof(*call));
+  call->async = ret_oid->async;
+  call->co = co;
+  call->co_ref = LUA_NOREF;
+  call->callback = ret_oid->callback;
+  call->request = ret_oid->request;
+  call->inst_id_len = ret_oid->inst_id_len;
+  oid_cpy(call->inst_id, ret_oid->inst_id, ret_oid->inst_id_len);
+  call->fd = -1;
+  call->timer = -1;
+  call->status = status;
+  call->native = NULL;
+  call->cancel = NULL;
+
+  if (mib_async_park(call) < 0) {
+    free(call);
+    return mib_async_step(NULL, co, status);
+  }
+
+  /* The call owns the coroutine from now on */
+  call->co_ref = idle_co_ref;
+  idle_co = NULL;
+  idle_co_ref = LUA_NOREF;
+
+  list_add_tail(&call->link, &ret_oid->async->calls);
+  ret_oid->async->pending = call;
+  return LUA_YIELD;
+}
+
+/* Finished call for the search of ret_oid, with status and results on the
+ * returned coroutine. NULL if the handler has not been called yet. */
+lua_State *
+mib_async_done(struct oid_search_res *ret_oid, int *status)
+{
+  struct list_head *curr;
+
+  if (ret_oid->async == NULL) {
+    return NULL;
+  }
+
+  list_for_each(curr, &ret_oid->async->calls) {
+    struct mib_async_call *call = list_entry(curr, struct mib_async_call, link);
+    if (call->status != LUA_YIELD && call->callback == ret_oid->callback && call->request == ret_oid->request &&
+        !oid_cmp(call->inst_id, call->inst_id_len, ret_oid->inst_id, ret_oid->inst_id_len)) {
+      *status = call->status;
+      return call->co;
+    }
+  }
+
+  return NULL;
+}
+
+/* Remote call for the search of ret_oid, made if not yet and then created
+ * is set. The request is parked until every remote call is answered. NULL
+ * if the request cannot be parked. */
+struct mib_async_call *
+mib_async_remote(struct oid_search_res *ret_oid, int *created)
+{
+  struct mib_async *async = ret_oid->async;
+  struct mib_async_call *call;
+  struct list_head *curr;
+  uint32_t id_len = ret_oid->inst_id - ret_oid->oid + ret_oid->inst_id_len;
+
+  *created = 0;
+  if (async == NULL || !snmp_event_running() || id_len > MIB_OID_MAX_LEN) {
+    return NULL;
+  }
+
+  list_for_each(curr, &async->calls) {
+    call = list_entry(curr, struct mib_async_call, link);
+    if (call->co == NULL && call->native == ret_oid->native && call->request == ret_oid->request &&
+        !oid_cmp(call->inst_id, call->inst_id_len, ret_oid->oid, id_len)) {
+      return call;
+    }
+  }
+
+  call = xmalloc(sizeof(*call));
+  call->async = async;
+  call->co = NULL;
+  call->co_ref = LUA_NOREF;
+  call->callback = LUA_NOREF;
+  call->request = ret_oid->request;
+  call->inst_id_len = id_len;
+  oid_cpy(call->inst_id, ret_oid->oid, id_len);
+  call->fd = -1;
+  call->timer = -1;
+  call->status = LUA_YIELD;
+  call->native = ret_oid->native;
+  call->err_stat = 0;
+  /* Value to write for set */
+  memcpy(&call->var, &ret_oid->var, sizeof(call->var));
+  call->ret_id_len = 0;
+  call->ud = NULL;
+  call->cancel = NULL;
+
+  list_add_tail(&call->link, &async->calls);
+  async->remote++;
+  *created = 1;
+  return call;
+}
+
+/* Answer of the remote call is filled in, replay the request if it waits
+ * for nothing else */
+void
+mib_async_answer(struct mib_async_call *call)
+{
+  struct mib_async *async = call->async;
+
+  call->status = 0;
+  call->ud = NULL;
+  call->cancel = NULL;
+  if (--async->remote == 0 && async->pending == NULL) {
+    async->resume(async);
+  }
+}
+
+void
+mib_async_init(struct mib_async *async, void (*resume)(struct mib_async *async))
+{
+  INIT_LIST_HEAD(&async->calls);
+  async->pending = NULL;
+  async->remote = 0;
+  async->prefetch = 0;
+  async->resume = resume;
+}
+
+static void
+mib_async_call_free(struct mib_async_call *call)
+{
+  mib_async_unwait(call);
+  luaL_unref(mib_lua_state, LUA_REGISTRYINDEX, call->co_ref);
+  if (call->co == NULL && call->status == LUA_YIELD && call->cancel != NULL) {
+    call->cancel(call);
+  }
+  list_del(&call->link);
+  free(call);
+}
+
+/* Drop Lua calls once a varbind is answered. Remote calls are kept, they may
+ * answer the varbinds after. */
+void
+mib_async_reset(struct mib_async *async)
+{
+  struct list_head *curr, *next;
+
+  list_for_each_safe(curr, next, &async->calls) {
+    struct mib_async_call *call = list_entry(curr, struct mib_async_call, link);
+    if (call->co != NULL) {
+      mib_async_call_free(call);
+    }
+  }
+  async->pending = NULL;
+}
+
+/* Drop all calls when the request is done with */
+void
+mib_async_free(struct mib_async *async)
+{
+  struct list_head *curr, *next;
+
+  list_for_each_safe(curr, next, &async->calls) {
+    mib_async_call_free(list_entry(curr, struct mib_async_call, link));
+  }
+  async->pending = NULL;
+  async->remote = 0;
+  async->prefetch = 0;
+}
@@ -0,0 +1,965 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* TCP and UDP groups (RFC 1213 and RFC 4022/4113 tables) served from
+ * snapshots of /proc/net/{tcp,tcp6,udp,udp6}. A snapshot is parsed, sorted
+ * and indexed on a timer, then swapped in whole, so requests only look rows
+ * up and a walk steps from row to row through a cursor. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mib.h"
+#include "snmp.h"
+#include "ev_loop.h"
+#include "util.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/* Interval of snapshot rebuild in milliseconds */
+#define INET_SNAPSHOT_REFRESH  3000
+/* Rebuild on request when the refresh timer has fallen behind */
+#define INET_SNAPSHOT_STALE    (2 * INET_SNAPSHOT_REFRESH)
+#define INET_READ_BUF_SIZ      (128 * 1024)
+#define INET_SCALAR_MAX        32
+#define INET_VIEW_MAX          3
+
+/* InetAddressType */
+#define INET_ADDR_IPV4         1
+#define INET_ADDR_IPV6         2
+
+/* TCP_LISTEN in /proc/net/tcp */
+#define PROC_TCP_LISTEN        0x0A
+
+struct inet_conn {
+  /* InetAddressType */
+  uint8_t type;
+  /* kernel socket state */
+  uint8_t state;
+  uint16_t lport;
+  uint16_t rport;
+  /* distinguishes endpoints with the same addresses and ports */
+  uint16_t instance;
+  uint8_t laddr[16];
+  uint8_t raddr[16];
+};
+
+/* Rows of one conceptual table, as positions in the sorted connections */
+struct inet_view {
+  int *rows;
+  int cnt;
+};
+
+struct inet_snapshot {
+  uint32_t gen;
+  uint64_t built;
+  /* all sockets sorted by (type, laddr, lport, raddr, rport) */
+  struct inet_conn *conns;
+  int cnt;
+  int cap;
+  struct inet_view views[INET_VIEW_MAX];
+  /* counters of the protocol line in /proc/net/snmp */
+  long long scalars[INET_SCALAR_MAX];
+  int scalar_cnt;
+};
+
+struct inet_proto {
+  /* name of line in /proc/net/snmp */
+  const char *name;
+  const char *ipv4_path;
+  const char *ipv6_path;
+  void (*views_build)(struct inet_snapshot *snap);
+  struct inet_snapshot *cur;
+  uint32_t gen;
+  int inited;
+};
+
+static char inet_read_buf[INET_READ_BUF_SIZ];
+
+static void
+inet_snapshot_free(struct inet_snapshot *snap)
+{
+  int i;
+
+  for (i = 0; i < INET_VIEW_MAX; i++) {
+    free(snap->views[i].rows);
+  }
+  free(snap->conns);
+  free(snap);
+}
+
+static const char *
+hex_parse(const char *p, const char *end, int digits, uint32_t *val)
+{
+  uint32_t v = 0;
+  int i;
+
+  if (end - p < digits) {
+    return NULL;
+  }
+
+  for (i = 0; i < digits; i++, p++) {
+    if (*p >= '0' && *p <= '9') {
+      v = (v << 4) | (*p - '0');
+    } else if (*p >= 'A' && *p <= 'F') {
+      v = (v << 4) | (*p - 'A' + 10);
+    } else if (*p >= 'a' && *p <= 'f') {
+      v = (v << 4) | (*p - 'a' + 10);
+    } else {
+      return NULL;
+    }
+  }
+
+  *val = v;
+  return p;
+}
+
+/* Address words are printed in host order, copying them back as they are
+ * restores the network byte sequence. */
+static const char *
+addr_parse(const char *p, const char *end, uint8_t type, uint8_t *addr, uint16_t *port)
+{
+  uint32_t w;
+  int i, words = type == INET_ADDR_IPV4 ? 1 : 4;
+
+  for (i = 0; i < words; i++) {
+    p = hex_parse(p, end, 8, &w);
+    if (p == NULL) {
+      return NULL;
+    }
+    memcpy(addr + i * 4, &w, 4);
+  }
+
+  if (p == end || *p++ != ':') {
+    return NULL;
+  }
+  p = hex_parse(p, end, 4, &w);
+  if (p == NULL) {
+    return NULL;
+  }
+  *port = w;
+  return p;
+}
+
+static const char *
+space_skip(const char *p, const char *end)
+{
+  while (p < end && *p == ' ') {
+    p++;
+  }
+  return p;
+}
+
+/* "  sl: local:port remote:port st ..." */
+static int
+inet_line_parse(const char *p, const char *end, uint8_t type, struct inet_conn *conn)
+{
+  uint32_t st;
+
+  p = memchr(p, ':', end - p);
+  if (p == NULL) {
+    return -1;
+  }
+  p = space_skip(p + 1, end);
+  p = addr_parse(p, end, type, conn->laddr, &conn->lport);
+  if (p == NULL) {
+    return -1;
+  }
+  p = space_skip(p, end);
+  p = addr_parse(p, end, type, conn->raddr, &conn->rport);
+  if (p == NULL) {
+    return -1;
+  }
+  p = space_skip(p, end);
+  if (hex_parse(p, end, 2, &st) == NULL) {
+    return -1;
+  }
+
+  conn->type = type;
+  conn->state = st;
+  conn->instance = 1;
+  return 0;
+}
+
+static struct inet_conn *
+inet_conn_new(struct inet_snapshot *snap)
+{
+  if (snap->cnt == snap->cap) {
+    snap->cap = alloc_nr(snap->cap);
+    snap->conns = xrealloc(snap->conns, snap->cap * sizeof(*snap->conns));
+  }
+  return &snap->conns[snap->cnt];
+}
+
+/* Stream the socket table in big chunks, one line at a time. */
+static void
+inet_proc_read(struct inet_snapshot *snap, const char *path, uint8_t type)
+{
+  int fd, len = 0, header = 1;
+  ssize_t n;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    /* No IPv6 support or no such protocol */
+    return;
+  }
+
+  for (; ;) {
+    char *line, *nl, *end;
+
+    n = read(fd, inet_read_buf + len, sizeof(inet_read_buf) - len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    len += n;
+    end = inet_read_buf + len;
+
+    for (line = inet_read_buf; (nl = memchr(line, '\n', end - line)) != NULL; line = nl + 1) {
+      if (header) {
+        header = 0;
+        continue;
+      }
+      if (!inet_line_parse(line, nl, type, inet_conn_new(snap))) {
+        snap->cnt++;
+      }
+    }
+
+    /* Keep the partial line for the next chunk */
+    len = end - line;
+    if (len == sizeof(inet_read_buf)) {
+      len = 0;
+    }
+    memmove(inet_read_buf, line, len);
+  }
+
+  close(fd);
+}
+
+/* The second line for the protocol in /proc/net/snmp carries values */
+static void
+inet_scalars_read(struct inet_snapshot *snap, const char *name)
+{
+  char line[1024];
+  size_t name_len = strlen(name);
+  int header = 1;
+  FILE *fp;
+
+  fp = fopen("/proc/net/snmp", "r");
+  if (fp == NULL) {
+    return;
+  }
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char *p, *q;
+    if (strncmp(line, name, name_len) || line[name_len] != ':') {
+      continue;
+    }
+    if (header) {
+      header = 0;
+      continue;
+    }
+    p = line + name_len + 1;
+    while (snap->scalar_cnt < INET_SCALAR_MAX) {
+      long long v = strtoll(p, &q, 10);
+      if (q == p) {
+        break;
+      }
+      snap->scalars[snap->scalar_cnt++] = v;
+      p = q;
+    }
+    break;
+  }
+
+  fclose(fp);
+}
+
+static int
+inet_conn_cmp(const void *a, const void *b)
+{
+  const struct inet_conn *c1 = a;
+  const struct inet_conn *c2 = b;
+  int len, ret;
+
+  if (c1->type != c2->type) {
+    return c1->type - c2->type;
+  }
+  len = c1->type == INET_ADDR_IPV4 ? 4 : 16;
+  ret = memcmp(c1->laddr, c2->laddr, len);
+  if (ret) {
+    return ret;
+  }
+  if (c1->lport != c2->lport) {
+    return c1->lport - c2->lport;
+  }
+  ret = memcmp(c1->raddr, c2->raddr, len);
+  if (ret) {
+    return ret;
+  }
+  return c1->rport - c2->rport;
+}
+
+static int
+inet_local_cmp(const struct inet_conn *c1, const struct inet_conn *c2)
+{
+  int len, ret;
+
+  if (c1->type != c2->type) {
+    return c1->type - c2->type;
+  }
+  len = c1->type == INET_ADDR_IPV4 ? 4 : 16;
+  ret = memcmp(c1->laddr, c2->laddr, len);
+  if (ret) {
+    return ret;
+  }
+  return c1->lport - c2->lport;
+}
+
+static void
+inet_view_add(struct inet_view *view, int row)
+{
+  view->rows[view->cnt++] = row;
+}
+
+static struct inet_snapshot *
+inet_snapshot_build(struct inet_proto *proto)
+{
+  struct inet_snapshot *snap;
+  int i;
+
+  snap = xcalloc(1, sizeof(*snap));
+
+  inet_scalars_read(snap, proto->name);
+  inet_proc_read(snap, proto->ipv4_path, INET_ADDR_IPV4);
+  inet_proc_read(snap, proto->ipv6_path, INET_ADDR_IPV6);
+
+  qsort(snap->conns, snap->cnt, sizeof(*snap->conns), inet_conn_cmp);
+
+  for (i = 0; i < INET_VIEW_MAX; i++) {
+    snap->views[i].rows = xmalloc((snap->cnt + 1) * sizeof(int));
+  }
+  proto->views_build(snap);
+
+  snap->gen = ++proto->gen;
+  snap->built = snmp_event_time();
+  return snap;
+}
+
+/* Searches look the snapshot up and are done with it before returning, and
+ * walks go on through cursors checked against the generation, so nothing
+ * points into the old snapshot when it is replaced. */
+static void
+inet_snapshot_refresh(struct inet_proto *proto)
+{
+  struct inet_snapshot *old = proto->cur;
+
+  proto->cur = inet_snapshot_build(proto);
+  if (old != NULL) {
+    inet_snapshot_free(old);
+  }
+}
+
+/* Without the built-in event loop (libevent, uloop) the refresh timer
+ * never fires, the snapshot is rebuilt on access once it is due. */
+static struct inet_snapshot *
+inet_snapshot_sync(struct inet_proto *proto)
+{
+  uint64_t age = snmp_event_time() - proto->cur->built;
+
+  if (age >= (snmp_event_running() ? INET_SNAPSHOT_STALE : INET_SNAPSHOT_REFRESH)) {
+    inet_snapshot_refresh(proto);
+  }
+  return proto->cur;
+}
+
+static void
+inet_timer_handler(void *ud)
+{
+  inet_snapshot_refresh(ud);
+}
+
+static int
+inet_proto_init(struct inet_proto *proto)
+{
+  if (proto->inited) {
+    return 0;
+  }
+
+  if (access(proto->ipv4_path, R_OK) < 0) {
+    SMARTSNMP_LOG(L_ERROR, "Cannot read %s: %s\n", proto->ipv4_path, strerror(errno));
+    return -1;
+  }
+
+  inet_snapshot_refresh(proto);
+  snmp_event_timer_add(INET_SNAPSHOT_REFRESH, INET_SNAPSHOT_REFRESH, inet_timer_handler, proto);
+
+  proto->inited = 1;
+  return 0;
+}
+
+static uint32_t
+inet_addr_index(oid_t *idx, uint8_t type, const uint8_t *addr)
+{
+  uint32_t i, len = type == INET_ADDR_IPV4 ? 4 : 16;
+
+  idx[0] = type;
+  idx[1] = len;
+  for (i = 0; i < len; i++) {
+    idx[2 + i] = addr[i];
+  }
+  return 2 + len;
+}
+
+static uint32_t
+inet_ipv4_index(oid_t *idx, const uint8_t *addr)
+{
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    idx[i] = addr[i];
+  }
+  return 4;
+}
+
+static void
+var_set_uint(Variable *var, uint8_t type, uint32_t val)
+{
+  tag(var) = type;
+  length(var) = 1;
+  count(var) = val;
+}
+
+static void
+var_set_ipaddr(Variable *var, const uint8_t *addr)
+{
+  tag(var) = ASN1_TAG_IPADDR;
+  length(var) = 4;
+  memcpy(ipaddr(var), addr, 4);
+}
+
+/* Conceptual table over one view of a snapshot */
+struct inet_table {
+  oid_t id;
+  const oid_t *cols;
+  int col_cnt;
+  int view;
+  uint32_t (*row_index)(void *ud, int row, oid_t *idx);
+  void (*entry_value)(const struct inet_conn *conn, oid_t col, Variable *var);
+  struct mib_native_cursor *cursor;
+};
+
+/* Scalar or table directly under the group */
+struct inet_object {
+  oid_t id;
+  /* scalar syntax and position in /proc/net/snmp line */
+  uint8_t tag;
+  int field;
+  /* NULL for scalar */
+  const struct inet_table *table;
+};
+
+#define INET_SCALAR(id, tag, field)  { id, tag, field, NULL }
+#define INET_TABLE(table)            { (table).id, 0, -1, &(table) }
+
+static void
+inet_scalar_value(const struct inet_snapshot *snap, const struct inet_object *obj, Variable *var)
+{
+  long long v = obj->field < snap->scalar_cnt ? snap->scalars[obj->field] : 0;
+
+  if (obj->tag == ASN1_TAG_CNT64) {
+    tag(var) = ASN1_TAG_CNT64;
+    length(var) = 1;
+    count64(var) = v;
+  } else if (obj->tag == ASN1_TAG_INT) {
+    tag(var) = ASN1_TAG_INT;
+    length(var) = 1;
+    integer(var) = v;
+  } else {
+    var_set_uint(var, obj->tag, v);
+  }
+}
+
+static struct mib_native_table *
+inet_table_init(struct mib_native_table *tab, struct inet_snapshot *snap, const struct inet_table *t)
+{
+  tab->cols = t->cols;
+  tab->col_cnt = t->col_cnt;
+  tab->row_cnt = snap->views[t->view].cnt;
+  tab->row_index = t->row_index;
+  tab->ud = snap;
+  tab->gen = snap->gen;
+  tab->cursor = t->cursor;
+  return tab;
+}
+
+static const struct inet_conn *
+inet_table_row(struct inet_snapshot *snap, const struct inet_table *t, int row)
+{
+  return &snap->conns[snap->views[t->view].rows[row]];
+}
+
+/* Dispatch a request over the sorted objects of a group */
+static int
+inet_group_search(struct inet_proto *proto, const struct inet_object *objs, int obj_cnt, struct oid_search_res *ret_oid)
+{
+  struct inet_snapshot *snap = inet_snapshot_sync(proto);
+  struct mib_native_table tab;
+  Variable *var = &ret_oid->var;
+  oid_t *inst_id = ret_oid->inst_id;
+  uint32_t sub_len;
+  int i, col, row, ret;
+
+  switch (ret_oid->request) {
+    case MIB_REQ_GET:
+      for (i = 0; i < obj_cnt; i++) {
+        const struct inet_object *obj = &objs[i];
+        if (ret_oid->inst_id_len == 0 || inst_id[0] != obj->id) {
+          continue;
+        }
+        if (obj->table == NULL) {
+          if (ret_oid->inst_id_len == 2 && inst_id[1] == 0) {
+            inet_scalar_value(snap, obj, var);
+          } else {
+            tag(var) = ASN1_TAG_NO_SUCH_INST;
+          }
+          return 0;
+        }
+        if (ret_oid->inst_id_len < 3 || inst_id[1] != 1) {
+          break;
+        }
+        inet_table_init(&tab, snap, obj->table);
+        ret = mib_native_table_get(&tab, inst_id + 2, ret_oid->inst_id_len - 2, &col, &row);
+        if (ret) {
+          tag(var) = ret;
+        } else {
+          obj->table->entry_value(inet_table_row(snap, obj->table, row), obj->table->cols[col], var);
+        }
+        return 0;
+      }
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+
+    case MIB_REQ_GETNEXT:
+      for (i = 0; i < obj_cnt; i++) {
+        const struct inet_object *obj = &objs[i];
+        oid_t head[2] = { obj->id, obj->table == NULL ? 0 : 1 };
+
+        if (obj->table == NULL) {
+          if (oid_cmp(inst_id, ret_oid->inst_id_len, head, 2) < 0) {
+            oid_cpy(inst_id, head, 2);
+            ret_oid->inst_id_len = 2;
+            inet_scalar_value(snap, obj, var);
+            return 0;
+          }
+          continue;
+        }
+
+        if (oid_cmp(inst_id, ret_oid->inst_id_len, head, 2) < 0) {
+          /* Ahead of the table, fetch its first instance */
+          oid_cpy(inst_id, head, 2);
+          ret_oid->inst_id_len = 2;
+        } else if (ret_oid->inst_id_len < 2 || oid_cmp(inst_id, 2, head, 2)) {
+          continue;
+        }
+
+        sub_len = ret_oid->inst_id_len - 2;
+        inet_table_init(&tab, snap, obj->table);
+        if (mib_native_table_next(&tab, inst_id + 2, &sub_len, &col, &row) == 0) {
+          ret_oid->inst_id_len = 2 + sub_len;
+          obj->table->entry_value(inet_table_row(snap, obj->table, row), obj->table->cols[col], var);
+          return 0;
+        }
+        /* End of table, go on with the next object */
+        oid_cpy(inst_id, head, 2);
+        inst_id[1]++;
+        ret_oid->inst_id_len = 2;
+      }
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+
+    default:
+      return SNMP_ERR_STAT_NOT_WRITABLE;
+  }
+}
+
+/*
+ * TCP group
+ */
+
+#define TCP_VIEW_CONN        0
+#define TCP_VIEW_CONNECTION  1
+#define TCP_VIEW_LISTENER    2
+
+/* Kernel socket state to tcpConnState */
+static const uint8_t tcp_conn_stat_map[] = {
+  12, /* unknown */
+  5,  /* ESTABLISHED */
+  3,  /* SYN_SENT */
+  4,  /* SYN_RECV */
+  6,  /* FIN_WAIT1 */
+  7,  /* FIN_WAIT2 */
+  11, /* TIME_WAIT */
+  1,  /* CLOSE */
+  8,  /* CLOSE_WAIT */
+  9,  /* LAST_ACK */
+  2,  /* LISTEN */
+  10, /* CLOSING */
+};
+
+static uint8_t
+tcp_conn_stat(const struct inet_conn *conn)
+{
+  return conn->state < elem_num(tcp_conn_stat_map) ? tcp_conn_stat_map[conn->state] : tcp_conn_stat_map[0];
+}
+
+/* tcpConnTable is IPv4 only, the RFC 4022 tables split listeners from
+ * connections. Duplicated indexes (e.g. SO_REUSEPORT) show up once. */
+static void
+tcp_views_build(struct inet_snapshot *snap)
+{
+  struct inet_view *conn = &snap->views[TCP_VIEW_CONN];
+  struct inet_view *connection = &snap->views[TCP_VIEW_CONNECTION];
+  struct inet_view *listener = &snap->views[TCP_VIEW_LISTENER];
+  int i;
+
+  for (i = 0; i < snap->cnt; i++) {
+    const struct inet_conn *c = &snap->conns[i];
+    if (c->type == INET_ADDR_IPV4) {
+      if (conn->cnt == 0 || inet_conn_cmp(&snap->conns[conn->rows[conn->cnt - 1]], c)) {
+        inet_view_add(conn, i);
+      }
+    }
+    if (c->state == PROC_TCP_LISTEN) {
+      if (listener->cnt == 0 || inet_local_cmp(&snap->conns[listener->rows[listener->cnt - 1]], c)) {
+        inet_view_add(listener, i);
+      }
+    } else {
+      if (connection->cnt == 0 || inet_conn_cmp(&snap->conns[connection->rows[connection->cnt - 1]], c)) {
+        inet_view_add(connection, i);
+      }
+    }
+  }
+}
+
+static uint32_t
+tcp_conn_row_index(void *ud, int row, oid_t *idx)
+{
+  struct inet_snapshot *snap = ud;
+  const struct inet_conn *c = &snap->conns[snap->views[TCP_VIEW_CONN].rows[row]];
+  uint32_t len = 0;
+
+  len += inet_ipv4_index(idx + len, c->laddr);
+  idx[len++] = c->lport;
+  len += inet_ipv4_index(idx + len, c->raddr);
+  idx[len++] = c->rport;
+  return len;
+}
+
+static uint32_t
+tcp_connection_row_index(void *ud, int row, oid_t *idx)
+{
+  struct inet_snapshot *snap = ud;
+  const struct inet_conn *c = &snap->conns[snap->views[TCP_VIEW_CONNECTION].rows[row]];
+  uint32_t len = 0;
+
+  len += inet_addr_index(idx + len, c->type, c->laddr);
+  idx[len++] = c->lport;
+  len += inet_addr_index(idx + len, c->type, c->raddr);
+  idx[len++] = c->rport;
+  return len;
+}
+
+static uint32_t
+tcp_listener_row_index(void *ud, int row, oid_t *idx)
+{
+  struct inet_snapshot *snap = ud;
+  const struct inet_conn *c = &snap->conns[snap->views[TCP_VIEW_LISTENER].rows[row]];
+  uint32_t len = 0;
+
+  len += inet_addr_index(idx + len, c->type, c->laddr);
+  idx[len++] = c->lport;
+  return len;
+}
+
+static void
+tcp_conn_entry_value(const struct inet_conn *conn, oid_t col, Variable *var)
+{
+  switch (col) {
+    case 1:
+      var_set_uint(var, ASN1_TAG_INT, tcp_conn_stat(conn));
+      break;
+    case 2:
+      var_set_ipaddr(var, conn->laddr);
+      break;
+    case 3:
+      var_set_uint(var, ASN1_TAG_INT, conn->lport);
+      break;
+    case 4:
+      var_set_ipaddr(var, conn->raddr);
+      break;
+    case 5:
+      var_set_uint(var, ASN1_TAG_INT, conn->rport);
+      break;
+    default:
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      break;
+  }
+}
+
+/* Owning process is unknown without scanning /proc/<pid>/fd, report 0. */
+static void
+tcp_connection_entry_value(const struct inet_conn *conn, oid_t col, Variable *var)
+{
+  switch (col) {
+    case 7:
+      var_set_uint(var, ASN1_TAG_INT, tcp_conn_stat(conn));
+      break;
+    case 8:
+      var_set_uint(var, ASN1_TAG_GAU, 0);
+      break;
+    default:
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      break;
+  }
+}
+
+static void
+inet_process_value(const struct inet_conn *conn, oid_t col, Variable *var)
+{
+  var_set_uint(var, ASN1_TAG_GAU, 0);
+}
+
+static const oid_t tcp_conn_cols[] = { 1, 2, 3, 4, 5 };
+static const oid_t tcp_connection_cols[] = { 7, 8 };
+static const oid_t tcp_listener_cols[] = { 4 };
+
+static struct mib_native_cursor tcp_cursors[INET_VIEW_MAX];
+
+static const struct inet_table tcp_conn_table = {
+  13, tcp_conn_cols, elem_num(tcp_conn_cols), TCP_VIEW_CONN,
+  tcp_conn_row_index, tcp_conn_entry_value, &tcp_cursors[TCP_VIEW_CONN]
+};
+
+static const struct inet_table tcp_connection_table = {
+  19, tcp_connection_cols, elem_num(tcp_connection_cols), TCP_VIEW_CONNECTION,
+  tcp_connection_row_index, tcp_connection_entry_value, &tcp_cursors[TCP_VIEW_CONNECTION]
+};
+
+static const struct inet_table tcp_listener_table = {
+  20, tcp_listener_cols, elem_num(tcp_listener_cols), TCP_VIEW_LISTENER,
+  tcp_listener_row_index, inet_process_value, &tcp_cursors[TCP_VIEW_LISTENER]
+};
+
+/* Fields of the Tcp line in /proc/net/snmp:
+ * RtoAlgorithm RtoMin RtoMax MaxConn ActiveOpens PassiveOpens AttemptFails
+ * EstabResets CurrEstab InSegs OutSegs RetransSegs InErrs OutRsts ... */
+static const struct inet_object tcp_objects[] = {
+  INET_SCALAR(1, ASN1_TAG_INT, 0),
+  INET_SCALAR(2, ASN1_TAG_INT, 1),
+  INET_SCALAR(3, ASN1_TAG_INT, 2),
+  INET_SCALAR(4, ASN1_TAG_INT, 3),
+  INET_SCALAR(5, ASN1_TAG_CNT, 4),
+  INET_SCALAR(6, ASN1_TAG_CNT, 5),
+  INET_SCALAR(7, ASN1_TAG_CNT, 6),
+  INET_SCALAR(8, ASN1_TAG_CNT, 7),
+  INET_SCALAR(9, ASN1_TAG_GAU, 8),
+  INET_SCALAR(10, ASN1_TAG_CNT, 9),
+  INET_SCALAR(11, ASN1_TAG_CNT, 10),
+  INET_SCALAR(12, ASN1_TAG_CNT, 11),
+  INET_TABLE(tcp_conn_table),
+  INET_SCALAR(14, ASN1_TAG_CNT, 12),
+  INET_SCALAR(15, ASN1_TAG_CNT, 13),
+  INET_SCALAR(17, ASN1_TAG_CNT64, 9),
+  INET_SCALAR(18, ASN1_TAG_CNT64, 10),
+  INET_TABLE(tcp_connection_table),
+  INET_TABLE(tcp_listener_table),
+};
+
+static struct inet_proto tcp_proto = {
+  "Tcp", "/proc/net/tcp", "/proc/net/tcp6", tcp_views_build
+};
+
+int
+mib_tcp_init(void)
+{
+  return inet_proto_init(&tcp_proto);
+}
+
+int
+mib_tcp_handler(struct oid_search_res *ret_oid)
+{
+  return inet_group_search(&tcp_proto, tcp_objects, elem_num(tcp_objects), ret_oid);
+}
+
+/*
+ * UDP group
+ */
+
+#define UDP_VIEW_TABLE     0
+#define UDP_VIEW_ENDPOINT  1
+
+/* udpTable is IPv4 only and indexed by local address, udpEndpointTable
+ * numbers endpoints sharing addresses and ports by udpEndpointInstance. */
+static void
+udp_views_build(struct inet_snapshot *snap)
+{
+  struct inet_view *table = &snap->views[UDP_VIEW_TABLE];
+  struct inet_view *endpoint = &snap->views[UDP_VIEW_ENDPOINT];
+  int i;
+
+  for (i = 0; i < snap->cnt; i++) {
+    struct inet_conn *c = &snap->conns[i];
+    if (c->type == INET_ADDR_IPV4) {
+      if (table->cnt == 0 || inet_local_cmp(&snap->conns[table->rows[table->cnt - 1]], c)) {
+        inet_view_add(table, i);
+      }
+    }
+    if (i > 0 && !inet_conn_cmp(&snap->conns[i - 1], c)) {
+      c->instance = snap->conns[i - 1].instance + 1;
+    }
+    inet_view_add(endpoint, i);
+  }
+}
+
+static uint32_t
+udp_row_index(void *ud, int row, oid_t *idx)
+{
+  struct inet_snapshot *snap = ud;
+  const struct inet_conn *c = &snap->conns[snap->views[UDP_VIEW_TABLE].rows[row]];
+  uint32_t len = 0;
+
+  len += inet_ipv4_index(idx + len, c->laddr);
+  idx[len++] = c->lport;
+  return len;
+}
+
+static uint32_t
+udp_endpoint_row_index(void *ud, int row, oid_t *idx)
+{
+  struct inet_snapshot *snap = ud;
+  const struct inet_conn *c = &snap->conns[snap->views[UDP_VIEW_ENDPOINT].rows[row]];
+  uint32_t len = 0;
+
+  len += inet_addr_index(idx + len, c->type, c->laddr);
+  idx[len++] = c->lport;
+  len += inet_addr_index(idx + len, c->type, c->raddr);
+  idx[len++] = c->rport;
+  idx[len++] = c->instance;
+  return len;
+}
+
+static void
+udp_entry_value(const struct inet_conn *conn, oid_t col, Variable *var)
+{
+  switch (col) {
+    case 1:
+      var_set_ipaddr(var, conn->laddr);
+      break;
+    case 2:
+      var_set_uint(var, ASN1_TAG_INT, conn->lport);
+      break;
+    default:
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      break;
+  }
+}
+
+static const oid_t udp_cols[] = { 1, 2 };
+static const oid_t udp_endpoint_cols[] = { 8 };
+
+static struct mib_native_cursor udp_cursors[INET_VIEW_MAX];
+
+static const struct inet_table udp_table = {
+  5, udp_cols, elem_num(udp_cols), UDP_VIEW_TABLE,
+  udp_row_index, udp_entry_value, &udp_cursors[UDP_VIEW_TABLE]
+};
+
+static const struct inet_table udp_endpoint_table = {
+  7, udp_endpoint_cols, elem_num(udp_endpoint_cols), UDP_VIEW_ENDPOINT,
+  udp_endpoint_row_index, inet_process_value, &udp_cursors[UDP_VIEW_ENDPOINT]
+};
+
+/* Fields of the Udp line in /proc/net/snmp:
+ * InDatagrams NoPorts InErrors OutDatagrams ... */
+static const struct inet_object udp_objects[] = {
+  INET_SCALAR(1, ASN1_TAG_CNT, 0),
+  INET_SCALAR(2, ASN1_TAG_CNT, 1),
+  INET_SCALAR(3, ASN1_TAG_CNT, 2),
+  INET_SCALAR(4, ASN1_TAG_CNT, 3),
+  INET_TABLE(udp_table),
+  INET_TABLE(udp_endpoint_table),
+  INET_SCALAR(8, ASN1_TAG_CNT64, 0),
+  INET_SCALAR(9, ASN1_TAG_CNT64, 3),
+};
+
+static struct inet_proto udp_proto = {
+  "Udp", "/proc/net/udp", "/proc/net/udp6", udp_views_build
+};
+
+int
+mib_udp_init(void)
+{
+  return inet_proto_init(&udp_proto);
+}
+
+int
+mib_udp_handler(struct oid_search_res *ret_oid)
+{
+  return inet_group_search(&udp_proto, udp_objects, elem_num(udp_objects), ret_oid);
+}
+
+#else /* !__linux__ */
+
+int
+mib_tcp_init(void)
+{
+  SMARTSNMP_LOG(L_WARNING, "Native tcp group needs procfs, not supported on this platform\n");
+  return -1;
+}
+
+int
+mib_tcp_handler(struct oid_search_res *ret_oid)
+{
+  tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+  return 0;
+}
+
+int
+mib_udp_init(void)
+{
+  SMARTSNMP_LOG(L_WARNING, "Native udp group needs procfs, not supported on this platform\n");
+  return -1;
+}
+
+int
+mib_udp_handler(struct oid_search_res *ret_oid)
+{
+  tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+  return 0;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,1190 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Interfaces group (RFC 2863 ifTable) and IF-MIB ifXTable, served from a row
+ * cache kept up to date by rtnetlink link events. Counters are refreshed by a
+ * full link dump on a timer, so walks never touch the kernel per request.
+ * Dump replies and acks of ifAdminStatus sets are read by the event loop, the
+ * set request is parked until its ack is in. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "mib.h"
+#include "snmp.h"
+#include "ev_loop.h"
+#include "util.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+
+/* Interval of counter refresh in milliseconds */
+#define IF_CACHE_REFRESH     3000
+/* Time given to the kernel to answer a dump or a set, in milliseconds */
+#define IF_REQ_TIMEOUT       1000
+#define IF_CACHE_BUF_SIZ     (65536)
+#define IF_CACHE_RCVBUF_SIZ  (1024 * 1024)
+#define IF_PHY_ADDR_MAX_LEN  32
+#define IF_ALIAS_MAX_LEN     64
+#define IF_KIND_MAX_LEN      16
+
+/* IANAifType */
+#define IF_TYPE_OTHER        1
+#define IF_TYPE_ETHERNET     6
+#define IF_TYPE_WIRELESS     71
+#define IF_TYPE_PPP          23
+#define IF_TYPE_LOOPBACK     24
+#define IF_TYPE_TUNNEL       131
+#define IF_TYPE_L2VLAN       135
+#define IF_TYPE_INFINIBAND   199
+#define IF_TYPE_BRIDGE       209
+
+/* IFLA_OPERSTATE values, linux/if.h cannot be mixed with net/if.h */
+#define OPER_UNKNOWN         0
+#define OPER_NOTPRESENT      1
+#define OPER_DOWN            2
+#define OPER_LOWERLAYERDOWN  3
+#define OPER_TESTING         4
+#define OPER_DORMANT         5
+#define OPER_UP              6
+
+/* ifAdminStatus and ifOperStatus */
+#define IF_STAT_UP           1
+#define IF_STAT_DOWN         2
+#define IF_STAT_TESTING      3
+#define IF_STAT_UNKNOWN      4
+#define IF_STAT_DORMANT      5
+#define IF_STAT_NOT_PRESENT  6
+#define IF_STAT_LOWER_DOWN   7
+
+struct if_entry {
+  uint32_t index;
+  uint32_t type;
+  uint32_t mtu;
+  uint32_t flags;
+  uint32_t txqlen;
+  uint32_t gen;
+  uint8_t oper_stat;
+  uint8_t phy_addr_len;
+  uint8_t phy_addr[IF_PHY_ADDR_MAX_LEN];
+  char name[IFNAMSIZ];
+  char alias[IF_ALIAS_MAX_LEN + 1];
+  /* bits per second, 0 if unknown */
+  uint64_t speed;
+  /* timeticks of the last oper status change */
+  uint32_t last_change;
+  /* timeticks of the row creation */
+  uint32_t discontinuity;
+  struct rtnl_link_stats64 stats;
+};
+
+/* ifAdminStatus set waiting for its ack */
+struct if_admin_req {
+  struct list_head link;
+  uint32_t seq;
+  uint64_t expire;
+  /* NULL once the request is done with */
+  struct mib_async_call *call;
+};
+
+struct if_cache {
+  int inited;
+  /* socket subscribed to link events */
+  int ev_sock;
+  /* socket for dumps and requests */
+  int req_sock;
+  uint32_t seq;
+  /* sequence of the dump in progress, 0 for none */
+  uint32_t dump_seq;
+  /* sequence of the set waited on in place, 0 for none, and its error */
+  uint32_t wait_seq;
+  int wait_error;
+  /* sets parked for their acks */
+  struct list_head admin_reqs;
+  /* generation of the latest dump for mark-and-sweep */
+  uint32_t gen;
+  /* events were lost, a dump is needed */
+  int resync;
+  uint64_t start;
+  uint64_t refreshed;
+  /* timeticks of the last row creation or deletion */
+  uint32_t table_last_change;
+  /* rows sorted by ifIndex */
+  struct if_entry **rows;
+  int cnt;
+  int cap;
+};
+
+static struct if_cache if_cache;
+static uint8_t if_cache_buf[IF_CACHE_BUF_SIZ];
+
+static uint32_t
+if_cache_ticks(void)
+{
+  return (snmp_event_time() - if_cache.start) / 10;
+}
+
+/* Return the position of index, or where it is to be inserted as -pos - 1 */
+static int
+if_entry_search(uint32_t index)
+{
+  int low = 0;
+  int high = if_cache.cnt;
+
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (if_cache.rows[mid]->index < index) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  if (low < if_cache.cnt && if_cache.rows[low]->index == index) {
+    return low;
+  }
+  return -low - 1;
+}
+
+static struct if_entry *
+if_entry_insert(int pos, uint32_t index)
+{
+  struct if_entry *entry;
+
+  if (if_cache.cnt == if_cache.cap) {
+    if_cache.cap = alloc_nr(if_cache.cap);
+    if_cache.rows = xrealloc(if_cache.rows, if_cache.cap * sizeof(*if_cache.rows));
+  }
+  memmove(if_cache.rows + pos + 1, if_cache.rows + pos, (if_cache.cnt - pos) * sizeof(*if_cache.rows));
+  if_cache.cnt++;
+
+  entry = xcalloc(1, sizeof(*entry));
+  entry->index = index;
+  entry->oper_stat = IF_STAT_UNKNOWN;
+  entry->discontinuity = if_cache_ticks();
+  if_cache.rows[pos] = entry;
+  if_cache.table_last_change = entry->discontinuity;
+  return entry;
+}
+
+static void
+if_entry_delete(int pos)
+{
+  free(if_cache.rows[pos]);
+  if_cache.cnt--;
+  memmove(if_cache.rows + pos, if_cache.rows + pos + 1, (if_cache.cnt - pos) * sizeof(*if_cache.rows));
+  if_cache.table_last_change = if_cache_ticks();
+}
+
+/* Speed is not carried by rtnetlink, read it when the link changes state. */
+static void
+if_entry_speed_update(struct if_entry *entry)
+{
+  char path[64];
+  FILE *fp;
+  long speed = 0;
+
+  entry->speed = 0;
+  snprintf(path, sizeof(path), "/sys/class/net/%s/speed", entry->name);
+  fp = fopen(path, "r");
+  if (fp != NULL) {
+    if (fscanf(fp, "%ld", &speed) == 1 && speed > 0) {
+      entry->speed = (uint64_t)speed * 1000000;
+    }
+    fclose(fp);
+  }
+}
+
+static uint32_t
+if_type_map(unsigned short arphrd, const char *kind)
+{
+  if (!strcmp(kind, "vlan")) {
+    return IF_TYPE_L2VLAN;
+  }
+  if (!strcmp(kind, "bridge")) {
+    return IF_TYPE_BRIDGE;
+  }
+
+  switch (arphrd) {
+    case ARPHRD_ETHER:
+      return IF_TYPE_ETHERNET;
+    case ARPHRD_LOOPBACK:
+      return IF_TYPE_LOOPBACK;
+    case ARPHRD_PPP:
+      return IF_TYPE_PPP;
+    case ARPHRD_IEEE80211:
+      return IF_TYPE_WIRELESS;
+    case ARPHRD_INFINIBAND:
+      return IF_TYPE_INFINIBAND;
+    case ARPHRD_TUNNEL:
+    case ARPHRD_TUNNEL6:
+    case ARPHRD_SIT:
+    case ARPHRD_IPGRE:
+      return IF_TYPE_TUNNEL;
+    default:
+      return IF_TYPE_OTHER;
+  }
+}
+
+static uint8_t
+if_oper_stat_map(uint8_t operstate, uint32_t flags)
+{
+  switch (operstate) {
+    case OPER_UP:
+      return IF_STAT_UP;
+    case OPER_DOWN:
+      return IF_STAT_DOWN;
+    case OPER_TESTING:
+      return IF_STAT_TESTING;
+    case OPER_DORMANT:
+      return IF_STAT_DORMANT;
+    case OPER_NOTPRESENT:
+      return IF_STAT_NOT_PRESENT;
+    case OPER_LOWERLAYERDOWN:
+      return IF_STAT_LOWER_DOWN;
+    default:
+      /* Drivers not reporting operstate, e.g. loopback */
+      if (flags & IFF_UP) {
+        return (flags & IFF_RUNNING) ? IF_STAT_UP : IF_STAT_DOWN;
+      }
+      return IF_STAT_DOWN;
+  }
+}
+
+static void
+if_link_kind(struct rtattr *linkinfo, char *kind)
+{
+  struct rtattr *rta;
+  int len = RTA_PAYLOAD(linkinfo);
+
+  for (rta = RTA_DATA(linkinfo); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type == IFLA_INFO_KIND) {
+      snprintf(kind, IF_KIND_MAX_LEN, "%.*s", (int)RTA_PAYLOAD(rta), (char *)RTA_DATA(rta));
+      return;
+    }
+  }
+}
+
+/* Copy a struct attribute, zero-filling what an older kernel leaves out */
+static void
+if_attr_copy(void *dst, size_t size, struct rtattr *rta)
+{
+  size_t len = RTA_PAYLOAD(rta);
+
+  memset(dst, 0, size);
+  memcpy(dst, RTA_DATA(rta), len < size ? len : size);
+}
+
+/* Apply one RTM_NEWLINK/RTM_DELLINK message to the cache */
+static void
+if_link_update(struct nlmsghdr *nlh)
+{
+  struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+  struct rtattr *rta;
+  struct if_entry *entry;
+  char kind[IF_KIND_MAX_LEN] = "";
+  int len, pos, created = 0, has_stats64 = 0;
+  uint8_t operstate = OPER_UNKNOWN;
+  uint8_t oper_stat;
+
+  if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi))) {
+    return;
+  }
+
+  pos = if_entry_search(ifi->ifi_index);
+
+  if (nlh->nlmsg_type == RTM_DELLINK) {
+    if (pos >= 0) {
+      if_entry_delete(pos);
+    }
+    return;
+  }
+
+  if (pos < 0) {
+    entry = if_entry_insert(-pos - 1, ifi->ifi_index);
+    created = 1;
+  } else {
+    entry = if_cache.rows[pos];
+  }
+
+  entry->flags = ifi->ifi_flags;
+  entry->gen = if_cache.gen;
+
+  len = IFLA_PAYLOAD(nlh);
+  for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    switch (rta->rta_type) {
+      case IFLA_IFNAME:
+        snprintf(entry->name, sizeof(entry->name), "%.*s", (int)RTA_PAYLOAD(rta), (char *)RTA_DATA(rta));
+        break;
+      case IFLA_IFALIAS:
+        snprintf(entry->alias, sizeof(entry->alias), "%.*s", (int)RTA_PAYLOAD(rta), (char *)RTA_DATA(rta));
+        break;
+      /* Undersized scalars are skipped */
+      case IFLA_MTU:
+        if (RTA_PAYLOAD(rta) >= sizeof(uint32_t)) {
+          entry->mtu = *(uint32_t *)RTA_DATA(rta);
+        }
+        break;
+      case IFLA_TXQLEN:
+        if (RTA_PAYLOAD(rta) >= sizeof(uint32_t)) {
+          entry->txqlen = *(uint32_t *)RTA_DATA(rta);
+        }
+        break;
+      case IFLA_OPERSTATE:
+        if (RTA_PAYLOAD(rta) >= sizeof(uint8_t)) {
+          operstate = *(uint8_t *)RTA_DATA(rta);
+        }
+        break;
+      case IFLA_ADDRESS:
+        entry->phy_addr_len = RTA_PAYLOAD(rta) > IF_PHY_ADDR_MAX_LEN ? IF_PHY_ADDR_MAX_LEN : RTA_PAYLOAD(rta);
+        memcpy(entry->phy_addr, RTA_DATA(rta), entry->phy_addr_len);
+        break;
+      case IFLA_LINKINFO:
+        if_link_kind(rta, kind);
+        break;
+      case IFLA_STATS64:
+        if_attr_copy(&entry->stats, sizeof(entry->stats), rta);
+        has_stats64 = 1;
+        break;
+      case IFLA_STATS:
+        if (!has_stats64) {
+          struct rtnl_link_stats st;
+          if_attr_copy(&st, sizeof(st), rta);
+          entry->stats.rx_packets = st.rx_packets;
+          entry->stats.tx_packets = st.tx_packets;
+          entry->stats.rx_bytes = st.rx_bytes;
+          entry->stats.tx_bytes = st.tx_bytes;
+          entry->stats.rx_errors = st.rx_errors;
+          entry->stats.tx_errors = st.tx_errors;
+          entry->stats.rx_dropped = st.rx_dropped;
+          entry->stats.tx_dropped = st.tx_dropped;
+          entry->stats.multicast = st.multicast;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  entry->type = if_type_map(ifi->ifi_type, kind);
+
+  oper_stat = if_oper_stat_map(operstate, entry->flags);
+  if (created || oper_stat != entry->oper_stat) {
+    if (!created) {
+      entry->last_change = if_cache_ticks();
+    }
+    entry->oper_stat = oper_stat;
+    if_entry_speed_update(entry);
+  }
+}
+
+/* Apply link events read into the buffer */
+static void
+if_cache_parse(int len)
+{
+  struct nlmsghdr *nlh;
+
+  for (nlh = (struct nlmsghdr *)if_cache_buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+    if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK) {
+      if_link_update(nlh);
+    }
+  }
+}
+
+/* Sequence of a new request, 0 is kept for none */
+static uint32_t
+if_req_seq(void)
+{
+  if (++if_cache.seq == 0) {
+    ++if_cache.seq;
+  }
+  return if_cache.seq;
+}
+
+/* Dump is in, sweep rows missed by events */
+static void
+if_cache_dump_done(void)
+{
+  int i;
+
+  for (i = if_cache.cnt - 1; i >= 0; i--) {
+    if (if_cache.rows[i]->gen != if_cache.gen) {
+      if_entry_delete(i);
+    }
+  }
+
+  if_cache.dump_seq = 0;
+  if_cache.resync = 0;
+  if_cache.refreshed = snmp_event_time();
+}
+
+/* Start a full link dump, which refreshes counters and resynchronizes rows.
+ * A dump still in progress is given up. */
+static int
+if_cache_dump_start(void)
+{
+  struct {
+    struct nlmsghdr nlh;
+    struct ifinfomsg ifi;
+  } req;
+
+  memset(&req, 0, sizeof(req));
+  req.nlh.nlmsg_len = sizeof(req);
+  req.nlh.nlmsg_type = RTM_GETLINK;
+  req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.nlh.nlmsg_seq = if_req_seq();
+  req.ifi.ifi_family = AF_UNSPEC;
+
+  if_cache.dump_seq = 0;
+  if (send(if_cache.req_sock, &req, sizeof(req), 0) < 0) {
+    SMARTSNMP_LOG(L_ERROR, "Send link dump request failure: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if_cache.gen++;
+  if_cache.dump_seq = req.nlh.nlmsg_seq;
+  return 0;
+}
+
+/* Ack of a parked set is in, or it timed out with error */
+static void
+if_admin_answer(struct if_admin_req *req, int error)
+{
+  struct mib_async_call *call = req->call;
+
+  list_del(&req->link);
+  free(req);
+
+  if (call != NULL) {
+    call->err_stat = error ? SNMP_ERR_STAT_COMMIT_FAILED : 0;
+    mib_async_answer(call);
+  }
+}
+
+static void
+if_admin_ack(uint32_t seq, int error)
+{
+  struct list_head *curr;
+
+  if (if_cache.wait_seq != 0 && seq == if_cache.wait_seq) {
+    if_cache.wait_seq = 0;
+    if_cache.wait_error = error;
+    return;
+  }
+
+  list_for_each(curr, &if_cache.admin_reqs) {
+    struct if_admin_req *req = list_entry(curr, struct if_admin_req, link);
+    if (req->seq == seq) {
+      if_admin_answer(req, error);
+      return;
+    }
+  }
+}
+
+/* Apply replies to dumps and sets read into the buffer */
+static void
+if_req_parse(int len)
+{
+  struct nlmsghdr *nlh;
+
+  for (nlh = (struct nlmsghdr *)if_cache_buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+    if (if_cache.dump_seq != 0 && nlh->nlmsg_seq == if_cache.dump_seq) {
+      switch (nlh->nlmsg_type) {
+        case RTM_NEWLINK:
+        case RTM_DELLINK:
+          if_link_update(nlh);
+          break;
+        case NLMSG_DONE:
+        case NLMSG_ERROR:
+          if_cache_dump_done();
+          break;
+        default:
+          break;
+      }
+    } else if (nlh->nlmsg_type == NLMSG_ERROR && nlh->nlmsg_len >= NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+      struct nlmsgerr *err = NLMSG_DATA(nlh);
+      if_admin_ack(nlh->nlmsg_seq, err->error);
+    }
+  }
+}
+
+/* Read replies pending on the request socket without blocking */
+static void
+if_req_drain(void)
+{
+  int len;
+
+  for (; ;) {
+    len = recv(if_cache.req_sock, if_cache_buf, sizeof(if_cache_buf), MSG_DONTWAIT);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (len == 0) {
+      break;
+    }
+    if_req_parse(len);
+  }
+}
+
+/* Wait in place until the request of *seq is answered, for callers out of
+ * the event loop or that cannot be parked. It is given up on timeout. */
+static int
+if_req_wait(uint32_t *seq)
+{
+  uint64_t expire = snmp_event_time() + IF_REQ_TIMEOUT;
+  struct pollfd pfd;
+
+  pfd.fd = if_cache.req_sock;
+  pfd.events = POLLIN;
+  while (*seq != 0) {
+    uint64_t now = snmp_event_time();
+    if (now >= expire || (poll(&pfd, 1, expire - now) < 0 && errno != EINTR)) {
+      *seq = 0;
+      return -1;
+    }
+    if_req_drain();
+  }
+  return 0;
+}
+
+static int
+if_cache_dump(void)
+{
+  if (if_cache_dump_start() < 0) {
+    return -1;
+  }
+  if (if_req_wait(&if_cache.dump_seq) < 0) {
+    SMARTSNMP_LOG(L_ERROR, "Receive link dump timeout\n");
+    return -1;
+  }
+  return 0;
+}
+
+/* Consume pending link events without blocking. */
+static void
+if_cache_drain(void)
+{
+  int len;
+
+  for (; ;) {
+    len = recv(if_cache.ev_sock, if_cache_buf, sizeof(if_cache_buf), MSG_DONTWAIT);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == ENOBUFS) {
+        /* Event storm overran the socket, rows may be stale */
+        if_cache.resync = 1;
+        continue;
+      }
+      break;
+    }
+    if (len == 0) {
+      break;
+    }
+    if_cache_parse(len);
+  }
+}
+
+/* Called on the request path, which is answered from the cache. Only out of
+ * the event loop is a stale cache dumped in place. */
+static void
+if_cache_sync(void)
+{
+  if_cache_drain();
+  if (snmp_event_running()) {
+    if (if_cache.resync && if_cache.dump_seq == 0) {
+      if_cache_dump_start();
+    }
+  } else if (if_cache.resync || snmp_event_time() - if_cache.refreshed >= IF_CACHE_REFRESH) {
+    if_cache_dump();
+  }
+}
+
+static void
+if_cache_event_handler(int sock, unsigned char flag, void *ud)
+{
+  if_cache_drain();
+  if (if_cache.resync && if_cache.dump_seq == 0) {
+    if_cache_dump_start();
+  }
+}
+
+static void
+if_cache_req_handler(int sock, unsigned char flag, void *ud)
+{
+  if_req_drain();
+}
+
+/* Fail sets not acked in time */
+static void
+if_admin_expire(void)
+{
+  struct list_head *curr, *next;
+  uint64_t now = snmp_event_time();
+
+  list_for_each_safe(curr, next, &if_cache.admin_reqs) {
+    struct if_admin_req *req = list_entry(curr, struct if_admin_req, link);
+    if (req->expire <= now) {
+      if_admin_answer(req, -ETIMEDOUT);
+    }
+  }
+}
+
+static void
+if_cache_timer_handler(void *ud)
+{
+  if_admin_expire();
+  if_cache_dump_start();
+}
+
+/* Request of the call is done with before the ack */
+static void
+if_admin_cancel(struct mib_async_call *call)
+{
+  struct if_admin_req *req = call->ud;
+  req->call = NULL;
+}
+
+/* Send administrative status change through rtnetlink, return its sequence
+ * or 0 on failure */
+static uint32_t
+if_admin_send(struct if_entry *entry, int stat)
+{
+  struct {
+    struct nlmsghdr nlh;
+    struct ifinfomsg ifi;
+  } req;
+
+  memset(&req, 0, sizeof(req));
+  req.nlh.nlmsg_len = sizeof(req);
+  req.nlh.nlmsg_type = RTM_NEWLINK;
+  req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  req.nlh.nlmsg_seq = if_req_seq();
+  req.ifi.ifi_family = AF_UNSPEC;
+  req.ifi.ifi_index = entry->index;
+  req.ifi.ifi_change = IFF_UP;
+  req.ifi.ifi_flags = stat == IF_STAT_UP ? IFF_UP : 0;
+
+  if (send(if_cache.req_sock, &req, sizeof(req), 0) < 0) {
+    SMARTSNMP_LOG(L_ERROR, "Send link change request failure: %s\n", strerror(errno));
+    return 0;
+  }
+  return req.nlh.nlmsg_seq;
+}
+
+/* Set administrative status, the request is parked until the ack */
+static int
+if_admin_stat_set(struct oid_search_res *ret_oid, struct if_entry *entry, int stat)
+{
+  struct mib_async_call *call;
+  struct if_admin_req *req;
+  int created;
+
+  call = mib_async_remote(ret_oid, &created);
+  if (call == NULL) {
+    /* Nowhere to park, wait for the ack in place */
+    if_cache.wait_seq = if_admin_send(entry, stat);
+    if (if_cache.wait_seq == 0 || if_req_wait(&if_cache.wait_seq) < 0 || if_cache.wait_error) {
+      return SNMP_ERR_STAT_COMMIT_FAILED;
+    }
+    return 0;
+  }
+
+  if (created) {
+    /* Failed sends are left to time out, not to answer within the search */
+    req = xmalloc(sizeof(*req));
+    req->seq = if_admin_send(entry, stat);
+    req->expire = snmp_event_time() + IF_REQ_TIMEOUT;
+    req->call = call;
+    list_add_tail(&req->link, &if_cache.admin_reqs);
+    call->ud = req;
+    call->cancel = if_admin_cancel;
+  }
+  if (call->status == LUA_YIELD) {
+    /* Parked, the request will be replayed */
+    return 0;
+  }
+  return call->err_stat;
+}
+
+static int
+if_cache_open(void)
+{
+  struct sockaddr_nl snl;
+  int rcvbuf = IF_CACHE_RCVBUF_SIZ;
+
+  if_cache.ev_sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+  if (if_cache.ev_sock < 0) {
+    perror("netlink socket()");
+    return -1;
+  }
+  setsockopt(if_cache.ev_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  memset(&snl, 0, sizeof(snl));
+  snl.nl_family = AF_NETLINK;
+  snl.nl_groups = RTMGRP_LINK;
+  if (bind(if_cache.ev_sock, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+    perror("netlink bind()");
+    close(if_cache.ev_sock);
+    return -1;
+  }
+
+  if_cache.req_sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+  if (if_cache.req_sock < 0) {
+    perror("netlink socket()");
+    close(if_cache.ev_sock);
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+mib_if_init(void)
+{
+  if (if_cache.inited) {
+    return 0;
+  }
+
+  if (if_cache_open() < 0) {
+    return -1;
+  }
+  INIT_LIST_HEAD(&if_cache.admin_reqs);
+
+  if_cache.start = snmp_event_time();
+  if (if_cache_dump() < 0) {
+    close(if_cache.ev_sock);
+    close(if_cache.req_sock);
+    return -1;
+  }
+
+  /* Link events, replies and counter refresh are driven by the event loop. */
+  snmp_event_add(if_cache.ev_sock, SNMP_EV_READ, if_cache_event_handler, NULL);
+  snmp_event_add(if_cache.req_sock, SNMP_EV_READ, if_cache_req_handler, NULL);
+  snmp_event_timer_add(IF_CACHE_REFRESH, IF_CACHE_REFRESH, if_cache_timer_handler, NULL);
+
+  if_cache.inited = 1;
+  return 0;
+}
+
+static uint32_t
+if_row_index(void *ud, int row, oid_t *idx)
+{
+  idx[0] = if_cache.rows[row]->index;
+  return 1;
+}
+
+/* ifEntry columns */
+static const oid_t if_entry_cols[] = {
+  1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22
+};
+
+/* ifXEntry columns */
+static const oid_t ifx_entry_cols[] = {
+  1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19
+};
+
+static void
+var_set_octstr(Variable *var, const void *str, uint32_t len)
+{
+  tag(var) = ASN1_TAG_OCTSTR;
+  length(var) = len;
+  memcpy(octstr(var), str, len);
+}
+
+static void
+var_set_uint(Variable *var, uint8_t type, uint32_t val)
+{
+  tag(var) = type;
+  length(var) = 1;
+  count(var) = val;
+}
+
+static void
+var_set_cnt64(Variable *var, uint64_t val)
+{
+  tag(var) = ASN1_TAG_CNT64;
+  length(var) = 1;
+  count64(var) = val;
+}
+
+static void
+if_entry_value(struct if_entry *entry, oid_t col, Variable *var)
+{
+  struct rtnl_link_stats64 *st = &entry->stats;
+
+  switch (col) {
+    case 1:
+      var_set_uint(var, ASN1_TAG_INT, entry->index);
+      break;
+    case 2:
+      var_set_octstr(var, entry->name, strlen(entry->name));
+      break;
+    case 3:
+      var_set_uint(var, ASN1_TAG_INT, entry->type);
+      break;
+    case 4:
+      var_set_uint(var, ASN1_TAG_INT, entry->mtu);
+      break;
+    case 5:
+      var_set_uint(var, ASN1_TAG_GAU, entry->speed > 0xffffffffULL ? 0xffffffff : entry->speed);
+      break;
+    case 6:
+      var_set_octstr(var, entry->phy_addr, entry->phy_addr_len);
+      break;
+    case 7:
+      var_set_uint(var, ASN1_TAG_INT, (entry->flags & IFF_UP) ? IF_STAT_UP : IF_STAT_DOWN);
+      break;
+    case 8:
+      var_set_uint(var, ASN1_TAG_INT, entry->oper_stat);
+      break;
+    case 9:
+      var_set_uint(var, ASN1_TAG_TIMETICKS, entry->last_change);
+      break;
+    case 10:
+      var_set_uint(var, ASN1_TAG_CNT, st->rx_bytes);
+      break;
+    case 11:
+      var_set_uint(var, ASN1_TAG_CNT, st->rx_packets - st->multicast);
+      break;
+    case 12:
+      var_set_uint(var, ASN1_TAG_CNT, st->multicast);
+      break;
+    case 13:
+      var_set_uint(var, ASN1_TAG_CNT, st->rx_dropped);
+      break;
+    case 14:
+      var_set_uint(var, ASN1_TAG_CNT, st->rx_errors);
+      break;
+    case 15:
+      var_set_uint(var, ASN1_TAG_CNT, 0);
+      break;
+    case 16:
+      var_set_uint(var, ASN1_TAG_CNT, st->tx_bytes);
+      break;
+    case 17:
+      var_set_uint(var, ASN1_TAG_CNT, st->tx_packets);
+      break;
+    case 18:
+      var_set_uint(var, ASN1_TAG_CNT, 0);
+      break;
+    case 19:
+      var_set_uint(var, ASN1_TAG_CNT, st->tx_dropped);
+      break;
+    case 20:
+      var_set_uint(var, ASN1_TAG_CNT, st->tx_errors);
+      break;
+    case 21:
+      var_set_uint(var, ASN1_TAG_GAU, entry->txqlen);
+      break;
+    case 22:
+      tag(var) = ASN1_TAG_OBJID;
+      length(var) = 2;
+      oid(var)[0] = 0;
+      oid(var)[1] = 0;
+      break;
+    default:
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      break;
+  }
+}
+
+/* Linux keeps no broadcast counters nor per-direction multicast for tx,
+ * so unicast counts include them except for received multicast. */
+static void
+ifx_entry_value(struct if_entry *entry, oid_t col, Variable *var)
+{
+  struct rtnl_link_stats64 *st = &entry->stats;
+
+  switch (col) {
+    case 1:
+      var_set_octstr(var, entry->name, strlen(entry->name));
+      break;
+    case 2:
+      var_set_uint(var, ASN1_TAG_CNT, st->multicast);
+      break;
+    case 3:
+    case 4:
+    case 5:
+      var_set_uint(var, ASN1_TAG_CNT, 0);
+      break;
+    case 6:
+      var_set_cnt64(var, st->rx_bytes);
+      break;
+    case 7:
+      var_set_cnt64(var, st->rx_packets - st->multicast);
+      break;
+    case 8:
+      var_set_cnt64(var, st->multicast);
+      break;
+    case 9:
+    case 12:
+    case 13:
+      var_set_cnt64(var, 0);
+      break;
+    case 10:
+      var_set_cnt64(var, st->tx_bytes);
+      break;
+    case 11:
+      var_set_cnt64(var, st->tx_packets);
+      break;
+    case 14:
+      /* ifLinkUpDownTrapEnable: disabled */
+      var_set_uint(var, ASN1_TAG_INT, 2);
+      break;
+    case 15:
+      var_set_uint(var, ASN1_TAG_GAU, entry->speed / 1000000);
+      break;
+    case 16:
+      var_set_uint(var, ASN1_TAG_INT, (entry->flags & IFF_PROMISC) ? 1 : 2);
+      break;
+    case 17:
+      var_set_uint(var, ASN1_TAG_INT, entry->type == IF_TYPE_ETHERNET ? 1 : 2);
+      break;
+    case 18:
+      var_set_octstr(var, entry->alias, strlen(entry->alias));
+      break;
+    case 19:
+      var_set_uint(var, ASN1_TAG_TIMETICKS, entry->discontinuity);
+      break;
+    default:
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      break;
+  }
+}
+
+typedef void (*if_value_fn)(struct if_entry *entry, oid_t col, Variable *var);
+
+/* Serve a conceptual table rooted at inst_id[0..prefix_len-1] = entry oid */
+static int
+if_table_search(struct oid_search_res *ret_oid, const oid_t *cols, int col_cnt, uint32_t prefix_len, if_value_fn entry_value)
+{
+  struct mib_native_table tab;
+  oid_t *inst_id = ret_oid->inst_id + prefix_len;
+  uint32_t inst_id_len = ret_oid->inst_id_len - prefix_len;
+  Variable *var = &ret_oid->var;
+  int col, row, ret;
+
+  tab.cols = cols;
+  tab.col_cnt = col_cnt;
+  tab.row_cnt = if_cache.cnt;
+  tab.row_index = if_row_index;
+  tab.ud = NULL;
+  tab.gen = 0;
+  tab.cursor = NULL;
+
+  switch (ret_oid->request) {
+    case MIB_REQ_GET:
+      ret = mib_native_table_get(&tab, inst_id, inst_id_len, &col, &row);
+      if (ret) {
+        tag(var) = ret;
+        return 0;
+      }
+      entry_value(if_cache.rows[row], cols[col], var);
+      return 0;
+
+    case MIB_REQ_GETNEXT:
+      if (mib_native_table_next(&tab, inst_id, &inst_id_len, &col, &row) < 0) {
+        tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
+      ret_oid->inst_id_len = prefix_len + inst_id_len;
+      entry_value(if_cache.rows[row], cols[col], var);
+      return 0;
+
+    default:
+      return SNMP_ERR_STAT_NOT_WRITABLE;
+  }
+}
+
+/* Compare request instance with a fixed sub-oid, for GETNEXT positioning */
+static int
+if_inst_cmp(const struct oid_search_res *ret_oid, const oid_t *id, uint32_t len)
+{
+  return oid_cmp(ret_oid->inst_id, ret_oid->inst_id_len, id, len);
+}
+
+/* interfaces group: ifNumber.0 and ifTable.ifEntry.col.index */
+int
+mib_if_handler(struct oid_search_res *ret_oid)
+{
+  static const oid_t if_number[] = { 1, 0 };
+  static const oid_t if_entry[] = { 2, 1 };
+  Variable *var = &ret_oid->var;
+  int pos;
+
+  if_cache_sync();
+
+  switch (ret_oid->request) {
+    case MIB_REQ_GET:
+      if (ret_oid->inst_id_len >= 1 && ret_oid->inst_id[0] == 1) {
+        if (ret_oid->inst_id_len == 2 && ret_oid->inst_id[1] == 0) {
+          var_set_uint(var, ASN1_TAG_INT, if_cache.cnt);
+        } else {
+          tag(var) = ASN1_TAG_NO_SUCH_INST;
+        }
+        return 0;
+      }
+      if (ret_oid->inst_id_len >= 2 && !oid_cmp(ret_oid->inst_id, 2, if_entry, 2)) {
+        return if_table_search(ret_oid, if_entry_cols, elem_num(if_entry_cols), 2, if_entry_value);
+      }
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+
+    case MIB_REQ_GETNEXT:
+      if (if_inst_cmp(ret_oid, if_number, 2) < 0) {
+        ret_oid->inst_id[0] = 1;
+        ret_oid->inst_id[1] = 0;
+        ret_oid->inst_id_len = 2;
+        var_set_uint(var, ASN1_TAG_INT, if_cache.cnt);
+        return 0;
+      }
+      if (if_inst_cmp(ret_oid, if_entry, 2) < 0) {
+        /* Ahead of the table, fetch its first instance */
+        ret_oid->inst_id[0] = 2;
+        ret_oid->inst_id[1] = 1;
+        ret_oid->inst_id_len = 2;
+      }
+      if (ret_oid->inst_id_len >= 2 && !oid_cmp(ret_oid->inst_id, 2, if_entry, 2)) {
+        return if_table_search(ret_oid, if_entry_cols, elem_num(if_entry_cols), 2, if_entry_value);
+      }
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+
+    case MIB_REQ_SET:
+    case MIB_REQ_TESTSET:
+      /* Written in varbind order, not ahead with the remote calls */
+      if (ret_oid->async != NULL && ret_oid->async->prefetch) {
+        tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
+      if (ret_oid->inst_id_len != 4 || oid_cmp(ret_oid->inst_id, 2, if_entry, 2) || ret_oid->inst_id[2] != 7) {
+        return SNMP_ERR_STAT_NOT_WRITABLE;
+      }
+      pos = if_entry_search(ret_oid->inst_id[3]);
+      if (pos < 0) {
+        return SNMP_ERR_STAT_NO_CREATION;
+      }
+      if (tag(var) != ASN1_TAG_INT) {
+        return SNMP_ERR_STAT_WRONG_TYPE;
+      }
+      if (integer(var) != IF_STAT_UP && integer(var) != IF_STAT_DOWN) {
+        return SNMP_ERR_STAT_WRONG_VALUE;
+      }
+      /* AgentX TestSet only checks, the write comes at CommitSet */
+      if (ret_oid->request == MIB_REQ_TESTSET) {
+        return 0;
+      }
+      return if_admin_stat_set(ret_oid, if_cache.rows[pos], integer(var));
+
+    default:
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+  }
+}
+
+/* IF-MIB group: ifMIBObjects.ifXTable.ifXEntry.col.index and ifTableLastChange.0 */
+int
+mib_ifx_handler(struct oid_search_res *ret_oid)
+{
+  static const oid_t ifx_entry[] = { 1, 1, 1 };
+  static const oid_t if_table_last_change[] = { 1, 5, 0 };
+  Variable *var = &ret_oid->var;
+
+  if_cache_sync();
+
+  switch (ret_oid->request) {
+    case MIB_REQ_GET:
+      if (ret_oid->inst_id_len >= 3 && !oid_cmp(ret_oid->inst_id, 3, ifx_entry, 3)) {
+        return if_table_search(ret_oid, ifx_entry_cols, elem_num(ifx_entry_cols), 3, ifx_entry_value);
+      }
+      if (!if_inst_cmp(ret_oid, if_table_last_change, 3)) {
+        var_set_uint(var, ASN1_TAG_TIMETICKS, if_cache.table_last_change);
+        return 0;
+      }
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+
+    case MIB_REQ_GETNEXT:
+      if (if_inst_cmp(ret_oid, ifx_entry, 3) < 0) {
+        ret_oid->inst_id[0] = 1;
+        ret_oid->inst_id[1] = 1;
+        ret_oid->inst_id[2] = 1;
+        ret_oid->inst_id_len = 3;
+      }
+      if (ret_oid->inst_id_len >= 3 && !oid_cmp(ret_oid->inst_id, 3, ifx_entry, 3)) {
+        if_table_search(ret_oid, ifx_entry_cols, elem_num(ifx_entry_cols), 3, ifx_entry_value);
+        if (MIB_TAG_VALID(tag(var))) {
+          return 0;
+        }
+      }
+      if (if_inst_cmp(ret_oid, if_table_last_change, 3) < 0) {
+        oid_cpy(ret_oid->inst_id, if_table_last_change, 3);
+        ret_oid->inst_id_len = 3;
+        var_set_uint(var, ASN1_TAG_TIMETICKS, if_cache.table_last_change);
+        return 0;
+      }
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+
+    default:
+      return SNMP_ERR_STAT_NOT_WRITABLE;
+  }
+}
+
+#else /* !__linux__ */
+
+int
+mib_if_init(void)
+{
+  SMARTSNMP_LOG(L_WARNING, "Native interfaces group needs rtnetlink, not supported on this platform\n");
+  return -1;
+}
+
+int
+mib_if_handler(struct oid_search_res *ret_oid)
+{
+  tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+  return 0;
+}
+
+int
+mib_ifx_handler(struct oid_search_res *ret_oid)
+{
+  tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+  return 0;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,415 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Latency histograms of request stages and of the handler of each
+ * registered group, built in with SMARTSNMP_LATENCY. Served as a table
+ * indexed by histogram: stages first, then groups as they register.
+ *
+ *   .1.1.2.n  name      OCTET STRING
+ *   .1.1.3.n  count     Counter64
+ *   .1.1.4.n  sum       Counter64, ns
+ *   .1.1.5.n  p50       Gauge32, ns
+ *   .1.1.6.n  p90       Gauge32, ns
+ *   .1.1.7.n  p99       Gauge32, ns
+ *   .1.1.8.n  max       Gauge32, ns
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mib.h"
+#include "snmp.h"
+#include "latency.h"
+#include "ev_loop.h"
+#include "util.h"
+
+#ifdef SMARTSNMP_LATENCY
+
+struct latency_hist latency_stages[LATENCY_STAGE_NUM] = {
+  { 1, "decode" },
+  { 2, "search" },
+  { 3, "encode" },
+  { 4, "send" },
+  { 5, "request" },
+};
+
+uint64_t latency_handler_ns;
+
+/* Group histograms sorted by id */
+static struct latency_hist **latency_groups;
+static int latency_group_cnt;
+static int latency_group_cap;
+static uint32_t latency_group_id = LATENCY_STAGE_NUM;
+/* Bumped when groups come and go, drops the walk cursor */
+static uint32_t latency_gen;
+
+uint64_t
+latency_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t
+latency_bucket(uint64_t ns)
+{
+  uint32_t shift;
+
+  if (ns < (1 << LATENCY_SUB_BITS)) {
+    return ns;
+  }
+  if (ns >= (uint64_t)1 << LATENCY_MAG_MAX) {
+    return LATENCY_BUCKETS - 1;
+  }
+  shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+  return ((shift + 1) << LATENCY_SUB_BITS) | ((ns >> shift) & ((1 << LATENCY_SUB_BITS) - 1));
+}
+
+/* Highest value counted in bucket */
+static uint64_t
+latency_bucket_value(uint32_t b)
+{
+  uint32_t shift, sub;
+
+  if (b < (1 << LATENCY_SUB_BITS)) {
+    return b;
+  }
+  shift = (b >> LATENCY_SUB_BITS) - 1;
+  sub = (b & ((1 << LATENCY_SUB_BITS) - 1)) | (1 << LATENCY_SUB_BITS);
+  return (((uint64_t)sub + 1) << shift) - 1;
+}
+
+void
+latency_record(struct latency_hist *h, uint64_t ns)
+{
+  h->count++;
+  h->sum += ns;
+  if (ns > h->max) {
+    h->max = ns;
+  }
+  h->buckets[latency_bucket(ns)]++;
+}
+
+/* Handlers run synchronously, time a yielding one spends parked is not
+ * counted here but in the request stage. */
+void
+latency_handler_record(struct latency_hist *h, uint64_t ns)
+{
+  latency_handler_ns += ns;
+  if (h != NULL) {
+    latency_record(h, ns);
+  }
+}
+
+struct latency_hist *
+latency_group_new(const oid_t *oid, uint32_t len)
+{
+  struct latency_hist *h = xcalloc(1, sizeof(*h));
+  uint32_t i, pos = 0;
+
+  h->id = ++latency_group_id;
+  h->name = xmalloc(len * 11 + 1);
+  h->name[0] = '\0';
+  for (i = 0; i < len; i++) {
+    pos += sprintf(h->name + pos, i ? ".%u" : "%u", oid[i]);
+  }
+
+  if (latency_group_cnt == latency_group_cap) {
+    latency_group_cap = latency_group_cap ? latency_group_cap * 2 : 16;
+    latency_groups = xrealloc(latency_groups, latency_group_cap * sizeof(*latency_groups));
+  }
+  latency_groups[latency_group_cnt++] = h;
+  latency_gen++;
+  return h;
+}
+
+void
+latency_group_free(struct latency_hist *h)
+{
+  int i;
+
+  if (h == NULL) {
+    return;
+  }
+  for (i = 0; i < latency_group_cnt; i++) {
+    if (latency_groups[i] == h) {
+      memmove(&latency_groups[i], &latency_groups[i + 1], (latency_group_cnt - i - 1) * sizeof(*latency_groups));
+      latency_group_cnt--;
+      break;
+    }
+  }
+  latency_gen++;
+  free(h->name);
+  free(h);
+}
+
+int
+latency_hist_cnt(void)
+{
+  return LATENCY_STAGE_NUM + latency_group_cnt;
+}
+
+const struct latency_hist *
+latency_hist_at(int row)
+{
+  return row < LATENCY_STAGE_NUM ? &latency_stages[row] : latency_groups[row - LATENCY_STAGE_NUM];
+}
+
+uint32_t
+latency_hist_gen(void)
+{
+  return latency_gen;
+}
+
+uint64_t
+latency_percentile(const struct latency_hist *h, uint32_t permille)
+{
+  uint64_t rank, seen = 0, v;
+  uint32_t b;
+
+  if (h->count == 0) {
+    return 0;
+  }
+
+  rank = (h->count * permille + 999) / 1000;
+  for (b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen >= rank && seen > 0) {
+      break;
+    }
+  }
+
+  /* Bucket bound may overshoot what was seen */
+  v = latency_bucket_value(b);
+  return v < h->max ? v : h->max;
+}
+
+#else /* !SMARTSNMP_LATENCY */
+
+int
+latency_hist_cnt(void)
+{
+  return 0;
+}
+
+const struct latency_hist *
+latency_hist_at(int row)
+{
+  return NULL;
+}
+
+uint32_t
+latency_hist_gen(void)
+{
+  return 0;
+}
+
+uint64_t
+latency_percentile(const struct latency_hist *h, uint32_t permille)
+{
+  return 0;
+}
+
+#endif /* SMARTSNMP_LATENCY */
+
+/* Write one line per histogram to path, or stdout if NULL */
+int
+latency_dump(const char *path)
+{
+  char tmp[256];
+  FILE *fp = stdout;
+  int i;
+
+  if (path != NULL) {
+    /* Readers never see a half written file */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+      SMARTSNMP_LOG(L_ERROR, "Open latency dump %s failure\n", tmp);
+      return -1;
+    }
+  }
+
+  fprintf(fp, "%-4s %-24s %12s %12s %12s %12s %12s %12s\n", "id", "name", "count", "avg(ns)", "p50(ns)", "p90(ns)", "p99(ns)", "max(ns)");
+  for (i = 0; i < latency_hist_cnt(); i++) {
+    const struct latency_hist *h = latency_hist_at(i);
+    fprintf(fp, "%-4u %-24s %12llu %12llu %12llu %12llu %12llu %12llu\n", h->id, h->name,
+            (unsigned long long)h->count, (unsigned long long)(h->count ? h->sum / h->count : 0),
+            (unsigned long long)latency_percentile(h, 500), (unsigned long long)latency_percentile(h, 900),
+            (unsigned long long)latency_percentile(h, 990), (unsigned long long)h->max);
+  }
+
+  if (path != NULL) {
+    fclose(fp);
+    if (rename(tmp, path) < 0) {
+      SMARTSNMP_LOG(L_ERROR, "Rename latency dump %s failure\n", tmp);
+      return -1;
+    }
+  } else {
+    fflush(fp);
+  }
+  return 0;
+}
+
+#ifdef SMARTSNMP_LATENCY
+static char *latency_dump_path;
+
+static void
+latency_dump_handler(void *ud)
+{
+  latency_dump(latency_dump_path);
+}
+#endif
+
+/* Dump to path every interval ms */
+int
+latency_dump_start(const char *path, uint32_t interval)
+{
+#ifdef SMARTSNMP_LATENCY
+  if (latency_dump_path != NULL || interval == 0) {
+    return -1;
+  }
+  latency_dump_path = xmalloc(strlen(path) + 1);
+  strcpy(latency_dump_path, path);
+  return snmp_event_timer_add(interval, interval, latency_dump_handler, NULL) < 0 ? -1 : 0;
+#else
+  SMARTSNMP_LOG(L_WARNING, "Latency histograms are not built in, dump not started\n");
+  return -1;
+#endif
+}
+
+/*
+ * Latency table
+ */
+
+static const oid_t latency_entry[] = { 1, 1 };
+static const oid_t latency_cols[] = { 2, 3, 4, 5, 6, 7, 8 };
+static struct mib_native_cursor latency_cursor;
+
+static uint32_t
+latency_row_index(void *ud, int row, oid_t *idx)
+{
+  idx[0] = latency_hist_at(row)->id;
+  return 1;
+}
+
+static void
+latency_gauge(Variable *var, uint64_t ns)
+{
+  tag(var) = ASN1_TAG_GAU;
+  length(var) = 1;
+  gauge(var) = ns > 0xffffffff ? 0xffffffff : ns;
+}
+
+static void
+latency_entry_value(const struct latency_hist *h, oid_t col, Variable *var)
+{
+  switch (col) {
+    case 2:
+      tag(var) = ASN1_TAG_OCTSTR;
+      length(var) = strlen(h->name);
+      memcpy(octstr(var), h->name, length(var));
+      break;
+    case 3:
+      tag(var) = ASN1_TAG_CNT64;
+      length(var) = 1;
+      count64(var) = h->count;
+      break;
+    case 4:
+      tag(var) = ASN1_TAG_CNT64;
+      length(var) = 1;
+      count64(var) = h->sum;
+      break;
+    case 5:
+      latency_gauge(var, latency_percentile(h, 500));
+      break;
+    case 6:
+      latency_gauge(var, latency_percentile(h, 900));
+      break;
+    case 7:
+      latency_gauge(var, latency_percentile(h, 990));
+      break;
+    default:
+      latency_gauge(var, h->max);
+      break;
+  }
+}
+
+int
+mib_latency_init(void)
+{
+#ifdef SMARTSNMP_LATENCY
+  return 0;
+#else
+  SMARTSNMP_LOG(L_WARNING, "Native latency group needs building with latency histograms\n");
+  return -1;
+#endif
+}
+
+int
+mib_latency_handler(struct oid_search_res *ret_oid)
+{
+  struct mib_native_table tab = {
+    latency_cols, elem_num(latency_cols), latency_hist_cnt(), latency_row_index, NULL, latency_hist_gen(), &latency_cursor
+  };
+  Variable *var = &ret_oid->var;
+  oid_t *inst_id = ret_oid->inst_id;
+  uint32_t sub_len;
+  int col, row, ret;
+
+  switch (ret_oid->request) {
+    case MIB_REQ_GET:
+      if (ret_oid->inst_id_len < 3 || oid_cmp(inst_id, 2, latency_entry, 2)) {
+        tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
+      ret = mib_native_table_get(&tab, inst_id + 2, ret_oid->inst_id_len - 2, &col, &row);
+      if (ret) {
+        tag(var) = ret;
+      } else {
+        latency_entry_value(latency_hist_at(row), latency_cols[col], var);
+      }
+      return 0;
+
+    case MIB_REQ_GETNEXT:
+      if (oid_cmp(inst_id, ret_oid->inst_id_len, latency_entry, 2) < 0) {
+        /* Ahead of the table, fetch its first instance */
+        oid_cpy(inst_id, latency_entry, 2);
+        ret_oid->inst_id_len = 2;
+      } else if (ret_oid->inst_id_len < 2 || oid_cmp(inst_id, 2, latency_entry, 2)) {
+        tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
+      sub_len = ret_oid->inst_id_len - 2;
+      if (mib_native_table_next(&tab, inst_id + 2, &sub_len, &col, &row) == 0) {
+        ret_oid->inst_id_len = 2 + sub_len;
+        latency_entry_value(latency_hist_at(row), latency_cols[col], var);
+        return 0;
+      }
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+
+    default:
+      return SNMP_ERR_STAT_NOT_WRITABLE;
+  }
+}
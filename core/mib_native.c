@@ -0,0 +1,180 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mib.h"
+#include "util.h"
+
+/* MIB groups implemented in C, registered by name from Lua modules */
+static const struct mib_native_group mib_native_groups[] = {
+  { "interfaces", mib_if_init, mib_if_handler },
+  { "ifmib", mib_if_init, mib_ifx_handler },
+  { "tcp", mib_tcp_init, mib_tcp_handler },
+  { "udp", mib_udp_init, mib_udp_handler },
+  { "snmp", mib_snmp_init, mib_snmp_handler },
+  { "mpd_stats", mib_snmp_init, mib_mpd_stats_handler },
+  { "usm_stats", mib_snmp_init, mib_usm_stats_handler },
+  { "latency", mib_latency_init, mib_latency_handler },
+};
+
+const struct mib_native_group *
+mib_native_group_search(const char *name)
+{
+  int i;
+
+  for (i = 0; i < elem_num(mib_native_groups); i++) {
+    if (!strcmp(mib_native_groups[i].name, name)) {
+      return &mib_native_groups[i];
+    }
+  }
+
+  return NULL;
+}
+
+static int
+table_col_search(const struct mib_native_table *tab, oid_t col)
+{
+  int i;
+
+  for (i = 0; i < tab->col_cnt; i++) {
+    if (tab->cols[i] >= col) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+/* Return the first row whose index is greater than (or equal to, if 'equal'
+ * is set) the given one. */
+static int
+table_row_search(const struct mib_native_table *tab, const oid_t *idx, uint32_t idx_len, int equal)
+{
+  oid_t row_idx[MIB_OID_MAX_LEN];
+  uint32_t row_idx_len;
+  int low = 0;
+  int high = tab->row_cnt;
+
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    int cmp;
+    row_idx_len = tab->row_index(tab->ud, mid, row_idx);
+    cmp = oid_cmp(row_idx, row_idx_len, idx, idx_len);
+    if (cmp > 0 || (equal && cmp == 0)) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+
+  return low;
+}
+
+/* Locate the exact column and row of instance [col, index...].
+ * Return 0 if found, ASN1_TAG_NO_SUCH_OBJ or ASN1_TAG_NO_SUCH_INST if not. */
+int
+mib_native_table_get(const struct mib_native_table *tab, const oid_t *inst_id, uint32_t inst_id_len, int *col, int *row)
+{
+  oid_t row_idx[MIB_OID_MAX_LEN];
+  uint32_t row_idx_len;
+  int c, r;
+
+  if (inst_id_len == 0) {
+    return ASN1_TAG_NO_SUCH_OBJ;
+  }
+
+  c = table_col_search(tab, inst_id[0]);
+  if (c == tab->col_cnt || tab->cols[c] != inst_id[0]) {
+    return ASN1_TAG_NO_SUCH_OBJ;
+  }
+
+  r = table_row_search(tab, inst_id + 1, inst_id_len - 1, 1);
+  if (r == tab->row_cnt) {
+    return ASN1_TAG_NO_SUCH_INST;
+  }
+  row_idx_len = tab->row_index(tab->ud, r, row_idx);
+  if (oid_cmp(row_idx, row_idx_len, inst_id + 1, inst_id_len - 1)) {
+    return ASN1_TAG_NO_SUCH_INST;
+  }
+
+  *col = c;
+  *row = r;
+  return 0;
+}
+
+/* Locate the column and row of the instance next to [col, index...] in
+ * column-major order and rewrite inst_id with it. Return 0 if found, -1 if
+ * end of table. */
+int
+mib_native_table_next(const struct mib_native_table *tab, oid_t *inst_id, uint32_t *inst_id_len, int *col, int *row)
+{
+  struct mib_native_cursor *cur = tab->cursor;
+  int c, r;
+
+  if (tab->row_cnt == 0) {
+    return -1;
+  }
+
+  if (cur != NULL && cur->gen == tab->gen && !oid_cmp(cur->inst_id, cur->inst_id_len, inst_id, *inst_id_len)) {
+    /* Walk continues from the last answer */
+    c = cur->col;
+    r = cur->row + 1;
+    if (r == tab->row_cnt) {
+      c++;
+      r = 0;
+    }
+  } else if (*inst_id_len == 0) {
+    c = 0;
+    r = 0;
+  } else {
+    c = table_col_search(tab, inst_id[0]);
+    if (c < tab->col_cnt && tab->cols[c] == inst_id[0]) {
+      r = table_row_search(tab, inst_id + 1, *inst_id_len - 1, 0);
+      if (r == tab->row_cnt) {
+        c++;
+        r = 0;
+      }
+    } else {
+      r = 0;
+    }
+  }
+
+  if (c >= tab->col_cnt) {
+    return -1;
+  }
+
+  inst_id[0] = tab->cols[c];
+  *inst_id_len = 1 + tab->row_index(tab->ud, r, inst_id + 1);
+
+  if (cur != NULL) {
+    cur->gen = tab->gen;
+    cur->col = c;
+    cur->row = r;
+    cur->inst_id_len = *inst_id_len;
+    oid_cpy(cur->inst_id, inst_id, *inst_id_len);
+  }
+
+  *col = c;
+  *row = r;
+  return 0;
+}
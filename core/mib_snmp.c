@@ -0,0 +1,171 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Statistics of the SNMP engine itself: the snmp group of SNMPv2-MIB
+ * (RFC 3418), snmpMPDStats (RFC 3412) and usmStats (RFC 3414). The agent
+ * is single threaded, so the counters are plain words bumped in place on
+ * the request path and read here as they are. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mib.h"
+#include "snmp.h"
+#include "util.h"
+
+/* Scalar read from a counter word */
+struct stats_object {
+  oid_t id;
+  uint8_t tag;
+  const uint32_t *val;
+};
+
+#define SNMP_STATS(id)         { id, ASN1_TAG_CNT, &snmp_stats[id] }
+#define MPD_STATS(id)          { id, ASN1_TAG_CNT, &mpd_stats[id] }
+#define USM_STATS(id, stat)    { id, ASN1_TAG_CNT, &usm_stats[stat] }
+
+/* snmpInPkts ... snmpProxyDrops, .7 and .23 are not assigned */
+static const struct stats_object snmp_objects[] = {
+  SNMP_STATS(SNMP_IN_PKTS),
+  SNMP_STATS(SNMP_OUT_PKTS),
+  SNMP_STATS(SNMP_IN_BAD_VERSIONS),
+  SNMP_STATS(SNMP_IN_BAD_COMMUNITY_NAMES),
+  SNMP_STATS(SNMP_IN_BAD_COMMUNITY_USES),
+  SNMP_STATS(SNMP_IN_ASN_PARSE_ERRS),
+  SNMP_STATS(SNMP_IN_TOO_BIGS),
+  SNMP_STATS(SNMP_IN_NO_SUCH_NAMES),
+  SNMP_STATS(SNMP_IN_BAD_VALUES),
+  SNMP_STATS(SNMP_IN_READ_ONLYS),
+  SNMP_STATS(SNMP_IN_GEN_ERRS),
+  SNMP_STATS(SNMP_IN_TOTAL_REQ_VARS),
+  SNMP_STATS(SNMP_IN_TOTAL_SET_VARS),
+  SNMP_STATS(SNMP_IN_GET_REQUESTS),
+  SNMP_STATS(SNMP_IN_GET_NEXTS),
+  SNMP_STATS(SNMP_IN_SET_REQUESTS),
+  SNMP_STATS(SNMP_IN_GET_RESPONSES),
+  SNMP_STATS(SNMP_IN_TRAPS),
+  SNMP_STATS(SNMP_OUT_TOO_BIGS),
+  SNMP_STATS(SNMP_OUT_NO_SUCH_NAMES),
+  SNMP_STATS(SNMP_OUT_BAD_VALUES),
+  SNMP_STATS(SNMP_OUT_GEN_ERRS),
+  SNMP_STATS(SNMP_OUT_GET_REQUESTS),
+  SNMP_STATS(SNMP_OUT_GET_NEXTS),
+  SNMP_STATS(SNMP_OUT_SET_REQUESTS),
+  SNMP_STATS(SNMP_OUT_GET_RESPONSES),
+  SNMP_STATS(SNMP_OUT_TRAPS),
+  { SNMP_ENABLE_AUTHEN_TRAPS, ASN1_TAG_INT, &snmp_stats[SNMP_ENABLE_AUTHEN_TRAPS] },
+  SNMP_STATS(SNMP_SILENT_DROPS),
+  SNMP_STATS(SNMP_PROXY_DROPS),
+};
+
+static const struct stats_object mpd_objects[] = {
+  MPD_STATS(MPD_UNKNOWN_SECURITY_MODELS),
+  MPD_STATS(MPD_INVALID_MSGS),
+  MPD_STATS(MPD_UNKNOWN_PDU_HANDLERS),
+};
+
+static const struct stats_object usm_objects[] = {
+  USM_STATS(1, USM_STATS_UNSUPPORTED_SEC_LEVELS),
+  USM_STATS(2, USM_STATS_NOT_IN_TIME_WINDOWS),
+  USM_STATS(3, USM_STATS_UNKNOWN_USER_NAMES),
+  USM_STATS(4, USM_STATS_UNKNOWN_ENGINE_IDS),
+  USM_STATS(5, USM_STATS_WRONG_DIGESTS),
+  USM_STATS(6, USM_STATS_DECRYPTION_ERRORS),
+};
+
+static void
+stats_value(const struct stats_object *obj, Variable *var)
+{
+  tag(var) = obj->tag;
+  length(var) = 1;
+  if (obj->tag == ASN1_TAG_INT) {
+    integer(var) = *obj->val;
+  } else {
+    count(var) = *obj->val;
+  }
+}
+
+/* Dispatch a request over the sorted scalars of a group */
+static int
+stats_group_search(const struct stats_object *objs, int obj_cnt, struct oid_search_res *ret_oid)
+{
+  Variable *var = &ret_oid->var;
+  oid_t *inst_id = ret_oid->inst_id;
+  int i;
+
+  switch (ret_oid->request) {
+    case MIB_REQ_GET:
+      for (i = 0; i < obj_cnt; i++) {
+        if (ret_oid->inst_id_len == 0 || inst_id[0] != objs[i].id) {
+          continue;
+        }
+        if (ret_oid->inst_id_len == 2 && inst_id[1] == 0) {
+          stats_value(&objs[i], var);
+        } else {
+          tag(var) = ASN1_TAG_NO_SUCH_INST;
+        }
+        return 0;
+      }
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+
+    case MIB_REQ_GETNEXT:
+      for (i = 0; i < obj_cnt; i++) {
+        oid_t head[2] = { objs[i].id, 0 };
+
+        if (oid_cmp(inst_id, ret_oid->inst_id_len, head, 2) < 0) {
+          oid_cpy(inst_id, head, 2);
+          ret_oid->inst_id_len = 2;
+          stats_value(&objs[i], var);
+          return 0;
+        }
+      }
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+
+    default:
+      return SNMP_ERR_STAT_NOT_WRITABLE;
+  }
+}
+
+int
+mib_snmp_init(void)
+{
+  return 0;
+}
+
+int
+mib_snmp_handler(struct oid_search_res *ret_oid)
+{
+  return stats_group_search(snmp_objects, elem_num(snmp_objects), ret_oid);
+}
+
+int
+mib_mpd_stats_handler(struct oid_search_res *ret_oid)
+{
+  return stats_group_search(mpd_objects, elem_num(mpd_objects), ret_oid);
+}
+
+int
+mib_usm_stats_handler(struct oid_search_res *ret_oid)
+{
+  return stats_group_search(usm_objects, elem_num(usm_objects), ret_oid);
+}
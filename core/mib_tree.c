@@ -24,6 +24,7 @@
 #include <assert.h>
 
 #include "mib.h"
+#include "latency.h"
 #include "util.h"
 
 /* MIB lua state */
@@ -41,14 +42,8 @@ static struct mib_group_node mib_dummy_node = {
 oid_t *
 oid_dup(const oid_t *oid, uint32_t len)
 {
-  int i;
-  oid_t *new_oid;
-  /* We need to allocate largest space so as to hold any oid */
-  new_oid = xmalloc(MIB_VALUE_MAX_LEN * sizeof(oid_t));
-  for (i = 0; i < len; i++) {
-    new_oid[i] = oid[i];
-  }
-  return new_oid;
+  oid_t *new_oid = xmalloc((len ? len : 1) * sizeof(oid_t));
+  return oid_cpy(new_oid, oid, len);
 }
 
 int
@@ -125,115 +120,143 @@ mib_handler_unref(int handler)
 }
 
 /* Embedded code is not funny at all... */
-int
-mib_instance_search(struct oid_search_res *ret_oid)
+static int
+__mib_instance_search(struct oid_search_res *ret_oid)
 {
-  int i;
+  int i, status;
   Variable *var = &ret_oid->var;
   lua_State *L = mib_lua_state;
+  lua_State *co;
+
+  /* Native group handler short-cuts Lua */
+  if (ret_oid->native != NULL) {
+    return ret_oid->native(ret_oid);
+  }
+
+  /* Prefetch only places remote calls */
+  if (ret_oid->async != NULL && ret_oid->async->prefetch) {
+    tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+    return 0;
+  }
+
+  /* Handler finished while the request was parked */
+  co = mib_async_done(ret_oid, &status);
+  if (co != NULL) {
+    goto RESULT;
+  }
 
-  /* Empty lua stack. */
-  lua_pop(L, -1);
+  /* Handlers run in coroutines so that they can yield. */
+  co = mib_async_thread();
   /* Get function. */
   lua_rawgeti(L, LUA_ENVIRONINDEX, ret_oid->callback);
+  lua_xmove(L, co, 1);
   /* op */
-  lua_pushinteger(L, ret_oid->request);
+  lua_pushinteger(co, ret_oid->request);
   /* req_sub_oid */
-  lua_newtable(L);
+  lua_newtable(co);
   for (i = 0; i < ret_oid->inst_id_len; i++) {
-    lua_pushinteger(L, ret_oid->inst_id[i]);
-    lua_rawseti(L, -2, i + 1);
+    lua_pushinteger(co, ret_oid->inst_id[i]);
+    lua_rawseti(co, -2, i + 1);
   }
 
-  if (ret_oid->request == MIB_REQ_SET) {
+  if (ret_oid->request == MIB_REQ_SET || ret_oid->request == MIB_REQ_TESTSET) {
     /* req_val */
     switch (tag(var)) {
       case ASN1_TAG_INT:
-        lua_pushinteger(L, integer(var));
+        lua_pushinteger(co, integer(var));
         break;
       case ASN1_TAG_OCTSTR:
-        lua_pushlstring(L, octstr(var), length(var));
+        lua_pushlstring(co, octstr(var), length(var));
         break;
       case ASN1_TAG_CNT:
-        lua_pushnumber(L, count(var));
+        lua_pushnumber(co, count(var));
         break;
       case ASN1_TAG_IPADDR:
-        lua_pushlstring(L, (char *)ipaddr(var), length(var));
+        lua_pushlstring(co, (char *)ipaddr(var), length(var));
         break;
       case ASN1_TAG_OBJID:
-        lua_newtable(L);
+        lua_newtable(co);
         for (i = 0; i < length(var); i++) {
-          lua_pushnumber(L, oid(var)[i]);
-          lua_rawseti(L, -2, i + 1);
+          lua_pushnumber(co, oid(var)[i]);
+          lua_rawseti(co, -2, i + 1);
         }
         break;
       case ASN1_TAG_GAU:
-        lua_pushnumber(L, gauge(var));
+        lua_pushnumber(co, gauge(var));
         break;
       case ASN1_TAG_TIMETICKS:
-        lua_pushnumber(L, timeticks(var));
+        lua_pushnumber(co, timeticks(var));
         break;
       default:
-        lua_pushnil(L);
+        lua_pushnil(co);
         break;
     }
     /* req_val_type */
-    lua_pushinteger(L, tag(var));
+    lua_pushinteger(co, tag(var));
   } else {
     /* req_val */
-    lua_pushnil(L);
+    lua_pushnil(co);
     /* req_val_type */
-    lua_pushnil(L);
+    lua_pushnil(co);
+  }
+
+  status = mib_async_run(ret_oid, co, 4);
+  if (status == LUA_YIELD) {
+    /* Parked, the request will be replayed. */
+    return 0;
   }
 
-  if (lua_pcall(L, 4, 4, 0) != 0) {
-    SMARTSNMP_LOG(L_ERROR, "MIB search hander %d fail: %s\n", ret_oid->callback, lua_tostring(L, -1));
+RESULT:
+  if (status != 0) {
+    SMARTSNMP_LOG(L_ERROR, "MIB search hander %d fail: %s\n", ret_oid->callback, lua_tostring(co, -1));
     tag(var) = ASN1_TAG_NO_SUCH_OBJ;
     return 0;
   }
 
-  ret_oid->err_stat = lua_tointeger(L, -4);
-  tag(var) = lua_tonumber(L, -1);
+  /* err_stat, rsp_sub_oid, rsp_val, rsp_val_type */
+  lua_settop(co, 4);
+  ret_oid->err_stat = lua_tointeger(co, -4);
+  tag(var) = lua_tonumber(co, -1);
 
   if (!ret_oid->err_stat && MIB_TAG_VALID(tag(var))) {
     /* Return value */
-    if (ret_oid->request != MIB_REQ_SET) {
+    if (ret_oid->request == MIB_REQ_GET || ret_oid->request == MIB_REQ_GETNEXT) {
       switch (tag(var)) {
         case ASN1_TAG_INT:
           length(var) = 1;
-          integer(var) = lua_tointeger(L, -2);
+          integer(var) = lua_tointeger(co, -2);
           break;
         case ASN1_TAG_OCTSTR:
-          length(var) = lua_objlen(L, -2);
-          memcpy(octstr(var), lua_tostring(L, -2), length(var));
+          length(var) = lua_objlen(co, -2);
+          memcpy(octstr(var), lua_tostring(co, -2), length(var));
           break;
         case ASN1_TAG_CNT:
           length(var) = 1;
-          count(var) = lua_tonumber(L, -2);
+          count(var) = lua_tonumber(co, -2);
           break;
         case ASN1_TAG_IPADDR:
-          length(var) = lua_objlen(L, -2);
+          length(var) = lua_objlen(co, -2);
           for (i = 0; i < length(var); i++) {
-            lua_rawgeti(L, -2, i + 1);
-            ipaddr(var)[i] = lua_tointeger(L, -1);
-            lua_pop(L, 1);
+            lua_rawgeti(co, -2, i + 1);
+            ipaddr(var)[i] = lua_tointeger(co, -1);
+            lua_pop(co, 1);
           }
           break;
         case ASN1_TAG_OBJID:
-          length(var) = lua_objlen(L, -2);
+          length(var) = lua_objlen(co, -2);
           for (i = 0; i < length(var); i++) {
-            lua_rawgeti(L, -2, i + 1);
-            oid(var)[i] = lua_tointeger(L, -1);
-            lua_pop(L, 1);
+            lua_rawgeti(co, -2, i + 1);
+            oid(var)[i] = lua_tointeger(co, -1);
+            lua_pop(co, 1);
           }
           break;
         case ASN1_TAG_GAU:
           length(var) = 1;
-          gauge(var) = lua_tonumber(L, -2);
+          gauge(var) = lua_tonumber(co, -2);
           break;
         case ASN1_TAG_TIMETICKS:
           length(var) = 1;
-          timeticks(var) = lua_tonumber(L, -2);
+          timeticks(var) = lua_tonumber(co, -2);
           break;
         default:
           assert(0);
@@ -242,11 +265,17 @@ mib_instance_search(struct oid_search_res *ret_oid)
 
     /* For GETNEXT request, return the new oid */
     if (ret_oid->request == MIB_REQ_GETNEXT) {
-      ret_oid->inst_id_len = lua_objlen(L, -3);
+      ret_oid->inst_id_len = lua_objlen(co, -3);
+      if (ret_oid->inst_id + ret_oid->inst_id_len > ret_oid->oid_buf + MIB_OID_MAX_LEN) {
+        SMARTSNMP_LOG(L_ERROR, "MIB search hander %d returns too long oid\n", ret_oid->callback);
+        ret_oid->inst_id_len = 0;
+        tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
       for (i = 0; i < ret_oid->inst_id_len; i++) {
-        lua_rawgeti(L, -3, i + 1);
-        ret_oid->inst_id[i] = lua_tointeger(L, -1);
-        lua_pop(L, 1);
+        lua_rawgeti(co, -3, i + 1);
+        ret_oid->inst_id[i] = lua_tointeger(co, -1);
+        lua_pop(co, 1);
       }
     }
   }
@@ -254,6 +283,19 @@ mib_instance_search(struct oid_search_res *ret_oid)
   return ret_oid->err_stat;
 }
 
+/* Instance search in the handler of a group, timed per group. A parked
+ * handler is one sample when its replay finishes the search. */
+int
+mib_instance_search(struct oid_search_res *ret_oid)
+{
+  int err;
+  LATENCY_STAMP(start);
+
+  err = __mib_instance_search(ret_oid);
+  LATENCY_HANDLER(MIB_SEARCH_PENDING(ret_oid) ? NULL : ret_oid->latency, start);
+  return err;
+}
+
 /* GET request search, depth-first traversal in mib-tree, oid must match */
 struct mib_node *
 mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_len, struct oid_search_res *ret_oid)
@@ -267,7 +309,8 @@ mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_l
   assert(view != NULL && orig_oid != NULL && ret_oid != NULL);
 
   /* Duplicate OID as return value */
-  ret_oid->oid = oid_dup(orig_oid, orig_id_len);
+  assert(orig_id_len <= MIB_OID_MAX_LEN);
+  ret_oid->oid = oid_cpy(ret_oid->oid_buf, orig_oid, orig_id_len);
   ret_oid->id_len = orig_id_len;
   ret_oid->err_stat = 0;
 
@@ -309,6 +352,8 @@ mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_l
         ret_oid->inst_id = oid;
         ret_oid->inst_id_len = id_len;
         ret_oid->callback = in->callback;
+        ret_oid->native = in->native;
+        ret_oid->latency = in->latency;
         ret_oid->err_stat = mib_instance_search(ret_oid);
         return node;
 
@@ -379,6 +424,9 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
     node = mib_tree_search(view, view->oid, view->id_len, ret_oid);
     assert(node != NULL);
     ret_oid->request = MIB_REQ_GETNEXT;
+    if (MIB_SEARCH_PENDING(ret_oid)) {
+      return;
+    }
     /* Duplicate the given oid */
     oid_cpy(ret_oid->oid, orig_oid, orig_id_len);
     ret_oid->id_len = orig_id_len;
@@ -397,6 +445,9 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
       node = mib_tree_search(view, view->oid, view->id_len, ret_oid);
       assert(node != NULL);
       ret_oid->request = MIB_REQ_GETNEXT;
+      if (MIB_SEARCH_PENDING(ret_oid)) {
+        return;
+      }
       /* Set the search mode according to node type */
       if (node->type == MIB_OBJ_GROUP) {
         immediate = 1;
@@ -406,7 +457,7 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
     } else {
       /* END_OF_MIB_VIEW */
       node = NULL;
-      ret_oid->oid = oid_dup(view->oid, view->id_len);
+      ret_oid->oid = oid_cpy(ret_oid->oid_buf, view->oid, view->id_len);
       ret_oid->id_len = view->id_len;
     }
   }
@@ -508,7 +559,13 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
           /* Find instance variable through lua handler function */
           ret_oid->inst_id = oid;
           ret_oid->callback = in->callback;
+          ret_oid->native = in->native;
+          ret_oid->latency = in->latency;
           ret_oid->err_stat = mib_instance_search(ret_oid);
+          if (MIB_SEARCH_PENDING(ret_oid)) {
+            /* Search goes on when the request is replayed */
+            return;
+          }
           if (MIB_TAG_VALID(tag(&ret_oid->var))) {
             ret_oid->id_len = oid - ret_oid->oid + ret_oid->inst_id_len;
             assert(ret_oid->id_len <= MIB_OID_MAX_LEN);
@@ -647,11 +704,13 @@ mib_group_node_delete(struct mib_group_node *gn)
 }
 
 static struct mib_instance_node *
-mib_instance_node_new(int callback)
+mib_instance_node_new(int callback, mib_native_handler native)
 {
   struct mib_instance_node *in = xmalloc(sizeof(*in));
   in->type = MIB_OBJ_INSTANCE;
   in->callback = callback;
+  in->native = native;
+  in->latency = NULL;
   return in;
 }
 
@@ -659,7 +718,10 @@ static void
 mib_instance_node_delete(struct mib_instance_node *in)
 {
   if (in != NULL) {
-    mib_handler_unref(in->callback);
+    if (in->native == NULL) {
+      mib_handler_unref(in->callback);
+    }
+    LATENCY_GROUP_FREE(in->latency);
     free(in);
   }
 }
@@ -820,7 +882,7 @@ mib_tree_delete(const oid_t *oid, uint32_t id_len)
  * the last id number must be the not existing instance node.
  */
 static struct mib_instance_node *
-mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
+mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback, mib_native_handler native)
 {
   struct mib_node *node = (struct mib_node *)&mib_dummy_node;
   struct mib_group_node *gn;
@@ -836,7 +898,7 @@ mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
           gn->sub_id[0] = *oid++;
           if (--id_len == 0) {
             /* Allocate new instance node */
-            node = gn->sub_ptr[0] = mib_instance_node_new(callback);
+            node = gn->sub_ptr[0] = mib_instance_node_new(callback, native);
             return (struct mib_instance_node *)node;
           } else {
             /* Allocate new group node */
@@ -859,7 +921,7 @@ mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
             gn->sub_id[i] = *oid++;
             if (--id_len == 0) {
               /* Allocate new instance node */
-              node = gn->sub_ptr[i] = mib_instance_node_new(callback);
+              node = gn->sub_ptr[i] = mib_instance_node_new(callback, native);
               return (struct mib_instance_node *)node;
             } else {
               /* Allocate new group node */
@@ -882,9 +944,8 @@ mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
   return NULL;
 }
 
-/* Register one instance node in mib-tree according to given oid with lua callback. */
-int
-mib_node_reg(const oid_t *oid, uint32_t len, int callback)
+static int
+__mib_node_reg(const oid_t *oid, uint32_t len, int callback, mib_native_handler native)
 {
   int i;
   struct mib_instance_node *in;
@@ -904,7 +965,7 @@ mib_node_reg(const oid_t *oid, uint32_t len, int callback)
     return -1;
   }
 
-  in = mib_tree_instance_insert(oid, len, callback);
+  in = mib_tree_instance_insert(oid, len, callback, native);
   if (in == NULL) {
     SMARTSNMP_LOG(L_WARNING, "Register group node oid: ");
     for (i = 0; i < len; i++) {
@@ -913,10 +974,26 @@ mib_node_reg(const oid_t *oid, uint32_t len, int callback)
     SMARTSNMP_LOG(L_WARNING, "fail, node already exists or oid overlaps.\n");
     return -1;
   }
+  in->latency = LATENCY_GROUP_NEW(oid, len);
 
   return 0;
 }
 
+/* Register one instance node in mib-tree according to given oid with lua callback. */
+int
+mib_node_reg(const oid_t *oid, uint32_t len, int callback)
+{
+  return __mib_node_reg(oid, len, callback, NULL);
+}
+
+/* Register one instance node in mib-tree according to given oid with C handler. */
+int
+mib_native_node_reg(const oid_t *oid, uint32_t len, mib_native_handler handler)
+{
+  assert(handler != NULL);
+  return __mib_node_reg(oid, len, LUA_NOREF, handler);
+}
+
 /* Unregister node(s) in mib-tree according to given oid. */
 void
 mib_node_unreg(const oid_t *oid, uint32_t len)
@@ -23,6 +23,7 @@
 
 #include <stdint.h>
 #include "asn1.h" 
+#include "mib.h"
 
 struct protocol_operation {
   const char *name;
@@ -31,9 +32,15 @@ struct protocol_operation {
   int (*close)(void);
   void (*run)(void);
   int (*reg)(const oid_t *grp_id, int id_len, int grp_cb);
+  int (*native_reg)(const oid_t *grp_id, int id_len, mib_native_handler handler);
   int (*unreg)(const oid_t *grp_id, int id_len);
-  void (*receive)(uint8_t *buf, int len);
-  void (*send)(uint8_t *buf, int len);
+  /* Both buf and sender addr are allocated and handed over by transports */
+  void (*receive)(uint8_t *buf, int len, void *addr);
+  void (*send)(uint8_t *buf, int len, const void *addr);
+  /* Manager of the request in process, NULL if unknown */
+  const char *(*peer)(void);
+  /* Context of the request in process, "" for the default one */
+  const char *(*context)(void);
 };
 
 extern struct protocol_operation snmp_prot_ops;
@@ -22,10 +22,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "mib.h"
 #include "snmp.h"
 #include "agentx.h"
 #include "protocol.h"
+#include "latency.h"
+#include "ev_loop.h"
 #include "util.h"
 
 static struct protocol_operation *prot_ops;
@@ -40,7 +47,8 @@ smartsnmp_init(lua_State *L)
 {
   int ret;
   const char *protocol = luaL_checkstring(L, 1);
-  int port = luaL_checkint(L, 2);
+  int port = luaL_optint(L, 2, 0);
+  const char *path = luaL_optstring(L, 3, NULL);
 
   signal(SIGINT, sig_int_handler);
 
@@ -50,6 +58,9 @@ smartsnmp_init(lua_State *L)
     prot_ops = &snmp_prot_ops;
   } else if (!strcmp(protocol, "agentx")) {
     prot_ops = &agentx_prot_ops;
+    if (path != NULL) {
+      agentx_conn.path = strdup(path);
+    }
   } else {
     lua_pushboolean(L, 0);
     return 1;  
@@ -126,6 +137,50 @@ smartsnmp_mib_node_reg(lua_State *L)
   return 1;
 }
 
+/* Register mib nodes implemented in C from Lua, nil and a message if the
+ * group cannot run here */
+int
+smartsnmp_mib_native_reg(lua_State *L)
+{
+  oid_t *grp_id;
+  int i, grp_id_len;
+  const char *name;
+  const struct mib_native_group *group;
+
+  /* Check if the first argument is a table. */
+  luaL_checktype(L, 1, LUA_TTABLE);
+  name = luaL_checkstring(L, 2);
+
+  group = mib_native_group_search(name);
+  if (group == NULL) {
+    return luaL_error(L, "Native group '%s' not found!", name);
+  }
+  /* Unsupported here, the agent goes on without it */
+  if (group->init() < 0) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "Native group '%s' init failure!", name);
+    return 2;
+  }
+
+  /* Get oid length */
+  grp_id_len = lua_objlen(L, 1);
+  /* Get oid */
+  grp_id = xmalloc(grp_id_len * sizeof(oid_t));
+  for (i = 0; i < grp_id_len; i++) {
+    lua_rawgeti(L, 1, i + 1);
+    grp_id[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+
+  /* Register node */
+  i = prot_ops->native_reg(grp_id, grp_id_len, group->handler);
+  free(grp_id);
+
+  /* Return value */
+  lua_pushnumber(L, i);
+  return 1;
+}
+
 /* Unregister mib nodes from Lua */
 int
 smartsnmp_mib_node_unreg(lua_State *L)
@@ -154,6 +209,151 @@ smartsnmp_mib_node_unreg(lua_State *L)
   return 1;
 }
 
+/* Manager of the request in process, nil if unknown */
+int
+smartsnmp_request_peer(lua_State *L)
+{
+  const char *peer = prot_ops->peer != NULL ? prot_ops->peer() : NULL;
+
+  if (peer != NULL) {
+    lua_pushstring(L, peer);
+  } else {
+    lua_pushnil(L);
+  }
+  return 1;
+}
+
+/* Context of the request in process, "" for the default one */
+int
+smartsnmp_request_context(lua_State *L)
+{
+  const char *context = prot_ops->context != NULL ? prot_ops->context() : NULL;
+
+  lua_pushstring(L, context != NULL ? context : "");
+  return 1;
+}
+
+/* Serve groups in another AgentX context, "" for the default one. Must be
+ * called before init, each context gets its own session. */
+int
+smartsnmp_agentx_context(lua_State *L)
+{
+  const char *context = luaL_checkstring(L, 1);
+
+  lua_pushboolean(L, agentx_session_add(context) != NULL);
+  return 1;
+}
+
+/* Accept AgentX sub-agents on TCP loopback port or Unix domain socket path,
+ * in SNMP agent mode after init */
+int
+smartsnmp_agentx_master(lua_State *L)
+{
+  int ret;
+
+  if (lua_type(L, 1) == LUA_TNUMBER) {
+    ret = agentx_master_init(lua_tointeger(L, 1), NULL);
+  } else {
+    ret = agentx_master_init(0, luaL_checkstring(L, 1));
+  }
+
+  lua_pushboolean(L, ret == 0);
+  return 1;
+}
+
+/* Wait in place for fd to be readable or timeout ms, for code that is not
+ * run by handlers and so cannot yield */
+int
+smartsnmp_poll_fd(lua_State *L)
+{
+  struct pollfd pfd;
+
+  pfd.fd = luaL_checkint(L, 1);
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  lua_pushboolean(L, poll(&pfd, pfd.fd >= 0 ? 1 : 0, luaL_optint(L, 2, -1)) > 0);
+  return 1;
+}
+
+/* Run shell command, return fd of its non-blocking stdout and pid */
+int
+smartsnmp_sh_spawn(lua_State *L)
+{
+  const char *command = luaL_checkstring(L, 1);
+  int fds[2];
+  pid_t pid;
+
+  if (pipe(fds) < 0) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    lua_pushnil(L);
+    return 1;
+  }
+
+  if (pid == 0) {
+    /* Own process group, for the whole command to be killed on timeout */
+    setpgid(0, 0);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+    _exit(127);
+  }
+
+  close(fds[1]);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  lua_pushinteger(L, fds[0]);
+  lua_pushinteger(L, pid);
+  return 2;
+}
+
+/* Read what is available on non-blocking fd, "" if nothing yet, nil at end */
+int
+smartsnmp_fd_read(lua_State *L)
+{
+  char buf[4096];
+  ssize_t len = read(luaL_checkint(L, 1), buf, sizeof(buf));
+
+  if (len > 0) {
+    lua_pushlstring(L, buf, len);
+  } else if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+    lua_pushliteral(L, "");
+  } else {
+    lua_pushnil(L);
+  }
+  return 1;
+}
+
+/* Close stdout of spawned command and reap it, killed first if told so */
+int
+smartsnmp_sh_reap(lua_State *L)
+{
+  int status;
+  pid_t pid = luaL_checkint(L, 2);
+
+  close(luaL_checkint(L, 1));
+  if (lua_toboolean(L, 3)) {
+    kill(-pid, SIGKILL);
+  }
+  waitpid(pid, &status, 0);
+  return 0;
+}
+
+/* Monotonic clock in milliseconds */
+int
+smartsnmp_time_ms(lua_State *L)
+{
+  lua_pushnumber(L, snmp_event_time());
+  return 1;
+}
+
 /* Register community string from Lua */
 int
 smartsnmp_mib_community_reg(lua_State *L)
@@ -228,6 +428,41 @@ smartsnmp_mib_user_reg(lua_State *L)
   return 0;
 }
 
+/* Set engine id text and boots file from Lua, either may be nil */
+int
+smartsnmp_usm_engine_init(lua_State *L)
+{
+  const char *id = luaL_optstring(L, 1, NULL);
+  const char *boots_path = luaL_optstring(L, 2, NULL);
+
+  lua_pushboolean(L, usm_engine_init(id, boots_path) == 0);
+  return 1;
+}
+
+/* Authenticate user with protocol and password from Lua */
+int
+smartsnmp_usm_user_reg(lua_State *L)
+{
+  const char *user = luaL_checkstring(L, 1);
+  const char *auth_proto = luaL_checkstring(L, 2);
+  const char *auth_passwd = luaL_checkstring(L, 3);
+
+  lua_pushboolean(L, usm_user_reg(user, auth_proto, auth_passwd) == 0);
+  return 1;
+}
+
+/* Encrypt messages of authenticated user with protocol and password from Lua */
+int
+smartsnmp_usm_user_priv_reg(lua_State *L)
+{
+  const char *user = luaL_checkstring(L, 1);
+  const char *priv_proto = luaL_checkstring(L, 2);
+  const char *priv_passwd = luaL_checkstring(L, 3);
+
+  lua_pushboolean(L, usm_user_priv_reg(user, priv_proto, priv_passwd) == 0);
+  return 1;
+}
+
 /* Unregister mib user string from Lua */
 int
 smartsnmp_mib_user_unreg(lua_State *L)
@@ -240,17 +475,249 @@ smartsnmp_mib_user_unreg(lua_State *L)
   return 0;
 }
 
+/* Send traps to host:port as community, at most rate per second after
+ * burst, 0 for no limit */
+int
+smartsnmp_trap_target_add(lua_State *L)
+{
+  const char *host = luaL_checkstring(L, 1);
+  int port = luaL_checkint(L, 2);
+  const char *community = luaL_checkstring(L, 3);
+  uint32_t rate = luaL_optint(L, 4, 0);
+  uint32_t burst = luaL_optint(L, 5, 0);
+
+  lua_pushboolean(L, snmp_trap_target_add(host, port, community, rate, burst) == 0);
+  return 1;
+}
+
+/* Send informs to host:port as community, at most window awaiting response,
+ * sent again after timeout ms doubled for each of retries */
+int
+smartsnmp_inform_target_add(lua_State *L)
+{
+  const char *host = luaL_checkstring(L, 1);
+  int port = luaL_checkint(L, 2);
+  const char *community = luaL_checkstring(L, 3);
+  uint32_t window = luaL_optint(L, 4, 8);
+  uint32_t timeout = luaL_optint(L, 5, 1000);
+  uint32_t retries = luaL_optint(L, 6, 3);
+
+  lua_pushboolean(L, snmp_inform_target_add(host, port, community, window, timeout, retries) == 0);
+  return 1;
+}
+
+/* Oid table at index into buf, return its length or 0 if not an oid */
+static uint32_t
+trap_oid_get(lua_State *L, int index, oid_t *buf)
+{
+  uint32_t i, len;
+
+  if (!lua_istable(L, index)) {
+    return 0;
+  }
+  len = lua_objlen(L, index);
+  if (len > MIB_OID_MAX_LEN) {
+    return 0;
+  }
+  for (i = 0; i < len; i++) {
+    lua_rawgeti(L, index, i + 1);
+    buf[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  return len;
+}
+
+/* Raise notification of trap oid with varbinds as { oid, tag, value }, to
+ * trap targets or through the AgentX session of context */
+int
+smartsnmp_trap_send(lua_State *L)
+{
+  struct snmp_trap *trap = NULL;
+  struct agentx_notify *notify = NULL;
+  oid_t oid[MIB_OID_MAX_LEN], obj[MIB_OID_MAX_LEN];
+  uint8_t ip[4];
+  uint32_t i, j, n, oid_len, len;
+  integer_t integer;
+  unsigned int uinteger;
+  const void *value;
+  uint8_t tag;
+
+  oid_len = trap_oid_get(L, 1, oid);
+  luaL_argcheck(L, oid_len > 0, 1, "notification oid expected");
+  luaL_checktype(L, 2, LUA_TTABLE);
+  if (prot_ops == &agentx_prot_ops) {
+    notify = agentx_notify_new(luaL_optstring(L, 3, ""), oid, oid_len);
+    if (notify == NULL) {
+      lua_pushboolean(L, 0);
+      return 1;
+    }
+  } else {
+    trap = snmp_trap_new(oid, oid_len);
+  }
+
+  n = lua_objlen(L, 2);
+  for (i = 0; i < n; i++) {
+    lua_rawgeti(L, 2, i + 1);
+    if (!lua_istable(L, -1)) {
+      lua_pop(L, 1);
+      continue;
+    }
+    lua_rawgeti(L, -1, 1);
+    lua_rawgeti(L, -2, 2);
+    lua_rawgeti(L, -3, 3);
+    /* varbind, oid, tag, value */
+    oid_len = trap_oid_get(L, lua_gettop(L) - 2, oid);
+    tag = lua_tointeger(L, -2);
+    len = 1;
+    switch (tag) {
+      case ASN1_TAG_INT:
+        integer = lua_tointeger(L, -1);
+        value = &integer;
+        break;
+      case ASN1_TAG_OCTSTR:
+        value = lua_tostring(L, -1);
+        len = lua_objlen(L, -1);
+        break;
+      case ASN1_TAG_CNT:
+      case ASN1_TAG_GAU:
+      case ASN1_TAG_TIMETICKS:
+        uinteger = lua_tonumber(L, -1);
+        value = &uinteger;
+        break;
+      case ASN1_TAG_IPADDR:
+        value = lua_istable(L, -1) ? ip : NULL;
+        len = 4;
+        for (j = 0; value != NULL && j < len; j++) {
+          lua_rawgeti(L, -1, j + 1);
+          ip[j] = lua_tointeger(L, -1);
+          lua_pop(L, 1);
+        }
+        break;
+      case ASN1_TAG_OBJID:
+        len = trap_oid_get(L, lua_gettop(L), obj);
+        value = len > 0 ? obj : NULL;
+        break;
+      default:
+        value = NULL;
+        break;
+    }
+    if (oid_len > 0 && value != NULL) {
+      if (notify != NULL) {
+        agentx_notify_vb_add(notify, oid, oid_len, tag, value, len);
+      } else {
+        snmp_trap_vb_add(trap, oid, oid_len, tag, value, len);
+      }
+    }
+    lua_pop(L, 4);
+  }
+
+  if (notify != NULL) {
+    agentx_notify_send(notify);
+  } else {
+    snmp_trap_send(trap);
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* Counters of notifications in a table */
+int
+smartsnmp_trap_stats(lua_State *L)
+{
+  const struct snmp_trap_stats *stats = snmp_trap_stats();
+
+  lua_createtable(L, 0, 6);
+  lua_pushnumber(L, stats->sent);
+  lua_setfield(L, -2, "sent");
+  lua_pushnumber(L, stats->merged);
+  lua_setfield(L, -2, "merged");
+  lua_pushnumber(L, stats->dropped);
+  lua_setfield(L, -2, "dropped");
+  lua_pushnumber(L, stats->inform_acked);
+  lua_setfield(L, -2, "inform_acked");
+  lua_pushnumber(L, stats->inform_retries);
+  lua_setfield(L, -2, "inform_retries");
+  lua_pushnumber(L, stats->inform_failed);
+  lua_setfield(L, -2, "inform_failed");
+  return 1;
+}
+
+/* Histograms of request stages and MIB groups, in ns */
+static int
+smartsnmp_latency_stats(lua_State *L)
+{
+  int i;
+
+  lua_createtable(L, latency_hist_cnt(), 0);
+  for (i = 0; i < latency_hist_cnt(); i++) {
+    const struct latency_hist *h = latency_hist_at(i);
+
+    lua_createtable(L, 0, 8);
+    lua_pushnumber(L, h->id);
+    lua_setfield(L, -2, "id");
+    lua_pushstring(L, h->name);
+    lua_setfield(L, -2, "name");
+    lua_pushnumber(L, h->count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, h->sum);
+    lua_setfield(L, -2, "sum");
+    lua_pushnumber(L, latency_percentile(h, 500));
+    lua_setfield(L, -2, "p50");
+    lua_pushnumber(L, latency_percentile(h, 900));
+    lua_setfield(L, -2, "p90");
+    lua_pushnumber(L, latency_percentile(h, 990));
+    lua_setfield(L, -2, "p99");
+    lua_pushnumber(L, h->max);
+    lua_setfield(L, -2, "max");
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+static int
+smartsnmp_latency_dump(lua_State *L)
+{
+  const char *path = luaL_optstring(L, 1, NULL);
+  uint32_t interval = luaL_optint(L, 2, 0);
+
+  if (path != NULL && interval != 0) {
+    lua_pushboolean(L, latency_dump_start(path, interval) == 0);
+  } else {
+    lua_pushboolean(L, latency_dump(path) == 0);
+  }
+  return 1;
+}
+
 static const luaL_Reg smartsnmp_func[] = {
   { "init", smartsnmp_init },
   { "open", smartsnmp_open },
   { "run", smartsnmp_run },
   { "exit", smartsnmp_exit },
   { "mib_node_reg", smartsnmp_mib_node_reg },
+  { "mib_native_reg", smartsnmp_mib_native_reg },
   { "mib_node_unreg", smartsnmp_mib_node_unreg },
+  { "request_peer", smartsnmp_request_peer },
+  { "request_context", smartsnmp_request_context },
+  { "agentx_context", smartsnmp_agentx_context },
+  { "agentx_master", smartsnmp_agentx_master },
+  { "poll_fd", smartsnmp_poll_fd },
+  { "sh_spawn", smartsnmp_sh_spawn },
+  { "fd_read", smartsnmp_fd_read },
+  { "sh_reap", smartsnmp_sh_reap },
+  { "time_ms", smartsnmp_time_ms },
   { "mib_community_reg", smartsnmp_mib_community_reg },
   { "mib_community_unreg", smartsnmp_mib_community_unreg },
   { "mib_user_reg", smartsnmp_mib_user_reg },
   { "mib_user_unreg", smartsnmp_mib_user_unreg },
+  { "usm_engine_init", smartsnmp_usm_engine_init },
+  { "usm_user_reg", smartsnmp_usm_user_reg },
+  { "usm_user_priv_reg", smartsnmp_usm_user_priv_reg },
+  { "trap_target_add", smartsnmp_trap_target_add },
+  { "inform_target_add", smartsnmp_inform_target_add },
+  { "trap_send", smartsnmp_trap_send },
+  { "trap_stats", smartsnmp_trap_stats },
+  { "latency_stats", smartsnmp_latency_stats },
+  { "latency_dump", smartsnmp_latency_dump },
   { NULL, NULL }
 };
 
@@ -34,20 +34,41 @@
 #include "mib.h"
 #include "util.h"
 
-struct snmp_datagram snmp_datagram;
+struct snmp_datagram *snmp_datagram_curr;
 
 /* Receive SNMP request datagram from transport layer */
 static void
-snmpd_receive(uint8_t *buf, int len)
+snmpd_receive(uint8_t *buf, int len, void *addr)
 {
-  snmpd_recv(buf, len);
+  snmpd_recv(buf, len, addr);
+  snmp_trap_poll();
 }
 
 /* Send SNMP response datagram to transport layer */
 static void
-snmpd_send(uint8_t *buf, int len)
+snmpd_send(uint8_t *buf, int len, const void *addr)
 {
-  snmp_trans_ops.send(buf, len);
+  snmp_trans_ops.send(buf, len, addr);
+}
+
+/* Address of the manager whose request is in process */
+static const char *
+snmpd_peer(void)
+{
+  if (snmp_datagram_curr == NULL || snmp_trans_ops.peer == NULL) {
+    return NULL;
+  }
+  return snmp_trans_ops.peer(snmp_datagram_curr->addr);
+}
+
+/* SNMPv3 context name of the request in process */
+static const char *
+snmpd_context(void)
+{
+  if (snmp_datagram_curr == NULL) {
+    return "";
+  }
+  return (const char *)snmp_datagram_curr->context_name;
 }
 
 /* Register mib group node */
@@ -57,6 +78,13 @@ snmpd_mib_node_reg(const oid_t *grp_id, int id_len, int grp_cb)
   return mib_node_reg(grp_id, id_len, grp_cb);
 }
 
+/* Register mib group node implemented in C */
+static int
+snmpd_mib_native_node_reg(const oid_t *grp_id, int id_len, mib_native_handler handler)
+{
+  return mib_native_node_reg(grp_id, id_len, handler);
+}
+
 /* Unregister mib group nodes */
 static int
 snmpd_mib_node_unreg(const oid_t *grp_id, int id_len)
@@ -68,8 +96,6 @@ snmpd_mib_node_unreg(const oid_t *grp_id, int id_len)
 static int
 snmpd_init(int port)
 {
-  INIT_LIST_HEAD(&snmp_datagram.vb_in_list);
-  INIT_LIST_HEAD(&snmp_datagram.vb_out_list);
   return snmp_trans_ops.init(port);
 }
 
@@ -100,7 +126,10 @@ struct protocol_operation snmp_prot_ops = {
   snmpd_close,
   snmpd_run,
   snmpd_mib_node_reg,
+  snmpd_mib_native_node_reg,
   snmpd_mib_node_unreg,
   snmpd_receive,
   snmpd_send,
+  snmpd_peer,
+  snmpd_context,
 };
@@ -23,6 +23,17 @@
 
 #include "asn1.h"
 #include "list.h"
+#include "mib.h"
+#include "util.h"
+
+/* msgFlags of SNMPv3 messages */
+#define SNMP_MSG_FLAG_AUTH    0x01
+#define SNMP_MSG_FLAG_PRIV    0x02
+#define SNMP_MSG_FLAG_REPORT  0x04
+
+/* Varbind list of a GETBULK response at most, what is left of the largest
+ * UDP datagram after headers */
+#define SNMP_BULK_LIST_MAX    (65507 - 1024)
 
 /* Error status */
 typedef enum snmp_err_stat {
@@ -55,12 +66,15 @@ typedef enum snmp_err_code {
   SNMP_ERR_OK                      = 0,
 
   SNMP_ERR_VERSION                 = -100,
+  SNMP_ERR_VERSION_UNSUPPORTED     = -101,
 
   SNMP_ERR_GLOBAL_DATA_LEN         = -200,
   SNMP_ERR_GLOBAL_ID               = -201,
   SNMP_ERR_GLOBAL_SIZE             = -202,
   SNMP_ERR_GLOBAL_FLAGS            = -203,
   SNMP_ERR_GLOBAL_MODEL            = -204,
+  SNMP_ERR_GLOBAL_FLAGS_LEN        = -205,
+  SNMP_ERR_GLOBAL_MODEL_UNKNOWN    = -206,
 
   SNMP_ERR_SECURITY_STR            = -300,
   SNMP_ERR_SECURITY_SEQ            = -301,
@@ -94,11 +108,78 @@ typedef enum snmp_err_code {
   SNMP_ERR_VB_VAR                  = -703,
   SNMP_ERR_VB_VALUE_LEN            = -704,
   SNMP_ERR_VB_OID_LEN              = -705,
+
+  SNMP_ERR_USM_USER                = -800,
+  SNMP_ERR_USM_SEC_LEVEL           = -801,
+  SNMP_ERR_USM_DIGEST              = -802,
+  SNMP_ERR_USM_DECRYPT             = -803,
+  SNMP_ERR_USM_ENGINE_ID           = -804,
+  SNMP_ERR_USM_TIME_WINDOW         = -805,
 } SNMP_ERR_CODE_E;
 
+/* snmp group counters of SNMPv2-MIB (RFC 3418), indexed by sub-id */
+enum snmp_stats_index {
+  SNMP_IN_PKTS = 1,
+  SNMP_OUT_PKTS,
+  SNMP_IN_BAD_VERSIONS,
+  SNMP_IN_BAD_COMMUNITY_NAMES,
+  SNMP_IN_BAD_COMMUNITY_USES,
+  SNMP_IN_ASN_PARSE_ERRS,
+  SNMP_IN_TOO_BIGS = 8,
+  SNMP_IN_NO_SUCH_NAMES,
+  SNMP_IN_BAD_VALUES,
+  SNMP_IN_READ_ONLYS,
+  SNMP_IN_GEN_ERRS,
+  SNMP_IN_TOTAL_REQ_VARS,
+  SNMP_IN_TOTAL_SET_VARS,
+  SNMP_IN_GET_REQUESTS,
+  SNMP_IN_GET_NEXTS,
+  SNMP_IN_SET_REQUESTS,
+  SNMP_IN_GET_RESPONSES,
+  SNMP_IN_TRAPS,
+  SNMP_OUT_TOO_BIGS,
+  SNMP_OUT_NO_SUCH_NAMES,
+  SNMP_OUT_BAD_VALUES,
+  SNMP_OUT_GEN_ERRS = 24,
+  SNMP_OUT_GET_REQUESTS,
+  SNMP_OUT_GET_NEXTS,
+  SNMP_OUT_SET_REQUESTS,
+  SNMP_OUT_GET_RESPONSES,
+  SNMP_OUT_TRAPS,
+  SNMP_ENABLE_AUTHEN_TRAPS,
+  SNMP_SILENT_DROPS,
+  SNMP_PROXY_DROPS,
+  SNMP_STATS_NUM,
+};
+
+/* snmpMPDStats counters (RFC 3412), indexed by sub-id */
+enum mpd_stats_index {
+  MPD_UNKNOWN_SECURITY_MODELS = 1,
+  MPD_INVALID_MSGS,
+  MPD_UNKNOWN_PDU_HANDLERS,
+  MPD_STATS_NUM,
+};
+
+/* usmStats counters (RFC 3414 5), in the order of their OIDs */
+enum usm_stats_index {
+  USM_STATS_UNSUPPORTED_SEC_LEVELS,
+  USM_STATS_NOT_IN_TIME_WINDOWS,
+  USM_STATS_UNKNOWN_USER_NAMES,
+  USM_STATS_UNKNOWN_ENGINE_IDS,
+  USM_STATS_WRONG_DIGESTS,
+  USM_STATS_DECRYPTION_ERRORS,
+  USM_STATS_NUM,
+};
+
+/* Bumped in place on the request path, read by the native groups */
+extern uint32_t snmp_stats[SNMP_STATS_NUM];
+extern uint32_t mpd_stats[MPD_STATS_NUM];
+extern uint32_t usm_stats[USM_STATS_NUM];
+
 struct var_bind {
   struct list_head link;
 
+  /* Stored after the value in the same block */
   oid_t *oid;
   uint32_t vb_len;
   uint32_t oid_len;
@@ -124,9 +205,13 @@ struct pdu_hdr {
   integer_t err_idx;
 };
 
+struct usm_user;
+
 struct snmp_datagram {
   void *recv_buf;
   void *send_buf;
+  /* Sender address from transport */
+  void *addr;
 
   uint32_t data_len;
   /* version */
@@ -153,8 +238,14 @@ struct snmp_datagram {
   uint32_t engine_time_len;
   octstr_t user_name[41];
   uint32_t user_name_len;
-  octstr_t auth_para[41];
+  octstr_t auth_para[49];
   uint32_t auth_para_len;
+  /* Offset of the MAC in the message being decoded or encoded */
+  uint32_t auth_para_off;
+  /* Authenticated user, NULL for unauthenticated messages */
+  struct usm_user *usm_user;
+  /* Offset of the scoped PDU in the message being encoded */
+  uint32_t scope_off;
   octstr_t priv_para[41];
   uint32_t priv_para_len;
   /* context */
@@ -171,9 +262,26 @@ struct snmp_datagram {
   uint32_t vb_out_cnt;
   struct list_head vb_in_list;
   struct list_head vb_out_list;
+  /* Storage of varbinds, released with the datagram */
+  struct arena vb_arena;
+
+  /* Request type and max repetitions of GETBULK */
+  uint8_t request;
+  uint32_t repeat;
+  /* Varbinds answered before the request was parked */
+  uint32_t vb_done;
+  /* Lua handlers parked in the request */
+  struct mib_async async;
+  /* Received at, in ns of the latency clock */
+  uint64_t stamp;
 };
 
-extern struct snmp_datagram snmp_datagram;
+/* Authoritative engine of this agent */
+extern octstr_t snmpv3_engine_id[];
+extern uint32_t snmpv3_engine_id_len;
+
+/* Request in process, NULL between requests */
+extern struct snmp_datagram *snmp_datagram_curr;
 
 uint32_t ber_value_enc_try(const void *value, uint32_t len, uint8_t type);
 uint32_t ber_value_enc(const void *value, uint32_t len, uint8_t type, uint8_t *buf);
@@ -184,12 +292,48 @@ uint32_t ber_value_dec_try(const uint8_t *buf, uint32_t len, uint8_t type);
 uint32_t ber_value_dec(const uint8_t *buf, uint32_t len, uint8_t type, void *value);
 uint32_t ber_length_dec_try(const uint8_t *buf);
 uint32_t ber_length_dec(const uint8_t *buf, uint32_t *value);
+uint32_t ber_tlv_dec(const uint8_t *buf, const uint8_t *end, uint8_t tag, uint32_t *value);
 
-void snmpd_recv(uint8_t *buf, int len);
+void snmpd_recv(uint8_t *buf, int len, void *addr);
+struct var_bind *snmp_vb_new(struct snmp_datagram *sdg, uint32_t oid_len, uint32_t val_len);
+void snmp_datagram_free(struct snmp_datagram *sdg);
 
 void snmp_get(struct snmp_datagram *sdg);
 void snmp_getnext(struct snmp_datagram *sdg);
 void snmp_set(struct snmp_datagram *sdg);
 void snmp_bulkget(struct snmp_datagram *sdg);
 void snmp_response(struct snmp_datagram *sdg);
+
+int usm_engine_init(const char *id, const char *boots_path);
+integer_t usm_engine_boots(void);
+integer_t usm_engine_time(void);
+int usm_user_reg(const char *name, const char *auth_proto, const char *auth_passwd);
+int usm_user_priv_reg(const char *name, const char *priv_proto, const char *priv_passwd);
+SNMP_ERR_CODE_E usm_incoming(struct snmp_datagram *sdg, uint8_t *msg, uint32_t len);
+SNMP_ERR_CODE_E usm_decrypt(struct snmp_datagram *sdg, uint8_t *data, uint32_t len);
+void usm_outgoing(struct snmp_datagram *sdg, uint8_t *msg, uint32_t len);
+void usm_report(struct snmp_datagram *sdg, SNMP_ERR_CODE_E err, const uint8_t *scope, uint32_t scope_len);
+
+struct snmp_trap;
+
+struct snmp_trap_stats {
+  /* Messages sent, with informs sent again */
+  uint32_t sent;
+  /* Notifications merged into queued ones */
+  uint32_t merged;
+  /* Notifications lost by targets behind */
+  uint32_t dropped;
+  uint32_t inform_acked;
+  uint32_t inform_retries;
+  uint32_t inform_failed;
+};
+
+int snmp_trap_target_add(const char *host, int port, const char *community, uint32_t rate, uint32_t burst);
+int snmp_inform_target_add(const char *host, int port, const char *community, uint32_t window, uint32_t timeout, uint32_t retries);
+struct snmp_trap *snmp_trap_new(const oid_t *trap_oid, uint32_t oid_len);
+void snmp_trap_vb_add(struct snmp_trap *trap, const oid_t *oid, uint32_t oid_len, uint8_t tag, const void *value, uint32_t len);
+void snmp_trap_send(struct snmp_trap *trap);
+void snmp_inform_response(integer_t request_id, const void *addr);
+void snmp_trap_poll(void);
+const struct snmp_trap_stats *snmp_trap_stats(void);
 #endif /* _SNMP_H_ */
@@ -59,6 +59,7 @@ ber_value_dec_try(const uint8_t *buf, uint32_t len, uint8_t type)
     case ASN1_TAG_CNT:
     case ASN1_TAG_GAU:
     case ASN1_TAG_TIMETICKS:
+    case ASN1_TAG_CNT64:
       ret = 1;
       break;
     case ASN1_TAG_OBJID:
@@ -85,13 +86,15 @@ ber_value_dec_try(const uint8_t *buf, uint32_t len, uint8_t type)
 static uint32_t
 ber_int_dec(const uint8_t *buf, uint32_t len, int *value)
 {
+  unsigned int v;
   int i, j;
 
-  *value = 0;
+  /* Shifted unsigned, sign bits of a long form just fall off */
+  v = 0;
 
   if (buf[0] & 0x80) {
-    for (i = 0, j = 0; j < sizeof(int) - len; j++) {
-      *value = (*value << 8) | 0xff;
+    for (i = 0, j = len; j < sizeof(int); j++) {
+      v = (v << 8) | 0xff;
     }
   } else {
     i = 0;
@@ -101,9 +104,10 @@ ber_int_dec(const uint8_t *buf, uint32_t len, int *value)
   }
 
   while (i < len) {
-    *value = (*value << 8) | buf[i++];
+    v = (v << 8) | buf[i++];
   }
 
+  *value = (int)v;
   return 1;
 }
 
@@ -129,6 +133,22 @@ ber_uint_dec(const uint8_t *buf, uint32_t len, unsigned int *value)
   return 1;
 }
 
+/* Input:  buffer, byte length;
+ * Output: 64-bit unsigned interger pointer
+ * Return: number of elements
+ */
+static uint32_t
+ber_uint64_dec(const uint8_t *buf, uint32_t len, uint64_t *value)
+{
+  int i;
+
+  *value = 0;
+  for (i = 0; i < len; i++) {
+    *value = (*value << 8) | buf[i];
+  }
+
+  return 1;
+}
 
 /* Input:  buffer, byte length;
  * Output: oid pointer
@@ -168,13 +188,16 @@ ber_value_dec(const uint8_t *buf, uint32_t len, uint8_t type, void *value)
 
   switch (type) {
     case ASN1_TAG_INT:
-    case ASN1_TAG_CNT:
       ret = ber_int_dec(buf, len, value);
       break;
+    case ASN1_TAG_CNT:
     case ASN1_TAG_GAU:
     case ASN1_TAG_TIMETICKS:
       ret = ber_uint_dec(buf, len, value);
       break;
+    case ASN1_TAG_CNT64:
+      ret = ber_uint64_dec(buf, len, value);
+      break;
     case ASN1_TAG_OBJID:
       ret = ber_oid_dec(buf, len, value);
       break;
@@ -229,3 +252,30 @@ ber_length_dec(const uint8_t *buf, uint32_t *value)
 
   return len;
 }
+
+/* Input:  buffer, end of buffer, tag expected;
+ * Output: value length
+ * Return: bytes of tag and length, 0 if the tag differs or the value runs
+ *         past the end
+ */
+uint32_t
+ber_tlv_dec(const uint8_t *buf, const uint8_t *end, uint8_t tag, uint32_t *value)
+{
+  uint32_t len_len;
+
+  if (end - buf < 2 || buf[0] != tag) {
+    return 0;
+  }
+
+  /* Definite lengths of at most 32 bits */
+  len_len = ber_length_dec_try(buf + 1);
+  if (len_len > 1 + sizeof(uint32_t) || buf[1] == 0x80 || len_len > end - buf - 1) {
+    return 0;
+  }
+  ber_length_dec(buf + 1, value);
+  if (*value > end - buf - 1 - len_len) {
+    return 0;
+  }
+
+  return 1 + len_len;
+}
@@ -128,6 +128,22 @@ ber_uint_enc_try(unsigned int value)
   return len;
 }
 
+/* Input:  64-bit unsigned integer value
+ * Output: none
+ * Return: byte length.
+ */
+static uint32_t
+ber_uint64_enc_try(uint64_t value)
+{
+  uint32_t len = 1;
+
+  while (value > 0x7f) {
+    value >>= 8;
+    len++;
+  }
+
+  return len;
+}
 
 /* Input:  oid pointer, number of elements
  * Output: none
@@ -172,15 +188,18 @@ ber_value_enc_try(const void *value, uint32_t len, uint8_t type)
 
   switch (type) {
     case ASN1_TAG_INT:
-    case ASN1_TAG_CNT:
       inter = (const int *)value;
       ret = ber_int_enc_try(*inter);
       break;
+    case ASN1_TAG_CNT:
     case ASN1_TAG_GAU:
     case ASN1_TAG_TIMETICKS:
       uinter = (const unsigned int *)value;
       ret = ber_uint_enc_try(*uinter);
       break;
+    case ASN1_TAG_CNT64:
+      ret = ber_uint64_enc_try(*(const uint64_t *)value);
+      break;
     case ASN1_TAG_OBJID:
       oid = (const oid_t *)value;
       ret = ber_oid_enc_try(oid, len);
@@ -311,6 +330,22 @@ ber_uint_enc(int value, uint8_t *buf)
   return j;
 }
 
+/* Input:  64-bit unsigned integer value
+ * Output: buffer
+ * Return: byte length.
+ */
+static uint32_t
+ber_uint64_enc(uint64_t value, uint8_t *buf)
+{
+  uint32_t i, len = ber_uint64_enc_try(value);
+
+  for (i = len; i > 0; i--) {
+    buf[i - 1] = value & 0xff;
+    value >>= 8;
+  }
+
+  return len;
+}
 
 /* Input:  oid pointer, number of elements
  * Output: buffer
@@ -362,15 +397,18 @@ ber_value_enc(const void *value, uint32_t len, uint8_t type, uint8_t *buf)
 
   switch (type) {
     case ASN1_TAG_INT:
-    case ASN1_TAG_CNT:
       inter = (const int *)value;
       ret = ber_int_enc(*inter, buf);
       break;
+    case ASN1_TAG_CNT:
     case ASN1_TAG_GAU:
     case ASN1_TAG_TIMETICKS:
       uinter = (const unsigned int *)value;
       ret = ber_uint_enc(*uinter, buf);
       break;
+    case ASN1_TAG_CNT64:
+      ret = ber_uint64_enc(*(const uint64_t *)value, buf);
+      break;
     case ASN1_TAG_OBJID:
       oid = (const oid_t *)value;
       ret = ber_oid_enc(oid, len, buf);
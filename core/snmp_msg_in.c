@@ -25,18 +25,22 @@
 
 #include "mib.h"
 #include "snmp.h"
+#include "latency.h"
 #include "util.h"
 
 static struct err_msg_map snmp_err_msg[] = {
   { SNMP_ERR_OK, "Every thing is OK!" },
 
   { SNMP_ERR_VERSION, "SNMP version tag should be integer!" },
+  { SNMP_ERR_VERSION_UNSUPPORTED, "SNMP version unsupported!" },
 
   { SNMP_ERR_GLOBAL_DATA_LEN, "SNMP global data tag should be sequence!" },
   { SNMP_ERR_GLOBAL_ID, "SNMP message id tag should be integer!" },
   { SNMP_ERR_GLOBAL_SIZE, "SNMP message max size tag should be integer!" },
   { SNMP_ERR_GLOBAL_FLAGS, "SNMP message flags tag should be octect string!" },
   { SNMP_ERR_GLOBAL_MODEL, "SNMP security model tag should be integer!" },
+  { SNMP_ERR_GLOBAL_FLAGS_LEN, "SNMP message flags should be one byte!" },
+  { SNMP_ERR_GLOBAL_MODEL_UNKNOWN, "SNMP security model unknown!" },
 
   { SNMP_ERR_SECURITY_STR, "SNMP security string tag should be octect string!" },
   { SNMP_ERR_SECURITY_SEQ, "SNMP security tag should be sequence!" },
@@ -70,61 +74,95 @@ static struct err_msg_map snmp_err_msg[] = {
   { SNMP_ERR_VB_VAR, "SNMP varbind allocation fail!" },
   { SNMP_ERR_VB_VALUE_LEN, "SNMP varbind value length exceeds!" },
   { SNMP_ERR_VB_OID_LEN, "SNMP varbind oid length exceeds!" },
+
+  { SNMP_ERR_USM_USER, "SNMP USM user name unknown!" },
+  { SNMP_ERR_USM_SEC_LEVEL, "SNMP USM security level unsupported for the user!" },
+  { SNMP_ERR_USM_DIGEST, "SNMP USM authentication digest wrong!" },
+  { SNMP_ERR_USM_DECRYPT, "SNMP USM encrypted PDU malformed!" },
+  { SNMP_ERR_USM_ENGINE_ID, "SNMP USM engine id unknown!" },
+  { SNMP_ERR_USM_TIME_WINDOW, "SNMP USM message not in time window!" },
 };
 
-static struct var_bind *
-vb_new(uint32_t oid_len, uint32_t val_len)
+uint32_t snmp_stats[SNMP_STATS_NUM] = {
+  /* Authentication failures raise no notification */
+  [SNMP_ENABLE_AUTHEN_TRAPS] = 2,
+};
+uint32_t mpd_stats[MPD_STATS_NUM];
+
+/* Varbind with room for oid_len sub-ids after val_len bytes of value */
+struct var_bind *
+snmp_vb_new(struct snmp_datagram *sdg, uint32_t oid_len, uint32_t val_len)
 {
-  struct var_bind *vb = xmalloc(sizeof(*vb) + val_len);
-  vb->oid = xmalloc(oid_len * sizeof(oid_t));
+  uint32_t val_size = ARENA_ALIGN(val_len);
+  struct var_bind *vb = arena_alloc(&sdg->vb_arena, sizeof(*vb) + val_size + oid_len * sizeof(oid_t));
+  vb->oid = (oid_t *)(vb->value + val_size);
   return vb;
 }
 
-static void
-vb_delete(struct var_bind *vb)
-{
-  free(vb->oid);
-  free(vb);
-}
+static void snmp_request_resume(struct mib_async *async);
 
-static void
-snmp_vb_list_free(struct list_head *vb_list)
+/* Contexts of finished requests kept for reuse */
+#define SNMP_DATAGRAM_POOL_SIZE  32
+
+static struct snmp_datagram *sdg_pool[SNMP_DATAGRAM_POOL_SIZE];
+static int sdg_pool_cnt;
+
+/* Each request has its own datagram, freed once responded or dropped */
+static struct snmp_datagram *
+snmp_datagram_new(uint8_t *buf, void *addr)
 {
-  struct list_head *pos, *n;
+  struct snmp_datagram *sdg;
+  struct arena vb_arena = { NULL };
 
-  list_for_each_safe(pos, n, vb_list) {
-    struct var_bind *vb = list_entry(pos, struct var_bind, link);
-    list_del(&vb->link);
-    vb_delete(vb);
+  if (sdg_pool_cnt > 0) {
+    sdg = sdg_pool[--sdg_pool_cnt];
+    vb_arena = sdg->vb_arena;
+  } else {
+    sdg = xmalloc(sizeof(*sdg));
   }
-}
 
-static void
-snmp_datagram_clear(struct snmp_datagram *sdg)
-{
-  snmp_vb_list_free(&sdg->vb_in_list);
-  snmp_vb_list_free(&sdg->vb_out_list);
   memset(sdg, 0, sizeof(*sdg));
+  sdg->vb_arena = vb_arena;
   INIT_LIST_HEAD(&sdg->vb_in_list);
   INIT_LIST_HEAD(&sdg->vb_out_list);
+  mib_async_init(&sdg->async, snmp_request_resume);
+  sdg->recv_buf = buf;
+  sdg->addr = addr;
+  return sdg;
+}
+
+void
+snmp_datagram_free(struct snmp_datagram *sdg)
+{
+  mib_async_free(&sdg->async);
+  free(sdg->recv_buf);
+  free(sdg->addr);
+
+  if (sdg_pool_cnt < SNMP_DATAGRAM_POOL_SIZE) {
+    arena_reset(&sdg->vb_arena);
+    sdg_pool[sdg_pool_cnt++] = sdg;
+  } else {
+    arena_free(&sdg->vb_arena);
+    free(sdg);
+  }
 }
 
-/* Alloc buffer for var bind decoding */
+/* Alloc buffer for decoding the var bind between buf and end */
 static struct var_bind *
-var_bind_alloc(uint8_t *buf, enum snmp_err_code *err)
+var_bind_alloc(struct snmp_datagram *sdg, uint8_t *buf, const uint8_t *end, enum snmp_err_code *err)
 {
   struct var_bind *vb;
-  uint8_t oid_type, val_type;
-  uint32_t oid_len, oid_dec_len, val_len;
+  uint8_t val_type;
+  uint32_t hdr_len, oid_len, oid_dec_len, val_len;
   uint8_t *buf1;
 
   /* OID */
-  oid_type = *buf++;
-  if (oid_type != ASN1_TAG_OBJID) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OBJID, &oid_len);
+  if (hdr_len == 0) {
     *err = SNMP_ERR_VB_OID_TYPE;
     return NULL;
   }
-  buf += ber_length_dec(buf, &oid_len);
+  buf += hdr_len;
   buf1 = buf;
   buf += oid_len;
 
@@ -135,21 +173,27 @@ var_bind_alloc(uint8_t *buf, enum snmp_err_code *err)
     return NULL;
   }
 
-  /* Value */
-  val_type = *buf++;
-  buf += ber_length_dec(buf, &val_len);
+  /* Value of any type */
+  hdr_len = buf < end ? ber_tlv_dec(buf, end, buf[0], &val_len) : 0;
+  if (hdr_len == 0) {
+    *err = SNMP_ERR_VB_VALUE_LEN;
+    return NULL;
+  }
+  val_type = buf[0];
+  buf += hdr_len;
   if (val_len > MIB_VALUE_MAX_LEN) {
     *err = SNMP_ERR_VB_VALUE_LEN;
     return NULL;
   }
-
-  /* Varbind allocation */
-  vb = vb_new(oid_dec_len, val_len);
-  if (vb == NULL) {
-    *err = SNMP_ERR_VB_VAR;
+  /* Oid values are decoded into a variable later on */
+  if (val_type == ASN1_TAG_OBJID && ber_value_dec_try(buf, val_len, ASN1_TAG_OBJID) > MIB_OID_MAX_LEN) {
+    *err = SNMP_ERR_VB_VALUE_LEN;
     return NULL;
   }
 
+  /* Varbind allocation */
+  vb = snmp_vb_new(sdg, oid_dec_len, val_len);
+
   /* vb->oid_len is the actual length of oid */
   vb->oid_len = ber_value_dec(buf1, oid_len, ASN1_TAG_OBJID, vb->oid);
 
@@ -164,43 +208,53 @@ var_bind_alloc(uint8_t *buf, enum snmp_err_code *err)
 
 /* Parse PDU header */
 static SNMP_ERR_CODE_E
-pdu_hdr_parse(struct snmp_datagram *sdg, uint8_t **buffer)
+pdu_hdr_parse(struct snmp_datagram *sdg, uint8_t **buffer, const uint8_t *end)
 {
   SNMP_ERR_CODE_E err;
   struct pdu_hdr *ph;
+  uint32_t hdr_len;
   uint8_t *buf;
 
   err = SNMP_ERR_OK;
   buf = *buffer;
   ph = &sdg->pdu_hdr;
 
-  ph->pdu_type = *buf++;
-  buf += ber_length_dec(buf, &ph->pdu_len);
+  /* PDU of any type */
+  hdr_len = buf < end ? ber_tlv_dec(buf, end, buf[0], &ph->pdu_len) : 0;
+  if (hdr_len == 0) {
+    err = SNMP_ERR_PDU_LEN;
+    return err;
+  }
+  ph->pdu_type = buf[0];
+  buf += hdr_len;
 
   /* Request ID */
-  if (*buf++ != ASN1_TAG_INT) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_INT, &ph->req_id_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_PDU_REQID;
     return err;
   }
-  buf += ber_length_dec(buf, &ph->req_id_len);
+  buf += hdr_len;
   ber_value_dec(buf, ph->req_id_len, ASN1_TAG_INT, &ph->req_id);
   buf += ph->req_id_len;
 
   /* Error status */
-  if (*buf++ != ASN1_TAG_INT) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_INT, &ph->err_stat_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_PDU_ERRSTAT;
     return err;
   }
-  buf += ber_length_dec(buf, &ph->err_stat_len);
+  buf += hdr_len;
   ber_value_dec(buf, ph->err_stat_len, ASN1_TAG_INT, &ph->err_stat);
   buf += ph->err_stat_len;
 
   /* Error index */
-  if (*buf++ != ASN1_TAG_INT) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_INT, &ph->err_idx_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_PDU_ERRIDX;
     return err;
   }
-  buf += ber_length_dec(buf, &ph->err_idx_len);
+  buf += hdr_len;
   ber_value_dec(buf, ph->err_idx_len, ASN1_TAG_INT, &ph->err_idx);
   buf += ph->err_idx_len;
 
@@ -210,35 +264,36 @@ pdu_hdr_parse(struct snmp_datagram *sdg, uint8_t **buffer)
 
 /* Parse varbind */
 static SNMP_ERR_CODE_E
-var_bind_parse(struct snmp_datagram *sdg, uint8_t **buffer)
+var_bind_parse(struct snmp_datagram *sdg, uint8_t **buffer, const uint8_t *end)
 {
   SNMP_ERR_CODE_E err;
   struct var_bind *vb;
   uint8_t *buf;
-  uint32_t vb_len, len_len;
-  const uint32_t tag_len = 1;
+  uint32_t hdr_len, vb_list_len, vb_len;
 
   err = SNMP_ERR_OK;
   buf = *buffer;
 
-  /* Varbind sequence length */
-  if (*buf++ != ASN1_TAG_SEQ) {
+  /* Varbind sequence length, sdg->vb_list_len is left for the response */
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_SEQ, &vb_list_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_VB_LIST_SEQ;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->vb_list_len);
+  buf += hdr_len;
+  end = buf + vb_list_len;
 
-  while (sdg->vb_list_len > 0) {
+  while (buf < end) {
     /* check vb_list type */
-    if (*buf++ != ASN1_TAG_SEQ) {
+    hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_SEQ, &vb_len);
+    if (hdr_len == 0) {
       err = SNMP_ERR_VB_SEQ;
       break;
     }
-    len_len = ber_length_dec(buf, &vb_len);
-    buf += len_len;
+    buf += hdr_len;
 
     /* Alloc a new var_bind and add into var_bind list. */
-    vb = var_bind_alloc(buf, &err);
+    vb = var_bind_alloc(sdg, buf, buf + vb_len, &err);
     if (vb == NULL) {
       break;
     }
@@ -246,7 +301,6 @@ var_bind_parse(struct snmp_datagram *sdg, uint8_t **buffer)
     sdg->vb_in_cnt++;
 
     buf += vb_len;
-    sdg->vb_list_len -= tag_len + len_len + vb_len;
   }
 
   *buffer = buf;
@@ -255,49 +309,63 @@ var_bind_parse(struct snmp_datagram *sdg, uint8_t **buffer)
 
 /* Global data */
 static SNMP_ERR_CODE_E
-global_data_decode(struct snmp_datagram *sdg, uint8_t **buffer)
+global_data_decode(struct snmp_datagram *sdg, uint8_t **buffer, const uint8_t *end)
 {
   SNMP_ERR_CODE_E err;
+  uint32_t hdr_len;
   uint8_t *buf;
 
   err = SNMP_ERR_OK;
   buf = *buffer;
 
   /* Global ID */
-  if (*buf++ != ASN1_TAG_INT) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_INT, &sdg->msg_id_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_GLOBAL_ID;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->msg_id_len);
+  buf += hdr_len;
   ber_value_dec(buf, sdg->msg_id_len, ASN1_TAG_INT, &sdg->msg_id);
   buf += sdg->msg_id_len;
 
   /* Global max size */
-  if (*buf++ != ASN1_TAG_INT) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_INT, &sdg->msg_size_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_GLOBAL_SIZE;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->msg_size_len);
+  buf += hdr_len;
   ber_value_dec(buf, sdg->msg_size_len, ASN1_TAG_INT, &sdg->msg_max_size);
   buf += sdg->msg_size_len;
 
   /* Global flags */
-  if (*buf++ != ASN1_TAG_OCTSTR) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OCTSTR, &sdg->msg_flags_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_GLOBAL_FLAGS;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->msg_flags_len);
+  buf += hdr_len;
+  if (sdg->msg_flags_len != 1) {
+    err = SNMP_ERR_GLOBAL_FLAGS_LEN;
+    return err;
+  }
   ber_value_dec(buf, sdg->msg_flags_len, ASN1_TAG_OCTSTR, &sdg->msg_flags);
   buf += sdg->msg_flags_len;
 
   /* Global security model */
-  if (*buf++ != ASN1_TAG_INT) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_INT, &sdg->msg_model_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_GLOBAL_MODEL;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->msg_model_len);
+  buf += hdr_len;
   ber_value_dec(buf, sdg->msg_model_len, ASN1_TAG_INT, &sdg->msg_security_model);
   buf += sdg->msg_model_len;
+  /* USM is the only one */
+  if (sdg->msg_security_model != 3) {
+    err = SNMP_ERR_GLOBAL_MODEL_UNKNOWN;
+    return err;
+  }
 
   *buffer = buf;
   return err;
@@ -305,34 +373,38 @@ global_data_decode(struct snmp_datagram *sdg, uint8_t **buffer)
 
 /* Security parameter  */
 static SNMP_ERR_CODE_E
-security_parameter_decode(struct snmp_datagram *sdg, uint8_t **buffer)
+security_parameter_decode(struct snmp_datagram *sdg, uint8_t **buffer, const uint8_t *end)
 {
   SNMP_ERR_CODE_E err;
+  uint32_t hdr_len;
   uint8_t *buf;
 
   err = SNMP_ERR_OK;
   buf = *buffer;
 
   /* Security string length */
-  if (*buf++ != ASN1_TAG_OCTSTR) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OCTSTR, &sdg->secur_str_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_SECURITY_STR;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->secur_str_len);
+  buf += hdr_len;
 
   /* Security sequence length */
-  if (*buf++ != ASN1_TAG_SEQ) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_SEQ, &sdg->secur_para_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_SECURITY_SEQ;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->secur_para_len);
+  buf += hdr_len;
 
   /* Engine ID */
-  if (*buf++ != ASN1_TAG_OCTSTR) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OCTSTR, &sdg->engine_id_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_SECURITY_ENGINE_ID;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->engine_id_len);
+  buf += hdr_len;
   if (sdg->engine_id_len + 1 > sizeof(sdg->engine_id)) {
     err = SNMP_ERR_SECURITY_ENGINE_ID_LEN;
     return err;
@@ -341,29 +413,32 @@ security_parameter_decode(struct snmp_datagram *sdg, uint8_t **buffer)
   buf += sdg->engine_id_len;
 
   /* Engine boots */
-  if (*buf++ != ASN1_TAG_INT) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_INT, &sdg->engine_boots_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_SECURITY_ENGINE_BOOTS;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->engine_boots_len);
+  buf += hdr_len;
   ber_value_dec(buf, sdg->engine_boots_len, ASN1_TAG_INT, &sdg->engine_boots);
   buf += sdg->engine_boots_len;
 
   /* Engine time */
-  if (*buf++ != ASN1_TAG_INT) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_INT, &sdg->engine_time_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_SECURITY_ENGINE_TIME;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->engine_time_len);
+  buf += hdr_len;
   ber_value_dec(buf, sdg->engine_time_len, ASN1_TAG_INT, &sdg->engine_time);
   buf += sdg->engine_time_len;
 
   /* User name */
-  if (*buf++ != ASN1_TAG_OCTSTR) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OCTSTR, &sdg->user_name_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_SECURITY_USER_NAME;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->user_name_len);
+  buf += hdr_len;
   if (sdg->user_name_len + 1 > sizeof(sdg->user_name)) {
     err = SNMP_ERR_SECURITY_USER_NAME_LEN;
     return err;
@@ -372,24 +447,27 @@ security_parameter_decode(struct snmp_datagram *sdg, uint8_t **buffer)
   buf += sdg->user_name_len;
 
   /* Authorative parameter */
-  if (*buf++ != ASN1_TAG_OCTSTR) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OCTSTR, &sdg->auth_para_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_SECURITY_AUTH_PARA;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->auth_para_len);
+  buf += hdr_len;
   if (sdg->auth_para_len + 1 > sizeof(sdg->auth_para)) {
     err = SNMP_ERR_SECURITY_AUTH_PARA_LEN;
     return err;
   }
+  sdg->auth_para_off = buf - (uint8_t *)sdg->recv_buf;
   ber_value_dec(buf, sdg->auth_para_len, ASN1_TAG_OCTSTR, &sdg->auth_para);
   buf += sdg->auth_para_len;
 
   /* Privative parameter */
-  if (*buf++ != ASN1_TAG_OCTSTR) {
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OCTSTR, &sdg->priv_para_len);
+  if (hdr_len == 0) {
     err = SNMP_ERR_SECURITY_ENGINE_TIME;
     return err;
   }
-  buf += ber_length_dec(buf, &sdg->priv_para_len);
+  buf += hdr_len;
   if (sdg->priv_para_len + 1 > sizeof(sdg->priv_para)) {
     err = SNMP_ERR_SECURITY_PRIV_PARA_LEN;
     return err;
@@ -401,40 +479,82 @@ security_parameter_decode(struct snmp_datagram *sdg, uint8_t **buffer)
   return err;
 }
 
-/* Decode snmp datagram */
+/* Count message dropped by decoding with err */
 static void
+snmp_decode_drop(SNMP_ERR_CODE_E err)
+{
+  switch (err) {
+    case SNMP_ERR_VERSION_UNSUPPORTED:
+      snmp_stats[SNMP_IN_BAD_VERSIONS]++;
+      break;
+    case SNMP_ERR_GLOBAL_FLAGS_LEN:
+      mpd_stats[MPD_INVALID_MSGS]++;
+      break;
+    case SNMP_ERR_GLOBAL_MODEL_UNKNOWN:
+      mpd_stats[MPD_UNKNOWN_SECURITY_MODELS]++;
+      break;
+    case SNMP_ERR_USM_USER:
+    case SNMP_ERR_USM_SEC_LEVEL:
+    case SNMP_ERR_USM_DIGEST:
+    case SNMP_ERR_USM_DECRYPT:
+    case SNMP_ERR_USM_ENGINE_ID:
+    case SNMP_ERR_USM_TIME_WINDOW:
+      /* In usmStats by usm_report() */
+      break;
+    default:
+      snmp_stats[SNMP_IN_ASN_PARSE_ERRS]++;
+      break;
+  }
+}
+
+/* Decode snmp datagram, return -1 on failure */
+static int
 snmp_decode(struct snmp_datagram *sdg)
 {
   SNMP_ERR_CODE_E err;
-  uint8_t *buf, dec_fail = 0;
+  uint8_t *buf, *end, dec_fail = 0;
+  uint32_t hdr_len, total_len;
   const uint32_t tag_len = 1;
+  int rest;
 
-  /* Skip tag and length */
+  /* Skip tag and length, checked to span the datagram by snmpd_recv() */
   buf = sdg->recv_buf + tag_len;
-  buf += ber_length_dec(buf, &snmp_datagram.data_len);
+  buf += ber_length_dec(buf, &sdg->data_len);
+  total_len = buf - (uint8_t *)sdg->recv_buf + sdg->data_len;
+  end = (uint8_t *)sdg->recv_buf + total_len;
 
   /* Version */
-  if (*buf++ != ASN1_TAG_INT) {
-    SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_VERSION, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_VERSION));
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_INT, &sdg->ver_len);
+  if (hdr_len == 0) {
+    err = SNMP_ERR_VERSION;
+    SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
     dec_fail = 1;
     goto DECODE_FINISH;
   }
-  buf += ber_length_dec(buf, &sdg->ver_len);
+  buf += hdr_len;
   ber_value_dec(buf, sdg->ver_len, ASN1_TAG_INT, &sdg->version);
   buf += sdg->ver_len;
+  if (sdg->version != 0 && sdg->version != 1 && sdg->version != 3) {
+    err = SNMP_ERR_VERSION_UNSUPPORTED;
+    SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
+    dec_fail = 1;
+    goto DECODE_FINISH;
+  }
 
   /* SNMPv3 */
   if (sdg->version >= 3) {
     /* Global data length */
-    if (*buf++ != ASN1_TAG_SEQ) {
-      SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_GLOBAL_DATA_LEN, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_GLOBAL_DATA_LEN));
+    hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_SEQ, &sdg->msg_len);
+    if (hdr_len == 0) {
+      err = SNMP_ERR_GLOBAL_DATA_LEN;
+      SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
       dec_fail = 1;
       goto DECODE_FINISH;
     }
-    buf += ber_length_dec(buf, &sdg->msg_len);
+    buf += hdr_len;
  
     /* Global data */
-    err = global_data_decode(sdg, &buf);
+    err = global_data_decode(sdg, &buf, end);
     if (err) { 
       SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
       dec_fail = 1;
@@ -442,30 +562,65 @@ snmp_decode(struct snmp_datagram *sdg)
     }
 
     /* Security parameter */
-    err = security_parameter_decode(sdg, &buf);
+    err = security_parameter_decode(sdg, &buf, end);
     if (err) { 
       SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
       dec_fail = 1;
       goto DECODE_FINISH;
     }
 
+    /* Authenticate the whole message before the rest is trusted */
+    err = usm_incoming(sdg, sdg->recv_buf, total_len);
+    if (err) {
+      /* Managers discovering engine id and time are no error */
+      if (err != SNMP_ERR_USM_ENGINE_ID && err != SNMP_ERR_USM_TIME_WINDOW) {
+        SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
+      }
+      rest = end - buf;
+      usm_report(sdg, err, buf, rest > 0 ? rest : 0);
+      dec_fail = 1;
+      goto DECODE_FINISH;
+    }
+
+    /* Encrypted scoped PDU is decrypted in place */
+    if (sdg->msg_flags & SNMP_MSG_FLAG_PRIV) {
+      uint32_t len;
+      err = SNMP_ERR_USM_DECRYPT;
+      hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OCTSTR, &len);
+      if (hdr_len != 0) {
+        buf += hdr_len;
+        err = usm_decrypt(sdg, buf, len);
+      }
+      if (err) {
+        SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
+        usm_report(sdg, err, NULL, 0);
+        dec_fail = 1;
+        goto DECODE_FINISH;
+      }
+    }
+
     /* Scope PDU length */
-    if (*buf++ != ASN1_TAG_SEQ) {
-      SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_SCOPE_PDU_SEQ, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_SCOPE_PDU_SEQ));
+    hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_SEQ, &sdg->scope_len);
+    if (hdr_len == 0) {
+      err = SNMP_ERR_SCOPE_PDU_SEQ;
+      SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
       dec_fail = 1;
       goto DECODE_FINISH;
     }
-    buf += ber_length_dec(buf, &sdg->scope_len);
+    buf += hdr_len;
 
     /* Context ID */
-    if (*buf++ != ASN1_TAG_OCTSTR) {
-      SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_CONTEXT_ID, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_CONTEXT_ID));
+    hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OCTSTR, &sdg->context_id_len);
+    if (hdr_len == 0) {
+      err = SNMP_ERR_CONTEXT_ID;
+      SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
       dec_fail = 1;
       goto DECODE_FINISH;
     }
-    buf += ber_length_dec(buf, &sdg->context_id_len);
+    buf += hdr_len;
     if (sdg->context_id_len + 1 > sizeof(sdg->context_id)) {
-      SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_CONTEXT_ID_LEN, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_CONTEXT_ID_LEN));
+      err = SNMP_ERR_CONTEXT_ID_LEN;
+      SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
       dec_fail = 1;
       goto DECODE_FINISH;
     }
@@ -474,14 +629,17 @@ snmp_decode(struct snmp_datagram *sdg)
   }
 
   /* Context name */
-  if (*buf++ != ASN1_TAG_OCTSTR) {
-    SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_CONTEXT_NAME, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_CONTEXT_NAME));
+  hdr_len = ber_tlv_dec(buf, end, ASN1_TAG_OCTSTR, &sdg->context_name_len);
+  if (hdr_len == 0) {
+    err = SNMP_ERR_CONTEXT_NAME;
+    SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
     dec_fail = 1;
     goto DECODE_FINISH;
   }
-  buf += ber_length_dec(buf, &sdg->context_name_len);
+  buf += hdr_len;
   if (sdg->context_name_len + 1 > sizeof(sdg->context_name)) {
-    SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_CONTEXT_NAME_LEN, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_CONTEXT_NAME_LEN));
+    err = SNMP_ERR_CONTEXT_NAME_LEN;
+    SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
     dec_fail = 1;
     goto DECODE_FINISH;
   }
@@ -489,7 +647,7 @@ snmp_decode(struct snmp_datagram *sdg)
   buf += sdg->context_name_len;
 
   /* PDU header */
-  err = pdu_hdr_parse(sdg, &buf);
+  err = pdu_hdr_parse(sdg, &buf, end);
   if (err) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
     dec_fail = 1;
@@ -497,7 +655,7 @@ snmp_decode(struct snmp_datagram *sdg)
   }
 
   /* var bind */
-  err = var_bind_parse(sdg, &buf);
+  err = var_bind_parse(sdg, &buf, end);
   if (err) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
     dec_fail = 1;
@@ -507,94 +665,176 @@ snmp_decode(struct snmp_datagram *sdg)
 DECODE_FINISH:
   /* We should free received buffer here */
   free(sdg->recv_buf);
+  sdg->recv_buf = NULL;
 
-  /* If fail, do some clear things */
   if (dec_fail) {
-    snmp_datagram_clear(sdg);
+    snmp_decode_drop(err);
+    return -1;
   }
+  return 0;
 }
 
-/* SNMP request dispatch */
+/* Process request until responded or parked by Lua handlers */
 static void
-snmp_request_dispatch(struct snmp_datagram *sdg)
+snmp_request_process(struct snmp_datagram *sdg)
 {
-  switch (sdg->pdu_hdr.pdu_type) {
+  snmp_datagram_curr = sdg;
+
+  switch (sdg->request) {
     case MIB_REQ_GET:
-      if (sdg->vb_in_cnt == 0) {
-        sdg->pdu_hdr.pdu_type = MIB_REPO;
-      } else {
-        sdg->pdu_hdr.pdu_type = MIB_RESP;
-      }
       snmp_get(sdg);
       break;
     case MIB_REQ_GETNEXT:
-      if (sdg->vb_in_cnt == 0) {
-        sdg->pdu_hdr.pdu_type = MIB_REPO;
-      } else {
-        sdg->pdu_hdr.pdu_type = MIB_RESP;
-      }
       snmp_getnext(sdg);
       break;
-    case MIB_RESP:
-      break;
     case MIB_REQ_SET:
-      if (sdg->vb_in_cnt == 0) {
-        sdg->pdu_hdr.pdu_type = MIB_REPO;
-      } else {
-        sdg->pdu_hdr.pdu_type = MIB_RESP;
-      }
       snmp_set(sdg);
       break;
     case MIB_REQ_BULKGET:
-      if (sdg->vb_in_cnt == 0) {
-        sdg->pdu_hdr.pdu_type = MIB_REPO;
-      } else {
-        sdg->pdu_hdr.pdu_type = MIB_RESP;
-      }
       snmp_bulkget(sdg);
       break;
-    case MIB_REQ_INF:
+    default:
+      assert(0);
+  }
+
+  snmp_datagram_curr = NULL;
+}
+
+/* Replay the parked request once its Lua handler finishes */
+static void
+snmp_request_resume(struct mib_async *async)
+{
+  snmp_request_process(container_of(async, struct snmp_datagram, async));
+}
+
+/* Count request refused by its community, it still gets noAccess */
+static void
+snmp_community_check(struct snmp_datagram *sdg)
+{
+  struct mib_community *community = mib_community_search(sdg->context_name);
+
+  if (community == NULL) {
+    snmp_stats[SNMP_IN_BAD_COMMUNITY_NAMES]++;
+  } else if (sdg->request == MIB_REQ_SET && mib_community_next_view(community, MIB_ACES_WRITE, NULL) == NULL) {
+    snmp_stats[SNMP_IN_BAD_COMMUNITY_USES]++;
+  }
+}
+
+/* Count error status of Response received */
+static void
+snmp_response_count(integer_t err_stat)
+{
+  snmp_stats[SNMP_IN_GET_RESPONSES]++;
+  switch (err_stat) {
+    case SNMP_ERR_STAT_TOO_BIG:
+      snmp_stats[SNMP_IN_TOO_BIGS]++;
       break;
-    case MIB_TRAP:
+    case SNMP_ERR_STAT_NO_SUCH_NAME:
+      snmp_stats[SNMP_IN_NO_SUCH_NAMES]++;
       break;
-    case MIB_REPO:
+    case SNMP_ERR_STAT_BAD_VALUE:
+      snmp_stats[SNMP_IN_BAD_VALUES]++;
+      break;
+    case SNMP_ERR_STAT_READ_ONLY:
+      snmp_stats[SNMP_IN_READ_ONLYS]++;
+      break;
+    case SNMP_ERR_STAT_GEN_ERR:
+      snmp_stats[SNMP_IN_GEN_ERRS]++;
       break;
     default:
       break;
   }
 }
 
+/* SNMP request dispatch */
+static void
+snmp_request_dispatch(struct snmp_datagram *sdg)
+{
+  switch (sdg->pdu_hdr.pdu_type) {
+    case MIB_REQ_GET:
+    case MIB_REQ_GETNEXT:
+    case MIB_REQ_SET:
+    case MIB_REQ_BULKGET:
+      sdg->request = sdg->pdu_hdr.pdu_type;
+      if (sdg->request == MIB_REQ_GET) {
+        snmp_stats[SNMP_IN_GET_REQUESTS]++;
+      } else if (sdg->request == MIB_REQ_GETNEXT) {
+        snmp_stats[SNMP_IN_GET_NEXTS]++;
+      } else if (sdg->request == MIB_REQ_SET) {
+        snmp_stats[SNMP_IN_SET_REQUESTS]++;
+      }
+      if (sdg->version < 3) {
+        snmp_community_check(sdg);
+      }
+      /* Discovery probes are answered by usm_report() */
+      sdg->pdu_hdr.pdu_type = MIB_RESP;
+      if (sdg->request == MIB_REQ_BULKGET) {
+        /* Max repetitions comes in place of error index, negative taken as 0 */
+        sdg->repeat = sdg->pdu_hdr.err_idx > 0 ? sdg->pdu_hdr.err_idx : 0;
+        sdg->pdu_hdr.err_idx = 0;
+      }
+      snmp_request_process(sdg);
+      break;
+    case MIB_RESP:
+      snmp_response_count(sdg->pdu_hdr.err_stat);
+      /* Acknowledges our inform */
+      if (sdg->version == 1) {
+        snmp_inform_response(sdg->pdu_hdr.req_id, sdg->addr);
+      }
+      snmp_datagram_free(sdg);
+      break;
+    case MIB_TRAP:
+      snmp_stats[SNMP_IN_TRAPS]++;
+      /* Fall through */
+    case MIB_REQ_INF:
+    case MIB_REPO:
+    default:
+      /* Nothing here to take them */
+      mpd_stats[MPD_UNKNOWN_PDU_HANDLERS]++;
+      snmp_datagram_free(sdg);
+      break;
+  }
+}
+
 /* Receive snmp datagram from transport module */
 void
-snmpd_recv(uint8_t *buffer, int len)
+snmpd_recv(uint8_t *buffer, int len, void *addr)
 {
-  uint32_t len_len;
-  const uint32_t tag_len = 1;
+  struct snmp_datagram *sdg;
+  uint32_t hdr_len, data_len;
 
   assert(buffer != NULL && len > 0);
+  snmp_stats[SNMP_IN_PKTS]++;
 
   /* Check PDU tag */
   if (buffer[0] != ASN1_TAG_SEQ) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_PDU_TYPE, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_PDU_TYPE));
+    snmp_stats[SNMP_IN_ASN_PARSE_ERRS]++;
     free(buffer);
+    free(addr);
     return;
   }
 
-  /* Check PDU length */
-  len_len = ber_length_dec(buffer + tag_len, &snmp_datagram.data_len);
-  if (tag_len + len_len + snmp_datagram.data_len != len) {
+  /* Check PDU length, the message spans the datagram */
+  hdr_len = ber_tlv_dec(buffer, buffer + len, ASN1_TAG_SEQ, &data_len);
+  if (hdr_len == 0 || hdr_len + data_len != len) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_PDU_LEN, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_PDU_LEN));
+    snmp_stats[SNMP_IN_ASN_PARSE_ERRS]++;
     free(buffer);
+    free(addr);
     return;
   }
 
-  /* Reset datagram */
-  snmp_datagram_clear(&snmp_datagram);
-  snmp_datagram.recv_buf = buffer;
+  sdg = snmp_datagram_new(buffer, addr);
+  LATENCY_STAMP_SET(sdg->stamp);
 
   /* Decode snmp datagram */
-  snmp_decode(&snmp_datagram);
+  if (snmp_decode(sdg) < 0) {
+    snmp_datagram_free(sdg);
+    return;
+  }
+  LATENCY_STAGE(LATENCY_DECODE, sdg->stamp);
 
   /* Dispatch request */
-  snmp_request_dispatch(&snmp_datagram);
+  snmp_request_dispatch(sdg);
 }
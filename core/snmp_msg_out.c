@@ -25,22 +25,19 @@
 #include "mib.h"
 #include "snmp.h"
 #include "protocol.h"
+#include "latency.h"
 #include "util.h"
 
-static octstr_t snmpv3_engine_id[] = {
-  0x80, 0x00, 0x00, 0x00,
-  /* Text */
-  0x04,
-  /* 'S', 'm', 'a', 'r', 't', 'S', 'N', 'M', 'P' */
-  0x53, 0x6d, 0x61, 0x72, 0x74, 0x53, 0x4e, 0x4d, 0x50, 
-};
-
 static uint32_t
 global_data_encode_try(struct snmp_datagram *sdg)
 {
   const uint32_t tag_len = 1;
   uint32_t len_len, msg_len;
- 
+
+  sdg->msg_id_len = ber_value_enc_try(&sdg->msg_id, 1, ASN1_TAG_INT);
+  sdg->msg_size_len = ber_value_enc_try(&sdg->msg_max_size, 1, ASN1_TAG_INT);
+  sdg->msg_model_len = ber_value_enc_try(&sdg->msg_security_model, 1, ASN1_TAG_INT);
+
   len_len = ber_length_enc_try(sdg->msg_id_len);
   msg_len = tag_len + len_len + sdg->msg_id_len;
 
@@ -76,7 +73,8 @@ global_data_encode(struct snmp_datagram *sdg, uint8_t *buf)
   /* Messege flags */
   *buf++ = ASN1_TAG_OCTSTR;
   buf += ber_length_enc(sdg->msg_flags_len, buf);
-  sdg->msg_flags = 0;
+  /* Same security level, never reportable */
+  sdg->msg_flags &= SNMP_MSG_FLAG_AUTH | SNMP_MSG_FLAG_PRIV;
   buf += ber_value_enc(&sdg->msg_flags, sdg->msg_flags_len, ASN1_TAG_OCTSTR, buf);
 
   /* Messege security model */
@@ -93,10 +91,16 @@ security_parameter_encode_try(struct snmp_datagram *sdg)
   const uint32_t tag_len = 1;
   uint32_t len_len, secur_para_len;
 
-  sdg->engine_id_len = sizeof(snmpv3_engine_id);
+  sdg->engine_id_len = snmpv3_engine_id_len;
   len_len = ber_length_enc_try(sdg->engine_id_len);
   secur_para_len = tag_len + len_len + sdg->engine_id_len;
 
+  /* Our boots and time, for managers to keep in step with */
+  sdg->engine_boots = usm_engine_boots();
+  sdg->engine_boots_len = ber_value_enc_try(&sdg->engine_boots, 1, ASN1_TAG_INT);
+  sdg->engine_time = usm_engine_time();
+  sdg->engine_time_len = ber_value_enc_try(&sdg->engine_time, 1, ASN1_TAG_INT);
+
   len_len = ber_length_enc_try(sdg->engine_boots_len);
   secur_para_len += tag_len + len_len + sdg->engine_boots_len;
 
@@ -145,6 +149,7 @@ security_parameter_encode(struct snmp_datagram *sdg, uint8_t *buf)
   /* Authotative parameter */
   *buf++ = ASN1_TAG_OCTSTR;
   buf += ber_length_enc(sdg->auth_para_len, buf);
+  sdg->auth_para_off = buf - (uint8_t *)sdg->send_buf;
   buf += ber_value_enc(&sdg->auth_para, sdg->auth_para_len, ASN1_TAG_OCTSTR, buf);
 
   /* Privative parameter */
@@ -166,6 +171,12 @@ asn1_encode(struct snmp_datagram *sdg)
   ph = &sdg->pdu_hdr;
   sdg->data_len = 0;
 
+  /* Sized for the values sent back, not as the request encoded them */
+  sdg->ver_len = ber_value_enc_try(&sdg->version, 1, ASN1_TAG_INT);
+  ph->req_id_len = ber_value_enc_try(&ph->req_id, 1, ASN1_TAG_INT);
+  ph->err_stat_len = ber_value_enc_try(&ph->err_stat, 1, ASN1_TAG_INT);
+  ph->err_idx_len = ber_value_enc_try(&ph->err_idx, 1, ASN1_TAG_INT);
+
   len_len = ber_length_enc_try(sdg->vb_list_len);
   ph->pdu_len = tag_len + len_len + sdg->vb_list_len;
 
@@ -186,7 +197,7 @@ asn1_encode(struct snmp_datagram *sdg)
 
   if (sdg->version >= 3) {
     /* SNMPv3 */
-    sdg->context_id_len = sizeof(snmpv3_engine_id);
+    sdg->context_id_len = snmpv3_engine_id_len;
     len_len = ber_length_enc_try(sdg->context_id_len);
     sdg->scope_len += tag_len + len_len + sdg->context_id_len;
 
@@ -205,6 +216,11 @@ asn1_encode(struct snmp_datagram *sdg)
 
     len_len = ber_length_enc_try(sdg->scope_len);
     sdg->data_len += tag_len + len_len;
+
+    /* Encrypted scoped PDU is wrapped in octet string */
+    if (sdg->msg_flags & SNMP_MSG_FLAG_PRIV) {
+      sdg->data_len += tag_len + ber_length_enc_try(tag_len + len_len + sdg->scope_len);
+    }
   }
 
   sdg->data_len += sdg->scope_len;
@@ -237,14 +253,21 @@ asn1_encode(struct snmp_datagram *sdg)
     /* Security parameter */
     buf = security_parameter_encode(sdg, buf);
 
+    /* Encrypted data */
+    if (sdg->msg_flags & SNMP_MSG_FLAG_PRIV) {
+      *buf++ = ASN1_TAG_OCTSTR;
+      buf += ber_length_enc(tag_len + ber_length_enc_try(sdg->scope_len) + sdg->scope_len, buf);
+    }
+    sdg->scope_off = buf - (uint8_t *)sdg->send_buf;
+
     /* Context sequence */
     *buf++ = ASN1_TAG_SEQ;
     buf += ber_length_enc(sdg->scope_len, buf);
 
     /* Context ID */
     *buf++ = ASN1_TAG_OCTSTR;
-    buf += ber_length_enc(sizeof(snmpv3_engine_id), buf);
-    buf += ber_value_enc(snmpv3_engine_id, sizeof(snmpv3_engine_id), ASN1_TAG_OCTSTR, buf);
+    buf += ber_length_enc(snmpv3_engine_id_len, buf);
+    buf += ber_value_enc(snmpv3_engine_id, snmpv3_engine_id_len, ASN1_TAG_OCTSTR, buf);
   }
 
   /* Context_name */
@@ -278,6 +301,38 @@ asn1_encode(struct snmp_datagram *sdg)
   return buf;
 }
 
+/* Count Response about to go out */
+static void
+snmp_response_count(const struct snmp_datagram *sdg)
+{
+  snmp_stats[SNMP_OUT_PKTS]++;
+  snmp_stats[SNMP_OUT_GET_RESPONSES]++;
+
+  switch (sdg->pdu_hdr.err_stat) {
+    case SNMP_ERR_STAT_NO_ERR:
+      if (sdg->request == MIB_REQ_SET) {
+        snmp_stats[SNMP_IN_TOTAL_SET_VARS] += sdg->vb_out_cnt;
+      } else {
+        snmp_stats[SNMP_IN_TOTAL_REQ_VARS] += sdg->vb_out_cnt;
+      }
+      break;
+    case SNMP_ERR_STAT_TOO_BIG:
+      snmp_stats[SNMP_OUT_TOO_BIGS]++;
+      break;
+    case SNMP_ERR_STAT_NO_SUCH_NAME:
+      snmp_stats[SNMP_OUT_NO_SUCH_NAMES]++;
+      break;
+    case SNMP_ERR_STAT_BAD_VALUE:
+      snmp_stats[SNMP_OUT_BAD_VALUES]++;
+      break;
+    case SNMP_ERR_STAT_GEN_ERR:
+      snmp_stats[SNMP_OUT_GEN_ERRS]++;
+      break;
+    default:
+      break;
+  }
+}
+
 void
 snmp_response(struct snmp_datagram *sdg)
 {
@@ -286,6 +341,7 @@ snmp_response(struct snmp_datagram *sdg)
   uint8_t *buf;
   uint32_t oid_len, len_len;
   const uint32_t tag_len = 1;
+  LATENCY_STAMP(start);
 
   buf = asn1_encode(sdg);
 
@@ -308,7 +364,18 @@ snmp_response(struct snmp_datagram *sdg)
     buf += vb_out->value_len;
   }
 
+  snmp_response_count(sdg);
+
   len_len = ber_length_enc_try(sdg->data_len);
+  usm_outgoing(sdg, sdg->send_buf, tag_len + len_len + sdg->data_len);
+  LATENCY_STAGE(LATENCY_ENCODE, start);
+
   /* This callback will free send_buf */
-  snmp_prot_ops.send(sdg->send_buf, tag_len + len_len + sdg->data_len);
+  LATENCY_STAMP_SET(start);
+  snmp_prot_ops.send(sdg->send_buf, tag_len + len_len + sdg->data_len, sdg->addr);
+  LATENCY_STAGE(LATENCY_SEND, start);
+  LATENCY_STAGE(LATENCY_REQUEST, sdg->stamp);
+
+  /* Request is done with */
+  snmp_datagram_free(sdg);
 }
@@ -24,8 +24,51 @@
 
 #include "mib.h"
 #include "snmp.h"
+#include "latency.h"
 #include "util.h"
 
+typedef void (*mib_search_func)(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res *ret_oid);
+
+/* Search of one varbind, timed net of the handlers it runs */
+static void
+mib_search(mib_search_func search, struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res *ret_oid)
+{
+  LATENCY_NET_STAMP(start);
+
+  search(sdg, vb_in, ret_oid);
+  LATENCY_NET_STAGE(LATENCY_SEARCH, start);
+}
+
+/* Parked on remote calls, search the varbinds after curr as well so that
+ * their remote calls go out in the same batch, writes to one sub-agent in
+ * one transaction. */
+static void
+mib_prefetch(struct snmp_datagram *sdg, struct list_head *curr, int request, mib_search_func search)
+{
+  struct oid_search_res ret_oid;
+  struct var_bind *vb_in;
+
+  if (sdg->async.pending != NULL || sdg->async.remote == 0) {
+    return;
+  }
+
+  memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.request = request;
+  ret_oid.async = &sdg->async;
+
+  sdg->async.prefetch = 1;
+  for (curr = curr->next; curr != &sdg->vb_in_list; curr = curr->next) {
+    vb_in = list_entry(curr, struct var_bind, link);
+    if (request == MIB_REQ_SET) {
+      /* Remote calls take the value to write */
+      tag(&ret_oid.var) = vb_in->value_type;
+      length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
+    }
+    search(sdg, vb_in, &ret_oid);
+  }
+  sdg->async.prefetch = 0;
+}
+
 static void
 mib_get(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res *ret_oid)
 {
@@ -56,19 +99,20 @@ mib_get(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res
 
     /* End of mib view */
     if (view == NULL) {
-      /* Duplicate original oid when result not found */
-      ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
+      /* Original oid when result not found */
+      ret_oid->oid = oid_cpy(ret_oid->oid_buf, vb_in->oid, vb_in->oid_len);
       ret_oid->id_len = vb_in->oid_len;
       return;
     }
 
     mib_tree_search(view, vb_in->oid, vb_in->oid_len, ret_oid);
+    if (MIB_SEARCH_PENDING(ret_oid)) {
+      return;
+    }
     if ((!ret_oid->err_stat && MIB_TAG_VALID(tag(&ret_oid->var))) || oid_cmp(vb_in->oid, vb_in->oid_len, view->oid, view->id_len) < 0) {
       /* Gotcha or given oid ahead of all views */
       return;
     }
-    /* Free temporary result */
-    free(ret_oid->oid);
   }
 }
 
@@ -84,22 +128,35 @@ snmp_get(struct snmp_datagram *sdg)
 
   memset(&ret_oid, 0, sizeof(ret_oid));
   ret_oid.request = MIB_REQ_GET;
+  ret_oid.async = &sdg->async;
 
   list_for_each_safe(curr, next, &sdg->vb_in_list) {
     vb_in = list_entry(curr, struct var_bind, link);
     vb_in_cnt++;
 
+    /* Answered before the request was parked */
+    if (vb_in_cnt <= sdg->vb_done) {
+      continue;
+    }
+
     /* Decode vb_in value first */
     tag(&ret_oid.var) = vb_in->value_type;
     length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
 
     /* Search at the input oid */
-    mib_get(sdg, vb_in, &ret_oid);
+    mib_search(mib_get, sdg, vb_in, &ret_oid);
+    if (MIB_SEARCH_PENDING(&ret_oid)) {
+      /* Parked, replay from this varbind on */
+      mib_prefetch(sdg, curr, MIB_REQ_GET, mib_get);
+      return;
+    }
+    mib_async_reset(&sdg->async);
+    sdg->vb_done++;
 
     val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out = snmp_vb_new(sdg, ret_oid.id_len, val_len);
     vb_out->oid_len = ret_oid.id_len;
+    oid_cpy(vb_out->oid, ret_oid.oid, ret_oid.id_len);
     vb_out->value_type = tag(&ret_oid.var);
     vb_out->value_len = ber_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
 
@@ -163,19 +220,20 @@ mib_getnext(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search
 
     /* End of mib view */
     if (view == NULL) {
-      /* Duplicate original oid when result not found */
-      ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
+      /* Original oid when result not found */
+      ret_oid->oid = oid_cpy(ret_oid->oid_buf, vb_in->oid, vb_in->oid_len);
       ret_oid->id_len = vb_in->oid_len;
       return;
     }
 
     mib_tree_search_next(view, vb_in->oid, vb_in->oid_len, ret_oid);
+    if (MIB_SEARCH_PENDING(ret_oid)) {
+      return;
+    }
     if (tag(&ret_oid->var) != ASN1_TAG_END_OF_MIB_VIEW) {
       /* Gotcha */
       break;
     }
-    /* Free temporary result */
-    free(ret_oid->oid);
   }
 }
 
@@ -191,22 +249,35 @@ snmp_getnext(struct snmp_datagram *sdg)
 
   memset(&ret_oid, 0, sizeof(ret_oid));
   ret_oid.request = MIB_REQ_GETNEXT;
+  ret_oid.async = &sdg->async;
 
   list_for_each_safe(curr, next, &sdg->vb_in_list) {
     vb_in = list_entry(curr, struct var_bind, link);
     vb_in_cnt++;
 
+    /* Answered before the request was parked */
+    if (vb_in_cnt <= sdg->vb_done) {
+      continue;
+    }
+
     /* Decode vb_in value first */
     tag(&ret_oid.var) = vb_in->value_type;
     length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
 
     /* Search at the next input oid */
-    mib_getnext(sdg, vb_in, &ret_oid);
+    mib_search(mib_getnext, sdg, vb_in, &ret_oid);
+    if (MIB_SEARCH_PENDING(&ret_oid)) {
+      /* Parked, replay from this varbind on */
+      mib_prefetch(sdg, curr, MIB_REQ_GETNEXT, mib_getnext);
+      return;
+    }
+    mib_async_reset(&sdg->async);
+    sdg->vb_done++;
 
     val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out = snmp_vb_new(sdg, ret_oid.id_len, val_len);
     vb_out->oid_len = ret_oid.id_len;
+    oid_cpy(vb_out->oid, ret_oid.oid, ret_oid.id_len);
     vb_out->value_type = tag(&ret_oid.var);
     vb_out->value_len = ber_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
 
@@ -282,19 +353,20 @@ mib_set(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res
 
     /* End of mib view */
     if (view == NULL) {
-      /* Duplicate original oid when result not found */
-      ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
+      /* Original oid when result not found */
+      ret_oid->oid = oid_cpy(ret_oid->oid_buf, vb_in->oid, vb_in->oid_len);
       ret_oid->id_len = vb_in->oid_len;
       return;
     }
 
     mib_tree_search(view, vb_in->oid, vb_in->oid_len, ret_oid);
+    if (MIB_SEARCH_PENDING(ret_oid)) {
+      return;
+    }
     if ((!ret_oid->err_stat && MIB_TAG_VALID(tag(&ret_oid->var))) || oid_cmp(vb_in->oid, vb_in->oid_len, view->oid, view->id_len) < 0) {
       /* Gotcha or given oid ahead of all views */
       return;
     }
-    /* Free temporary result */
-    free(ret_oid->oid);
   }
 }
 
@@ -311,22 +383,35 @@ snmp_set(struct snmp_datagram *sdg)
 
   memset(&ret_oid, 0, sizeof(ret_oid));
   ret_oid.request = MIB_REQ_SET;
+  ret_oid.async = &sdg->async;
 
   list_for_each_safe(curr, next, &sdg->vb_in_list) {
     vb_in = list_entry(curr, struct var_bind, link);
     vb_in_cnt++;
 
+    /* Answered before the request was parked */
+    if (vb_in_cnt <= sdg->vb_done) {
+      continue;
+    }
+
     /* Decode vb_in value first */
     tag(&ret_oid.var) = vb_in->value_type;
     length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
 
     /* Search at the input oid and set it */
-    mib_set(sdg, vb_in, &ret_oid);
+    mib_search(mib_set, sdg, vb_in, &ret_oid);
+    if (MIB_SEARCH_PENDING(&ret_oid)) {
+      /* Parked, replay from this varbind on */
+      mib_prefetch(sdg, curr, MIB_REQ_SET, mib_set);
+      return;
+    }
+    mib_async_reset(&sdg->async);
+    sdg->vb_done++;
 
     val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out = snmp_vb_new(sdg, ret_oid.id_len, val_len);
     vb_out->oid_len = ret_oid.id_len;
+    oid_cpy(vb_out->oid, ret_oid.oid, ret_oid.id_len);
     vb_out->value_type = vb_in->value_type;
     vb_out->value_len = ber_value_enc(value(&ret_oid.var), val_len, tag(&ret_oid.var), vb_out->value);
 
@@ -378,42 +463,43 @@ snmp_bulkget(struct snmp_datagram *sdg)
 
   memset(&ret_oid, 0, sizeof(ret_oid));
   ret_oid.request = MIB_REQ_GETNEXT;
-  repeat = sdg->pdu_hdr.err_idx;
-  sdg->pdu_hdr.err_idx = 0;
+  ret_oid.async = &sdg->async;
+  repeat = sdg->repeat;
 
   while (repeat-- > 0) {
     list_for_each_safe(curr, next, &sdg->vb_in_list) {
       vb_in = list_entry(curr, struct var_bind, link);
       vb_in_cnt++;
 
+      /* Answered before the request was parked */
+      if (vb_in_cnt <= sdg->vb_done) {
+        continue;
+      }
+
       /* Decode vb_in value first */
       tag(&ret_oid.var) = vb_in->value_type;
       length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
 
       /* Search at the next input oid */
-      mib_getnext(sdg, vb_in, &ret_oid);
-
-      /* Return oid for the next query. */
-      free(vb_in->oid);
-      vb_in->oid = oid_dup(ret_oid.oid, ret_oid.id_len);
-      vb_in->oid_len = ret_oid.id_len;
+      mib_search(mib_getnext, sdg, vb_in, &ret_oid);
+      if (MIB_SEARCH_PENDING(&ret_oid)) {
+        /* Parked, replay from this varbind on */
+        return;
+      }
+      mib_async_reset(&sdg->async);
+      sdg->vb_done++;
 
       val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-      vb_out = xmalloc(sizeof(*vb_out) + val_len);
-      vb_out->oid = ret_oid.oid;
+      vb_out = snmp_vb_new(sdg, ret_oid.id_len, val_len);
       vb_out->oid_len = ret_oid.id_len;
+      oid_cpy(vb_out->oid, ret_oid.oid, ret_oid.id_len);
+
+      /* Return oid for the next query, both live as long as the request */
+      vb_in->oid = vb_out->oid;
+      vb_in->oid_len = vb_out->oid_len;
       vb_out->value_type = tag(&ret_oid.var);
       vb_out->value_len = ber_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
 
-      /* Error status */
-      if (ret_oid.err_stat) {
-        if (!sdg->pdu_hdr.err_stat) {
-          /* Report the first error varbind */
-          sdg->pdu_hdr.err_stat = ret_oid.err_stat;
-          sdg->pdu_hdr.err_idx = vb_in_cnt;
-        }
-      }
-
       /* OID length encoding */
       oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
       len_len = ber_length_enc_try(oid_len);
@@ -423,15 +509,29 @@ snmp_bulkget(struct snmp_datagram *sdg)
       len_len = ber_length_enc_try(vb_out->value_len);
       vb_out->vb_len += tag_len + len_len + vb_out->value_len;
 
-      /* Varbind length encoding */
+      /* Varbind length encoding, the response is cut before outgrowing a
+       * datagram. Nothing fresh is cut on a replay, as it stopped here. */
       len_len = ber_length_enc_try(vb_out->vb_len);
+      if (sdg->vb_list_len + tag_len + len_len + vb_out->vb_len > SNMP_BULK_LIST_MAX) {
+        goto RESPONSE;
+      }
       sdg->vb_list_len += tag_len + len_len + vb_out->vb_len;
 
+      /* Error status */
+      if (ret_oid.err_stat) {
+        if (!sdg->pdu_hdr.err_stat) {
+          /* Report the first error varbind */
+          sdg->pdu_hdr.err_stat = ret_oid.err_stat;
+          sdg->pdu_hdr.err_idx = vb_in_cnt;
+        }
+      }
+
       /* Add into list. */
       list_add_tail(&vb_out->link, &sdg->vb_out_list);
       sdg->vb_out_cnt++;
     }
   }
 
+RESPONSE:
   snmp_response(sdg);
 }
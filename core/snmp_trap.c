@@ -0,0 +1,613 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snmp.h"
+#include "protocol.h"
+#include "ev_loop.h"
+#include "util.h"
+
+/* SNMPv2-Trap and InformRequest notifications to UDP targets. Raised
+ * notifications wait in a ring that every target reads at its own pace,
+ * and are sent together at the end of the event loop turn. */
+
+/* Notifications kept for targets behind, the oldest ones go first */
+#define TRAP_RING_SIZE  256
+
+/* Encoded sysUpTime.0 and snmpTrapOID.0 */
+static const uint8_t sys_uptime_oid[] = {
+  ASN1_TAG_OBJID, 8, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x03, 0x00,
+};
+static const uint8_t snmp_trap_oid[] = {
+  ASN1_TAG_OBJID, 10, 0x2b, 0x06, 0x01, 0x06, 0x03, 0x01, 0x01, 0x04, 0x01, 0x00,
+};
+
+struct snmp_trap {
+  /* Hundredths of a second since start when raised */
+  uint32_t uptime;
+  uint32_t hash;
+  /* Varbinds after sysUpTime.0, starting with snmpTrapOID.0 */
+  uint8_t *vbs;
+  uint32_t vbs_len;
+  uint32_t vbs_size;
+};
+
+/* InformRequest kept for retransmission until acknowledged */
+struct inform {
+  integer_t request_id;
+  uint8_t *msg;
+  uint32_t len;
+  uint32_t timeout;
+  uint32_t tries;
+  uint64_t expire;
+};
+
+struct trap_target {
+  struct trap_target *next;
+  struct sockaddr_in sin;
+  char *community;
+  /* Token bucket in thousandths of a notification, no limit at rate 0 */
+  uint32_t rate;
+  uint32_t burst;
+  uint64_t tokens;
+  uint64_t stamp;
+  /* Sequence number of the next notification to send */
+  uint32_t seq;
+  /* Informs awaiting response, at most window of them. NULL for targets
+   * of traps. */
+  struct inform *informs;
+  uint32_t inform_cnt;
+  uint32_t window;
+  /* First retransmission after timeout ms, doubled for each of retries */
+  uint32_t timeout;
+  uint32_t retries;
+};
+
+static struct {
+  struct snmp_trap *ring[TRAP_RING_SIZE];
+  /* Sequence numbers of the oldest kept and the next notification */
+  uint32_t tail;
+  uint32_t head;
+  struct trap_target *targets;
+  uint32_t request_id;
+  uint64_t start;
+  struct snmp_trap_stats stats;
+  /* Flush at the end of the turn, when held targets get tokens, and
+   * retransmit informs timed out */
+  int flush_timer;
+  int hold_timer;
+  int retry_timer;
+} trap_queue = {
+  .flush_timer = -1,
+  .hold_timer = -1,
+  .retry_timer = -1,
+};
+
+static uint32_t
+tlv_size(uint32_t len)
+{
+  return 1 + ber_length_enc_try(len) + len;
+}
+
+static uint8_t *
+tlv_hdr(uint8_t *buf, uint8_t tag, uint32_t len)
+{
+  *buf++ = tag;
+  return buf + ber_length_enc(len, buf);
+}
+
+/* Targets added later only get what is raised after */
+static struct trap_target *
+trap_target_new(const char *host, int port, const char *community)
+{
+  struct trap_target *t;
+  struct in_addr addr;
+
+  if (inet_pton(AF_INET, host, &addr) != 1 || port <= 0 || port > 65535) {
+    SMARTSNMP_LOG(L_ERROR, "Trap target %s:%d should be IPv4 address and port\n", host, port);
+    return NULL;
+  }
+
+  if (trap_queue.start == 0) {
+    trap_queue.start = snmp_event_time();
+  }
+
+  t = xcalloc(1, sizeof(*t));
+  t->sin.sin_family = AF_INET;
+  t->sin.sin_addr = addr;
+  t->sin.sin_port = htons(port);
+  t->community = xmalloc(strlen(community) + 1);
+  strcpy(t->community, community);
+  t->stamp = snmp_event_time();
+  t->seq = trap_queue.head;
+  t->next = trap_queue.targets;
+  trap_queue.targets = t;
+  return t;
+}
+
+/* Send traps to host:port as community, at most rate per second after a
+ * burst, no limit at rate 0 */
+int
+snmp_trap_target_add(const char *host, int port, const char *community, uint32_t rate, uint32_t burst)
+{
+  struct trap_target *t = trap_target_new(host, port, community);
+
+  if (t == NULL) {
+    return -1;
+  }
+  t->rate = rate;
+  t->burst = burst > 0 ? burst : 1;
+  t->tokens = (uint64_t)t->burst * 1000;
+  return 0;
+}
+
+/* Send informs to host:port as community, at most window of them awaiting
+ * response. Unanswered ones are sent again after timeout ms, doubled each
+ * time, and given up after retries. */
+int
+snmp_inform_target_add(const char *host, int port, const char *community, uint32_t window, uint32_t timeout, uint32_t retries)
+{
+  struct trap_target *t;
+
+  if (window == 0 || timeout == 0) {
+    SMARTSNMP_LOG(L_ERROR, "Inform target %s:%d needs window and timeout\n", host, port);
+    return -1;
+  }
+  t = trap_target_new(host, port, community);
+  if (t == NULL) {
+    return -1;
+  }
+  t->window = window;
+  t->timeout = timeout;
+  t->retries = retries;
+  t->informs = xcalloc(window, sizeof(struct inform));
+  return 0;
+}
+
+static void
+trap_reserve(struct snmp_trap *trap, uint32_t len)
+{
+  if (trap->vbs_len + len > trap->vbs_size) {
+    while (trap->vbs_len + len > trap->vbs_size) {
+      trap->vbs_size *= 2;
+    }
+    trap->vbs = xrealloc(trap->vbs, trap->vbs_size);
+  }
+}
+
+/* Notification of trap_oid, varbinds to be added before it is sent */
+struct snmp_trap *
+snmp_trap_new(const oid_t *trap_oid, uint32_t oid_len)
+{
+  struct snmp_trap *trap = xmalloc(sizeof(*trap));
+
+  trap->uptime = trap_queue.start ? (snmp_event_time() - trap_queue.start) / 10 : 0;
+  trap->vbs_len = 0;
+  trap->vbs_size = 128;
+  trap->vbs = xmalloc(trap->vbs_size);
+
+  /* snmpTrapOID.0 first */
+  snmp_trap_vb_add(trap, NULL, 0, ASN1_TAG_OBJID, trap_oid, oid_len);
+  return trap;
+}
+
+/* Varbind of value with len elements as in ber_value_enc(), oid NULL for
+ * snmpTrapOID.0 */
+void
+snmp_trap_vb_add(struct snmp_trap *trap, const oid_t *oid, uint32_t oid_len, uint8_t tag, const void *value, uint32_t len)
+{
+  uint32_t enc_oid_len, enc_len, vb_len;
+  uint8_t *buf;
+
+  enc_oid_len = oid != NULL ? ber_value_enc_try(oid, oid_len, ASN1_TAG_OBJID) : 0;
+  enc_len = ber_value_enc_try(value, len, tag);
+  vb_len = (oid != NULL ? tlv_size(enc_oid_len) : sizeof(snmp_trap_oid)) + tlv_size(enc_len);
+  trap_reserve(trap, tlv_size(vb_len));
+
+  buf = tlv_hdr(trap->vbs + trap->vbs_len, ASN1_TAG_SEQ, vb_len);
+  if (oid != NULL) {
+    buf = tlv_hdr(buf, ASN1_TAG_OBJID, enc_oid_len);
+    buf += ber_value_enc(oid, oid_len, ASN1_TAG_OBJID, buf);
+  } else {
+    memcpy(buf, snmp_trap_oid, sizeof(snmp_trap_oid));
+    buf += sizeof(snmp_trap_oid);
+  }
+  buf = tlv_hdr(buf, tag, enc_len);
+  buf += ber_value_enc(value, len, tag, buf);
+  trap->vbs_len = buf - trap->vbs;
+}
+
+static void
+trap_free(struct snmp_trap *trap)
+{
+  free(trap->vbs);
+  free(trap);
+}
+
+/* FNV-1a */
+static uint32_t
+trap_hash(const uint8_t *buf, uint32_t len)
+{
+  uint32_t h = 2166136261U;
+
+  while (len-- > 0) {
+    h = (h ^ *buf++) * 16777619U;
+  }
+  return h;
+}
+
+/* SNMPv2c message of trap to target in pdu_type, return its length */
+static uint32_t
+trap_encode(struct trap_target *t, const struct snmp_trap *trap, uint8_t pdu_type, integer_t request_id, uint8_t **msg)
+{
+  uint32_t uptime_len, vb_len, vbs_len, pdu_len, comm_len, msg_len;
+  integer_t version = 1, zero = 0;
+  uint8_t *buf, *p;
+
+  uptime_len = ber_value_enc_try(&trap->uptime, 1, ASN1_TAG_TIMETICKS);
+  vb_len = sizeof(sys_uptime_oid) + tlv_size(uptime_len);
+  vbs_len = tlv_size(vb_len) + trap->vbs_len;
+  pdu_len = tlv_size(ber_value_enc_try(&request_id, 1, ASN1_TAG_INT)) + 2 * tlv_size(1) + tlv_size(vbs_len);
+  comm_len = strlen(t->community);
+  msg_len = tlv_size(1) + tlv_size(comm_len) + tlv_size(pdu_len);
+
+  buf = xmalloc(tlv_size(msg_len));
+  p = tlv_hdr(buf, ASN1_TAG_SEQ, msg_len);
+  p = tlv_hdr(p, ASN1_TAG_INT, 1);
+  p += ber_value_enc(&version, 1, ASN1_TAG_INT, p);
+  p = tlv_hdr(p, ASN1_TAG_OCTSTR, comm_len);
+  memcpy(p, t->community, comm_len);
+  p += comm_len;
+
+  p = tlv_hdr(p, pdu_type, pdu_len);
+  p = tlv_hdr(p, ASN1_TAG_INT, ber_value_enc_try(&request_id, 1, ASN1_TAG_INT));
+  p += ber_value_enc(&request_id, 1, ASN1_TAG_INT, p);
+  p = tlv_hdr(p, ASN1_TAG_INT, 1);
+  p += ber_value_enc(&zero, 1, ASN1_TAG_INT, p);
+  p = tlv_hdr(p, ASN1_TAG_INT, 1);
+  p += ber_value_enc(&zero, 1, ASN1_TAG_INT, p);
+
+  p = tlv_hdr(p, ASN1_TAG_SEQ, vbs_len);
+  p = tlv_hdr(p, ASN1_TAG_SEQ, vb_len);
+  memcpy(p, sys_uptime_oid, sizeof(sys_uptime_oid));
+  p += sizeof(sys_uptime_oid);
+  p = tlv_hdr(p, ASN1_TAG_TIMETICKS, uptime_len);
+  p += ber_value_enc(&trap->uptime, 1, ASN1_TAG_TIMETICKS, p);
+  memcpy(p, trap->vbs, trap->vbs_len);
+  p += trap->vbs_len;
+
+  *msg = buf;
+  return p - buf;
+}
+
+static void
+inform_send(struct trap_target *t, const struct inform *inf)
+{
+  uint8_t *buf = xmalloc(inf->len);
+
+  memcpy(buf, inf->msg, inf->len);
+  /* This callback will free buf */
+  snmp_prot_ops.send(buf, inf->len, &t->sin);
+  trap_queue.stats.sent++;
+  snmp_stats[SNMP_OUT_PKTS]++;
+}
+
+static void
+inform_remove(struct trap_target *t, uint32_t i)
+{
+  free(t->informs[i].msg);
+  t->informs[i] = t->informs[--t->inform_cnt];
+}
+
+/* Trap, or inform awaiting response, to target */
+static void
+trap_target_send(struct trap_target *t, const struct snmp_trap *trap, uint64_t now)
+{
+  integer_t request_id = ++trap_queue.request_id & 0x7fffffff;
+  struct inform *inf;
+  uint8_t *buf;
+  uint32_t len;
+
+  if (t->informs == NULL) {
+    len = trap_encode(t, trap, MIB_TRAP, request_id, &buf);
+    /* This callback will free buf */
+    snmp_prot_ops.send(buf, len, &t->sin);
+    trap_queue.stats.sent++;
+    snmp_stats[SNMP_OUT_PKTS]++;
+    snmp_stats[SNMP_OUT_TRAPS]++;
+    return;
+  }
+
+  inf = &t->informs[t->inform_cnt++];
+  inf->request_id = request_id;
+  inf->len = trap_encode(t, trap, MIB_REQ_INF, request_id, &inf->msg);
+  inf->timeout = t->timeout;
+  inf->tries = 0;
+  inf->expire = now + inf->timeout;
+  inform_send(t, inf);
+}
+
+/* Refill the bucket, return whether a notification may go */
+static int
+trap_target_ready(struct trap_target *t, uint64_t now)
+{
+  if (t->informs != NULL) {
+    return t->inform_cnt < t->window;
+  }
+  if (t->rate == 0) {
+    return 1;
+  }
+  t->tokens += (now - t->stamp) * t->rate;
+  if (t->tokens > (uint64_t)t->burst * 1000) {
+    t->tokens = (uint64_t)t->burst * 1000;
+  }
+  t->stamp = now;
+  return t->tokens >= 1000;
+}
+
+static void trap_hold_handler(void *ud);
+static void inform_retry_handler(void *ud);
+
+/* Come back when the first inform awaiting response times out */
+static void
+inform_retry_schedule(uint64_t now)
+{
+  struct trap_target *t;
+  uint64_t expire = 0;
+  uint32_t i;
+
+  for (t = trap_queue.targets; t != NULL; t = t->next) {
+    for (i = 0; i < t->inform_cnt; i++) {
+      if (expire == 0 || t->informs[i].expire < expire) {
+        expire = t->informs[i].expire;
+      }
+    }
+  }
+
+  if (trap_queue.retry_timer >= 0) {
+    snmp_event_timer_remove(trap_queue.retry_timer);
+    trap_queue.retry_timer = -1;
+  }
+  if (expire != 0) {
+    trap_queue.retry_timer = snmp_event_timer_add(expire > now ? expire - now : 0, 0, inform_retry_handler, NULL);
+  }
+}
+
+/* Send what each target may, come back when a held one gets a token.
+ * Targets of informs are held by their window until responses come. */
+static void
+trap_flush(void)
+{
+  struct trap_target *t;
+  uint64_t now = snmp_event_time();
+  uint32_t tail, wait = 0;
+  int held = 0;
+
+  tail = trap_queue.head;
+
+  for (t = trap_queue.targets; t != NULL; t = t->next) {
+    while (t->seq != trap_queue.head && trap_target_ready(t, now)) {
+      trap_target_send(t, trap_queue.ring[t->seq % TRAP_RING_SIZE], now);
+      t->seq++;
+      if (t->rate != 0) {
+        t->tokens -= 1000;
+      }
+    }
+    if (t->seq != trap_queue.head && t->rate != 0) {
+      uint32_t ms = (1000 - t->tokens + t->rate - 1) / t->rate;
+      if (!held || ms < wait) {
+        wait = ms;
+      }
+      held = 1;
+    }
+    if ((int32_t)(t->seq - tail) < 0) {
+      tail = t->seq;
+    }
+  }
+
+  /* Sent to every target */
+  while (trap_queue.tail != tail) {
+    trap_free(trap_queue.ring[trap_queue.tail % TRAP_RING_SIZE]);
+    trap_queue.tail++;
+  }
+
+  if (trap_queue.hold_timer >= 0) {
+    snmp_event_timer_remove(trap_queue.hold_timer);
+    trap_queue.hold_timer = -1;
+  }
+  if (held) {
+    trap_queue.hold_timer = snmp_event_timer_add(wait, 0, trap_hold_handler, NULL);
+  }
+
+  inform_retry_schedule(now);
+}
+
+static void
+trap_flush_handler(void *ud)
+{
+  trap_queue.flush_timer = -1;
+  trap_flush();
+}
+
+static void
+trap_hold_handler(void *ud)
+{
+  trap_queue.hold_timer = -1;
+  trap_flush();
+}
+
+/* Send informs timed out again, give up after retries */
+static void
+inform_retry(uint64_t now)
+{
+  struct trap_target *t;
+  struct inform *inf;
+  uint32_t i;
+
+  for (t = trap_queue.targets; t != NULL; t = t->next) {
+    i = 0;
+    while (i < t->inform_cnt) {
+      inf = &t->informs[i];
+      if (inf->expire > now) {
+        i++;
+      } else if (inf->tries == t->retries) {
+        SMARTSNMP_LOG(L_WARNING, "Inform %d to %s unanswered, given up\n", inf->request_id, inet_ntoa(t->sin.sin_addr));
+        inform_remove(t, i);
+        trap_queue.stats.inform_failed++;
+      } else {
+        inf->tries++;
+        inf->timeout *= 2;
+        inf->expire = now + inf->timeout;
+        inform_send(t, inf);
+        trap_queue.stats.inform_retries++;
+        i++;
+      }
+    }
+  }
+}
+
+static void
+inform_retry_handler(void *ud)
+{
+  trap_queue.retry_timer = -1;
+  inform_retry(snmp_event_time());
+  /* Windows given up on take the next ones */
+  trap_flush();
+}
+
+/* Without the built-in event loop (libevent, uloop) the timers above
+ * never fire, so retries and held traps are handled whenever the agent
+ * gets a turn: a datagram received or a notification raised outside one. */
+void
+snmp_trap_poll(void)
+{
+  if (snmp_event_running() || trap_queue.targets == NULL) {
+    return;
+  }
+  inform_retry(snmp_event_time());
+  trap_flush();
+}
+
+static void
+trap_flush_later(void)
+{
+  if (!snmp_event_running()) {
+    /* The request in process polls when done */
+    if (snmp_datagram_curr == NULL) {
+      snmp_trap_poll();
+    }
+    return;
+  }
+
+  /* Notifications of this turn go together */
+  if (trap_queue.flush_timer < 0) {
+    trap_queue.flush_timer = snmp_event_timer_add(0, 0, trap_flush_handler, NULL);
+    if (trap_queue.flush_timer < 0) {
+      trap_flush();
+    }
+  }
+}
+
+/* Response from addr to the inform of request_id */
+void
+snmp_inform_response(integer_t request_id, const void *addr)
+{
+  const struct sockaddr_in *sin = addr;
+  struct trap_target *t;
+  uint32_t i;
+
+  for (t = trap_queue.targets; t != NULL; t = t->next) {
+    if (t->sin.sin_addr.s_addr != sin->sin_addr.s_addr || t->sin.sin_port != sin->sin_port) {
+      continue;
+    }
+    for (i = 0; i < t->inform_cnt; i++) {
+      if (t->informs[i].request_id == request_id) {
+        inform_remove(t, i);
+        trap_queue.stats.inform_acked++;
+        /* Slides the window */
+        trap_flush_later();
+        return;
+      }
+    }
+  }
+}
+
+/* Queue trap for all targets and release it. Repeats of a notification
+ * no target has been sent yet are counted in it instead of being queued. */
+void
+snmp_trap_send(struct snmp_trap *trap)
+{
+  struct snmp_trap *old;
+  struct trap_target *t;
+  uint32_t seq, unsent;
+
+  if (trap_queue.targets == NULL) {
+    trap_free(trap);
+    return;
+  }
+
+  /* Notifications before the target furthest on are sent to some */
+  unsent = trap_queue.tail;
+  for (t = trap_queue.targets; t != NULL; t = t->next) {
+    if ((int32_t)(t->seq - unsent) > 0) {
+      unsent = t->seq;
+    }
+  }
+
+  trap->hash = trap_hash(trap->vbs, trap->vbs_len);
+  for (seq = unsent; seq != trap_queue.head; seq++) {
+    old = trap_queue.ring[seq % TRAP_RING_SIZE];
+    if (old->hash == trap->hash && old->vbs_len == trap->vbs_len && !memcmp(old->vbs, trap->vbs, trap->vbs_len)) {
+      trap_queue.stats.merged++;
+      trap_free(trap);
+      return;
+    }
+  }
+
+  /* Full ring, targets behind lose the oldest */
+  if (trap_queue.head - trap_queue.tail == TRAP_RING_SIZE) {
+    for (t = trap_queue.targets; t != NULL; t = t->next) {
+      if (t->seq == trap_queue.tail) {
+        t->seq++;
+        trap_queue.stats.dropped++;
+      }
+    }
+    trap_free(trap_queue.ring[trap_queue.tail % TRAP_RING_SIZE]);
+    trap_queue.tail++;
+  }
+
+  trap_queue.ring[trap_queue.head % TRAP_RING_SIZE] = trap;
+  trap_queue.head++;
+
+  trap_flush_later();
+}
+
+const struct snmp_trap_stats *
+snmp_trap_stats(void)
+{
+  return &trap_queue.stats;
+}
@@ -20,6 +20,7 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <assert.h>
 #include <unistd.h>
@@ -32,11 +33,19 @@
 #include "ev_loop.h"
 #include "util.h"
 
-struct snmp_data_entry {
-  int sock;
+/* Response waiting for the socket to be writable */
+struct snmp_send_entry {
+  struct snmp_send_entry *next;
   uint8_t *buf;
   int len;
-  struct sockaddr_in *client_sin;
+  struct sockaddr_in client_sin;
+};
+
+struct snmp_data_entry {
+  int sock;
+  /* Responses may be sent in another order than requests come */
+  struct snmp_send_entry *head;
+  struct snmp_send_entry **tail;
 };
 
 static struct snmp_data_entry snmp_entry;
@@ -46,13 +55,19 @@ snmp_write_handler(int sock, unsigned char flag, void *ud)
 {
   struct snmp_data_entry *entry = ud;
 
-  if (sendto(sock, entry->buf, entry->len, 0, (struct sockaddr *)entry->client_sin, sizeof(struct sockaddr_in)) == -1) {
-    perror("sendto()");
-    snmp_event_done();
-  }
+  while (entry->head != NULL) {
+    struct snmp_send_entry *send_entry = entry->head;
+
+    if (sendto(sock, send_entry->buf, send_entry->len, 0, (struct sockaddr *)&send_entry->client_sin, sizeof(struct sockaddr_in)) == -1) {
+      perror("sendto()");
+      snmp_event_done();
+    }
 
-  free(entry->buf);
-  free(entry->client_sin);
+    entry->head = send_entry->next;
+    free(send_entry->buf);
+    free(send_entry);
+  }
+  entry->tail = &entry->head;
 
   snmp_event_remove(sock, flag);
 }
@@ -61,32 +76,58 @@ static void
 snmp_read_handler(int sock, unsigned char flag, void *ud)
 {
   socklen_t server_sz = sizeof(struct sockaddr_in);
+  struct sockaddr_in *client_sin;
   int len;
   uint8_t *buf;
 
   buf = xmalloc(TRANS_BUF_SIZ);
-  snmp_entry.client_sin = xmalloc(server_sz);
+  client_sin = xmalloc(server_sz);
 
   /* Receive UDP data, store the address of the sender in client_sin */
-  len = recvfrom(sock, buf, TRANS_BUF_SIZ, 0, (struct sockaddr *)snmp_entry.client_sin, &server_sz);
-  if (len == -1) {
+  len = recvfrom(sock, buf, TRANS_BUF_SIZ, 0, (struct sockaddr *)client_sin, &server_sz);
+  if (len <= 0) {
     perror("recvfrom()");
-    snmp_event_done();
+    free(buf);
+    free(client_sin);
+    return;
   }
 
-  /* Parse SNMP PDU in decoder */
-  snmp_prot_ops.receive(buf, len);
+  /* Parse SNMP PDU in decoder, client_sin goes with the request */
+  snmp_prot_ops.receive(buf, len, client_sin);
 }
 
 /* Send snmp datagram as a UDP packet to the remote */
 static void
-transport_send(uint8_t *buf, int len)
+transport_send(uint8_t *buf, int len, const void *addr)
 {
-  snmp_entry.buf = buf;
-  snmp_entry.len = len;
+  struct snmp_send_entry *send_entry;
+
+  send_entry = xmalloc(sizeof(*send_entry));
+  send_entry->next = NULL;
+  send_entry->buf = buf;
+  send_entry->len = len;
+  memcpy(&send_entry->client_sin, addr, sizeof(struct sockaddr_in));
+
+  *snmp_entry.tail = send_entry;
+  snmp_entry.tail = &send_entry->next;
   snmp_event_add(snmp_entry.sock, SNMP_EV_WRITE, snmp_write_handler, &snmp_entry);
 }
 
+/* Printable form of a request sender address */
+static const char *
+transport_peer(const void *addr)
+{
+  static char peer[INET_ADDRSTRLEN + 8];
+  const struct sockaddr_in *client_sin = addr;
+  char ip[INET_ADDRSTRLEN];
+
+  if (client_sin == NULL || inet_ntop(AF_INET, &client_sin->sin_addr, ip, sizeof(ip)) == NULL) {
+    return NULL;
+  }
+  snprintf(peer, sizeof(peer), "%s:%u", ip, ntohs(client_sin->sin_port));
+  return peer;
+}
+
 static void
 transport_running(void)
 {
@@ -106,6 +147,8 @@ transport_init(int port)
 {
   struct sockaddr_in sin;
 
+  snmp_entry.head = NULL;
+  snmp_entry.tail = &snmp_entry.head;
   snmp_entry.sock = socket(AF_INET, SOCK_DGRAM, 0);
   if (snmp_entry.sock < 0) {
     perror("usock");
@@ -132,4 +175,6 @@ struct transport_operation snmp_trans_ops = {
   transport_running,
   transport_stop,
   transport_send,
+  transport_peer,
+  1,
 };
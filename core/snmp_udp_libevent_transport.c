@@ -38,12 +38,11 @@ static struct event_base *event_base;
 static struct event *snmp_recv_event;
 static struct event *snmp_send_event;
 static int sock;
-struct sockaddr_in *client_sin;
 
 struct send_data_entry {
   int len;
   uint8_t * buf;
-  struct sockaddr_in * client_sin;
+  struct sockaddr_in client_sin;
   TAILQ_ENTRY(send_data_entry) entries;
 };
 
@@ -58,14 +57,13 @@ snmp_write_cb(const int sock, short int which, void *arg)
     entry = TAILQ_FIRST(&send_queue_head);
 
     /* Send the data back to the client */
-    if (sendto(sock, entry->buf, entry->len, 0, (struct sockaddr *) entry->client_sin, sizeof(struct sockaddr_in)) == -1) {
+    if (sendto(sock, entry->buf, entry->len, 0, (struct sockaddr *) &entry->client_sin, sizeof(struct sockaddr_in)) == -1) {
       perror("sendto()");
       event_loopbreak();
     }
     TAILQ_REMOVE(&send_queue_head, entry, entries);
 
     free(entry->buf);
-    free(entry->client_sin);
     free(entry);
 
     /* Free send event */
@@ -83,6 +81,7 @@ static void
 snmp_read_cb(const int sock, short int which, void *arg)
 {
   socklen_t server_sz = sizeof(struct sockaddr_in);
+  struct sockaddr_in * client_sin;
   int len;
   uint8_t * buf;
 
@@ -91,24 +90,26 @@ snmp_read_cb(const int sock, short int which, void *arg)
 
   /* Receive UDP data, store the address of the sender in client_sin */
   len = recvfrom(sock, buf, TRANS_BUF_SIZ, 0, (struct sockaddr *)client_sin, &server_sz);
-  if (len == -1) {
+  if (len <= 0) {
     perror("recvfrom()");
-    event_loopbreak();
+    free(buf);
+    free(client_sin);
+    return;
   }
 
-  /* Parse SNMP PDU in decoder */
-  snmp_prot_ops.receive(buf, len);
+  /* Parse SNMP PDU in decoder, client_sin goes with the request */
+  snmp_prot_ops.receive(buf, len, client_sin);
 }
 
 static void
-transport_send(uint8_t * buf, int len)
+transport_send(uint8_t * buf, int len, const void * addr)
 {
   struct send_data_entry * entry;
 
   entry = xmalloc(sizeof(struct send_data_entry));
   entry->buf = buf;
   entry->len = len;
-  entry->client_sin = client_sin;
+  memcpy(&entry->client_sin, addr, sizeof(struct sockaddr_in));
 
   /* Insert to tail */
   TAILQ_INSERT_TAIL(&send_queue_head, entry, entries);
@@ -118,6 +119,21 @@ transport_send(uint8_t * buf, int len)
   event_add(snmp_send_event, NULL);
 }
 
+/* Printable form of a request sender address */
+static const char *
+transport_peer(const void * addr)
+{
+  static char peer[INET_ADDRSTRLEN + 8];
+  const struct sockaddr_in * client_sin = addr;
+  char ip[INET_ADDRSTRLEN];
+
+  if (client_sin == NULL || inet_ntop(AF_INET, &client_sin->sin_addr, ip, sizeof(ip)) == NULL) {
+    return NULL;
+  }
+  snprintf(peer, sizeof(peer), "%s:%u", ip, ntohs(client_sin->sin_port));
+  return peer;
+}
+
 static void
 transport_running(void)
 {
@@ -176,4 +192,6 @@ struct transport_operation snmp_trans_ops = {
   transport_running,
   transport_stop,
   transport_send,
+  transport_peer,
+  0,
 };
@@ -21,6 +21,7 @@
 #include <sys/socket.h>
 #include <sys/queue.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <assert.h>
 #include <stdio.h>
@@ -34,18 +35,12 @@
 #include "util.h"
 
 static struct uloop_fd server;
-static struct sockaddr_in *client_sin;
-
-struct send_data_entry {
-  int len;
-  uint8_t *buf;
-  struct sockaddr_in *client_sin;
-};
 
 static void
 server_cb(struct uloop_fd *fd, unsigned int events)
 {
   socklen_t server_sz = sizeof(struct sockaddr_in);
+  struct sockaddr_in *client_sin;
   int len;
   uint8_t * buf;
 
@@ -54,35 +49,43 @@ server_cb(struct uloop_fd *fd, unsigned int events)
 
   /* Receive UDP data, store the address of the sender in client_sin */
   len = recvfrom(server.fd, buf, TRANS_BUF_SIZ, 0, (struct sockaddr *)client_sin, &server_sz);
-  if (len == -1) {
+  if (len <= 0) {
     perror("recvfrom()");
-    uloop_done();
+    free(buf);
+    free(client_sin);
+    return;
   }
 
-  /* Parse SNMP PDU in decoder */
-  snmp_prot_ops.receive(buf, len);
+  /* Parse SNMP PDU in decoder, client_sin goes with the request */
+  snmp_prot_ops.receive(buf, len, client_sin);
 }
 
 /* Send snmp datagram as a UDP packet to the remote */
 static void
-transport_send(uint8_t *buf, int len)
+transport_send(uint8_t *buf, int len, const void *addr)
 {
-  struct send_data_entry *entry;
-
-  entry = xmalloc(sizeof(struct send_data_entry));
-  entry->buf = buf;
-  entry->len = len;
-  entry->client_sin = client_sin;
-
   /* Send the data back to the client */
-  if (sendto(server.fd, entry->buf, entry->len, 0, (struct sockaddr *)entry->client_sin, sizeof(struct sockaddr_in)) == -1) {
+  if (sendto(server.fd, buf, len, 0, (const struct sockaddr *)addr, sizeof(struct sockaddr_in)) == -1) {
     perror("sendto()");
     uloop_done();
   }
 
-  free(entry->buf);
-  free(entry->client_sin);
-  free(entry);
+  free(buf);
+}
+
+/* Printable form of a request sender address */
+static const char *
+transport_peer(const void *addr)
+{
+  static char peer[INET_ADDRSTRLEN + 8];
+  const struct sockaddr_in *client_sin = addr;
+  char ip[INET_ADDRSTRLEN];
+
+  if (client_sin == NULL || inet_ntop(AF_INET, &client_sin->sin_addr, ip, sizeof(ip)) == NULL) {
+    return NULL;
+  }
+  snprintf(peer, sizeof(peer), "%s:%u", ip, ntohs(client_sin->sin_port));
+  return peer;
 }
 
 static void
@@ -130,4 +133,6 @@ struct transport_operation snmp_trans_ops = {
   transport_running,
   transport_stop,
   transport_send,
+  transport_peer,
+  0,
 };
@@ -0,0 +1,640 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "snmp.h"
+#include "protocol.h"
+#include "digest.h"
+#include "aes.h"
+#include "util.h"
+
+/* User-based Security Model (RFC 3414, SHA-2 from RFC 7860, AES from
+ * RFC 3826 with 192/256-bit keys extended as in the Blumenthal draft) */
+
+/* Password bytes hashed into a user key */
+#define USM_PASSWD_EXPAND_LEN  1048576
+#define USM_PASSWD_MIN_LEN     8
+/* msgPrivacyParameters of AES */
+#define USM_SALT_LEN           8
+/* Engine id is enterprise 0 and text format, followed by the text */
+#define USM_ENGINE_ID_HDR_LEN  5
+#define USM_ENGINE_ID_MAX_LEN  32
+/* Authenticated messages are all late once boots get here */
+#define USM_ENGINE_BOOTS_MAX   2147483647
+/* Seconds a message may be off the engine time */
+#define USM_TIME_WINDOW        150
+/* Longest Report, with engine id, user name and MAC at their longest */
+#define USM_REPORT_MAX_LEN     512
+
+octstr_t snmpv3_engine_id[USM_ENGINE_ID_MAX_LEN] = {
+  0x80, 0x00, 0x00, 0x00,
+  /* Text */
+  0x04,
+  /* 'S', 'm', 'a', 'r', 't', 'S', 'N', 'M', 'P' */
+  0x53, 0x6d, 0x61, 0x72, 0x74, 0x53, 0x4e, 0x4d, 0x50,
+};
+uint32_t snmpv3_engine_id_len = USM_ENGINE_ID_HDR_LEN + 9;
+
+/* Restarts counted in the boots file, 1 when there is none */
+static integer_t engine_boots = 1;
+/* Monotonic second the engine time counts from */
+static time_t engine_start;
+static int engine_started;
+
+uint32_t usm_stats[USM_STATS_NUM];
+
+/* Encoded usmStats counter OID 1.3.6.1.6.3.15.1.1.n.0, n patched in */
+#define USM_STATS_OID_N  10
+static const uint8_t usm_stats_oid[] = {
+  ASN1_TAG_OBJID, 10, 0x2b, 0x06, 0x01, 0x06, 0x03, 0x0f, 0x01, 0x01, 0x00, 0x00,
+};
+
+struct usm_auth_proto {
+  const char *name;
+  const struct digest_alg *alg;
+  /* Truncated MAC length in msgAuthenticationParameters */
+  uint32_t mac_len;
+};
+
+static const struct usm_auth_proto usm_auth_protos[] = {
+  { "MD5", &digest_md5, 12 },
+  { "SHA", &digest_sha1, 12 },
+  { "SHA-224", &digest_sha224, 16 },
+  { "SHA-256", &digest_sha256, 24 },
+  { "SHA-384", &digest_sha384, 32 },
+  { "SHA-512", &digest_sha512, 48 },
+};
+
+struct usm_priv_proto {
+  const char *name;
+  uint32_t key_len;
+};
+
+static const struct usm_priv_proto usm_priv_protos[] = {
+  { "AES", 16 },
+  { "AES-192", 24 },
+  { "AES-256", 32 },
+};
+
+struct usm_user {
+  struct usm_user *next;
+  char *name;
+  const struct usm_auth_proto *auth;
+  /* Key localized to this engine, with its HMAC pads hashed */
+  struct hmac_key auth_key;
+  /* NULL unless the user talks encrypted */
+  const struct usm_priv_proto *priv;
+  struct aes_key priv_key;
+};
+
+static struct usm_user *usm_users;
+
+/* Salt of the next encrypted message, started at random */
+static uint64_t usm_salt;
+
+/* Boots of the last run plus one, saved before the agent answers anyone */
+static int
+usm_engine_boots_load(const char *path)
+{
+  unsigned long boots = 0;
+  char *tmp;
+  FILE *fp;
+  int ok;
+
+  fp = fopen(path, "r");
+  if (fp != NULL) {
+    if (fscanf(fp, "%lu", &boots) != 1) {
+      boots = 0;
+    }
+    fclose(fp);
+  }
+  boots = boots < USM_ENGINE_BOOTS_MAX ? boots + 1 : USM_ENGINE_BOOTS_MAX;
+
+  /* Replaced by rename, so a crash never leaves the count behind */
+  tmp = xmalloc(strlen(path) + 5);
+  sprintf(tmp, "%s.tmp", path);
+  fp = fopen(tmp, "w");
+  ok = 0;
+  if (fp != NULL) {
+    ok = fprintf(fp, "%lu\n", boots) > 0 && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok && rename(tmp, path) == 0;
+  }
+  free(tmp);
+  if (!ok) {
+    SMARTSNMP_LOG(L_ERROR, "Can't save engine boots to %s\n", path);
+    return -1;
+  }
+
+  engine_boots = boots;
+  return 0;
+}
+
+/* Engine id text and boots file, both optional. Keys are localized to the
+ * engine id, so it comes before any user. */
+int
+usm_engine_init(const char *id, const char *boots_path)
+{
+  struct timespec ts;
+
+  if (id != NULL) {
+    if (strlen(id) == 0 || strlen(id) > USM_ENGINE_ID_MAX_LEN - USM_ENGINE_ID_HDR_LEN) {
+      SMARTSNMP_LOG(L_ERROR, "Engine id %s should be 1 to %d bytes\n", id, USM_ENGINE_ID_MAX_LEN - USM_ENGINE_ID_HDR_LEN);
+      return -1;
+    }
+    if (usm_users != NULL) {
+      SMARTSNMP_LOG(L_ERROR, "Engine id should be set before users\n");
+      return -1;
+    }
+    memcpy(snmpv3_engine_id + USM_ENGINE_ID_HDR_LEN, id, strlen(id));
+    snmpv3_engine_id_len = USM_ENGINE_ID_HDR_LEN + strlen(id);
+  }
+
+  if (boots_path != NULL && usm_engine_boots_load(boots_path) < 0) {
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  engine_start = ts.tv_sec;
+  engine_started = 1;
+  return 0;
+}
+
+integer_t
+usm_engine_boots(void)
+{
+  return engine_boots;
+}
+
+/* Seconds since the engine started */
+integer_t
+usm_engine_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  if (!engine_started) {
+    engine_start = ts.tv_sec;
+    engine_started = 1;
+  }
+  return ts.tv_sec - engine_start;
+}
+
+static struct usm_user *
+usm_user_search(const char *name)
+{
+  struct usm_user *u;
+
+  for (u = usm_users; u != NULL; u = u->next) {
+    if (!strcmp(u->name, name)) {
+      return u;
+    }
+  }
+  return NULL;
+}
+
+/* Password to key (RFC 3414 A.2.1), localized to engine id (A.2.2) */
+static void
+usm_key_localize(const struct digest_alg *alg, const char *passwd, uint32_t passwd_len,
+                 const octstr_t *engine_id, uint32_t engine_id_len, uint8_t *key)
+{
+  union digest_ctx ctx;
+  uint8_t chunk[64];
+  uint32_t i, count;
+
+  alg->init(&ctx);
+  for (count = 0; count < USM_PASSWD_EXPAND_LEN; count += sizeof(chunk)) {
+    for (i = 0; i < sizeof(chunk); i++) {
+      chunk[i] = passwd[(count + i) % passwd_len];
+    }
+    alg->update(&ctx, chunk, sizeof(chunk));
+  }
+  alg->final(&ctx, key);
+
+  alg->init(&ctx);
+  alg->update(&ctx, key, alg->digest_len);
+  alg->update(&ctx, (const uint8_t *)engine_id, engine_id_len);
+  alg->update(&ctx, key, alg->digest_len);
+  alg->final(&ctx, key);
+
+  memset(chunk, 0, sizeof(chunk));
+}
+
+/* Authenticate user with protocol and password, at configuration time
+ * since localizing the password is deliberately slow */
+int
+usm_user_reg(const char *name, const char *auth_proto, const char *auth_passwd)
+{
+  const struct usm_auth_proto *auth = NULL;
+  struct usm_user *u;
+  uint8_t key[DIGEST_MAX_LEN];
+  int i;
+
+  for (i = 0; i < elem_num(usm_auth_protos); i++) {
+    if (!strcmp(usm_auth_protos[i].name, auth_proto)) {
+      auth = &usm_auth_protos[i];
+      break;
+    }
+  }
+  if (auth == NULL) {
+    SMARTSNMP_LOG(L_ERROR, "Unknown authentication protocol %s for user %s\n", auth_proto, name);
+    return -1;
+  }
+  if (strlen(auth_passwd) < USM_PASSWD_MIN_LEN) {
+    SMARTSNMP_LOG(L_ERROR, "Authentication password of user %s is shorter than %d\n", name, USM_PASSWD_MIN_LEN);
+    return -1;
+  }
+
+  u = usm_user_search(name);
+  if (u == NULL) {
+    u = xcalloc(1, sizeof(*u));
+    u->name = xmalloc(strlen(name) + 1);
+    strcpy(u->name, name);
+    u->next = usm_users;
+    usm_users = u;
+  }
+
+  usm_key_localize(auth->alg, auth_passwd, strlen(auth_passwd), snmpv3_engine_id, snmpv3_engine_id_len, key);
+  hmac_key_init(&u->auth_key, auth->alg, key, auth->alg->digest_len);
+  u->auth = auth;
+  memset(key, 0, sizeof(key));
+
+  return 0;
+}
+
+static void
+usm_salt_init(void)
+{
+  int fd = open("/dev/urandom", O_RDONLY);
+
+  if (fd < 0 || read(fd, &usm_salt, sizeof(usm_salt)) != sizeof(usm_salt)) {
+    usm_salt = (uint64_t)time(NULL) << 32 | getpid();
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+/* Encrypt messages of authenticated user with protocol and password */
+int
+usm_user_priv_reg(const char *name, const char *priv_proto, const char *priv_passwd)
+{
+  const struct usm_priv_proto *priv = NULL;
+  const struct digest_alg *alg;
+  struct usm_user *u;
+  uint8_t key[DIGEST_MAX_LEN * 2];
+  uint32_t key_len;
+  int i;
+
+  for (i = 0; i < elem_num(usm_priv_protos); i++) {
+    if (!strcmp(usm_priv_protos[i].name, priv_proto)) {
+      priv = &usm_priv_protos[i];
+      break;
+    }
+  }
+  if (priv == NULL) {
+    SMARTSNMP_LOG(L_ERROR, "Unknown privacy protocol %s for user %s\n", priv_proto, name);
+    return -1;
+  }
+  u = usm_user_search(name);
+  if (u == NULL) {
+    SMARTSNMP_LOG(L_ERROR, "Privacy of user %s needs authentication\n", name);
+    return -1;
+  }
+  if (strlen(priv_passwd) < USM_PASSWD_MIN_LEN) {
+    SMARTSNMP_LOG(L_ERROR, "Privacy password of user %s is shorter than %d\n", name, USM_PASSWD_MIN_LEN);
+    return -1;
+  }
+
+  /* Localized with the authentication hash, extended by hashing it */
+  alg = u->auth->alg;
+  usm_key_localize(alg, priv_passwd, strlen(priv_passwd), snmpv3_engine_id, snmpv3_engine_id_len, key);
+  for (key_len = alg->digest_len; key_len < priv->key_len; key_len += alg->digest_len) {
+    digest(alg, key, key_len, key + key_len);
+  }
+  aes_key_init(&u->priv_key, key, priv->key_len);
+  u->priv = priv;
+  memset(key, 0, sizeof(key));
+
+  if (usm_salt == 0) {
+    usm_salt_init();
+  }
+  return 0;
+}
+
+static int
+usm_mac_equal(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+  uint8_t diff = 0;
+  uint32_t i;
+
+  for (i = 0; i < len; i++) {
+    diff |= a[i] ^ b[i];
+  }
+  return diff == 0;
+}
+
+/* Check the security level and MAC of message of len bytes received in
+ * sdg, where the MAC is already copied out of auth_para_off */
+SNMP_ERR_CODE_E
+usm_incoming(struct snmp_datagram *sdg, uint8_t *msg, uint32_t len)
+{
+  struct usm_user *u;
+  uint8_t mac[DIGEST_MAX_LEN];
+
+  /* Discovery probes come with an empty engine id */
+  if (sdg->engine_id_len != snmpv3_engine_id_len ||
+      memcmp(sdg->engine_id, snmpv3_engine_id, snmpv3_engine_id_len)) {
+    return SNMP_ERR_USM_ENGINE_ID;
+  }
+
+  u = usm_user_search((const char *)sdg->user_name);
+
+  if (!(sdg->msg_flags & SNMP_MSG_FLAG_AUTH)) {
+    /* Users with keys only talk at their own security level */
+    if (sdg->msg_flags & SNMP_MSG_FLAG_PRIV) {
+      return SNMP_ERR_USM_SEC_LEVEL;
+    }
+    return u == NULL ? SNMP_ERR_OK : SNMP_ERR_USM_SEC_LEVEL;
+  }
+
+  if (u == NULL) {
+    return SNMP_ERR_USM_USER;
+  }
+  if (!(sdg->msg_flags & SNMP_MSG_FLAG_PRIV) != (u->priv == NULL)) {
+    return SNMP_ERR_USM_SEC_LEVEL;
+  }
+  if (sdg->auth_para_len != u->auth->mac_len) {
+    return SNMP_ERR_USM_DIGEST;
+  }
+  if (u->priv != NULL && sdg->priv_para_len != USM_SALT_LEN) {
+    return SNMP_ERR_USM_DECRYPT;
+  }
+
+  /* One pass over the message with the MAC field zeroed in place */
+  memset(msg + sdg->auth_para_off, 0, u->auth->mac_len);
+  hmac(&u->auth_key, msg, len, mac);
+  if (!usm_mac_equal(mac, (const uint8_t *)sdg->auth_para, u->auth->mac_len)) {
+    return SNMP_ERR_USM_DIGEST;
+  }
+
+  /* Responses carry a zeroed MAC until signed */
+  memset(sdg->auth_para, 0, sdg->auth_para_len);
+  sdg->usm_user = u;
+
+  /* Late messages are still answered by a Report signed for the user */
+  if (engine_boots == USM_ENGINE_BOOTS_MAX || sdg->engine_boots != engine_boots ||
+      llabs((long long)sdg->engine_time - usm_engine_time()) > USM_TIME_WINDOW) {
+    return SNMP_ERR_USM_TIME_WINDOW;
+  }
+  return SNMP_ERR_OK;
+}
+
+/* Backwards from p, so that every length is known when its header goes in */
+static uint8_t *
+report_hdr(uint8_t *p, uint8_t tag, uint32_t len)
+{
+  p -= ber_length_enc_try(len);
+  ber_length_enc(len, p);
+  *--p = tag;
+  return p;
+}
+
+static uint8_t *
+report_str(uint8_t *p, const void *str, uint32_t len)
+{
+  p -= len;
+  memcpy(p, str, len);
+  return report_hdr(p, ASN1_TAG_OCTSTR, len);
+}
+
+/* Integer or counter of 32 bits */
+static uint8_t *
+report_int(uint8_t *p, uint8_t tag, const void *value)
+{
+  uint32_t len = ber_value_enc_try(value, 1, tag);
+
+  p -= len;
+  ber_value_enc(value, 1, tag, p);
+  return report_hdr(p, tag, len);
+}
+
+/* Request id from plaintext scoped PDU of len bytes, 0 when not there */
+static integer_t
+report_request_id(const uint8_t *buf, uint32_t len)
+{
+  /* Scoped PDU, context engine id, context name, PDU of any type */
+  static const uint8_t tags[] = { ASN1_TAG_SEQ, ASN1_TAG_OCTSTR, ASN1_TAG_OCTSTR, 0, ASN1_TAG_INT };
+  const uint8_t *end = buf + len;
+  integer_t id = 0;
+  uint32_t l = 0;
+  int i;
+
+  for (i = 0; i < elem_num(tags); i++) {
+    if (end - buf < 2 || (tags[i] && buf[0] != tags[i]) ||
+        ber_length_dec_try(buf + 1) > sizeof(uint32_t) || ber_length_dec_try(buf + 1) >= (uint32_t)(end - buf)) {
+      return 0;
+    }
+    buf += 1 + ber_length_dec(buf + 1, &l);
+    if (tags[i] == ASN1_TAG_OCTSTR) {
+      buf += l;
+    }
+  }
+
+  if (l == 0 || l > sizeof(id) || l > (uint32_t)(end - buf)) {
+    return 0;
+  }
+  ber_value_dec(buf, l, ASN1_TAG_INT, &id);
+  return id;
+}
+
+/* Count message failing USM with err and, if it asks for Reports, send the
+ * usmStats counter of err back right away without going near the MIB tree.
+ * Only msgID, request id, engine time and the counter change between
+ * Reports. scope is what follows the security parameters. */
+void
+usm_report(struct snmp_datagram *sdg, SNMP_ERR_CODE_E err, const uint8_t *scope, uint32_t scope_len)
+{
+  uint8_t msg[USM_REPORT_MAX_LEN], oid[sizeof(usm_stats_oid)];
+  uint8_t *p, *end, *scoped, *param, *mac = NULL, *out;
+  const struct usm_user *u = NULL;
+  integer_t req_id, version = 3, zero = 0, boots, time;
+  octstr_t flags = 0;
+  int stat;
+
+  switch (err) {
+    case SNMP_ERR_USM_SEC_LEVEL:
+      stat = USM_STATS_UNSUPPORTED_SEC_LEVELS;
+      break;
+    case SNMP_ERR_USM_TIME_WINDOW:
+      stat = USM_STATS_NOT_IN_TIME_WINDOWS;
+      /* Managers learn the engine time from this one, so it is signed */
+      u = sdg->usm_user;
+      flags = SNMP_MSG_FLAG_AUTH;
+      break;
+    case SNMP_ERR_USM_USER:
+      stat = USM_STATS_UNKNOWN_USER_NAMES;
+      break;
+    case SNMP_ERR_USM_ENGINE_ID:
+      stat = USM_STATS_UNKNOWN_ENGINE_IDS;
+      break;
+    case SNMP_ERR_USM_DIGEST:
+      stat = USM_STATS_WRONG_DIGESTS;
+      break;
+    case SNMP_ERR_USM_DECRYPT:
+      stat = USM_STATS_DECRYPTION_ERRORS;
+      break;
+    default:
+      return;
+  }
+
+  usm_stats[stat]++;
+  if (!(sdg->msg_flags & SNMP_MSG_FLAG_REPORT)) {
+    return;
+  }
+
+  req_id = sdg->msg_flags & SNMP_MSG_FLAG_PRIV ? 0 : report_request_id(scope, scope_len);
+  boots = engine_boots;
+  time = usm_engine_time();
+  memcpy(oid, usm_stats_oid, sizeof(oid));
+  oid[USM_STATS_OID_N] = stat + 1;
+
+  end = p = msg + sizeof(msg);
+
+  /* Scoped PDU with the counter as the only varbind */
+  p = report_int(p, ASN1_TAG_CNT, &usm_stats[stat]);
+  p -= sizeof(oid);
+  memcpy(p, oid, sizeof(oid));
+  p = report_hdr(p, ASN1_TAG_SEQ, end - p);
+  p = report_hdr(p, ASN1_TAG_SEQ, end - p);
+  p = report_int(p, ASN1_TAG_INT, &zero);
+  p = report_int(p, ASN1_TAG_INT, &zero);
+  p = report_int(p, ASN1_TAG_INT, &req_id);
+  p = report_hdr(p, MIB_REPO, end - p);
+  p = report_str(p, "", 0);
+  p = report_str(p, snmpv3_engine_id, snmpv3_engine_id_len);
+  p = report_hdr(p, ASN1_TAG_SEQ, end - p);
+  scoped = p;
+
+  /* Security parameters, MAC zeroed until signed */
+  p = report_str(p, "", 0);
+  if (u != NULL) {
+    p -= u->auth->mac_len;
+    memset(p, 0, u->auth->mac_len);
+    mac = p;
+    p = report_hdr(p, ASN1_TAG_OCTSTR, u->auth->mac_len);
+  } else {
+    p = report_str(p, "", 0);
+  }
+  p = report_str(p, sdg->user_name, sdg->user_name_len);
+  p = report_int(p, ASN1_TAG_INT, &time);
+  p = report_int(p, ASN1_TAG_INT, &boots);
+  p = report_str(p, snmpv3_engine_id, snmpv3_engine_id_len);
+  p = report_hdr(p, ASN1_TAG_SEQ, scoped - p);
+  p = report_hdr(p, ASN1_TAG_OCTSTR, scoped - p);
+  param = p;
+
+  /* Header with the msgID of the message */
+  p = report_int(p, ASN1_TAG_INT, &sdg->msg_security_model);
+  p = report_str(p, &flags, 1);
+  p = report_int(p, ASN1_TAG_INT, &sdg->msg_max_size);
+  p = report_int(p, ASN1_TAG_INT, &sdg->msg_id);
+  p = report_hdr(p, ASN1_TAG_SEQ, param - p);
+
+  p = report_int(p, ASN1_TAG_INT, &version);
+  p = report_hdr(p, ASN1_TAG_SEQ, end - p);
+
+  if (u != NULL) {
+    uint8_t digest[DIGEST_MAX_LEN];
+    hmac(&u->auth_key, p, end - p, digest);
+    memcpy(mac, digest, u->auth->mac_len);
+  }
+
+  /* This callback will free the copy */
+  out = xmalloc(end - p);
+  memcpy(out, p, end - p);
+  snmp_prot_ops.send(out, end - p, sdg->addr);
+  snmp_stats[SNMP_OUT_PKTS]++;
+}
+
+/* IV from the engine boots and time of the message and its salt */
+static void
+usm_iv(const struct snmp_datagram *sdg, const octstr_t *salt, uint8_t *iv)
+{
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    iv[i] = sdg->engine_boots >> (24 - i * 8);
+    iv[4 + i] = sdg->engine_time >> (24 - i * 8);
+  }
+  memcpy(iv + 8, salt, USM_SALT_LEN);
+}
+
+/* Decrypt scoped PDU of len bytes in place, for authenticated sdg */
+SNMP_ERR_CODE_E
+usm_decrypt(struct snmp_datagram *sdg, uint8_t *data, uint32_t len)
+{
+  struct usm_user *u = sdg->usm_user;
+  uint8_t iv[AES_BLOCK_LEN];
+  uint32_t hdr_len, seq_len;
+  int i;
+
+  usm_iv(sdg, sdg->priv_para, iv);
+  aes_cfb_decrypt(&u->priv_key, iv, data, len);
+
+  /* A wrong key leaves no sequence spanning the plaintext */
+  if (len < 2 || data[0] != ASN1_TAG_SEQ || ber_length_dec_try(data + 1) > sizeof(uint32_t) ||
+      ber_length_dec_try(data + 1) >= len) {
+    return SNMP_ERR_USM_DECRYPT;
+  }
+  hdr_len = 1 + ber_length_dec(data + 1, &seq_len);
+  if (seq_len != len - hdr_len) {
+    return SNMP_ERR_USM_DECRYPT;
+  }
+
+  /* Salt of the response */
+  usm_salt++;
+  for (i = 0; i < USM_SALT_LEN; i++) {
+    sdg->priv_para[i] = usm_salt >> (56 - i * 8);
+  }
+  return SNMP_ERR_OK;
+}
+
+/* Encrypt the scoped PDU and sign encoded response of len bytes, in place */
+void
+usm_outgoing(struct snmp_datagram *sdg, uint8_t *msg, uint32_t len)
+{
+  struct usm_user *u = sdg->usm_user;
+  uint8_t mac[DIGEST_MAX_LEN], iv[AES_BLOCK_LEN];
+
+  if (u != NULL) {
+    if (u->priv != NULL) {
+      usm_iv(sdg, sdg->priv_para, iv);
+      aes_cfb_encrypt(&u->priv_key, iv, msg + sdg->scope_off, len - sdg->scope_off);
+    }
+    hmac(&u->auth_key, msg, len, mac);
+    memcpy(msg + sdg->auth_para_off, mac, u->auth->mac_len);
+  }
+}
@@ -30,7 +30,12 @@ struct transport_operation {
   int (*init)(int port);
   void (*running)(void);
   void (*stop)(void);
-  void (*send)(uint8_t *buf, int len);
+  /* Send to the sender address handed over with a received datagram */
+  void (*send)(uint8_t *buf, int len, const void *addr);
+  /* Printable form of a sender address, NULL if unknown */
+  const char *(*peer)(const void *addr);
+  /* Set if running means running the built-in event loop */
+  int evloop;
 };
 
 extern struct transport_operation snmp_trans_ops;
@@ -166,6 +166,74 @@ xcalloc(int nr, size_t size)
   return ret;
 }
 
+/* Bump allocator for objects freed all at once */
+#define ARENA_CHUNK_SIZE  4096
+#define ARENA_ALIGN(n)    (((n) + sizeof(double) - 1) & ~(sizeof(double) - 1))
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+  double data[0];
+};
+
+struct arena {
+  struct arena_chunk *head;
+};
+
+static inline void *
+arena_alloc(struct arena *a, size_t size)
+{
+  struct arena_chunk *c = a->head;
+  void *ret;
+
+  size = ARENA_ALIGN(size);
+  if (c == NULL || c->used + size > c->size) {
+    size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    c = xmalloc(sizeof(*c) + chunk_size);
+    c->size = chunk_size;
+    c->used = 0;
+    c->next = a->head;
+    a->head = c;
+  }
+
+  ret = (char *)c->data + c->used;
+  c->used += size;
+  return ret;
+}
+
+/* Drop all objects, one chunk of standard size is kept for reuse and
+ * oversized ones are freed */
+static inline void
+arena_reset(struct arena *a)
+{
+  struct arena_chunk *c = a->head, *keep = NULL;
+
+  while (c != NULL) {
+    struct arena_chunk *next = c->next;
+    if (keep == NULL && c->size == ARENA_CHUNK_SIZE) {
+      keep = c;
+    } else {
+      free(c);
+    }
+    c = next;
+  }
+
+  if (keep != NULL) {
+    keep->next = NULL;
+    keep->used = 0;
+  }
+  a->head = keep;
+}
+
+static inline void
+arena_free(struct arena *a)
+{
+  arena_reset(a);
+  free(a->head);
+  a->head = NULL;
+}
+
 static inline const char *
 error_message(struct err_msg_map *msg_blk, size_t size, int err)
 {
@@ -44,6 +44,12 @@ local SNMP_REQ_INF                   = 0xA6
 local SNMP_TRAP                      = 0xA7
 local SNMP_REPO                      = 0xA8
 
+-- Set transaction phases
+local MIB_REQ_TESTSET                = 0x100
+local MIB_REQ_COMMITSET              = 0x101
+local MIB_REQ_UNDOSET                = 0x102
+local MIB_REQ_CLEANUPSET             = 0x103
+
 -- ASN1 tag
 local ASN1_TAG_BOOL                  = 0x01
 local ASN1_TAG_INT                   = 0x02
@@ -104,12 +110,75 @@ function _M.module_method_unregister(name)
     _M.module_methods[name] = nil
 end
 
+-- Wait for fd to be readable or timeout ms to elapse, nil or -1 for
+-- either means not to wait on it. Return true if fd is readable.
+-- Inside handlers the request is parked meanwhile and the agent goes on
+-- serving others, elsewhere it just blocks.
+function _M.wait_fd(fd, timeout)
+    fd = fd or -1
+    timeout = timeout or -1
+    if coroutine.running() == nil then
+        return core.poll_fd(fd, timeout)
+    end
+    return coroutine.yield(fd, timeout)
+end
+
+-- Sleep for ms without blocking other requests.
+function _M.sleep(ms)
+    _M.wait_fd(-1, ms)
+end
+
+-- Read output like file:read() does with rmode.
+local read_mode = function (s, rmode)
+    local m = string.sub(rmode, 2, 2)
+    if m == 'a' then
+        return s
+    elseif s == '' then
+        return nil
+    elseif m == 'l' then
+        return string.match(s, "^[^\n]*")
+    elseif m == 'n' then
+        return tonumber(string.match(s, "^%s*(%S+)"))
+    end
+    return nil
+end
+
+-- Time in ms handlers give shell commands to finish.
+_M.sh_call_timeout = 5000
+
 -- Shell command invoke.
-function _M.sh_call(command, rmode)
+function _M.sh_call(command, rmode, timeout)
     if type(command) ~= 'string' or type(rmode) ~= 'string' then
         return nil
     end
 
+    -- Handlers wait for command output without blocking the agent, commands
+    -- still running when time is up are killed and get nil.
+    if coroutine.running() ~= nil then
+        local fd, pid = core.sh_spawn(command)
+        if fd == nil then
+            return nil
+        end
+        local deadline = core.time_ms() + (timeout or _M.sh_call_timeout)
+        local output = {}
+        while true do
+            local s = core.fd_read(fd)
+            if s == nil then
+                break
+            elseif s == '' then
+                local left = deadline - core.time_ms()
+                if left <= 0 or not _M.wait_fd(fd, left) then
+                    core.sh_reap(fd, pid, true)
+                    return nil
+                end
+            else
+                table.insert(output, s)
+            end
+        end
+        core.sh_reap(fd, pid)
+        return read_mode(table.concat(output), rmode)
+    end
+
     local t = nil
     local f = io.popen(command)
     if f then
@@ -207,6 +276,12 @@ function _M.Gauge(g, s)
     return { tag = ASN1_TAG_GAU, access = MIB_ACES_RW, get_f = g, set_f = s }
 end
 
+-- Group implemented in C core, looked up by name.
+function _M.NativeGroup(name)
+    assert(type(name) == 'string', 'Argument must be string type')
+    return { native = name }
+end
+
 --
 -- Helper functions
 --
@@ -538,8 +613,121 @@ local function return_value_check(g, v, t)
     end
 end
 
+--[[
+  Table snapshot for consistent walks. A table entry may set 'snapshot' to a
+  number of seconds:
+    [22] = {
+      [1] = {
+        indexes = cache,
+        snapshot = 10,
+        [1] = ...
+      }
+    }
+  A walk entering such a table from its root evaluates all its instances
+  once and pins the result to the manager. Following GETNEXT/GETBULK
+  requests from the same manager are answered from the pinned snapshot
+  until the walk leaves the table or it stays idle for that many seconds.
+]]--
+
+local oid_less = function (oid1, oid2)
+    local len = math.min(#oid1, #oid2)
+    for i = 1, len do
+        if oid1[i] ~= oid2[i] then
+            return oid1[i] < oid2[i]
+        end
+    end
+    return #oid1 < #oid2
+end
+
+local oid_equal = function (oid1, oid2)
+    if #oid1 ~= #oid2 then return false end
+    for i = 1, #oid1 do
+        if oid1[i] ~= oid2[i] then return false end
+    end
+    return true
+end
+
+-- Return entry option of snapshot lifetime, nil if not a snapshot table.
+local table_snapshot_ttl = function (group, table_no)
+    local tab = group[table_no]
+    if type(tab) ~= 'table' or tab.get_f ~= nil then return nil end
+    local _, entry = next(tab)
+    if type(entry) ~= 'table' then return nil end
+    return entry.snapshot
+end
+
+-- Pin keys are of the manager and context of the request, which are only
+-- known until a handler yields, so the owner is taken before searching.
+local table_snapshot_owner = function ()
+    return (core.request_peer() or '') .. '/' .. core.request_context() .. '/'
+end
+
+-- Evaluate all accessible instances of a table in lexicographical order.
+local table_snapshot_build = function (group, table_no, it, ttl)
+    local snap = { oids = {}, vals = {}, tags = {}, errs = {}, pos = 0, ttl = ttl }
+    local oid = { table_no }
+    while true do
+        oid = group_index_table_getnext(oid, it)
+        if next(oid) == nil then break end
+        local variable = group[oid[1]][oid[2]][oid[3]]
+        local inst_no
+        if #oid == 4 then
+            inst_no = oid[4]
+        else
+            inst_no = {}
+            for i = 4, #oid do
+                table.insert(inst_no, oid[i])
+            end
+        end
+        if variable.access ~= MIB_ACES_UNA then
+            local val, err = variable.get_f(inst_no)
+            if val ~= nil then
+                local n = #snap.oids + 1
+                snap.oids[n] = { unpack(oid) }
+                snap.vals[n] = val
+                snap.tags[n] = variable.tag
+                snap.errs[n] = err
+            end
+        end
+    end
+    snap.expires = os.time() + ttl
+    return snap
+end
+
+-- Position of the instance next to oid in snapshot, nil if beyond.
+local table_snapshot_next = function (snap, oid)
+    local n
+    if snap.pos > 0 and oid_equal(snap.oids[snap.pos], oid) then
+        -- walk goes on from the last answer
+        n = snap.pos + 1
+    else
+        local low, high = 1, #snap.oids + 1
+        while low < high do
+            local mid = math.floor((low + high) / 2)
+            if oid_less(oid, snap.oids[mid]) then
+                high = mid
+            else
+                low = mid + 1
+            end
+        end
+        n = low
+    end
+    if n > #snap.oids then return nil end
+    snap.pos = n
+    snap.expires = os.time() + snap.ttl
+    return n
+end
+
+-- Drop snapshots of managers which have gone away.
+local table_snapshot_sweep = function (pins)
+    local now = os.time()
+    for key, snap in pairs(pins) do
+        if snap.expires < now then pins[key] = nil end
+    end
+end
+
 -- Search and operation
-local mib_node_search = function (group, name, op, req_sub_oid, req_val, req_val_type)
+local mib_node_search = function (group, name, pins, txns, op, req_sub_oid, req_val, req_val_type)
     local err_stat = nil
     local rsp_sub_oid = nil
     local rsp_val = nil
@@ -555,13 +743,9 @@ local mib_node_search = function (group, name, op, req_sub_oid, req_val, req_val
         return nil
     end
 
-    local handlers = {}
-    -- set operation
-    handlers[SNMP_REQ_SET] = function ()
-        rsp_sub_oid = req_sub_oid
-        rsp_val = req_val
-        rsp_val_type = req_val_type
-
+    -- Locate the object to set, return error status or the object and its
+    -- instance, nil instance for a scalar.
+    local set_lookup = function ()
         local obj_no = req_sub_oid[1]
         local dim = effective_object_index(group_index_table, obj_no)
         if dim ~= nil then
@@ -570,14 +754,16 @@ local mib_node_search = function (group, name, op, req_sub_oid, req_val, req_val
                 local scalar = group[obj_no]
                 -- check access
                 if scalar.access == MIB_ACES_UNA or not(#req_sub_oid == 2 and req_sub_oid[2] == 0) then
-                    return _M.SNMP_ERR_STAT_UNACCESS, rsp_sub_oid, rsp_val, rsp_val_type
+                    return _M.SNMP_ERR_STAT_UNACCESS
                 end
                 -- check type
-                if rsp_val_type ~= scalar.tag then
-                    return _M.SNMP_ERR_STAT_WRONG_TYPE, rsp_sub_oid, rsp_val, rsp_val_type
+                if req_val_type ~= scalar.tag then
+                    return _M.SNMP_ERR_STAT_WRONG_TYPE
                 end
-
-                err_stat = scalar.set_f(rsp_val)
+                if scalar.set_f == nil then
+                    return _M.SNMP_ERR_STAT_NOT_WRITABLE
+                end
+                return nil, scalar, nil
             elseif dim >= 4 then
                 -- table
                 local table_no = obj_no
@@ -585,36 +771,69 @@ local mib_node_search = function (group, name, op, req_sub_oid, req_val, req_val
                 local var_no = req_sub_oid[3]
                 local tab = group[table_no]
                 if #req_sub_oid < 3 or tab[entry_no] == nil or tab[entry_no][var_no] == nil then
-                    return _M.SNMP_ERR_STAT_UNACCESS, rsp_sub_oid, rsp_val, rsp_val_type
+                    return _M.SNMP_ERR_STAT_UNACCESS
                 end
                 -- check access
                 local variable = tab[entry_no][var_no]
                 local inst_no
-                if #rsp_sub_oid == 4 then
-                    inst_no = rsp_sub_oid[4]
+                if #req_sub_oid == 4 then
+                    inst_no = req_sub_oid[4]
                 else
                     inst_no = {}
-                    for i = 4, #rsp_sub_oid do
-                        table.insert(inst_no, rsp_sub_oid[i])
+                    for i = 4, #req_sub_oid do
+                        table.insert(inst_no, req_sub_oid[i])
                     end
                 end
                 if variable.access == MIB_ACES_UNA or
                    type(inst_no) == 'number' and inst_no == nil or
                    type(inst_no) == 'table' and next(inst_no) == nil then
-                    return _M.SNMP_ERR_STAT_UNACCESS, rsp_sub_oid, rsp_val, rsp_val_type
+                    return _M.SNMP_ERR_STAT_UNACCESS
                 end
                 -- check type
-                if rsp_val_type ~= variable.tag then
-                    return _M.SNMP_ERR_STAT_WRONG_TYPE, rsp_sub_oid, rsp_val, rsp_val_type
+                if req_val_type ~= variable.tag then
+                    return _M.SNMP_ERR_STAT_WRONG_TYPE
                 end
-
-                err_stat = variable.set_f(inst_no, rsp_val)
-            else
-                return _M.SNMP_ERR_STAT_NOT_WRITABLE, rsp_sub_oid, rsp_val, rsp_val_type
+                if variable.set_f == nil then
+                    return _M.SNMP_ERR_STAT_NOT_WRITABLE
+                end
+                return nil, variable, inst_no
             end
-       else
-           return _M.SNMP_ERR_STAT_NOT_WRITABLE, rsp_sub_oid, rsp_val, rsp_val_type
-       end
+        end
+        return _M.SNMP_ERR_STAT_NOT_WRITABLE
+    end
+
+    -- Writes staged in the set transaction, one per context as each
+    -- context is served in its own AgentX session.
+    local set_txn = function ()
+        local context = core.request_context()
+        if txns[context] == nil then
+            txns[context] = {}
+        end
+        return txns[context]
+    end
+
+    local set_write = function (variable, inst_no, val)
+        if inst_no == nil then
+            return variable.set_f(val)
+        else
+            return variable.set_f(inst_no, val)
+        end
+    end
+
+    local handlers = {}
+    -- set operation
+    handlers[SNMP_REQ_SET] = function ()
+        rsp_sub_oid = req_sub_oid
+        rsp_val = req_val
+        rsp_val_type = req_val_type
+
+        local variable, inst_no
+        err_stat, variable, inst_no = set_lookup()
+        if err_stat ~= nil then
+            return err_stat, rsp_sub_oid, rsp_val, rsp_val_type
+        end
+
+        err_stat = set_write(variable, inst_no, rsp_val)
 
         return_value_check(name, rsp_val, rsp_val_type)
 
@@ -625,6 +844,69 @@ local mib_node_search = function (group, name, op, req_sub_oid, req_val, req_val
         end
     end
 
+    -- Stage a write of the set transaction, it is checked but not applied
+    handlers[MIB_REQ_TESTSET] = function ()
+        local variable, inst_no
+        err_stat, variable, inst_no = set_lookup()
+        if err_stat ~= nil then
+            return err_stat, req_sub_oid, req_val, req_val_type
+        end
+
+        table.insert(set_txn(), { sub_oid = req_sub_oid, value = req_val, variable = variable, inst_no = inst_no })
+        return _M.SNMP_ERR_STAT_NO_ERR, req_sub_oid, req_val, req_val_type
+    end
+
+    -- Apply all staged writes, in one call of group.commit_f if the group
+    -- has it, otherwise by set_f of each object.
+    handlers[MIB_REQ_COMMITSET] = function ()
+        local txn = set_txn()
+        for _, w in ipairs(txn) do
+            if w.inst_no == nil then
+                w.old = w.variable.get_f()
+            else
+                w.old = w.variable.get_f(w.inst_no)
+            end
+        end
+
+        if group.commit_f ~= nil then
+            local writes = {}
+            for _, w in ipairs(txn) do
+                table.insert(writes, { oid = w.sub_oid, value = w.value })
+                w.done = true
+            end
+            err_stat = group.commit_f(writes)
+        else
+            for _, w in ipairs(txn) do
+                err_stat = set_write(w.variable, w.inst_no, w.value)
+                w.done = true
+                if err_stat ~= nil and err_stat ~= _M.SNMP_ERR_STAT_NO_ERR then break end
+            end
+        end
+
+        return err_stat or _M.SNMP_ERR_STAT_NO_ERR
+    end
+
+    -- Restore the values the commit has overwritten, latest first
+    handlers[MIB_REQ_UNDOSET] = function ()
+        local txn = set_txn()
+        for i = #txn, 1, -1 do
+            local w = txn[i]
+            if w.done and w.old ~= nil then
+                local err = set_write(w.variable, w.inst_no, w.old)
+                if err ~= nil and err ~= _M.SNMP_ERR_STAT_NO_ERR then
+                    err_stat = err
+                end
+            end
+        end
+
+        return err_stat or _M.SNMP_ERR_STAT_NO_ERR
+    end
+
+    handlers[MIB_REQ_CLEANUPSET] = function ()
+        txns[core.request_context()] = nil
+        return _M.SNMP_ERR_STAT_NO_ERR
+    end
+
     -- get operation
     handlers[SNMP_REQ_GET] = function ()
         rsp_sub_oid = req_sub_oid
@@ -696,8 +978,43 @@ local mib_node_search = function (group, name, op, req_sub_oid, req_val, req_val
         end
     end
 
+    local snapshot_response = function (snap, n)
+        rsp_sub_oid = snap.oids[n]
+        rsp_val = snap.vals[n]
+        rsp_val_type = snap.tags[n]
+        err_stat = snap.errs[n]
+
+        return_value_check(name, rsp_val, rsp_val_type)
+
+        if err_stat ~= nil then
+            return err_stat, rsp_sub_oid, rsp_val, rsp_val_type
+        else
+            return _M.SNMP_ERR_STAT_NO_ERR, rsp_sub_oid, rsp_val, rsp_val_type
+        end
+    end
+
     -- get next operation
     handlers[SNMP_REQ_GETNEXT] = function ()
+        -- Walk goes on in a pinned table snapshot
+        local owner = table_snapshot_owner()
+        local table_no = req_sub_oid[1]
+        if table_no ~= nil and table_snapshot_ttl(group, table_no) ~= nil then
+            local key = owner .. table_no
+            local snap = pins[key]
+            if snap ~= nil and snap.expires >= os.time() then
+                local n = table_snapshot_next(snap, req_sub_oid)
+                if n ~= nil then
+                    return snapshot_response(snap, n)
+                end
+                -- Walk leaves the table, carry on after it.
+                req_sub_oid = { table_no + 1 }
+            end
+            pins[key] = nil
+        end
+
+        group_index_table = group_index_table_generator(group, name)
+        -- request oid is modified in place by the search below
+        local req_no, req_len = req_sub_oid[1], #req_sub_oid
         rsp_sub_oid = req_sub_oid
 
         local i = 1
@@ -761,6 +1078,24 @@ local mib_node_search = function (group, name, op, req_sub_oid, req_val, req_val
             return _M.SNMP_ERR_STAT_NO_ERR, rsp_sub_oid, nil, ASN1_TAG_NO_SUCH_OBJ
         end
 
+        -- Walk enters a snapshot table from its root, pin a snapshot.
+        table_no = rsp_sub_oid[1]
+        local ttl = table_snapshot_ttl(group, table_no)
+        if ttl ~= nil and #rsp_sub_oid >= 4 and not (req_no == table_no and req_len >= 3) then
+            for _, it in ipairs(group_index_table) do
+                if it[1][1] == table_no and #it >= 4 then
+                    table_snapshot_sweep(pins)
+                    local snap = table_snapshot_build(group, table_no, it, ttl)
+                    local n = table_snapshot_next(snap, { table_no })
+                    if n ~= nil then
+                        pins[owner .. table_no] = snap
+                        return snapshot_response(snap, n)
+                    end
+                    break
+                end
+            end
+        end
+
         return_value_check(name, rsp_val, rsp_val_type)
 
         if err_stat ~= nil then
@@ -770,7 +1105,9 @@ local mib_node_search = function (group, name, op, req_sub_oid, req_val, req_val
         end
     end
 
-    group_index_table = group_index_table_generator(group, name)
+    if op == SNMP_REQ_GET or op == SNMP_REQ_SET or op == MIB_REQ_TESTSET then
+        group_index_table = group_index_table_generator(group, name)
+    end
     H = handlers[op]
     return H()
 end
@@ -780,8 +1117,25 @@ end
 --
 
 -- initialize snmp agent
-_M.init = function (protocol, port)
-    return core.init(protocol, port)
+_M.init = function (protocol, port, agentx_socket)
+    return core.init(protocol, port, agentx_socket)
+end
+
+-- serve groups in an AgentX context as well, before init
+_M.add_context = function (context)
+    assert(type(context) == 'string')
+    return core.agentx_context(context)
+end
+
+-- accept AgentX sub-agents on TCP loopback port or Unix socket path, after init
+_M.agentx_master = function (address)
+    assert(type(address) == 'number' or type(address) == 'string')
+    return core.agentx_master(address)
+end
+
+-- context of the request in process, '' for the default one
+_M.request_context = function ()
+    return core.request_context()
 end
 
 -- open snmp agent
@@ -838,10 +1192,113 @@ _M.set_rw_user = function (user, oid)
     end
 end
 
+-- set SNMPv3 engine id text and file counting engine boots, before users
+_M.set_engine = function (engine_id, boots_file)
+    assert(engine_id == nil or type(engine_id) == 'string')
+    assert(boots_file == nil or type(boots_file) == 'string')
+    return core.usm_engine_init(engine_id, boots_file)
+end
+
+-- authenticate user with 'MD5', 'SHA' or 'SHA-224/256/384/512' and password
+_M.set_user_auth = function (user, auth_protocol, auth_password)
+    assert(type(user) == 'string')
+    assert(type(auth_protocol) == 'string' and type(auth_password) == 'string')
+    return core.usm_user_reg(user, auth_protocol, auth_password)
+end
+
+-- encrypt messages of authenticated user with 'AES', 'AES-192' or 'AES-256'
+_M.set_user_priv = function (user, priv_protocol, priv_password)
+    assert(type(user) == 'string')
+    assert(type(priv_protocol) == 'string' and type(priv_password) == 'string')
+    return core.usm_user_priv_reg(user, priv_protocol, priv_password)
+end
+
+-- send SNMPv2-Trap notifications to host:port as community, at most rate
+-- per second after burst, no limit if rate is nil or 0
+_M.add_trap_target = function (host, port, community, rate, burst)
+    assert(type(host) == 'string' and type(port) == 'number')
+    assert(type(community) == 'string')
+    assert(rate == nil or type(rate) == 'number')
+    assert(burst == nil or type(burst) == 'number')
+    return core.trap_target_add(host, port, community, rate, burst)
+end
+
+-- send InformRequest notifications to host:port as community, at most window
+-- awaiting response, sent again after timeout ms doubled for each of retries
+_M.add_inform_target = function (host, port, community, window, timeout, retries)
+    assert(type(host) == 'string' and type(port) == 'number')
+    assert(type(community) == 'string')
+    assert(window == nil or type(window) == 'number')
+    assert(timeout == nil or type(timeout) == 'number')
+    assert(retries == nil or type(retries) == 'number')
+    return core.inform_target_add(host, port, community, window, timeout, retries)
+end
+
+local trap_tags = {
+    Int = ASN1_TAG_INT,
+    OctString = ASN1_TAG_OCTSTR,
+    Oid = ASN1_TAG_OBJID,
+    Ipaddr = ASN1_TAG_IPADDR,
+    Count = ASN1_TAG_CNT,
+    Gauge = ASN1_TAG_GAU,
+    Timeticks = ASN1_TAG_TIMETICKS,
+}
+
+-- raise notification trap_oid with varbinds as { oid = , type = , value = },
+-- type is 'Int', 'OctString', 'Oid', 'Ipaddr', 'Count', 'Gauge' or
+-- 'Timeticks'. The agent merges repeats while the first one is queued,
+-- sub-agents send it to the master agent in context, '' by default.
+_M.trap = function (trap_oid, varbinds, context)
+    assert(type(trap_oid) == 'table')
+    assert(context == nil or type(context) == 'string')
+    local vbs = {}
+    for i, vb in ipairs(varbinds or {}) do
+        local tag = trap_tags[vb.type]
+        assert(type(vb.oid) == 'table' and tag ~= nil, 'Varbind must have oid and type')
+        vbs[i] = { vb.oid, tag, vb.value }
+    end
+    return core.trap_send(trap_oid, vbs, context)
+end
+
+-- notification messages sent, merged while queued and lost by slow targets,
+-- informs acknowledged, sent again and given up
+_M.trap_stats = function ()
+    return core.trap_stats()
+end
+
+-- latency histograms as { id = , name = , count = , sum = , p50 = , p90 = ,
+-- p99 = , max = } in ns, empty unless built with --latency=yes
+_M.latency_stats = function ()
+    return core.latency_stats()
+end
+
+-- write latency histograms to file, stdout if nil, every interval ms if given
+_M.latency_dump = function (file, interval)
+    assert(file == nil or type(file) == 'string')
+    assert(interval == nil or type(interval) == 'number')
+    return core.latency_dump(file, interval)
+end
+
 -- register a group of snmp mib nodes
 _M.register_mib_group = function (oid, group, name)
+    if group.native ~= nil then
+        local ret, err = core.mib_native_reg(oid, group.native)
+        if ret == nil then
+            -- e.g. interfaces, tcp and udp off Linux, the rest is served
+            print(string.format("Group \'%s\' skipped: %s", name, err))
+            return
+        end
+        if ret ~= 0 then
+            error(string.format("Group \'%s\': native group \'%s\' register failure", name, group.native))
+        end
+        return
+    end
+    -- table snapshots pinned by managers
+    local pins = {}
+    -- writes staged in set transactions
+    local txns = {}
     local mib_search_handler = function (op, req_sub_oid, req_val, req_val_type)
-        return mib_node_search(group, name, op, req_sub_oid, req_val, req_val_type)
+        return mib_node_search(group, name, pins, txns, op, req_sub_oid, req_val, req_val_type)
     end
     core.mib_node_reg(oid, mib_search_handler)
 end
@@ -851,6 +1308,11 @@ _M.unregister_mib_group = function(oid)
     core.mib_node_unreg(oid)
 end
 
+-- index table of group as built on every search of it, for benchmarks
+_M.group_index_table = function (group, name)
+    return group_index_table_generator(group, name)
+end
+
 -- print group index table through generator
 _M.group_index_table_check = function (group, name)
     local it = group_index_table_generator(group, name)
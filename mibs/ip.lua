@@ -198,6 +198,8 @@ local ipGroup = {
     [22] = {
         [1] = {
             indexes = ip_NetToMedia_cache,
+            -- keep walks consistent while the ARP cache changes
+            snapshot = 10,
             [1] = mib.Int(function (sub_oid)
                               load_config()
                               local index
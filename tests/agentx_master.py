@@ -0,0 +1,240 @@
+import socket, select, struct, time, os
+
+# Local AgentX master stand-in (RFC 2741), enough to drive the sub-agent
+# without Net-SNMP. PDUs are in little endian byte order.
+
+AGENTX_OPEN = 1
+AGENTX_CLOSE = 2
+AGENTX_REGISTER = 3
+AGENTX_UNREGISTER = 4
+AGENTX_GET = 5
+AGENTX_GETNEXT = 6
+AGENTX_GETBULK = 7
+AGENTX_TESTSET = 8
+AGENTX_COMMITSET = 9
+AGENTX_UNDOSET = 10
+AGENTX_CLEANUPSET = 11
+AGENTX_NOTIFY = 12
+AGENTX_PING = 13
+AGENTX_RESPONSE = 18
+
+NON_DEFAULT_CONTEXT = 0x08
+
+HDR_LEN = 20
+
+def oid_encode(oid, include = 0):
+	subs = [int(x) for x in oid.strip('.').split('.')] if oid.strip('.') else []
+	prefix = 0
+	if len(subs) >= 5 and subs[:4] == [1, 3, 6, 1] and subs[4] < 256:
+		prefix = subs[4]
+		subs = subs[5:]
+	return struct.pack('<BBBB', len(subs), prefix, include, 0) + b''.join([struct.pack('<I', s) for s in subs])
+
+def oid_decode(buf, pos):
+	n, prefix, include, reserved = struct.unpack_from('<BBBB', buf, pos)
+	pos += 4
+	subs = list(struct.unpack_from('<%dI' % n, buf, pos))
+	pos += 4 * n
+	if prefix:
+		subs = [1, 3, 6, 1, prefix] + subs
+	return '.' + '.'.join([str(s) for s in subs]), pos
+
+def octstr_decode(buf, pos):
+	n, = struct.unpack_from('<I', buf, pos)
+	pos += 4
+	return buf[pos:pos + n], pos + ((n + 3) & ~3)
+
+def varbind_decode(buf, pos):
+	tag, = struct.unpack_from('<H', buf, pos)
+	oid, pos = oid_decode(buf, pos + 4)
+	if tag in (2, 65, 66, 67):
+		value, = struct.unpack_from('<I', buf, pos)
+		pos += 4
+	elif tag == 70:
+		value, = struct.unpack_from('<Q', buf, pos)
+		pos += 8
+	elif tag in (4, 64, 68):
+		value, pos = octstr_decode(buf, pos)
+	elif tag == 6:
+		value, pos = oid_decode(buf, pos)
+	else:
+		value = {5: 'null', 128: 'noSuchObject', 129: 'noSuchInstance', 130: 'endOfMibView'}.get(tag, tag)
+	return (oid, tag, value), pos
+
+def varbind_encode(oid, tag, value):
+	buf = struct.pack('<HH', tag, 0) + oid_encode(oid)
+	if tag in (2, 65, 66, 67):
+		buf += struct.pack('<I', value)
+	elif tag == 4:
+		buf += struct.pack('<I', len(value)) + value + b'\0' * (-len(value) % 4)
+	elif tag == 6:
+		buf += oid_encode(value)
+	return buf
+
+class AgentXMaster:
+	"""Accept one sub-agent on TCP port or Unix socket path"""
+	def __init__(self, address = 17705, latency = 0):
+		if isinstance(address, int):
+			self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+			self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+			self.listener.bind(('127.0.0.1', address))
+		else:
+			if os.path.exists(address):
+				os.unlink(address)
+			self.listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+			self.listener.bind(address)
+		self.listener.listen(1)
+		# Seconds administrative PDUs are answered after
+		self.latency = latency
+		self.packet_id = 1000
+		self.buf = b''
+		# Context of each session opened, the last one is used for requests
+		self.sessions = {}
+		self.session_id = 0
+		# (context, oid) of registrations
+		self.registered = []
+		self.sock = None
+
+	def accept(self, timeout = 10):
+		self.listener.settimeout(timeout)
+		self.sock, addr = self.listener.accept()
+		if self.sock.family == socket.AF_INET:
+			self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+	def close(self):
+		if self.sock is not None:
+			self.sock.close()
+		if self.listener.family == socket.AF_UNIX:
+			os.unlink(self.listener.getsockname())
+		self.listener.close()
+
+	def pdu_ready(self):
+		if len(self.buf) < HDR_LEN:
+			return False
+		length, = struct.unpack_from('<I', self.buf, 16)
+		return len(self.buf) >= HDR_LEN + length
+
+	def read_pdu(self, timeout = 5):
+		self.sock.settimeout(timeout)
+		while not self.pdu_ready():
+			data = self.sock.recv(65536)
+			if not data:
+				raise EOFError
+			self.buf += data
+		version, pdu_type, flags, reserved, sid, tid, pid, length = struct.unpack_from('<BBBBIIII', self.buf)
+		payload = self.buf[HDR_LEN:HDR_LEN + length]
+		self.buf = self.buf[HDR_LEN + length:]
+		return {'type': pdu_type, 'flags': flags, 'sid': sid, 'tid': tid, 'pid': pid, 'payload': payload}
+
+	def pdu(self, pdu_type, payload, pid, tid = 0, flags = 0, context = None, session_id = None):
+		if context:
+			flags |= NON_DEFAULT_CONTEXT
+			payload = struct.pack('<I', len(context)) + context + b'\0' * (-len(context) % 4) + payload
+		if session_id is None:
+			session_id = self.session_id
+		return struct.pack('<BBBBIIII', 1, pdu_type, flags, 0, session_id, tid, pid, len(payload)) + payload
+
+	def response_pdu(self, req, error = 0, index = 0):
+		return self.pdu(AGENTX_RESPONSE, struct.pack('<IHH', 0, error, index), req['pid'], req['tid'], session_id = req['sid'])
+
+	def session(self, context = b''):
+		"""Session id the sub-agent serves context in"""
+		for session_id, ctx in self.sessions.items():
+			if ctx == context:
+				return session_id
+		return None
+
+	def serve_admin(self, count = None, idle = 1.0, refuse = ()):
+		"""Answer open and registrations, until count of them are answered
+		or the sub-agent is idle. Answers are delayed by latency, without
+		holding back the following PDUs."""
+		pending = []
+		answered = 0
+		while True:
+			now = time.time()
+			while pending and pending[0][0] <= now:
+				self.sock.sendall(pending.pop(0)[1])
+				answered += 1
+			if count is not None and answered >= count:
+				return
+			if self.pdu_ready():
+				req = self.read_pdu()
+				error = 0
+				if req['type'] == AGENTX_OPEN:
+					self.session_id += 1
+					self.sessions[self.session_id] = None
+					req['sid'] = self.session_id
+				elif req['type'] == AGENTX_REGISTER:
+					context, pos = b'', 0
+					if req['flags'] & NON_DEFAULT_CONTEXT:
+						context, pos = octstr_decode(req['payload'], 0)
+					oid, pos = oid_decode(req['payload'], pos + 4)
+					self.registered.append((context, oid))
+					if self.sessions.get(req['sid']) is None:
+						self.sessions[req['sid']] = context
+					if oid in refuse:
+						error = 263
+				pending.append((time.time() + self.latency, self.response_pdu(req, error)))
+				continue
+			wait = pending[0][0] - now if pending else idle
+			r, w, x = select.select([self.sock], [], [], max(wait, 0))
+			if r:
+				data = self.sock.recv(65536)
+				if not data:
+					raise EOFError
+				self.buf += data
+			elif not pending:
+				return
+
+	def parse_response(self, pdu):
+		uptime, error, index = struct.unpack_from('<IHH', pdu['payload'])
+		pos = 8
+		varbinds = []
+		while pos < len(pdu['payload']):
+			vb, pos = varbind_decode(pdu['payload'], pos)
+			varbinds.append(vb)
+		return {'pid': pdu['pid'], 'error': error, 'index': index, 'varbinds': varbinds}
+
+	def ranges(self, oids, include):
+		buf = b''
+		for oid in oids:
+			if isinstance(oid, tuple):
+				start, end = oid
+			else:
+				start, end = oid, ''
+			buf += oid_encode(start, include) + oid_encode(end)
+		return buf
+
+	def request_pdu(self, pdu_type, payload, context = None, tid = None):
+		"""Request PDU in the session of context, its packet id is the
+		last one taken"""
+		self.packet_id += 1
+		session_id = self.session(context or b'')
+		return self.pdu(pdu_type, payload, self.packet_id, tid or self.packet_id, context = context, session_id = session_id)
+
+	def request(self, pdu_type, payload, context = None, tid = None):
+		self.sock.sendall(self.request_pdu(pdu_type, payload, context, tid))
+		pdu = self.read_pdu()
+		assert(pdu['type'] == AGENTX_RESPONSE and pdu['pid'] == self.packet_id and pdu['sid'] == self.session(context or b''))
+		return self.parse_response(pdu)
+
+	def read_batch(self, timeout = 5):
+		"""Whole PDUs in what the first read brings"""
+		self.sock.settimeout(timeout)
+		data = self.sock.recv(65536)
+		if not data:
+			raise EOFError
+		self.buf += data
+		pdus = []
+		while self.pdu_ready():
+			pdus.append(self.read_pdu())
+		return pdus
+
+	def get(self, oids, **kwargs):
+		return self.request(AGENTX_GET, self.ranges(oids, 1), **kwargs)
+
+	def getnext(self, oids, **kwargs):
+		return self.request(AGENTX_GETNEXT, self.ranges(oids, 0), **kwargs)
+
+	def getbulk(self, oids, non_rep = 0, max_rep = 10, **kwargs):
+		return self.request(AGENTX_GETBULK, struct.pack('<HH', non_rep, max_rep) + self.ranges(oids, 0), **kwargs)
@@ -0,0 +1,186 @@
+import socket, struct, threading
+from agentx_master import *
+
+# AgentX sub-agent stand-in (RFC 2741) serving a table of objects through the
+# master agent under test. PDUs are in little endian byte order.
+
+AGENTX_COMMIT_FAILED = 14
+AGENTX_NOT_WRITABLE = 17
+
+def oid_key(oid):
+	return tuple([int(x) for x in oid.strip('.').split('.')]) if oid.strip('.') else ()
+
+class AgentXSubAgent:
+	"""Serve objects, a dict of oid -> (tag, value), on a master agent
+	at TCP port or Unix socket path"""
+	def __init__(self, address = 17706, objects = {}):
+		if isinstance(address, int):
+			self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+			address = ('127.0.0.1', address)
+		else:
+			self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+		try:
+			self.sock.connect(address)
+		except socket.error:
+			self.sock.close()
+			raise
+		self.objects = dict(objects)
+		self.buf = b''
+		self.packet_id = 0
+		self.session_id = 0
+		# Type and decoded payload of each request received
+		self.requests = []
+		# Requests are read but left unanswered while set
+		self.silent = False
+		# Oid whose write fails at CommitSet
+		self.commit_fail = None
+		self.staged = []
+		self.undo = []
+		self.thread = None
+
+	def pdu_ready(self):
+		if len(self.buf) < HDR_LEN:
+			return False
+		length, = struct.unpack_from('<I', self.buf, 16)
+		return len(self.buf) >= HDR_LEN + length
+
+	def read_pdu(self, timeout = 5):
+		self.sock.settimeout(timeout)
+		while not self.pdu_ready():
+			data = self.sock.recv(65536)
+			if not data:
+				raise EOFError
+			self.buf += data
+		version, pdu_type, flags, reserved, sid, tid, pid, length = struct.unpack_from('<BBBBIIII', self.buf)
+		payload = self.buf[HDR_LEN:HDR_LEN + length]
+		self.buf = self.buf[HDR_LEN + length:]
+		return {'type': pdu_type, 'flags': flags, 'sid': sid, 'tid': tid, 'pid': pid, 'payload': payload}
+
+	def admin(self, pdu_type, payload):
+		self.packet_id += 1
+		self.sock.sendall(struct.pack('<BBBBIIII', 1, pdu_type, 0, 0, self.session_id, 0, self.packet_id, len(payload)) + payload)
+		pdu = self.read_pdu()
+		uptime, error, index = struct.unpack_from('<IHH', pdu['payload'])
+		return pdu['sid'], error
+
+	def open(self, timeout = 0):
+		self.session_id, error = self.admin(AGENTX_OPEN, struct.pack('<BBBB', timeout, 0, 0, 0) + oid_encode('') + struct.pack('<I', 0))
+		return error
+
+	def register(self, subtree, timeout = 0):
+		sid, error = self.admin(AGENTX_REGISTER, struct.pack('<BBBB', timeout, 127, 0, 0) + oid_encode(subtree))
+		return error
+
+	def notify(self, varbinds):
+		sid, error = self.admin(AGENTX_NOTIFY, b''.join([varbind_encode(*vb) for vb in varbinds]))
+		return error
+
+	def close(self):
+		sid, error = self.admin(AGENTX_CLOSE, struct.pack('<BBBB', 1, 0, 0, 0))
+		return error
+
+	def ranges(self, payload):
+		pos = 0
+		ranges = []
+		while pos < len(payload):
+			include, = struct.unpack_from('<B', payload, pos + 2)
+			start, pos = oid_decode(payload, pos)
+			end, pos = oid_decode(payload, pos)
+			ranges.append((start, end, include))
+		return ranges
+
+	def lookup(self, start, end, include):
+		"""First object in search range, as an (oid, tag, value) varbind"""
+		if start == end:
+			end = ''
+		for oid in sorted(self.objects.keys(), key = oid_key):
+			if oid_key(oid) < oid_key(start) or (oid == start and not include):
+				continue
+			if end and oid_key(oid) >= oid_key(end):
+				break
+			tag, value = self.objects[oid]
+			return oid, tag, value
+		return start, 130, None
+
+	def respond(self, req, varbinds = [], error = 0, index = 0):
+		payload = struct.pack('<IHH', 0, error, index) + b''.join([varbind_encode(*vb) for vb in varbinds])
+		self.sock.sendall(struct.pack('<BBBBIIII', 1, AGENTX_RESPONSE, 0, 0, req['sid'], req['tid'], req['pid'], len(payload)) + payload)
+
+	def serve_one(self, timeout = 5):
+		req = self.read_pdu(timeout)
+		t = req['type']
+		if t in (AGENTX_GET, AGENTX_GETNEXT):
+			ranges = self.ranges(req['payload'])
+			self.requests.append((t, ranges))
+			if self.silent:
+				return
+			varbinds = []
+			for start, end, include in ranges:
+				if t == AGENTX_GET:
+					if start in self.objects:
+						tag, value = self.objects[start]
+						varbinds.append((start, tag, value))
+					else:
+						varbinds.append((start, 128, None))
+				else:
+					varbinds.append(self.lookup(start, end, include))
+			self.respond(req, varbinds)
+		elif t == AGENTX_TESTSET:
+			pos = 0
+			varbinds = []
+			while pos < len(req['payload']):
+				vb, pos = varbind_decode(req['payload'], pos)
+				varbinds.append(vb)
+			self.requests.append((t, varbinds))
+			if self.silent:
+				return
+			for i, (oid, tag, value) in enumerate(varbinds):
+				if oid not in self.objects:
+					self.respond(req, error = AGENTX_NOT_WRITABLE, index = i + 1)
+					return
+			self.staged = varbinds
+			self.respond(req)
+		elif t == AGENTX_COMMITSET:
+			self.requests.append((t, req['tid']))
+			self.undo = []
+			for i, (oid, tag, value) in enumerate(self.staged):
+				if oid == self.commit_fail:
+					self.respond(req, error = AGENTX_COMMIT_FAILED, index = i + 1)
+					return
+				self.undo.append((oid, self.objects[oid]))
+				self.objects[oid] = (tag, value)
+			self.respond(req)
+		elif t == AGENTX_UNDOSET:
+			self.requests.append((t, req['tid']))
+			for oid, old in reversed(self.undo):
+				self.objects[oid] = old
+			self.undo = []
+			self.respond(req)
+		elif t == AGENTX_CLEANUPSET:
+			self.requests.append((t, req['tid']))
+			self.staged = []
+		else:
+			self.requests.append((t, None))
+			self.respond(req)
+
+	def serve(self):
+		try:
+			while True:
+				self.serve_one(timeout = None)
+		except (EOFError, socket.error):
+			pass
+
+	def start(self):
+		"""Answer requests in the background"""
+		self.thread = threading.Thread(target = self.serve)
+		self.thread.daemon = True
+		self.thread.start()
+
+	def stop(self):
+		try:
+			self.sock.shutdown(socket.SHUT_RDWR)
+		except socket.error:
+			pass
+		self.sock.close()
+		if self.thread is not None:
+			self.thread.join()
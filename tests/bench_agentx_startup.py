@@ -0,0 +1,45 @@
+# Measure how long the sub-agent takes to get many groups registered with
+# a master agent which answers every PDU after some latency.
+#
+# Usage: python tests/bench_agentx_startup.py [groups] [latency_ms]
+
+import sys, os, time, subprocess, tempfile
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from agentx_master import *
+
+groups = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+latency = float(sys.argv[2]) / 1000 if len(sys.argv) > 2 else 0.002
+port = 17705
+
+env = dict(os.environ)
+env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+env['LUA_CPATH'] = "build/?.so"
+lua_exe = os.environ.get('LUA', "lua5.1")
+
+conf = tempfile.NamedTemporaryFile(mode = 'w', suffix = '.conf', delete = False)
+conf.write("protocol = 'agentx'\n")
+conf.write("port = %d\n" % port)
+conf.write("mib_module_path = 'mibs'\n")
+conf.write("mib_modules = {}\n")
+conf.write("for i = 1, %d do mib_modules['1.3.6.1.4.1.8888.' .. i] = 'dummy' end\n" % groups)
+conf.write("mib_modules['1.3.6.1.2.1.1'] = 'system'\n")
+conf.close()
+
+master = AgentXMaster(port, latency)
+agent = subprocess.Popen([lua_exe, "./bin/smartsnmpd", "-c", conf.name], env = env)
+try:
+	master.accept()
+	start = time.time()
+	# Open plus every group registration
+	master.serve_admin(count = groups + 2)
+	registered = time.time()
+	reply = master.get(['.1.3.6.1.2.1.1.1.0'])
+	served = time.time()
+	assert(reply['varbinds'][0][1] == 4)
+	print("%d groups, %.1f ms master latency" % (groups, latency * 1000))
+	print("registered in %.1f ms, first GET answered %.1f ms after open" % ((registered - start) * 1000, (served - start) * 1000))
+finally:
+	agent.terminate()
+	agent.wait()
+	master.close()
+	os.unlink(conf.name)
@@ -0,0 +1,14 @@
+-------------------------------------------------------------------------------
+-- snmp_bench profile: SNMPv2c GETs of system scalars
+-------------------------------------------------------------------------------
+
+host = '127.0.0.1'
+port = 161
+-- Seconds of load, requests outstanding and ms a request is given up after
+duration = 10
+window = 16
+timeout = 1000
+
+requests = {
+  { type = 'get', community = 'public', oids = { '1.3.6.1.2.1.1.3.0' } },
+}
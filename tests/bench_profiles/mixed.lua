@@ -0,0 +1,27 @@
+-------------------------------------------------------------------------------
+-- snmp_bench profile: mix of walks and SNMPv3 polls against the agent as
+-- configured by config/snmp.conf
+-------------------------------------------------------------------------------
+
+host = '127.0.0.1'
+port = 161
+-- Seconds of load, requests outstanding and ms a request is given up after
+duration = 10
+window = 16
+timeout = 1000
+
+-- Picked at random in proportion to weight. type is 'get', 'getnext' or
+-- 'getbulk', SNMPv3 when there is a user, SNMPv2c as community otherwise.
+requests = {
+  { type = 'get', community = 'public', weight = 4,
+    oids = { '1.3.6.1.2.1.1.3.0', '1.3.6.1.2.1.1.5.0', '1.3.6.1.2.1.1.6.0' } },
+  { type = 'getnext', community = 'public', weight = 2,
+    oids = { '1.3.6.1.2.1.2.2.1.2', '1.3.6.1.2.1.2.2.1.10', '1.3.6.1.2.1.2.2.1.16' } },
+  { type = 'getbulk', community = 'public', weight = 1, non_repeaters = 0, max_repetitions = 10,
+    oids = { '1.3.6.1.2.1.2.2.1.10', '1.3.6.1.2.1.2.2.1.16' } },
+  { type = 'get', user = 'rwAuthUser', auth_protocol = 'SHA', auth_password = 'smartsnmp_auth', weight = 2,
+    oids = { '1.3.6.1.2.1.1.3.0', '1.3.6.1.2.1.11.1.0' } },
+  { type = 'getbulk', user = 'rwPrivUser', auth_protocol = 'SHA', auth_password = 'smartsnmp_auth',
+    priv_protocol = 'AES', priv_password = 'smartsnmp_priv', weight = 1, max_repetitions = 10,
+    oids = { '1.3.6.1.2.1.2.2.1.10' } },
+}
@@ -0,0 +1,85 @@
+# Measure what USM authentication and privacy add to an SNMPv3 GET round
+# trip, for every protocol against an unauthenticated user, and the round
+# trip of the engine discovery probe managers start with. Requests are
+# signed and encrypted once up front and responses are not checked, so the client
+# side adds no hashing to the timing. Users take turns over several rounds
+# and the best round counts, to keep out scheduling noise.
+#
+# Usage: python tests/bench_usm.py [requests] [rounds]
+
+import sys, os, time, socket, subprocess, tempfile
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from snmp_client import *
+
+requests = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+rounds = int(sys.argv[2]) if len(sys.argv) > 2 else 5
+port = 16163
+password = 'smartsnmp_auth'
+priv_password = 'smartsnmp_priv'
+protocols = ['MD5', 'SHA', 'SHA-224', 'SHA-256', 'SHA-384', 'SHA-512']
+# (authentication, privacy) of authPriv users
+priv_protocols = [('SHA', 'AES'), ('SHA', 'AES-256'), ('SHA-256', 'AES-256')]
+
+env = dict(os.environ)
+env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+env['LUA_CPATH'] = "build/?.so"
+lua_exe = os.environ.get('LUA', "lua5.1")
+
+conf = tempfile.NamedTemporaryFile(mode = 'w', suffix = '.conf', delete = False)
+conf.write("protocol = 'snmp'\n")
+conf.write("port = %d\n" % port)
+conf.write("users = {\n")
+conf.write("  { user = 'noAuth', views = { ['.'] = 'ro' } },\n")
+for proto in protocols:
+	conf.write("  { user = '%s', auth_protocol = '%s', auth_password = '%s', views = { ['.'] = 'ro' } },\n" % (proto, proto, password))
+for auth, priv in priv_protocols:
+	conf.write("  { user = '%s/%s', auth_protocol = '%s', auth_password = '%s', priv_protocol = '%s', priv_password = '%s', views = { ['.'] = 'ro' } },\n" % (auth, priv, auth, password, priv, priv_password))
+conf.write("}\n")
+conf.write("mib_module_path = 'mibs'\n")
+conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system' }\n")
+conf.close()
+
+def round_trip(client, msg):
+	"""Mean seconds of GET round trips"""
+	start = time.time()
+	for i in range(requests):
+		client.sock.sendto(msg, ('127.0.0.1', port))
+		client.sock.recv(65536)
+	return (time.time() - start) / requests
+
+agent = subprocess.Popen([lua_exe, "./bin/smartsnmpd", "-c", conf.name], env = env, stdout = open(os.devnull, 'w'))
+try:
+	client = SNMPv3Client(port, 'noAuth', timeout = 0.5)
+	for i in range(50):
+		try:
+			client.get(['.1.3.6.1.2.1.1.3.0'])
+			break
+		except socket.timeout:
+			pass
+	clients = [client] + [SNMPv3Client(port, proto, proto, password) for proto in protocols]
+	clients += [SNMPv3Client(port, auth + '/' + priv, auth, password, priv, priv_password) for auth, priv in priv_protocols]
+	names = protocols + [auth + '/' + priv for auth, priv in priv_protocols]
+	pdu = tlv(SNMP_GET, int_encode(1) + int_encode(0) + int_encode(0) + tlv(0x30, tlv(0x30, oid_encode('.1.3.6.1.2.1.1.3.0') + tlv(ASN1_NULL, b''))))
+	for c in clients[1:]:
+		c.discover()
+	# Probe of a client yet to discover the engine
+	clients.append(SNMPv3Client(port, 'noAuth'))
+	names.append('discovery')
+	msgs = [bytes(c.message(pdu)) for c in clients]
+	best = [None] * len(clients)
+	for r in range(rounds):
+		for i, c in enumerate(clients):
+			t = round_trip(c, msgs[i])
+			if best[i] is None or t < best[i]:
+				best[i] = t
+	for c in clients:
+		c.close()
+	print("%d GETs per user, best of %d rounds" % (requests, rounds))
+	print("%-15s round trip %.1f us" % ('noAuth', best[0] * 1e6))
+	for i, name in enumerate(names[:-1]):
+		print("%-15s round trip %.1f us, USM adds %.1f us" % (name, best[i + 1] * 1e6, (best[i + 1] - best[0]) * 1e6))
+	print("%-15s round trip %.1f us, Report" % (names[-1], best[-1] * 1e6))
+finally:
+	agent.terminate()
+	agent.wait()
+	os.unlink(conf.name)
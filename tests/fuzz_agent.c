@@ -0,0 +1,156 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Agent the fuzz targets feed: transports are stubs dropping whatever is
+ * sent, and the snmp group of native handlers is served to community
+ * 'public' and users 'noAuth' and 'authPriv', so that inputs getting
+ * through the decoders go on to searches and responses. Built without
+ * libFuzzer, main() runs the fuzz target over the files given, or over
+ * stdin as AFL feeds it, which also replays crashes found.
+ *
+ * Usage: fuzz_snmp|fuzz_agentx [input ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "transport.h"
+#include "agentx.h"
+#include "snmp.h"
+#include "mib.h"
+#include "util.h"
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static int
+stub_init(int port)
+{
+  return 0;
+}
+
+static void
+stub_running(void)
+{
+  /* dummy */
+}
+
+static void
+stub_stop(void)
+{
+  /* dummy */
+}
+
+static void
+stub_send(uint8_t *buf, int len, const void *addr)
+{
+  free(buf);
+}
+
+struct transport_operation snmp_trans_ops = {
+  "snmp_fuzz",
+  stub_init,
+  stub_running,
+  stub_stop,
+  stub_send,
+  NULL,
+};
+
+struct transport_operation agentx_trans_ops = {
+  "agentx_fuzz",
+  stub_init,
+  stub_running,
+  stub_stop,
+  stub_send,
+  NULL,
+};
+
+int
+LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+  static const oid_t view[] = { 1, 3, 6, 1 };
+  static const oid_t snmp_group[] = { 1, 3, 6, 1, 2, 1, 11 };
+  const struct mib_native_group *group;
+
+  mib_init();
+  usm_engine_init("fuzz", NULL);
+
+  mib_community_reg(view, elem_num(view), "public", MIB_ACES_READ);
+  mib_community_reg(view, elem_num(view), "private", MIB_ACES_WRITE);
+  mib_user_reg(view, elem_num(view), "noAuth", MIB_ACES_READ);
+  mib_user_reg(view, elem_num(view), "authPriv", MIB_ACES_WRITE);
+  usm_user_reg("authPriv", "SHA", "authPriv_password");
+  usm_user_priv_reg("authPriv", "AES", "authPriv_password");
+
+  group = mib_native_group_search("snmp");
+  group->init();
+  mib_native_node_reg(snmp_group, elem_num(snmp_group), group->handler);
+
+  /* Session a response to packet 0 opens */
+  agentx_session_add(NULL);
+  return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+static void
+fuzz_file(FILE *fp)
+{
+  static uint8_t buf[TRANS_BUF_SIZ];
+  size_t len;
+
+  len = fread(buf, 1, sizeof(buf), fp);
+  LLVMFuzzerTestOneInput(buf, len);
+}
+
+int
+main(int argc, char **argv)
+{
+  FILE *fp;
+  int i;
+
+  LLVMFuzzerInitialize(&argc, &argv);
+
+  if (argc < 2) {
+#ifdef __AFL_LOOP
+    /* Persistent mode, many inputs a process */
+    while (__AFL_LOOP(1000)) {
+      fuzz_file(stdin);
+    }
+#else
+    fuzz_file(stdin);
+#endif
+    return 0;
+  }
+
+  for (i = 1; i < argc; i++) {
+    fp = fopen(argv[i], "rb");
+    if (fp == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    fuzz_file(fp);
+    fclose(fp);
+  }
+  return 0;
+}
+
+#endif /* FUZZ_LIBFUZZER */
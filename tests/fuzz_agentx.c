@@ -0,0 +1,54 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Fuzz target of AgentX PDUs from the master agent, each input a stream
+ * the sub-agent reads PDUs off as its transport frames them */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "transport.h"
+#include "protocol.h"
+#include "agentx.h"
+#include "util.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  uint32_t pos, pdu_len;
+  uint8_t *buf;
+
+  if (size > TRANS_BUF_SIZ) {
+    return 0;
+  }
+
+  for (pos = 0; size - pos >= sizeof(struct x_pdu_hdr); pos += pdu_len) {
+    pdu_len = agentx_pdu_len(data + pos);
+    if (pdu_len > size - pos) {
+      break;
+    }
+    buf = xmalloc(pdu_len);
+    memcpy(buf, data + pos, pdu_len);
+    agentx_prot_ops.receive(buf, pdu_len, NULL);
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Fuzz target of SNMP messages, each input a UDP datagram to the agent */
+
+#include <netinet/in.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "transport.h"
+#include "protocol.h"
+#include "util.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  struct sockaddr_in *from;
+  uint8_t *buf;
+
+  if (size == 0 || size > TRANS_BUF_SIZ) {
+    return 0;
+  }
+
+  /* Handed over as the UDP transport does, exactly sized to catch overruns */
+  buf = xmalloc(size);
+  memcpy(buf, data, size);
+  from = xcalloc(1, sizeof(*from));
+  from->sin_family = AF_INET;
+  from->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  snmp_prot_ops.receive(buf, size, from);
+  return 0;
+}
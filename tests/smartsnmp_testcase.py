@@ -2,7 +2,7 @@ from smartsnmp_testframework import *
 
 class SmartSNMPTestCase:
 	def test_snmpget(self):
-		self.snmpget_expect(".1.3.6.1.2.1.2.1.0", Integer(5))
+		self.snmpget_expect(".1.3.6.1.2.1.2.1.0", Integer(r"\d+"))
 		self.snmpget_expect(".", SNMPNoSuchObject())
 		self.snmpget_expect(".0", SNMPNoSuchObject())
 		self.snmpget_expect(".1.3", SNMPNoSuchObject())
@@ -17,6 +17,7 @@ class SmartSNMPTestCase:
 		# a correct request for MIB-II/UDP should be .1.3.6.1.2.1.7.5.1.2.4.x.x.x.x.p
 		self.snmpget_expect(".1.3.6.1.2.1.7.5.1.2.4", SNMPNoSuchInstance())
 		self.snmpget_expect(".1.3.6.1.2.1.7.5.1.2.4.1.1", SNMPNoSuchInstance())
+		self.snmpget_expect(".1.3.6.1.2.1.6.4.0", Integer(-1))
 
 	def test_snmpgetnext(self):
 		self.snmpgetnext_expect(".", ".1.3.6.1.2.1.1.1.0", OctStr(r".*"))
@@ -24,6 +25,7 @@ class SmartSNMPTestCase:
 		self.snmpgetnext_expect(".1.3", ".1.3.6.1.2.1.1.1.0", OctStr(r".*"))
 		self.snmpgetnext_expect(".1.4", ".1.4", SNMPEndOfMib())
 		self.snmpgetnext_expect(".1.5.6.7.8.100", ".1.5.6.7.8.100", SNMPEndOfMib())
+		self.snmpgetnext_expect(".1.3.6.1.2.1.2.2.1.1", ".1.3.6.1.2.1.2.2.1.1.1", Integer(1))
 
 	def test_snmpset(self):
 		self.snmpset_expect(".1.3.6.1.2.1.1.9.1.1", Integer(1), SNMPNoAccess())
@@ -45,3 +47,7 @@ class SmartSNMPTestCase:
 
 	def test_snmpwalk(self):
 		self.snmpwalk_expect(".")
+
+	def test_snmpbulkwalk(self):
+		self.snmpbulkwalk_expect(".1.3.6.1.2.1.1")
+		self.snmpbulkwalk_expect(".1.3.6.1.2.1.2")
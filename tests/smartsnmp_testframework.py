@@ -137,6 +137,9 @@ class SmartSNMPTestFramework:
 	def snmpwalk(self, oid, **kwargs):
 		return self.snmp_request('walk', oid, **kwargs)
 
+	def snmpbulkwalk(self, oid, **kwargs):
+		return self.snmp_request('bulkwalk', oid, **kwargs)
+
 	def snmpget_result_check(self, result, oid, expect):
 		# return OID match
 		if oid == '.':
@@ -214,6 +217,14 @@ class SmartSNMPTestFramework:
 			self.snmpwalk_result_check(results[i], len(results), i)
 		print('Done.')
 
+	def snmpbulkwalk_expect(self, oid, **kwargs):
+		# bulk walk returns the same objects as walk
+		walk_oids = [r["oid"] for r in self.snmpwalk(oid, **kwargs) if "value" in r]
+		bulk_oids = [r["oid"] for r in self.snmpbulkwalk(oid, **kwargs) if "value" in r]
+		print('Checking bulk walk results (total = %d) ...' % len(bulk_oids)),
+		assert(len(bulk_oids) > 0 and bulk_oids == walk_oids)
+		print('Done.')
+
 	def snmp_setup(self, config_file):
 		print "Starting Smart-SNMP Agent (Master Mode)..."
 		self.snmp = pexpect.spawn(r"%s %s ./bin/smartsnmpd -c %s" % (lua_exe, luacov, config_file), env = env)
@@ -0,0 +1,1177 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Load generator benchmarking a running agent. It keeps a window of
+ * requests outstanding, picked by weight from the mix of a profile, and
+ * reports requests per second, round trip percentiles and CPU time per
+ * request of the agent and of itself. Profiles are Lua files in the style
+ * of snmp.conf, see tests/bench_profiles.
+ *
+ * Messages are encoded once per entry of the mix. Ids, engine time and
+ * salt are patched in and SNMPv3 messages encrypted and signed at every
+ * send, which is all the generator spends on a request.
+ *
+ * Usage: snmp_bench [-d seconds] [-w window] [-p agent_pid] profile
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "mib.h"
+#include "digest.h"
+#include "aes.h"
+#include "util.h"
+
+#define BENCH_MSG_MAX         8192
+#define BENCH_RECV_MAX        65536
+#define BENCH_OIDS_MAX        16
+#define BENCH_NAME_MAX        32
+#define BENCH_ENGINE_ID_MAX   32
+/* Password bytes hashed into a user key, as the agent does */
+#define BENCH_PASSWD_EXPAND_LEN  1048576
+#define BENCH_SALT_LEN        8
+/* msgFlags */
+#define BENCH_FLAG_AUTH       0x01
+#define BENCH_FLAG_PRIV       0x02
+#define BENCH_FLAG_REPORTABLE 0x04
+/* Ids from here on encode in 4 bytes, integers must be encoded minimal */
+#define BENCH_ID_BASE         0x00800000
+
+struct bench_auth_proto {
+  const char *name;
+  const struct digest_alg *alg;
+  uint32_t mac_len;
+};
+
+static const struct bench_auth_proto bench_auth_protos[] = {
+  { "MD5", &digest_md5, 12 },
+  { "SHA", &digest_sha1, 12 },
+  { "SHA-224", &digest_sha224, 16 },
+  { "SHA-256", &digest_sha256, 24 },
+  { "SHA-384", &digest_sha384, 32 },
+  { "SHA-512", &digest_sha512, 48 },
+};
+
+struct bench_priv_proto {
+  const char *name;
+  uint32_t key_len;
+};
+
+static const struct bench_priv_proto bench_priv_protos[] = {
+  { "AES", 16 },
+  { "AES-192", 24 },
+  { "AES-256", 32 },
+};
+
+/* Entry of the mix with its message template */
+struct bench_request {
+  char name[BENCH_NAME_MAX * 2];
+  uint32_t weight;
+  uint8_t type;
+  uint32_t non_rep;
+  uint32_t max_rep;
+  uint8_t vbs[BENCH_MSG_MAX];
+  uint32_t vbs_len;
+
+  /* SNMPv2c unless there is a user */
+  char community[BENCH_NAME_MAX];
+  char user[BENCH_NAME_MAX];
+  const struct bench_auth_proto *auth;
+  const struct bench_priv_proto *priv;
+  char *auth_passwd;
+  char *priv_passwd;
+  struct hmac_key auth_key;
+  struct aes_key priv_key;
+
+  uint8_t msg[BENCH_MSG_MAX];
+  uint32_t len;
+  /* Offsets of the 4 byte msgID and request-id, engine time, MAC, salt and
+   * scoped PDU in msg. Encrypted scoped PDU is kept in clear in scoped. */
+  uint32_t msg_id_off;
+  uint32_t req_id_off;
+  uint32_t time_off;
+  uint32_t time_len;
+  uint32_t mac_off;
+  uint32_t salt_off;
+  uint32_t scope_off;
+  uint8_t scoped[BENCH_MSG_MAX];
+  uint32_t scoped_len;
+
+  uint64_t sent;
+  uint64_t done;
+  uint64_t errors;
+  uint64_t lost;
+  uint64_t *rtt;
+  uint32_t rtt_cap;
+};
+
+/* Request awaiting response */
+struct bench_slot {
+  struct bench_request *req;
+  uint32_t id;
+  uint64_t sent;
+};
+
+static struct bench_request *bench_reqs;
+static int bench_req_cnt;
+static uint32_t bench_weight_sum;
+
+static int bench_sock;
+static uint32_t bench_seq;
+static uint32_t bench_rand = 2463534242U;
+
+/* Discovered engine */
+static uint8_t engine_id[BENCH_ENGINE_ID_MAX];
+static uint32_t engine_id_len;
+static uint32_t engine_boots;
+static uint32_t engine_time;
+static uint64_t engine_synced;
+static uint64_t bench_salt;
+
+static uint64_t
+bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * BER of the messages
+ */
+
+static uint32_t
+ber_len_enc(uint8_t *out, uint32_t len)
+{
+  if (len < 0x80) {
+    out[0] = len;
+    return 1;
+  } else if (len <= 0xff) {
+    out[0] = 0x81;
+    out[1] = len;
+    return 2;
+  } else {
+    out[0] = 0x82;
+    out[1] = len >> 8;
+    out[2] = len;
+    return 3;
+  }
+}
+
+static uint32_t
+ber_tlv_enc(uint8_t *out, uint8_t tag, const uint8_t *val, uint32_t len)
+{
+  uint32_t n;
+
+  out[0] = tag;
+  n = 1 + ber_len_enc(out + 1, len);
+  memmove(out + n, val, len);
+  return n + len;
+}
+
+/* Bytes of v as a positive integer, sign bit clear */
+static uint32_t
+ber_int_len(uint32_t v)
+{
+  uint32_t n = 1;
+
+  while (n < 5 && (n == 4 ? v >> 31 : v >> (n * 8 - 1)) != 0) {
+    n++;
+  }
+  return n;
+}
+
+/* Value of v in len bytes */
+static void
+ber_int_set(uint8_t *buf, uint32_t v, uint32_t len)
+{
+  while (len-- > 0) {
+    *buf++ = len < 4 ? v >> (len * 8) : 0;
+  }
+}
+
+static uint32_t
+ber_int_enc(uint8_t *out, uint32_t v)
+{
+  uint8_t val[5];
+  uint32_t n = ber_int_len(v);
+
+  ber_int_set(val, v, n);
+  return ber_tlv_enc(out, ASN1_TAG_INT, val, n);
+}
+
+/* Dotted oid, 0 if it is none */
+static uint32_t
+ber_oid_enc(uint8_t *out, const char *str)
+{
+  oid_t oid[MIB_OID_MAX_LEN];
+  uint8_t val[MIB_OID_MAX_LEN * 5];
+  uint32_t i, n = 0, len = 0;
+  char *end;
+
+  if (*str == '.') {
+    str++;
+  }
+  while (*str != '\0' && n < MIB_OID_MAX_LEN) {
+    oid[n++] = strtoul(str, &end, 10);
+    if (end == str || (*end != '.' && *end != '\0')) {
+      return 0;
+    }
+    str = *end == '.' ? end + 1 : end;
+  }
+  if (*str != '\0' || n < 2) {
+    return 0;
+  }
+
+  oid[1] += oid[0] * 40;
+  for (i = 1; i < n; i++) {
+    int shift;
+
+    for (shift = 28; shift > 0 && (oid[i] >> shift) == 0; shift -= 7);
+    for (; shift > 0; shift -= 7) {
+      val[len++] = 0x80 | ((oid[i] >> shift) & 0x7f);
+    }
+    val[len++] = oid[i] & 0x7f;
+  }
+  return ber_tlv_enc(out, ASN1_TAG_OBJID, val, len);
+}
+
+/* Header of the TLV at *pos, moved to its value, -1 if it overruns len */
+static int
+ber_tlv_dec(const uint8_t *buf, uint32_t len, uint32_t *pos, uint8_t *tag, uint32_t *val_len)
+{
+  uint32_t p = *pos, l, n;
+
+  if (p + 2 > len) {
+    return -1;
+  }
+  *tag = buf[p++];
+  l = buf[p++];
+  if (l & 0x80) {
+    n = l & 0x7f;
+    if (n == 0 || n > 3 || p + n > len) {
+      return -1;
+    }
+    for (l = 0; n > 0; n--) {
+      l = (l << 8) | buf[p++];
+    }
+  }
+  if (l > len - p) {
+    return -1;
+  }
+  *val_len = l;
+  *pos = p;
+  return 0;
+}
+
+/* Step over the TLV at *pos */
+static int
+ber_tlv_skip(const uint8_t *buf, uint32_t len, uint32_t *pos)
+{
+  uint8_t tag;
+  uint32_t l;
+
+  if (ber_tlv_dec(buf, len, pos, &tag, &l) < 0) {
+    return -1;
+  }
+  *pos += l;
+  return 0;
+}
+
+static uint32_t
+ber_uint_dec(const uint8_t *buf, uint32_t len)
+{
+  uint32_t v = 0;
+
+  while (len-- > 0) {
+    v = (v << 8) | *buf++;
+  }
+  return v;
+}
+
+/*
+ * Message templates
+ */
+
+static uint32_t
+bench_pdu_enc(struct bench_request *r, uint8_t *out)
+{
+  uint8_t buf[BENCH_MSG_MAX];
+  uint32_t len;
+
+  len = ber_int_enc(buf, BENCH_ID_BASE);
+  len += ber_int_enc(buf + len, r->non_rep);
+  len += ber_int_enc(buf + len, r->max_rep);
+  len += ber_tlv_enc(buf + len, ASN1_TAG_SEQ, r->vbs, r->vbs_len);
+  return ber_tlv_enc(out, r->type, buf, len);
+}
+
+/* Offset of request-id in the scoped PDU at buf */
+static uint32_t
+bench_scoped_req_id(const uint8_t *buf, uint32_t len)
+{
+  uint32_t pos = 0, l;
+  uint8_t tag;
+
+  ber_tlv_dec(buf, len, &pos, &tag, &l);
+  ber_tlv_skip(buf, len, &pos);
+  ber_tlv_skip(buf, len, &pos);
+  ber_tlv_dec(buf, len, &pos, &tag, &l);
+  ber_tlv_dec(buf, len, &pos, &tag, &l);
+  return pos;
+}
+
+static void
+bench_v2c_build(struct bench_request *r)
+{
+  uint8_t buf[BENCH_MSG_MAX];
+  uint32_t len, pos = 0, l;
+  uint8_t tag;
+
+  len = ber_int_enc(buf, 1);
+  len += ber_tlv_enc(buf + len, ASN1_TAG_OCTSTR, (uint8_t *)r->community, strlen(r->community));
+  len += bench_pdu_enc(r, buf + len);
+  r->len = ber_tlv_enc(r->msg, ASN1_TAG_SEQ, buf, len);
+
+  /* Version, community, PDU */
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  ber_tlv_skip(r->msg, r->len, &pos);
+  ber_tlv_skip(r->msg, r->len, &pos);
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  r->req_id_off = pos;
+  r->msg_id_off = pos;
+}
+
+/* SNMPv3 message of r at engine time t, the discovery probe if r has no
+ * user. Rebuilt when t takes another number of bytes. */
+static void
+bench_v3_build(struct bench_request *r, uint32_t t)
+{
+  uint8_t buf[BENCH_MSG_MAX], hdr[64], sec[BENCH_MSG_MAX], params[BENCH_MSG_MAX];
+  const uint8_t zero[DIGEST_MAX_LEN] = { 0 };
+  uint8_t flags = BENCH_FLAG_REPORTABLE;
+  uint32_t len, hdr_len, sec_len, pos = 0, l;
+  uint8_t tag;
+
+  if (r->auth != NULL) {
+    flags |= BENCH_FLAG_AUTH;
+  }
+  if (r->priv != NULL) {
+    flags |= BENCH_FLAG_PRIV;
+  }
+
+  /* msgGlobalData */
+  len = ber_int_enc(buf, BENCH_ID_BASE);
+  len += ber_int_enc(buf + len, 65507);
+  len += ber_tlv_enc(buf + len, ASN1_TAG_OCTSTR, &flags, 1);
+  len += ber_int_enc(buf + len, 3);
+  hdr_len = ber_tlv_enc(hdr, ASN1_TAG_SEQ, buf, len);
+
+  /* USM security parameters */
+  len = ber_tlv_enc(buf, ASN1_TAG_OCTSTR, engine_id, r->user[0] ? engine_id_len : 0);
+  len += ber_int_enc(buf + len, engine_boots);
+  len += ber_int_enc(buf + len, t);
+  len += ber_tlv_enc(buf + len, ASN1_TAG_OCTSTR, (uint8_t *)r->user, strlen(r->user));
+  len += ber_tlv_enc(buf + len, ASN1_TAG_OCTSTR, zero, r->auth ? r->auth->mac_len : 0);
+  len += ber_tlv_enc(buf + len, ASN1_TAG_OCTSTR, zero, r->priv ? BENCH_SALT_LEN : 0);
+  len = ber_tlv_enc(params, ASN1_TAG_SEQ, buf, len);
+  sec_len = ber_tlv_enc(sec, ASN1_TAG_OCTSTR, params, len);
+
+  /* Scoped PDU */
+  len = ber_tlv_enc(buf, ASN1_TAG_OCTSTR, engine_id, r->user[0] ? engine_id_len : 0);
+  len += ber_tlv_enc(buf + len, ASN1_TAG_OCTSTR, NULL, 0);
+  len += bench_pdu_enc(r, buf + len);
+  r->scoped_len = ber_tlv_enc(r->scoped, ASN1_TAG_SEQ, buf, len);
+
+  len = ber_int_enc(buf, 3);
+  memcpy(buf + len, hdr, hdr_len);
+  len += hdr_len;
+  memcpy(buf + len, sec, sec_len);
+  len += sec_len;
+  if (r->priv != NULL) {
+    len += ber_tlv_enc(buf + len, ASN1_TAG_OCTSTR, r->scoped, r->scoped_len);
+  } else {
+    memcpy(buf + len, r->scoped, r->scoped_len);
+    len += r->scoped_len;
+  }
+  r->len = ber_tlv_enc(r->msg, ASN1_TAG_SEQ, buf, len);
+
+  /* Version, msgGlobalData */
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  ber_tlv_skip(r->msg, r->len, &pos);
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  r->msg_id_off = pos;
+  pos = r->msg_id_off + l;
+  ber_tlv_skip(r->msg, r->len, &pos);
+  ber_tlv_skip(r->msg, r->len, &pos);
+  ber_tlv_skip(r->msg, r->len, &pos);
+  /* Engine id, boots, time, user, MAC and salt */
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  ber_tlv_skip(r->msg, r->len, &pos);
+  ber_tlv_skip(r->msg, r->len, &pos);
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  r->time_off = pos;
+  r->time_len = l;
+  pos += l;
+  ber_tlv_skip(r->msg, r->len, &pos);
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  r->mac_off = pos;
+  pos += l;
+  ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+  r->salt_off = pos;
+  pos += l;
+
+  if (r->priv != NULL) {
+    ber_tlv_dec(r->msg, r->len, &pos, &tag, &l);
+    r->scope_off = pos;
+    r->req_id_off = bench_scoped_req_id(r->scoped, r->scoped_len);
+  } else {
+    r->scope_off = pos;
+    r->req_id_off = pos + bench_scoped_req_id(r->scoped, r->scoped_len);
+  }
+}
+
+/* Password to key (RFC 3414 A.2), localized to the discovered engine */
+static void
+bench_key_localize(const struct digest_alg *alg, const char *passwd, uint8_t *key)
+{
+  union digest_ctx ctx;
+  uint8_t chunk[64];
+  uint32_t i, count, len = strlen(passwd);
+
+  alg->init(&ctx);
+  for (count = 0; count < BENCH_PASSWD_EXPAND_LEN; count += sizeof(chunk)) {
+    for (i = 0; i < sizeof(chunk); i++) {
+      chunk[i] = passwd[(count + i) % len];
+    }
+    alg->update(&ctx, chunk, sizeof(chunk));
+  }
+  alg->final(&ctx, key);
+
+  alg->init(&ctx);
+  alg->update(&ctx, key, alg->digest_len);
+  alg->update(&ctx, engine_id, engine_id_len);
+  alg->update(&ctx, key, alg->digest_len);
+  alg->final(&ctx, key);
+}
+
+static void
+bench_keys_init(struct bench_request *r)
+{
+  const struct digest_alg *alg;
+  uint8_t key[DIGEST_MAX_LEN * 2];
+  uint32_t key_len;
+
+  if (r->auth == NULL) {
+    return;
+  }
+  alg = r->auth->alg;
+  bench_key_localize(alg, r->auth_passwd, key);
+  hmac_key_init(&r->auth_key, alg, key, alg->digest_len);
+
+  if (r->priv != NULL) {
+    bench_key_localize(alg, r->priv_passwd, key);
+    for (key_len = alg->digest_len; key_len < r->priv->key_len; key_len += alg->digest_len) {
+      digest(alg, key, key_len, key + key_len);
+    }
+    aes_key_init(&r->priv_key, key, r->priv->key_len);
+  }
+}
+
+/* Patch ids, time and salt into the template, encrypt and sign */
+static void
+bench_send(struct bench_request *r, uint32_t id, uint64_t now)
+{
+  uint8_t iv[AES_BLOCK_LEN], mac[DIGEST_MAX_LEN];
+  uint32_t t = 0;
+  int i;
+
+  if (r->user[0] != '\0') {
+    t = engine_time + (now - engine_synced) / 1000000000ULL;
+    if (ber_int_len(t) != r->time_len) {
+      bench_v3_build(r, t);
+    }
+    ber_int_set(r->msg + r->time_off, t, r->time_len);
+  }
+  ber_int_set(r->msg + r->msg_id_off, id, 4);
+  if (r->user[0] == '\0') {
+    ber_int_set(r->msg + r->req_id_off, id, 4);
+  } else {
+    if (r->priv != NULL) {
+      bench_salt++;
+      for (i = 0; i < 4; i++) {
+        iv[i] = engine_boots >> (24 - i * 8);
+        iv[4 + i] = t >> (24 - i * 8);
+      }
+      for (i = 0; i < BENCH_SALT_LEN; i++) {
+        iv[8 + i] = bench_salt >> (56 - i * 8);
+      }
+      memcpy(r->msg + r->salt_off, iv + 8, BENCH_SALT_LEN);
+      ber_int_set(r->scoped + r->req_id_off, id, 4);
+      memcpy(r->msg + r->scope_off, r->scoped, r->scoped_len);
+      aes_cfb_encrypt(&r->priv_key, iv, r->msg + r->scope_off, r->scoped_len);
+    } else {
+      ber_int_set(r->msg + r->req_id_off, id, 4);
+    }
+    if (r->auth != NULL) {
+      memset(r->msg + r->mac_off, 0, r->auth->mac_len);
+      hmac(&r->auth_key, r->msg, r->len, mac);
+      memcpy(r->msg + r->mac_off, mac, r->auth->mac_len);
+    }
+  }
+
+  if (send(bench_sock, r->msg, r->len, 0) < 0 && errno != ECONNREFUSED) {
+    fprintf(stderr, "send: %s\n", strerror(errno));
+  }
+  r->sent++;
+}
+
+/* Id of a response, and whether it reports an error. The PDU of an
+ * encrypted response is not looked into. */
+static int
+bench_response(const uint8_t *buf, uint32_t len, uint32_t *id, int *error)
+{
+  uint32_t pos = 0, l, version;
+  uint8_t tag, flags = 0;
+
+  if (ber_tlv_dec(buf, len, &pos, &tag, &l) < 0 || tag != ASN1_TAG_SEQ ||
+      ber_tlv_dec(buf, len, &pos, &tag, &l) < 0 || tag != ASN1_TAG_INT) {
+    return -1;
+  }
+  version = ber_uint_dec(buf + pos, l);
+  pos += l;
+
+  if (version == 3) {
+    /* msgID, msgMaxSize, msgFlags */
+    if (ber_tlv_dec(buf, len, &pos, &tag, &l) < 0 || ber_tlv_dec(buf, len, &pos, &tag, &l) < 0) {
+      return -1;
+    }
+    *id = ber_uint_dec(buf + pos, l);
+    pos += l;
+    if (ber_tlv_skip(buf, len, &pos) < 0 || ber_tlv_dec(buf, len, &pos, &tag, &l) < 0 || l != 1) {
+      return -1;
+    }
+    flags = buf[pos];
+    pos += l;
+    if (ber_tlv_skip(buf, len, &pos) < 0 || ber_tlv_skip(buf, len, &pos) < 0) {
+      return -1;
+    }
+    *error = 0;
+    if (flags & BENCH_FLAG_PRIV) {
+      return 0;
+    }
+    /* Context engine id and name */
+    if (ber_tlv_dec(buf, len, &pos, &tag, &l) < 0 || ber_tlv_skip(buf, len, &pos) < 0 ||
+        ber_tlv_skip(buf, len, &pos) < 0) {
+      return -1;
+    }
+  } else {
+    if (ber_tlv_skip(buf, len, &pos) < 0) {
+      return -1;
+    }
+  }
+
+  /* request-id and error-status of the PDU */
+  if (ber_tlv_dec(buf, len, &pos, &tag, &l) < 0) {
+    return -1;
+  }
+  *error = tag != MIB_RESP;
+  if (ber_tlv_dec(buf, len, &pos, &tag, &l) < 0) {
+    return -1;
+  }
+  if (version != 3) {
+    *id = ber_uint_dec(buf + pos, l);
+  }
+  pos += l;
+  if (ber_tlv_dec(buf, len, &pos, &tag, &l) < 0) {
+    return -1;
+  }
+  if (ber_uint_dec(buf + pos, l) != 0) {
+    *error = 1;
+  }
+  return 0;
+}
+
+/* Engine id, boots and time from the Report answering a probe */
+static int
+bench_discover(void)
+{
+  struct bench_request probe;
+  uint8_t buf[BENCH_RECV_MAX];
+  struct pollfd pfd = { bench_sock, POLLIN, 0 };
+  uint32_t pos, l, i;
+  uint8_t tag;
+  int n, try;
+
+  memset(&probe, 0, sizeof(probe));
+  probe.type = MIB_REQ_GET;
+  bench_v3_build(&probe, 0);
+
+  for (try = 0; try < 3; try++) {
+    ber_int_set(probe.msg + probe.msg_id_off, BENCH_ID_BASE + try, 4);
+    ber_int_set(probe.msg + probe.req_id_off, BENCH_ID_BASE + try, 4);
+    send(bench_sock, probe.msg, probe.len, 0);
+    if (poll(&pfd, 1, 1000) <= 0) {
+      continue;
+    }
+    n = recv(bench_sock, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      continue;
+    }
+
+    /* Version, msgGlobalData, then into the security parameters */
+    pos = 0;
+    if (ber_tlv_dec(buf, n, &pos, &tag, &l) < 0 || ber_tlv_skip(buf, n, &pos) < 0 ||
+        ber_tlv_skip(buf, n, &pos) < 0 || ber_tlv_dec(buf, n, &pos, &tag, &l) < 0 ||
+        ber_tlv_dec(buf, n, &pos, &tag, &l) < 0 || ber_tlv_dec(buf, n, &pos, &tag, &l) < 0 ||
+        l > BENCH_ENGINE_ID_MAX) {
+      break;
+    }
+    memcpy(engine_id, buf + pos, l);
+    engine_id_len = l;
+    pos += l;
+    for (i = 0; i < 2; i++) {
+      if (ber_tlv_dec(buf, n, &pos, &tag, &l) < 0) {
+        return -1;
+      }
+      if (i == 0) {
+        engine_boots = ber_uint_dec(buf + pos, l);
+      } else {
+        engine_time = ber_uint_dec(buf + pos, l);
+      }
+      pos += l;
+    }
+    engine_synced = bench_now();
+    return 0;
+  }
+  return -1;
+}
+
+/*
+ * Profile
+ */
+
+static int
+bench_field_str(lua_State *L, const char *key, char *buf, uint32_t size)
+{
+  const char *s;
+  int ret = 0;
+
+  lua_getfield(L, -1, key);
+  if (lua_isstring(L, -1)) {
+    s = lua_tostring(L, -1);
+    if (strlen(s) < size) {
+      strcpy(buf, s);
+    } else {
+      ret = -1;
+    }
+  } else if (!lua_isnil(L, -1)) {
+    ret = -1;
+  }
+  lua_pop(L, 1);
+  return ret;
+}
+
+static char *
+bench_field_strdup(lua_State *L, const char *key)
+{
+  char *s = NULL;
+
+  lua_getfield(L, -1, key);
+  if (lua_isstring(L, -1)) {
+    s = xmalloc(lua_objlen(L, -1) + 1);
+    strcpy(s, lua_tostring(L, -1));
+  }
+  lua_pop(L, 1);
+  return s;
+}
+
+static uint32_t
+bench_field_int(lua_State *L, const char *key, uint32_t def)
+{
+  uint32_t v = def;
+
+  lua_getfield(L, -1, key);
+  if (lua_isnumber(L, -1)) {
+    v = lua_tonumber(L, -1);
+  }
+  lua_pop(L, 1);
+  return v;
+}
+
+static uint32_t
+bench_global_int(lua_State *L, const char *name, uint32_t def)
+{
+  uint32_t v = def;
+
+  lua_getglobal(L, name);
+  if (lua_isnumber(L, -1)) {
+    v = lua_tonumber(L, -1);
+  }
+  lua_pop(L, 1);
+  return v;
+}
+
+/* Entry of requests at the top of the stack */
+static int
+bench_request_load(lua_State *L, struct bench_request *r, int i)
+{
+  static const struct { const char *name; uint8_t type; } types[] = {
+    { "get", MIB_REQ_GET },
+    { "getnext", MIB_REQ_GETNEXT },
+    { "getbulk", MIB_REQ_BULKGET },
+  };
+  char type[BENCH_NAME_MAX] = "get", proto[BENCH_NAME_MAX] = "";
+  uint8_t buf[BENCH_MSG_MAX];
+  uint32_t n, len;
+  int j;
+
+  memset(r, 0, sizeof(*r));
+  strcpy(r->community, "public");
+  if (!lua_istable(L, -1) || bench_field_str(L, "type", type, sizeof(type)) < 0 ||
+      bench_field_str(L, "community", r->community, sizeof(r->community)) < 0 ||
+      bench_field_str(L, "user", r->user, sizeof(r->user)) < 0 ||
+      bench_field_str(L, "name", r->name, sizeof(r->name)) < 0) {
+    return -1;
+  }
+  for (j = 0; j < elem_num(types); j++) {
+    if (!strcmp(types[j].name, type)) {
+      r->type = types[j].type;
+    }
+  }
+  if (r->type == 0) {
+    fprintf(stderr, "Request %d: unknown type %s\n", i, type);
+    return -1;
+  }
+  r->weight = bench_field_int(L, "weight", 1);
+  if (r->type == MIB_REQ_BULKGET) {
+    r->non_rep = bench_field_int(L, "non_repeaters", 0);
+    r->max_rep = bench_field_int(L, "max_repetitions", 10);
+  }
+  if (r->name[0] == '\0') {
+    snprintf(r->name, sizeof(r->name), "%s %s", type, r->user[0] ? r->user : r->community);
+  }
+
+  if (bench_field_str(L, "auth_protocol", proto, sizeof(proto)) < 0) {
+    return -1;
+  }
+  if (proto[0] != '\0') {
+    for (j = 0; j < elem_num(bench_auth_protos); j++) {
+      if (!strcmp(bench_auth_protos[j].name, proto)) {
+        r->auth = &bench_auth_protos[j];
+      }
+    }
+    r->auth_passwd = bench_field_strdup(L, "auth_password");
+    if (r->auth == NULL || r->auth_passwd == NULL || r->auth_passwd[0] == '\0') {
+      fprintf(stderr, "Request %d: bad authentication %s\n", i, proto);
+      return -1;
+    }
+  }
+  proto[0] = '\0';
+  if (bench_field_str(L, "priv_protocol", proto, sizeof(proto)) < 0) {
+    return -1;
+  }
+  if (proto[0] != '\0') {
+    for (j = 0; j < elem_num(bench_priv_protos); j++) {
+      if (!strcmp(bench_priv_protos[j].name, proto)) {
+        r->priv = &bench_priv_protos[j];
+      }
+    }
+    r->priv_passwd = bench_field_strdup(L, "priv_password");
+    if (r->priv == NULL || r->auth == NULL || r->priv_passwd == NULL || r->priv_passwd[0] == '\0') {
+      fprintf(stderr, "Request %d: bad privacy %s\n", i, proto);
+      return -1;
+    }
+  }
+  if (r->auth != NULL && r->user[0] == '\0') {
+    fprintf(stderr, "Request %d: security needs a user\n", i);
+    return -1;
+  }
+
+  /* Varbinds of oids with NULL values */
+  lua_getfield(L, -1, "oids");
+  if (!lua_istable(L, -1) || lua_objlen(L, -1) == 0 || lua_objlen(L, -1) > BENCH_OIDS_MAX) {
+    fprintf(stderr, "Request %d: 1 to %d oids wanted\n", i, BENCH_OIDS_MAX);
+    return -1;
+  }
+  n = lua_objlen(L, -1);
+  for (j = 1; j <= n; j++) {
+    lua_rawgeti(L, -1, j);
+    len = lua_isstring(L, -1) ? ber_oid_enc(buf, lua_tostring(L, -1)) : 0;
+    if (len == 0) {
+      fprintf(stderr, "Request %d: bad oid %d\n", i, j);
+      return -1;
+    }
+    buf[len++] = ASN1_TAG_NUL;
+    buf[len++] = 0;
+    r->vbs_len += ber_tlv_enc(r->vbs + r->vbs_len, ASN1_TAG_SEQ, buf, len);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return 0;
+}
+
+static int
+bench_profile_load(const char *path, struct sockaddr_in *addr, uint32_t *duration, uint32_t *window, uint32_t *timeout)
+{
+  lua_State *L = luaL_newstate();
+  const char *host = "127.0.0.1";
+  int i, ret = -1;
+
+  luaL_openlibs(L);
+  if (luaL_dofile(L, path)) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    goto out;
+  }
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(bench_global_int(L, "port", 161));
+  lua_getglobal(L, "host");
+  if (lua_isstring(L, -1)) {
+    host = lua_tostring(L, -1);
+  }
+  if (inet_pton(AF_INET, host, &addr->sin_addr) != 1) {
+    fprintf(stderr, "Bad host %s\n", host);
+    goto out;
+  }
+  lua_pop(L, 1);
+  *duration = bench_global_int(L, "duration", 10);
+  *window = bench_global_int(L, "window", 16);
+  *timeout = bench_global_int(L, "timeout", 1000);
+
+  lua_getglobal(L, "requests");
+  if (!lua_istable(L, -1) || lua_objlen(L, -1) == 0) {
+    fprintf(stderr, "No requests in %s\n", path);
+    goto out;
+  }
+  bench_req_cnt = lua_objlen(L, -1);
+  bench_reqs = xcalloc(bench_req_cnt, sizeof(*bench_reqs));
+  for (i = 0; i < bench_req_cnt; i++) {
+    lua_rawgeti(L, -1, i + 1);
+    if (bench_request_load(L, &bench_reqs[i], i + 1) < 0) {
+      fprintf(stderr, "Bad request %d in %s\n", i + 1, path);
+      goto out;
+    }
+    bench_weight_sum += bench_reqs[i].weight;
+    lua_pop(L, 1);
+  }
+  if (bench_weight_sum == 0) {
+    fprintf(stderr, "No request weighs anything in %s\n", path);
+    goto out;
+  }
+  ret = 0;
+
+out:
+  lua_close(L);
+  return ret;
+}
+
+/*
+ * Load
+ */
+
+/* Weighted pick from the mix, xorshift so that runs repeat */
+static struct bench_request *
+bench_pick(void)
+{
+  uint32_t w;
+  int i;
+
+  bench_rand ^= bench_rand << 13;
+  bench_rand ^= bench_rand >> 17;
+  bench_rand ^= bench_rand << 5;
+  w = bench_rand % bench_weight_sum;
+  for (i = 0; w >= bench_reqs[i].weight; i++) {
+    w -= bench_reqs[i].weight;
+  }
+  return &bench_reqs[i];
+}
+
+/* Slot index rides in the low part of ids, which stay in 4 bytes */
+static void
+bench_slot_fill(struct bench_slot *slots, uint32_t window, uint32_t i, uint64_t now)
+{
+  struct bench_slot *s = &slots[i];
+
+  bench_seq = (bench_seq + 1) % ((0x7fffffff - BENCH_ID_BASE) / window);
+  s->req = bench_pick();
+  s->id = BENCH_ID_BASE + bench_seq * window + i;
+  s->sent = now;
+  bench_send(s->req, s->id, now);
+}
+
+static void
+bench_rtt_add(struct bench_request *r, uint64_t ns)
+{
+  if (r->done == r->rtt_cap) {
+    r->rtt_cap = r->rtt_cap ? r->rtt_cap * 2 : 1024;
+    r->rtt = xrealloc(r->rtt, r->rtt_cap * sizeof(*r->rtt));
+  }
+  r->rtt[r->done++] = ns;
+}
+
+static void
+bench_run(uint32_t duration, uint32_t window, uint32_t timeout)
+{
+  struct bench_slot *slots = xcalloc(window, sizeof(*slots));
+  struct pollfd pfd = { bench_sock, POLLIN, 0 };
+  uint8_t *buf = xmalloc(BENCH_RECV_MAX);
+  uint64_t now, start, end, expire, tmo = (uint64_t)timeout * 1000000ULL;
+  uint32_t i, id = 0, busy = window;
+  int n, error, wait;
+
+  start = bench_now();
+  end = start + (uint64_t)duration * 1000000000ULL;
+  for (i = 0; i < window; i++) {
+    bench_slot_fill(slots, window, i, start);
+  }
+
+  while (busy > 0) {
+    now = bench_now();
+    expire = now + tmo;
+    for (i = 0; i < window; i++) {
+      if (slots[i].req != NULL && slots[i].sent + tmo < expire) {
+        expire = slots[i].sent + tmo;
+      }
+    }
+    wait = expire > now ? (expire - now + 999999) / 1000000 : 0;
+    poll(&pfd, 1, wait);
+
+    while ((n = recv(bench_sock, buf, BENCH_RECV_MAX, MSG_DONTWAIT)) > 0) {
+      now = bench_now();
+      if (bench_response(buf, n, &id, &error) < 0) {
+        continue;
+      }
+      i = (id - BENCH_ID_BASE) % window;
+      if (id < BENCH_ID_BASE || slots[i].req == NULL || slots[i].id != id) {
+        /* Late answer of a request given up */
+        continue;
+      }
+      bench_rtt_add(slots[i].req, now - slots[i].sent);
+      slots[i].req->errors += error;
+      slots[i].req = NULL;
+      busy--;
+      if (now < end) {
+        bench_slot_fill(slots, window, i, now);
+        busy++;
+      }
+    }
+
+    now = bench_now();
+    for (i = 0; i < window; i++) {
+      if (slots[i].req != NULL && now - slots[i].sent >= tmo) {
+        slots[i].req->lost++;
+        slots[i].req = NULL;
+        busy--;
+        if (now < end) {
+          bench_slot_fill(slots, window, i, now);
+          busy++;
+        }
+      }
+    }
+  }
+
+  free(buf);
+  free(slots);
+}
+
+static int
+bench_u64_cmp(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double
+bench_percentile(const uint64_t *rtt, uint64_t cnt, uint32_t permille)
+{
+  if (cnt == 0) {
+    return 0;
+  }
+  return rtt[(cnt - 1) * permille / 1000] / 1000.0;
+}
+
+static void
+bench_report_line(const char *name, uint64_t sent, uint64_t done, uint64_t lost, uint64_t errors,
+                  uint64_t *rtt, uint32_t duration)
+{
+  qsort(rtt, done, sizeof(*rtt), bench_u64_cmp);
+  printf("%-24s %9llu %9llu %7llu %7llu %10.0f %9.1f %9.1f %9.1f %9.1f\n", name,
+         (unsigned long long)sent, (unsigned long long)done, (unsigned long long)lost, (unsigned long long)errors,
+         (double)done / duration, bench_percentile(rtt, done, 500), bench_percentile(rtt, done, 900),
+         bench_percentile(rtt, done, 990), bench_percentile(rtt, done, 1000));
+}
+
+/* User and system time of the agent in seconds, -1 if it can't be read */
+static double
+bench_agent_cpu(int pid)
+{
+  char path[64], stat[1024], *p;
+  unsigned long utime, stime;
+  FILE *fp;
+  size_t n;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  n = fread(stat, 1, sizeof(stat) - 1, fp);
+  fclose(fp);
+  stat[n] = '\0';
+  /* Fields after the command name in parentheses, utime is the 14th */
+  p = strrchr(stat, ')');
+  if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+    return -1;
+  }
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double
+bench_self_cpu(void)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct sockaddr_in addr;
+  uint32_t duration, window, timeout, opt_duration = 0, opt_window = 0;
+  uint64_t sent = 0, done = 0, lost = 0, errors = 0, *rtt;
+  double agent_cpu = -1, self_cpu;
+  int i, opt, pid = 0, v3 = 0;
+
+  while ((opt = getopt(argc, argv, "d:w:p:")) != -1) {
+    switch (opt) {
+      case 'd':
+        opt_duration = atoi(optarg);
+        break;
+      case 'w':
+        opt_window = atoi(optarg);
+        break;
+      case 'p':
+        pid = atoi(optarg);
+        break;
+      default:
+        usage("snmp_bench [-d seconds] [-w window] [-p agent_pid] profile");
+    }
+  }
+  if (optind != argc - 1) {
+    usage("snmp_bench [-d seconds] [-w window] [-p agent_pid] profile");
+  }
+
+  if (bench_profile_load(argv[optind], &addr, &duration, &window, &timeout) < 0) {
+    return 1;
+  }
+  if (opt_duration) {
+    duration = opt_duration;
+  }
+  if (opt_window) {
+    window = opt_window;
+  }
+  if (duration == 0 || window == 0 || timeout == 0) {
+    fprintf(stderr, "Duration, window and timeout must not be 0\n");
+    return 1;
+  }
+
+  bench_sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (bench_sock < 0 || connect(bench_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "Connect to agent: %s\n", strerror(errno));
+    return 1;
+  }
+
+  for (i = 0; i < bench_req_cnt; i++) {
+    v3 |= bench_reqs[i].user[0] != '\0';
+  }
+  if (v3 && bench_discover() < 0) {
+    fprintf(stderr, "No engine discovered at %s:%d\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+    return 1;
+  }
+  bench_salt = (uint64_t)time(NULL) << 32 | getpid();
+  for (i = 0; i < bench_req_cnt; i++) {
+    if (bench_reqs[i].user[0] != '\0') {
+      bench_keys_init(&bench_reqs[i]);
+      bench_v3_build(&bench_reqs[i], engine_time);
+    } else {
+      bench_v2c_build(&bench_reqs[i]);
+    }
+  }
+
+  if (pid) {
+    agent_cpu = bench_agent_cpu(pid);
+    if (agent_cpu < 0) {
+      fprintf(stderr, "No CPU time of agent %d\n", pid);
+    }
+  }
+  self_cpu = bench_self_cpu();
+  bench_run(duration, window, timeout);
+  self_cpu = bench_self_cpu() - self_cpu;
+  if (agent_cpu >= 0) {
+    agent_cpu = bench_agent_cpu(pid) - agent_cpu;
+  }
+
+  printf("%s: %u s, window %u, timeout %u ms\n", argv[optind], duration, window, timeout);
+  printf("%-24s %9s %9s %7s %7s %10s %9s %9s %9s %9s\n", "request", "sent", "done", "lost", "errors",
+         "req/s", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+  for (i = 0; i < bench_req_cnt; i++) {
+    sent += bench_reqs[i].sent;
+    done += bench_reqs[i].done;
+    lost += bench_reqs[i].lost;
+    errors += bench_reqs[i].errors;
+  }
+  rtt = xmalloc((done + 1) * sizeof(*rtt));
+  for (done = 0, i = 0; i < bench_req_cnt; i++) {
+    struct bench_request *r = &bench_reqs[i];
+
+    memcpy(rtt + done, r->rtt, r->done * sizeof(*rtt));
+    done += r->done;
+    bench_report_line(r->name, r->sent, r->done, r->lost, r->errors, r->rtt, duration);
+  }
+  bench_report_line("total", sent, done, lost, errors, rtt, duration);
+
+  if (done > 0) {
+    if (agent_cpu >= 0) {
+      printf("agent CPU %.1f us/request, ", agent_cpu * 1e6 / done);
+    }
+    printf("generator CPU %.1f us/request\n", self_cpu * 1e6 / done);
+  }
+  free(rtt);
+  return lost > 0 || errors > 0;
+}
@@ -0,0 +1,391 @@
+import socket, hashlib, hmac, struct, time
+
+# Minimal SNMPv2c and SNMPv3 manager, enough to drive the agent without
+# Net-SNMP tools.
+
+ASN1_INT = 0x02
+ASN1_OCTSTR = 0x04
+ASN1_NULL = 0x05
+ASN1_OBJID = 0x06
+
+SNMP_GET = 0xa0
+SNMP_GETNEXT = 0xa1
+SNMP_SET = 0xa3
+SNMP_GETBULK = 0xa5
+SNMP_REPORT = 0xa8
+
+def length_encode(n):
+	if n < 0x80:
+		return bytearray([n])
+	b = bytearray()
+	while n:
+		b.insert(0, n & 0xff)
+		n >>= 8
+	return bytearray([0x80 | len(b)]) + b
+
+def tlv(tag, value):
+	return bytearray([tag]) + length_encode(len(value)) + bytearray(value)
+
+def int_encode(i):
+	b = bytearray([i & 0xff])
+	i >>= 8
+	while not ((i == 0 and b[0] < 0x80) or (i == -1 and b[0] >= 0x80)):
+		b.insert(0, i & 0xff)
+		i >>= 8
+	return tlv(ASN1_INT, b)
+
+def oid_encode(oid):
+	subs = [int(x) for x in oid.strip('.').split('.')]
+	b = bytearray([subs[0] * 40 + subs[1]])
+	for s in subs[2:]:
+		sub = bytearray([s & 0x7f])
+		s >>= 7
+		while s:
+			sub.insert(0, 0x80 | (s & 0x7f))
+			s >>= 7
+		b += sub
+	return tlv(ASN1_OBJID, b)
+
+def tlv_decode(buf, pos):
+	tag = buf[pos]
+	n = buf[pos + 1]
+	pos += 2
+	if n & 0x80:
+		length = 0
+		for i in range(n & 0x7f):
+			length = (length << 8) | buf[pos + i]
+		pos += n & 0x7f
+		n = length
+	return tag, buf[pos:pos + n], pos + n
+
+def oid_decode(b):
+	subs = [b[0] // 40, b[0] % 40]
+	s = 0
+	for c in b[1:]:
+		s = (s << 7) | (c & 0x7f)
+		if not c & 0x80:
+			subs.append(s)
+			s = 0
+	return '.' + '.'.join([str(x) for x in subs])
+
+def value_decode(tag, b):
+	if tag == ASN1_INT:
+		i = 0
+		for c in b:
+			i = (i << 8) | c
+		if b and b[0] & 0x80:
+			i -= 1 << (8 * len(b))
+		return i
+	if tag in (0x41, 0x42, 0x43, 0x46):
+		i = 0
+		for c in b:
+			i = (i << 8) | c
+		return i
+	if tag == ASN1_OBJID:
+		return oid_decode(b)
+	if tag == ASN1_OCTSTR:
+		return bytes(b)
+	return {ASN1_NULL: None, 0x80: 'noSuchObject', 0x81: 'noSuchInstance', 0x82: 'endOfMibView'}.get(tag, bytes(b))
+
+def varbinds_decode(vbs):
+	result = []
+	pos = 0
+	while pos < len(vbs):
+		tag, vb, pos = tlv_decode(vbs, pos)
+		tag, oid, vpos = tlv_decode(vb, 0)
+		tag, value, vpos = tlv_decode(vb, vpos)
+		result.append((oid_decode(oid), value_decode(tag, value)))
+	return result
+
+class SNMPClient:
+	def __init__(self, port = 161, community = 'public', timeout = 5):
+		self.port = port
+		self.community = bytearray(community.encode('ascii'))
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.sock.settimeout(timeout)
+		self.request_id = 0
+
+	def close(self):
+		self.sock.close()
+
+	def message(self, pdu):
+		return tlv(0x30, int_encode(1) + tlv(ASN1_OCTSTR, self.community) + pdu)
+
+	def scoped_pdu(self, data):
+		"""PDU of response data"""
+		tag, msg, pos = tlv_decode(data, 0)
+		tag, version, pos = tlv_decode(msg, 0)
+		tag, community, pos = tlv_decode(msg, pos)
+		tag, pdu, pos = tlv_decode(msg, pos)
+		return pdu
+
+	def request(self, pdu_type, varbinds, non_rep = 0, max_rep = 0):
+		"""Send request of (oid, encoded value) varbinds, return
+		(error status, error index, [(oid, value)])"""
+		self.request_id += 1
+		vbs = bytearray()
+		for oid, value in varbinds:
+			vbs += tlv(0x30, oid_encode(oid) + value)
+		pdu = tlv(pdu_type, int_encode(self.request_id) + int_encode(non_rep) + int_encode(max_rep) + tlv(0x30, vbs))
+		self.sock.sendto(bytes(self.message(pdu)), ('127.0.0.1', self.port))
+
+		pdu = self.scoped_pdu(bytearray(self.sock.recv(65536)))
+		tag, request_id, pos = tlv_decode(pdu, 0)
+		tag, error, pos = tlv_decode(pdu, pos)
+		tag, index, pos = tlv_decode(pdu, pos)
+		tag, vbs, pos = tlv_decode(pdu, pos)
+		return value_decode(ASN1_INT, error), value_decode(ASN1_INT, index), varbinds_decode(vbs)
+
+	def get(self, oids):
+		return self.request(SNMP_GET, [(oid, tlv(ASN1_NULL, b'')) for oid in oids])
+
+	def getnext(self, oids):
+		return self.request(SNMP_GETNEXT, [(oid, tlv(ASN1_NULL, b'')) for oid in oids])
+
+	def getbulk(self, oids, non_rep = 0, max_rep = 10):
+		return self.request(SNMP_GETBULK, [(oid, tlv(ASN1_NULL, b'')) for oid in oids], non_rep, max_rep)
+
+	def set_int(self, oid, value):
+		return self.request(SNMP_SET, [(oid, int_encode(value))])
+
+	def walk(self, root):
+		result = []
+		oid = root
+		while True:
+			error, index, varbinds = self.getnext([oid])
+			oid, value = varbinds[0]
+			if value == 'endOfMibView' or not oid.startswith(root + '.'):
+				return result
+			result.append((oid, value))
+
+# Engine id of the agent by default
+engine_id = b'\x80\x00\x00\x00\x04SmartSNMP'
+
+# usmStats counters sent in Reports
+usm_stats_unsupported_sec_levels = '.1.3.6.1.6.3.15.1.1.1.0'
+usm_stats_not_in_time_windows = '.1.3.6.1.6.3.15.1.1.2.0'
+usm_stats_unknown_user_names = '.1.3.6.1.6.3.15.1.1.3.0'
+usm_stats_unknown_engine_ids = '.1.3.6.1.6.3.15.1.1.4.0'
+usm_stats_wrong_digests = '.1.3.6.1.6.3.15.1.1.5.0'
+usm_stats_decryption_errors = '.1.3.6.1.6.3.15.1.1.6.0'
+
+class SNMPReport(Exception):
+	"""Report PDU answering a request, with its (oid, counter) varbind
+	and msgFlags"""
+	def __init__(self, request_id, varbind, flags):
+		Exception.__init__(self, varbind[0])
+		self.request_id = request_id
+		self.oid, self.value = varbind
+		self.flags = flags
+
+# Digest and truncated MAC length of USM authentication protocols
+auth_protocols = {
+	'MD5': ('md5', 12),
+	'SHA': ('sha1', 12),
+	'SHA-224': ('sha224', 16),
+	'SHA-256': ('sha256', 24),
+	'SHA-384': ('sha384', 32),
+	'SHA-512': ('sha512', 48),
+}
+
+# Key length of USM privacy protocols
+priv_protocols = {
+	'AES': 16,
+	'AES-192': 24,
+	'AES-256': 32,
+}
+
+def key_localize(auth_protocol, password, engine_id):
+	"""RFC 3414 A.2 password to key, localized to engine id"""
+	name = auth_protocols[auth_protocol][0]
+	password = password.encode('ascii')
+	ku = hashlib.new(name, (password * (1048576 // len(password) + 1))[:1048576]).digest()
+	return hashlib.new(name, ku + engine_id + ku).digest()
+
+def aes_sbox():
+	sbox = [0] * 256
+	p = q = 1
+	while True:
+		p = (p ^ (p << 1) ^ (0x1b if p & 0x80 else 0)) & 0xff
+		q ^= q << 1
+		q ^= q << 2
+		q ^= q << 4
+		q &= 0xff
+		if q & 0x80:
+			q ^= 0x09
+		rotl = lambda x, n: ((x << n) | (x >> (8 - n))) & 0xff
+		sbox[p] = q ^ rotl(q, 1) ^ rotl(q, 2) ^ rotl(q, 3) ^ rotl(q, 4) ^ 0x63
+		if p == 1:
+			break
+	sbox[0] = 0x63
+	return sbox
+
+SBOX = aes_sbox()
+
+def xtime(x):
+	return ((x << 1) ^ (0x1b if x & 0x80 else 0)) & 0xff
+
+class AES:
+	"""Forward cipher only, which is all CFB needs"""
+	def __init__(self, key):
+		nk = len(key) // 4
+		self.rounds = nk + 6
+		w = [list(key[i * 4:i * 4 + 4]) for i in range(nk)]
+		rcon = 1
+		for i in range(nk, 4 * (self.rounds + 1)):
+			t = list(w[i - 1])
+			if i % nk == 0:
+				t = [SBOX[b] for b in t[1:] + t[:1]]
+				t[0] ^= rcon
+				rcon = xtime(rcon)
+			elif nk > 6 and i % nk == 4:
+				t = [SBOX[b] for b in t]
+			w.append([w[i - nk][j] ^ t[j] for j in range(4)])
+		self.w = w
+
+	def encrypt(self, block):
+		s = [block[i] ^ self.w[i // 4][i % 4] for i in range(16)]
+		for r in range(1, self.rounds + 1):
+			s = [SBOX[b] for b in s]
+			s = [s[(i + 4 * (i % 4)) % 16] for i in range(16)]
+			if r < self.rounds:
+				m = []
+				for c in range(4):
+					a = s[c * 4:c * 4 + 4]
+					t = a[0] ^ a[1] ^ a[2] ^ a[3]
+					m += [a[i] ^ t ^ xtime(a[i] ^ a[(i + 1) % 4]) for i in range(4)]
+				s = m
+			s = [s[i] ^ self.w[r * 4 + i // 4][i % 4] for i in range(16)]
+		return bytearray(s)
+
+	def cfb(self, iv, data, decrypt):
+		out = bytearray()
+		fb = bytearray(iv)
+		for i in range(0, len(data), 16):
+			ks = self.encrypt(fb)
+			chunk = bytearray(data[i:i + 16])
+			res = bytearray([chunk[j] ^ ks[j] for j in range(len(chunk))])
+			out += res
+			fb = chunk if decrypt else res
+		return out
+
+class SNMPv3Client(SNMPClient):
+	"""USM user without or with authentication and privacy, responses
+	have to carry the right MAC. Engine id, boots and time are discovered
+	before the first request."""
+	def __init__(self, port = 161, user = 'roNoAuthUser', auth_protocol = None, auth_password = None,
+	             priv_protocol = None, priv_password = None, timeout = 5):
+		SNMPClient.__init__(self, port, timeout = timeout)
+		self.user = bytearray(user.encode('ascii'))
+		self.auth_protocol = auth_protocol
+		self.auth_password = auth_password
+		self.priv_protocol = priv_protocol
+		self.priv_password = priv_password
+		self.mac_len = 0
+		if auth_protocol is not None:
+			self.digest, self.mac_len = auth_protocols[auth_protocol]
+		self.engine_id = None
+		self.boots = 0
+		self.time = 0
+		self.synced = time.time()
+		self.salt = 0
+
+	def level(self):
+		"""msgFlags of the security level, unauthenticated until discovered"""
+		if self.engine_id is None:
+			return 0
+		return (0x01 if self.auth_protocol else 0) | (0x02 if self.priv_protocol else 0)
+
+	def discover(self):
+		"""Probe with an empty engine id, the Report tells id, boots and time"""
+		try:
+			SNMPClient.request(self, SNMP_GET, [])
+		except SNMPReport as report:
+			assert(report.oid == usm_stats_unknown_engine_ids)
+		self.engine_id = self.peer_engine_id
+		self.boots, self.time, self.synced = self.peer_boots, self.peer_time, time.time()
+		if self.auth_protocol is not None:
+			self.key = key_localize(self.auth_protocol, self.auth_password, self.engine_id)
+		if self.priv_protocol is not None:
+			key = key_localize(self.auth_protocol, self.priv_password, self.engine_id)
+			while len(key) < priv_protocols[self.priv_protocol]:
+				key += hashlib.new(self.digest, key).digest()
+			self.cipher = AES(bytearray(key[:priv_protocols[self.priv_protocol]]))
+
+	def request(self, pdu_type, varbinds, non_rep = 0, max_rep = 0):
+		if self.engine_id is None:
+			self.discover()
+		return SNMPClient.request(self, pdu_type, varbinds, non_rep, max_rep)
+
+	def mac(self, msg):
+		return bytearray(hmac.new(self.key, bytes(msg), self.digest).digest()[:self.mac_len])
+
+	def message(self, pdu):
+		level = self.level()
+		engine = self.engine_id or b''
+		user = self.user if self.engine_id is not None else b''
+		mac_len = self.mac_len if level & 0x01 else 0
+		engine_time = self.time + int(time.time() - self.synced)
+		header = tlv(0x30, int_encode(self.request_id) + int_encode(65507) + tlv(ASN1_OCTSTR, bytearray([0x04 | level])) + int_encode(3))
+		data = tlv(0x30, tlv(ASN1_OCTSTR, engine) + tlv(ASN1_OCTSTR, b'') + pdu)
+		salt = bytearray()
+		if level & 0x02:
+			self.salt += 1
+			salt = bytearray(struct.pack('>Q', self.salt))
+			iv = bytearray(struct.pack('>II', self.boots, engine_time)) + salt
+			data = tlv(ASN1_OCTSTR, self.cipher.cfb(iv, data, False))
+		security = tlv(0x30, tlv(ASN1_OCTSTR, engine) + int_encode(self.boots) + int_encode(engine_time) + tlv(ASN1_OCTSTR, user) + tlv(ASN1_OCTSTR, bytearray(mac_len)) + tlv(ASN1_OCTSTR, salt))
+		msg = tlv(0x30, int_encode(3) + header + tlv(ASN1_OCTSTR, security) + data)
+		if level & 0x01:
+			# MAC is right before the privacy parameters and data
+			pos = len(msg) - len(data) - 2 - len(salt) - mac_len
+			msg[pos:pos + mac_len] = self.mac(msg)
+		return msg
+
+	def scoped_pdu(self, data):
+		"""PDU of response data, Reports are raised as SNMPReport"""
+		tag, msg, base = tlv_decode(data, 0)
+		base -= len(msg)
+		tag, version, pos = tlv_decode(msg, 0)
+		tag, header, pos = tlv_decode(msg, pos)
+		tag, security, pos = tlv_decode(msg, pos)
+		spos = pos - len(security)
+		tag, params, p = tlv_decode(security, 0)
+		ppos = p - len(params)
+		fields = []
+		p = 0
+		for i in range(6):
+			tag, value, p = tlv_decode(params, p)
+			fields.append((value, p - len(value)))
+		tag, flags, hpos = tlv_decode(header, 0)
+		tag, flags, hpos = tlv_decode(header, hpos)
+		tag, flags, hpos = tlv_decode(header, hpos)
+		flags = flags[0]
+		self.peer_engine_id = bytes(fields[0][0])
+		self.peer_boots = value_decode(ASN1_INT, fields[1][0])
+		self.peer_time = value_decode(ASN1_INT, fields[2][0])
+		if flags & 0x01:
+			mac, at = fields[4]
+			mac = bytearray(mac)
+			at += base + spos + ppos
+			data[at:at + len(mac)] = bytearray(len(mac))
+			assert(mac == self.mac(data))
+			# Authentic boots and time keep us in the time window
+			self.boots, self.time, self.synced = self.peer_boots, self.peer_time, time.time()
+		tag, scoped, pos = tlv_decode(msg, pos)
+		if flags & 0x02:
+			assert(tag == ASN1_OCTSTR)
+			iv = bytearray(struct.pack('>II', self.peer_boots, self.peer_time)) + fields[5][0]
+			tag, scoped, pos = tlv_decode(self.cipher.cfb(iv, scoped, True), 0)
+		tag, context_engine, spos = tlv_decode(scoped, 0)
+		tag, context, spos = tlv_decode(scoped, spos)
+		tag, pdu, spos = tlv_decode(scoped, spos)
+		if tag == SNMP_REPORT:
+			tag, request_id, p = tlv_decode(pdu, 0)
+			tag, error, p = tlv_decode(pdu, p)
+			tag, index, p = tlv_decode(pdu, p)
+			tag, vbs, p = tlv_decode(pdu, p)
+			raise SNMPReport(value_decode(ASN1_INT, request_id), varbinds_decode(vbs)[0], flags)
+		# Responses come at the security level of the user
+		assert(flags & 0x03 == self.level())
+		return pdu
@@ -0,0 +1,582 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Microbenchmarks of the hot paths of a request, each in isolation: the
+ * BER codec, MIB tree searches over a synthetic tree of native groups,
+ * searches answered by a Lua group and the index table Lua groups build
+ * on every search. Each benchmark runs a fixed number of operations over
+ * several rounds and the best round counts, to keep out scheduling noise.
+ * Run it from the top directory, where lualib is.
+ *
+ * Usage: snmp_microbench [-n ops] [-r rounds] [-g groups] [-f fanout]
+ *                        [-t rows] [benchmark ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mib.h"
+#include "snmp.h"
+#include "util.h"
+
+int luaopen_smartsnmp_core(lua_State *L);
+
+/* Synthetic groups live under 1.3.6.1.4.1.9999.200.<a>.<b>, the Lua group
+ * at 1.3.6.1.4.1.9999.201 */
+#define BENCH_TREE_OID       1, 3, 6, 1, 4, 1, 9999, 200
+#define BENCH_TREE_OID_LEN   8
+#define BENCH_LUA_OID_LEN    8
+
+struct microbench {
+  const char *name;
+  const char *desc;
+  void (*run)(uint32_t ops);
+};
+
+static uint32_t bench_groups = 1000;
+static uint32_t bench_fanout = 32;
+static uint32_t bench_rows = 100;
+
+static lua_State *bench_L;
+static struct mib_view bench_view;
+static const oid_t bench_view_oid[] = { 1 };
+/* Results go here so that nothing is optimized out */
+static volatile uint32_t bench_sink;
+
+static uint64_t
+bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * BER codec
+ */
+
+static const uint32_t bench_lengths[] = { 3, 42, 127, 128, 200, 1400, 4096, 65535 };
+
+static void
+bench_length_enc(uint32_t ops)
+{
+  uint8_t buf[8];
+  uint32_t i, len;
+
+  for (i = 0; i < ops; i++) {
+    len = bench_lengths[i % elem_num(bench_lengths)];
+    bench_sink += ber_length_enc_try(len);
+    bench_sink += ber_length_enc(len, buf);
+  }
+}
+
+static void
+bench_length_dec(uint32_t ops)
+{
+  uint8_t bufs[elem_num(bench_lengths)][8];
+  uint32_t i, len;
+
+  for (i = 0; i < elem_num(bench_lengths); i++) {
+    ber_length_enc(bench_lengths[i], bufs[i]);
+  }
+  for (i = 0; i < ops; i++) {
+    const uint8_t *buf = bufs[i % elem_num(bench_lengths)];
+
+    bench_sink += ber_length_dec_try(buf);
+    bench_sink += ber_length_dec(buf, &len);
+    bench_sink += len;
+  }
+}
+
+/* TLVs of octet strings of the lengths above, values inside the buffer */
+static uint8_t bench_tlvs[elem_num(bench_lengths)][65535 + 8];
+
+static void
+bench_tlv_init(void)
+{
+  uint32_t i;
+
+  for (i = 0; i < elem_num(bench_lengths); i++) {
+    bench_tlvs[i][0] = ASN1_TAG_OCTSTR;
+    ber_length_enc(bench_lengths[i], &bench_tlvs[i][1]);
+  }
+}
+
+static void
+bench_hdr_dec(uint32_t ops)
+{
+  uint32_t i, len;
+
+  bench_tlv_init();
+  for (i = 0; i < ops; i++) {
+    const uint8_t *buf = bench_tlvs[i % elem_num(bench_lengths)];
+
+    /* As the decoder went before the bounds checks */
+    if (*buf++ != ASN1_TAG_OCTSTR) {
+      continue;
+    }
+    bench_sink += ber_length_dec(buf, &len);
+    bench_sink += len;
+  }
+}
+
+static void
+bench_tlv_dec(uint32_t ops)
+{
+  uint32_t i, len;
+
+  bench_tlv_init();
+  for (i = 0; i < ops; i++) {
+    const uint8_t *buf = bench_tlvs[i % elem_num(bench_lengths)];
+
+    bench_sink += ber_tlv_dec(buf, buf + sizeof(bench_tlvs[0]), ASN1_TAG_OCTSTR, &len);
+    bench_sink += len;
+  }
+}
+
+static const int bench_ints[] ={ 0, 1, -1, 127, 128, -129, 65535, 1000000, -2147483647, 2147483647 };
+
+static void
+bench_int_enc(uint32_t ops)
+{
+  uint8_t buf[8];
+  uint32_t i;
+
+  for (i = 0; i < ops; i++) {
+    const int *v = &bench_ints[i % elem_num(bench_ints)];
+
+    bench_sink += ber_value_enc_try(v, 1, ASN1_TAG_INT);
+    bench_sink += ber_value_enc(v, 1, ASN1_TAG_INT, buf);
+  }
+}
+
+static void
+bench_int_dec(uint32_t ops)
+{
+  uint8_t bufs[elem_num(bench_ints)][8];
+  uint32_t lens[elem_num(bench_ints)];
+  uint32_t i, j;
+  int v;
+
+  for (i = 0; i < elem_num(bench_ints); i++) {
+    lens[i] = ber_value_enc(&bench_ints[i], 1, ASN1_TAG_INT, bufs[i]);
+  }
+  for (i = 0; i < ops; i++) {
+    j = i % elem_num(bench_ints);
+    bench_sink += ber_value_dec_try(bufs[j], lens[j], ASN1_TAG_INT);
+    bench_sink += ber_value_dec(bufs[j], lens[j], ASN1_TAG_INT, &v);
+    bench_sink += v;
+  }
+}
+
+static void
+bench_cnt64_codec(uint32_t ops)
+{
+  uint8_t buf[16];
+  uint64_t v, w;
+  uint32_t i, len;
+
+  for (i = 0; i < ops; i++) {
+    v = (uint64_t)i * 0x9e3779b97f4aULL;
+    len = ber_value_enc(&v, 1, ASN1_TAG_CNT64, buf);
+    bench_sink += ber_value_dec(buf, len, ASN1_TAG_CNT64, &w);
+    bench_sink += (uint32_t)w;
+  }
+}
+
+/* ifInOctets of rows 1 to 4096, typical of walks */
+static void
+bench_oid_enc(uint32_t ops)
+{
+  oid_t oid[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10, 0 };
+  uint8_t buf[MIB_OID_MAX_LEN * 5];
+  uint32_t i;
+
+  for (i = 0; i < ops; i++) {
+    oid[10] = i % 4096 + 1;
+    bench_sink += ber_value_enc_try(oid, elem_num(oid), ASN1_TAG_OBJID);
+    bench_sink += ber_value_enc(oid, elem_num(oid), ASN1_TAG_OBJID, buf);
+  }
+}
+
+static void
+bench_oid_dec(uint32_t ops)
+{
+  oid_t oid[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10, 4000 }, out[MIB_OID_MAX_LEN];
+  uint8_t buf[MIB_OID_MAX_LEN * 5];
+  uint32_t i, len;
+
+  len = ber_value_enc(oid, elem_num(oid), ASN1_TAG_OBJID, buf);
+  for (i = 0; i < ops; i++) {
+    bench_sink += ber_value_dec_try(buf, len, ASN1_TAG_OBJID);
+    bench_sink += ber_value_dec(buf, len, ASN1_TAG_OBJID, out);
+    bench_sink += out[10];
+  }
+}
+
+static void
+bench_octstr_codec(uint32_t ops)
+{
+  const char str[] = "Linux smartsnmp 3.2.0 #1 SMP x86_64";
+  uint8_t buf[64];
+  char out[64];
+  uint32_t i, len;
+
+  for (i = 0; i < ops; i++) {
+    len = ber_value_enc(str, sizeof(str) - 1, ASN1_TAG_OCTSTR, buf);
+    bench_sink += ber_value_dec(buf, len, ASN1_TAG_OCTSTR, out);
+  }
+}
+
+/*
+ * MIB tree searches
+ */
+
+/* Group of one scalar .1.0 */
+static int
+bench_native_handler(struct oid_search_res *ret_oid)
+{
+  static const oid_t inst[] = { 1, 0 };
+  Variable *var = &ret_oid->var;
+
+  switch (ret_oid->request) {
+    case MIB_REQ_GET:
+      if (oid_cmp(ret_oid->inst_id, ret_oid->inst_id_len, inst, 2)) {
+        tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
+      break;
+
+    case MIB_REQ_GETNEXT:
+      if (oid_cmp(ret_oid->inst_id, ret_oid->inst_id_len, inst, 2) >= 0) {
+        tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
+      oid_cpy(ret_oid->inst_id, inst, 2);
+      ret_oid->inst_id_len = 2;
+      break;
+
+    default:
+      return SNMP_ERR_STAT_NOT_WRITABLE;
+  }
+  tag(var) = ASN1_TAG_INT;
+  length(var) = 1;
+  integer(var) = 1;
+  return 0;
+}
+
+/* Instance oid .1.0 of synthetic group g */
+static uint32_t
+bench_tree_oid(uint32_t g, oid_t *oid)
+{
+  const oid_t base[] = { BENCH_TREE_OID };
+
+  oid_cpy(oid, base, BENCH_TREE_OID_LEN);
+  oid[BENCH_TREE_OID_LEN] = g / bench_fanout + 1;
+  oid[BENCH_TREE_OID_LEN + 1] = g % bench_fanout + 1;
+  oid[BENCH_TREE_OID_LEN + 2] = 1;
+  oid[BENCH_TREE_OID_LEN + 3] = 0;
+  return BENCH_TREE_OID_LEN + 4;
+}
+
+static void
+bench_tree_init(void)
+{
+  oid_t oid[MIB_OID_MAX_LEN];
+  uint32_t g, len;
+
+  for (g = 0; g < bench_groups; g++) {
+    len = bench_tree_oid(g, oid);
+    mib_native_node_reg(oid, len - 2, bench_native_handler);
+  }
+}
+
+/* Groups visited in a scattered order */
+static uint32_t
+bench_tree_group(uint32_t i)
+{
+  return (i * 2654435761U) % bench_groups;
+}
+
+static void
+bench_tree_get(uint32_t ops)
+{
+  struct oid_search_res ret_oid;
+  oid_t oid[MIB_OID_MAX_LEN];
+  uint32_t i, len;
+
+  memset(&ret_oid, 0, sizeof(ret_oid));
+  for (i = 0; i < ops; i++) {
+    len = bench_tree_oid(bench_tree_group(i), oid);
+    ret_oid.request = MIB_REQ_GET;
+    mib_tree_search(&bench_view, oid, len, &ret_oid);
+    bench_sink += tag(&ret_oid.var);
+  }
+}
+
+/* From the instance of a group on to the one of the next group */
+static void
+bench_tree_getnext(uint32_t ops)
+{
+  struct oid_search_res ret_oid;
+  oid_t oid[MIB_OID_MAX_LEN];
+  uint32_t i, len;
+
+  memset(&ret_oid, 0, sizeof(ret_oid));
+  for (i = 0; i < ops; i++) {
+    len = bench_tree_oid(bench_tree_group(i), oid);
+    ret_oid.request = MIB_REQ_GETNEXT;
+    mib_tree_search_next(&bench_view, oid, len, &ret_oid);
+    bench_sink += ret_oid.id_len;
+  }
+}
+
+/*
+ * Lua groups
+ */
+
+static const char bench_lua_init[] =
+  "local mib = require 'smartsnmp'\n"
+  "local rows = ...\n"
+  "assert(mib.init('snmp', 0), 'Failed to init the agent')\n"
+  "local indexes = {}\n"
+  "for i = 1, rows do indexes[i] = true end\n"
+  "bench_group = {\n"
+  "    [1] = mib.ConstInt(function () return 1 end),\n"
+  "    [2] = mib.ConstOctString(function () return 'smartsnmp' end),\n"
+  "    [3] = {\n"
+  "        [1] = {\n"
+  "            indexes = indexes,\n"
+  "            [1] = mib.ConstInt(function (i) return i end),\n"
+  "            [2] = mib.ConstCount(function (i) return i * 10 end),\n"
+  "        },\n"
+  "    },\n"
+  "}\n"
+  "mib.register_mib_group({ 1, 3, 6, 1, 4, 1, 9999, 201 }, bench_group, 'bench')\n"
+  "bench_index_table = function (n)\n"
+  "    for i = 1, n do mib.group_index_table(bench_group, 'bench') end\n"
+  "end\n";
+
+static int
+bench_lua_open(void)
+{
+  bench_L = luaL_newstate();
+  luaL_openlibs(bench_L);
+
+  /* Core linked in, Lua library from the tree */
+  lua_getglobal(bench_L, "package");
+  lua_getfield(bench_L, -1, "preload");
+  lua_pushcfunction(bench_L, luaopen_smartsnmp_core);
+  lua_setfield(bench_L, -2, "smartsnmp.core");
+  lua_pop(bench_L, 1);
+  lua_pushstring(bench_L, "lualib/?/init.lua;lualib/?.lua");
+  lua_setfield(bench_L, -2, "path");
+  lua_pop(bench_L, 1);
+
+  if (luaL_loadbuffer(bench_L, bench_lua_init, sizeof(bench_lua_init) - 1, "microbench") ||
+      (lua_pushinteger(bench_L, bench_rows), lua_pcall(bench_L, 1, 0, 0))) {
+    fprintf(stderr, "%s\n", lua_tostring(bench_L, -1));
+    return -1;
+  }
+  return 0;
+}
+
+/* Scalar or table instance of the Lua group */
+static uint32_t
+bench_lua_oid(uint32_t i, oid_t *oid)
+{
+  const oid_t base[] = { 1, 3, 6, 1, 4, 1, 9999, 201 };
+  uint32_t n = i % (bench_rows * 2 + 2);
+
+  oid_cpy(oid, base, BENCH_LUA_OID_LEN);
+  if (n < 2) {
+    oid[BENCH_LUA_OID_LEN] = n + 1;
+    oid[BENCH_LUA_OID_LEN + 1] = 0;
+    return BENCH_LUA_OID_LEN + 2;
+  }
+  n -= 2;
+  oid[BENCH_LUA_OID_LEN] = 3;
+  oid[BENCH_LUA_OID_LEN + 1] = 1;
+  oid[BENCH_LUA_OID_LEN + 2] = n / bench_rows + 1;
+  oid[BENCH_LUA_OID_LEN + 3] = n % bench_rows + 1;
+  return BENCH_LUA_OID_LEN + 4;
+}
+
+static void
+bench_lua_get(uint32_t ops)
+{
+  struct oid_search_res ret_oid;
+  oid_t oid[MIB_OID_MAX_LEN];
+  uint32_t i, len;
+
+  memset(&ret_oid, 0, sizeof(ret_oid));
+  for (i = 0; i < ops; i++) {
+    len = bench_lua_oid(i, oid);
+    ret_oid.request = MIB_REQ_GET;
+    mib_tree_search(&bench_view, oid, len, &ret_oid);
+    bench_sink += tag(&ret_oid.var);
+  }
+}
+
+static void
+bench_lua_getnext(uint32_t ops)
+{
+  struct oid_search_res ret_oid;
+  oid_t oid[MIB_OID_MAX_LEN];
+  uint32_t i, len;
+
+  memset(&ret_oid, 0, sizeof(ret_oid));
+  for (i = 0; i < ops; i++) {
+    len = bench_lua_oid(i, oid);
+    ret_oid.request = MIB_REQ_GETNEXT;
+    mib_tree_search_next(&bench_view, oid, len, &ret_oid);
+    bench_sink += ret_oid.id_len;
+  }
+}
+
+static void
+bench_index_table(uint32_t ops)
+{
+  lua_getglobal(bench_L, "bench_index_table");
+  lua_pushinteger(bench_L, ops);
+  if (lua_pcall(bench_L, 1, 0, 0)) {
+    fprintf(stderr, "%s\n", lua_tostring(bench_L, -1));
+    lua_pop(bench_L, 1);
+  }
+}
+
+static const struct microbench microbenches[] = {
+  { "ber_length_enc", "ber_length_enc_try/enc of lengths up to 65535", bench_length_enc },
+  { "ber_length_dec", "ber_length_dec_try/dec of the same", bench_length_dec },
+  { "ber_hdr_dec", "tag compare and ber_length_dec, unchecked", bench_hdr_dec },
+  { "ber_tlv_dec", "ber_tlv_dec of the same, bounds checked", bench_tlv_dec },
+  { "ber_int_enc","ber_value_enc_try/enc of integers", bench_int_enc },
+  { "ber_int_dec", "ber_value_dec_try/dec of the same", bench_int_dec },
+  { "ber_cnt64", "ber_value_enc/dec of Counter64", bench_cnt64_codec },
+  { "ber_oid_enc", "ber_value_enc_try/enc of 11 sub-id oids", bench_oid_enc },
+  { "ber_oid_dec", "ber_value_dec_try/dec of the same", bench_oid_dec },
+  { "ber_octstr", "ber_value_enc/dec of a 35 byte string", bench_octstr_codec },
+  { "tree_get", "mib_tree_search GET, native groups", bench_tree_get },
+  { "tree_getnext", "mib_tree_search_next to the next native group", bench_tree_getnext },
+  { "lua_get", "mib_tree_search GET, Lua group handler", bench_lua_get },
+  { "lua_getnext", "mib_tree_search_next, Lua group handler", bench_lua_getnext },
+  { "index_table", "group_index_table_generator of the Lua group", bench_index_table },
+};
+
+static uint32_t bench_ops = 100000;
+static uint32_t bench_rounds = 5;
+static int bench_argc;
+static char **bench_argv;
+
+/* Called as a function of the core, Lua callbacks of the tree are looked
+ * up in its environment */
+static int
+bench_run(lua_State *L)
+{
+  uint32_t r, n;
+  uint64_t t, best;
+  int i, j;
+
+  printf("%u ops, best of %u rounds, %u native groups by %u, %u rows in the Lua group\n",
+         bench_ops, bench_rounds, bench_groups, bench_fanout, bench_rows);
+  for (i = 0; i < elem_num(microbenches); i++) {
+    const struct microbench *mb = &microbenches[i];
+
+    if (optind < bench_argc) {
+      for (j = optind; j < bench_argc && strcmp(bench_argv[j], mb->name); j++);
+      if (j == bench_argc) {
+        continue;
+      }
+    }
+    /* Index tables are built per search, far fewer of them do */
+    n = mb->run == bench_index_table ? bench_ops / 100 + 1 : bench_ops;
+    best = 0;
+    for (r = 0; r < bench_rounds; r++) {
+      t = bench_now();
+      mb->run(n);
+      t = bench_now() - t;
+      if (best == 0 || t < best) {
+        best = t;
+      }
+    }
+    printf("%-16s %12.1f ns/op  %s\n", mb->name, (double)best / n, mb->desc);
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:g:f:t:")) != -1) {
+    switch (opt) {
+      case 'n':
+        bench_ops = atoi(optarg);
+        break;
+      case 'r':
+        bench_rounds = atoi(optarg);
+        break;
+      case 'g':
+        bench_groups = atoi(optarg);
+        break;
+      case 'f':
+        bench_fanout = atoi(optarg);
+        break;
+      case 't':
+        bench_rows = atoi(optarg);
+        break;
+      default:
+        usage("snmp_microbench [-n ops] [-r rounds] [-g groups] [-f fanout] [-t rows] [benchmark ...]");
+    }
+  }
+  if (bench_ops == 0 || bench_rounds == 0 || bench_groups == 0 || bench_fanout == 0 || bench_rows == 0) {
+    usage("snmp_microbench [-n ops] [-r rounds] [-g groups] [-f fanout] [-t rows] [benchmark ...]");
+  }
+  bench_argc = argc;
+  bench_argv = argv;
+
+  /* Agent initialized by the Lua group, searches are seen through '.' */
+  if (bench_lua_open() < 0) {
+    return 1;
+  }
+  bench_tree_init();
+  bench_view.oid = bench_view_oid;
+  INIT_LIST_HEAD(&bench_view.communities);
+  INIT_LIST_HEAD(&bench_view.users);
+
+  lua_pushcfunction(bench_L, bench_run);
+  lua_getglobal(bench_L, "package");
+  lua_getfield(bench_L, -1, "loaded");
+  lua_getfield(bench_L, -1, "smartsnmp.core");
+  lua_getfield(bench_L, -1, "init");
+  lua_getfenv(bench_L, -1);
+  lua_setfenv(bench_L, -6);
+  lua_pop(bench_L, 4);
+  if (lua_pcall(bench_L, 0, 0, 0)) {
+    fprintf(stderr, "%s\n", lua_tostring(bench_L, -1));
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,444 @@
+/*
+ * This file is part of SmartSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/* Replays the SNMP requests of a pcap capture into the agent, without any
+ * socket: the agent is set up by bin/smartsnmpd from a configuration file
+ * as usual, then this transport hands the UDP payloads sent to the agent
+ * port straight to the protocol layer and counts the responses. Requests
+ * are fed back to back with the event loop stopped, so handlers waiting on
+ * commands run in place and runs are repeatable. Run it from the top
+ * directory, where bin and lualib are.
+ *
+ * Usage: snmp_replay [-c config] [-p port] [-l loops] capture.pcap
+ */
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "transport.h"
+#include "protocol.h"
+#include "util.h"
+
+int luaopen_smartsnmp_core(lua_State *L);
+
+/* Link types of the captures read */
+#define LINKTYPE_NULL       0
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LINUX_SLL  113
+#define LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4      0x0800
+#define ETHERTYPE_VLAN      0x8100
+
+/* UDP datagram sent to the agent */
+struct replay_packet {
+  uint8_t *payload;
+  uint32_t len;
+  struct sockaddr_in from;
+};
+
+static struct replay_packet *replay_packets;
+static uint32_t replay_packet_cnt;
+static uint32_t replay_packet_max;
+
+/* Frames left out, by reason */
+static uint32_t replay_skip_link;
+static uint32_t replay_skip_port;
+static uint32_t replay_skip_frag;
+
+static const char *replay_capture;
+static uint32_t replay_loops = 1;
+static uint16_t replay_port;
+
+/* Filled in by the stub transport */
+static uint64_t replay_in_bytes;
+static uint64_t replay_out_cnt;
+static uint64_t replay_out_bytes;
+static uint64_t replay_ns;
+static double replay_cpu;
+
+static uint64_t
+replay_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double
+replay_cpu_time(void)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * Capture file
+ */
+
+static uint16_t
+get_be16(const uint8_t *p)
+{
+  return p[0] << 8 | p[1];
+}
+
+static uint32_t
+get_u32(const uint8_t *p, int swap)
+{
+  if (swap) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+  }
+  return (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+/* Keep the UDP payload of an IPv4 packet if sent to the agent port */
+static void
+replay_ipv4(const uint8_t *ip, uint32_t len)
+{
+  struct replay_packet *pkt;
+  const uint8_t *udp;
+  uint32_t ihl, tot_len, udp_len;
+
+  if (len < 20 || ip[0] >> 4 != 4 || ip[9] != IPPROTO_UDP) {
+    replay_skip_link++;
+    return;
+  }
+  ihl = (ip[0] & 0xf) * 4;
+  tot_len = get_be16(ip + 2);
+  /* Fragments are not put together again */
+  if (get_be16(ip + 6) & 0x3fff) {
+    replay_skip_frag++;
+    return;
+  }
+  if (ihl < 20 || tot_len > len || tot_len < ihl + 8) {
+    replay_skip_link++;
+    return;
+  }
+  udp = ip + ihl;
+  udp_len = get_be16(udp + 4);
+  if (udp_len < 8 || udp_len > tot_len - ihl) {
+    replay_skip_link++;
+    return;
+  }
+  if (get_be16(udp + 2) != replay_port || udp_len == 8) {
+    replay_skip_port++;
+    return;
+  }
+
+  if (replay_packet_cnt == replay_packet_max) {
+    replay_packet_max = replay_packet_max ? replay_packet_max * 2 : 1024;
+    replay_packets = xrealloc(replay_packets, replay_packet_max * sizeof(*replay_packets));
+  }
+  pkt = &replay_packets[replay_packet_cnt++];
+  pkt->len = udp_len - 8;
+  pkt->payload = xmalloc(pkt->len);
+  memcpy(pkt->payload, udp + 8, pkt->len);
+  memset(&pkt->from, 0, sizeof(pkt->from));
+  pkt->from.sin_family = AF_INET;
+  memcpy(&pkt->from.sin_addr, ip + 12, 4);
+  memcpy(&pkt->from.sin_port, udp, 2);
+}
+
+/* Network layer of a frame by link type */
+static void
+replay_frame(uint32_t linktype, const uint8_t *frame, uint32_t len)
+{
+  uint32_t off, proto;
+
+  switch (linktype) {
+    case LINKTYPE_NULL:
+      /* AF_INET in the byte order of the capturing host */
+      if (len < 4 || (get_u32(frame, 0) != AF_INET && get_u32(frame, 1) != AF_INET)) {
+        replay_skip_link++;
+        return;
+      }
+      replay_ipv4(frame + 4, len - 4);
+      return;
+    case LINKTYPE_ETHERNET:
+      off = 12;
+      if (len >= off + 2 && get_be16(frame + off) == ETHERTYPE_VLAN) {
+        off += 4;
+      }
+      break;
+    case LINKTYPE_RAW:
+      replay_ipv4(frame, len);
+      return;
+    case LINKTYPE_LINUX_SLL:
+      off = 14;
+      break;
+    case LINKTYPE_LINUX_SLL2:
+      off = 0;
+      break;
+    default:
+      replay_skip_link++;
+      return;
+  }
+
+  if (len < off + 2) {
+    replay_skip_link++;
+    return;
+  }
+  proto = get_be16(frame + off);
+  if (proto != ETHERTYPE_IPV4) {
+    replay_skip_link++;
+    return;
+  }
+  /* SLL2 keeps the protocol first, in a 20 bytes header */
+  off = linktype == LINKTYPE_LINUX_SLL2 ? 20 : off + 2;
+  if (len < off) {
+    replay_skip_link++;
+    return;
+  }
+  replay_ipv4(frame + off, len - off);
+}
+
+/* Load the requests of a capture, in the classic pcap format */
+static int
+replay_load(const char *path)
+{
+  uint8_t hdr[24], rec[16], *frame;
+  uint32_t linktype, snaplen, len;
+  int swap;
+  FILE *fp;
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+  if (fread(hdr, sizeof(hdr), 1, fp) != 1) {
+    fprintf(stderr, "%s: no pcap header\n", path);
+    fclose(fp);
+    return -1;
+  }
+
+  /* Microsecond or nanosecond timestamps, written either way round */
+  switch (get_u32(hdr, 0)) {
+    case 0xa1b2c3d4:
+    case 0xa1b23c4d:
+      swap = 0;
+      break;
+    case 0xd4c3b2a1:
+    case 0x4d3cb2a1:
+      swap = 1;
+      break;
+    default:
+      fprintf(stderr, "%s: not a pcap file, pcapng ones need converting first\n", path);
+      fclose(fp);
+      return -1;
+  }
+  snaplen = get_u32(hdr + 16, swap);
+  linktype = get_u32(hdr + 20, swap) & 0xffff;
+  if (snaplen == 0 || snaplen > 262144) {
+    snaplen = 262144;
+  }
+  frame = xmalloc(snaplen);
+
+  while (fread(rec, sizeof(rec), 1, fp) == 1) {
+    len = get_u32(rec + 8, swap);
+    if (len > snaplen) {
+      fprintf(stderr, "%s: frame of %u bytes beyond the snapshot length\n", path, len);
+      break;
+    }
+    if (fread(frame, 1, len, fp) != len) {
+      fprintf(stderr, "%s: truncated frame\n", path);
+      break;
+    }
+    replay_frame(linktype, frame, len);
+  }
+
+  free(frame);
+  fclose(fp);
+  return 0;
+}
+
+/*
+ * Stub transport of the agent
+ */
+
+static int
+replay_init(int port)
+{
+  /* Requests to the configured port unless told otherwise */
+  if (replay_port == 0) {
+    replay_port = port;
+  }
+  return 0;
+}
+
+/* Feed the requests in, all of them answered before returning */
+static void
+replay_running(void)
+{
+  struct sockaddr_in *from;
+  uint8_t *buf;
+  uint32_t loop, i;
+  double cpu;
+  uint64_t t;
+
+  if (replay_load(replay_capture) < 0) {
+    return;
+  }
+
+  cpu = replay_cpu_time();
+  t = replay_now();
+  for (loop = 0; loop < replay_loops; loop++) {
+    for (i = 0; i < replay_packet_cnt; i++) {
+      const struct replay_packet *pkt = &replay_packets[i];
+
+      /* Handed over to the agent as a UDP transport does */
+      buf = xmalloc(TRANS_BUF_SIZ);
+      memcpy(buf, pkt->payload, pkt->len);
+      from = xmalloc(sizeof(*from));
+      memcpy(from, &pkt->from, sizeof(*from));
+      replay_in_bytes += pkt->len;
+      snmp_prot_ops.receive(buf, pkt->len, from);
+    }
+  }
+  replay_ns = replay_now() - t;
+  replay_cpu = replay_cpu_time() - cpu;
+}
+
+static void
+replay_stop(void)
+{
+  /* dummy */
+}
+
+static void
+replay_send(uint8_t *buf, int len, const void *addr)
+{
+  replay_out_cnt++;
+  replay_out_bytes += len;
+  free(buf);
+}
+
+static const char *
+replay_peer(const void *addr)
+{
+  static char peer[INET_ADDRSTRLEN + 8];
+  const struct sockaddr_in *from = addr;
+  char ip[INET_ADDRSTRLEN];
+
+  if (from == NULL || inet_ntop(AF_INET, &from->sin_addr, ip, sizeof(ip)) == NULL) {
+    return NULL;
+  }
+  snprintf(peer, sizeof(peer), "%s:%u", ip, ntohs(from->sin_port));
+  return peer;
+}
+
+struct transport_operation snmp_trans_ops = {
+  "snmp_replay",
+  replay_init,
+  replay_running,
+  replay_stop,
+  replay_send,
+  replay_peer,
+};
+
+int
+main(int argc, char **argv)
+{
+  const char *config = "config/snmp.conf";
+  uint64_t in_cnt;
+  lua_State *L;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:p:l:")) != -1) {
+    switch (opt) {
+      case 'c':
+        config = optarg;
+        break;
+      case 'p':
+        replay_port = atoi(optarg);
+        break;
+      case 'l':
+        replay_loops = atoi(optarg);
+        break;
+      default:
+        usage("snmp_replay [-c config] [-p port] [-l loops] capture.pcap");
+    }
+  }
+  if (optind != argc - 1 || replay_loops == 0) {
+    usage("snmp_replay [-c config] [-p port] [-l loops] capture.pcap");
+  }
+  replay_capture = argv[optind];
+
+  L = luaL_newstate();
+  luaL_openlibs(L);
+
+  /* Core linked in, Lua library from the tree */
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, luaopen_smartsnmp_core);
+  lua_setfield(L, -2, "smartsnmp.core");
+  lua_pop(L, 1);
+  lua_pushstring(L, "lualib/?/init.lua;lualib/?.lua;./?.lua");
+  lua_setfield(L, -2, "path");
+  lua_pop(L, 1);
+
+  /* The agent as started with -c config, its run replays the capture */
+  lua_newtable(L);
+  lua_pushstring(L, "bin/smartsnmpd");
+  lua_rawseti(L, -2, 0);
+  lua_pushstring(L, "-c");
+  lua_rawseti(L, -2, 1);
+  lua_pushstring(L, config);
+  lua_rawseti(L, -2, 2);
+  lua_setglobal(L, "arg");
+  if (luaL_dofile(L, "bin/smartsnmpd")) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    return 1;
+  }
+  if (replay_ns == 0) {
+    return 1;
+  }
+
+  in_cnt = (uint64_t)replay_packet_cnt * replay_loops;
+  printf("%u requests to port %u in %s, %u frames skipped (%u other ports, %u fragments, %u not UDP over IPv4)\n",
+         replay_packet_cnt, replay_port, replay_capture,
+         replay_skip_port + replay_skip_frag + replay_skip_link, replay_skip_port, replay_skip_frag, replay_skip_link);
+  printf("replayed %u times: %llu requests, %llu bytes in, %llu responses, %llu bytes out\n",
+         replay_loops, (unsigned long long)in_cnt, (unsigned long long)replay_in_bytes,
+         (unsigned long long)replay_out_cnt, (unsigned long long)replay_out_bytes);
+  if (in_cnt > 0) {
+    printf("%.3f s, %.0f req/s, %.2f us/req, %.2f us CPU/req\n",
+           replay_ns / 1e9, in_cnt * 1e9 / replay_ns, replay_ns / 1e3 / in_cnt, replay_cpu * 1e6 / in_cnt);
+  }
+
+  lua_close(L);
+  return 0;
+}
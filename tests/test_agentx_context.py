@@ -0,0 +1,152 @@
+import unittest
+import sys, os, shutil, subprocess, tempfile
+from agentx_master import *
+
+contexts = [b'', b'tenantA', b'tenantB']
+
+class AgentXContextTestCase(unittest.TestCase):
+	def setUp(self):
+		self.master = AgentXMaster(17705)
+		conf = tempfile.NamedTemporaryFile(mode = 'w', suffix = '.conf', delete = False)
+		conf.write("protocol = 'agentx'\n")
+		conf.write("port = 17705\n")
+		conf.write("contexts = { '', 'tenantA', 'tenantB' }\n")
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system', ['1.3.6.1.2.1.4'] = 'ip' }\n")
+		conf.close()
+		self.conf = conf.name
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		self.agentx = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", self.conf], env = env, stdout = open(os.devnull, 'w'))
+		self.master.accept()
+		# Open and two groups in each context
+		self.master.serve_admin(count = 3 * len(contexts))
+
+	def tearDown(self):
+		self.agentx.terminate()
+		self.agentx.wait()
+		self.master.close()
+		os.unlink(self.conf)
+
+	def test_agentx_context_sessions(self):
+		self.assertEqual(sorted(self.master.sessions.values()), sorted(contexts))
+		for context in contexts:
+			self.assertTrue((context, '.1.3.6.1.2.1.1') in self.master.registered)
+			self.assertTrue((context, '.1.3.6.1.2.1.4') in self.master.registered)
+
+	def test_agentx_context_get(self):
+		for context in contexts:
+			reply = self.master.get(['.1.3.6.1.2.1.1.1.0'], context = context)
+			self.assertEqual(reply['error'], 0)
+			self.assertEqual(reply['varbinds'][0][1], 4)
+
+	def test_agentx_context_set(self):
+		# Transactions of two sessions go on side by side
+		self.master.request(AGENTX_TESTSET, varbind_encode('.1.3.6.1.2.1.4.2.0', 2, 61), context = b'tenantA', tid = 100)
+		self.master.request(AGENTX_TESTSET, varbind_encode('.1.3.6.1.2.1.4.2.0', 2, 62), context = b'tenantB', tid = 200)
+		reply = self.master.request(AGENTX_COMMITSET, b'', context = b'tenantA', tid = 100)
+		self.assertEqual(reply['error'], 0)
+		reply = self.master.get(['.1.3.6.1.2.1.4.2.0'])
+		self.assertEqual(reply['varbinds'][0][2], 61)
+		reply = self.master.request(AGENTX_COMMITSET, b'', context = b'tenantB', tid = 200)
+		self.assertEqual(reply['error'], 0)
+		reply = self.master.get(['.1.3.6.1.2.1.4.2.0'])
+		self.assertEqual(reply['varbinds'][0][2], 62)
+
+	def test_agentx_context_getbulk_end(self):
+		# Repeater past the last object stays at endOfMibView
+		reply = self.master.getbulk(['.1.3.6.1.2.1.99', '.1.3.6.1.2.1.1'], max_rep = 3)
+		self.assertEqual(reply['error'], 0)
+		varbinds = reply['varbinds']
+		self.assertEqual(len(varbinds), 6)
+		for i in range(3):
+			self.assertEqual(varbinds[2 * i][1], 130)
+			self.assertNotEqual(varbinds[2 * i + 1][1], 130)
+		self.assertEqual(varbinds[4][0], varbinds[0][0])
+
+# .1.0 is written as given, .2.0 fails the commit with 13
+setter = """
+local mib = require "smartsnmp"
+
+local first, second = 0, 0
+
+return {
+    [1] = mib.Int(function () return first end, function (v) first = v end),
+    [2] = mib.Int(function () return second end, function (v)
+        if v == 13 then return mib.SNMP_ERR_STAT_COMMIT_FAILED end
+        second = v
+    end),
+}
+"""
+
+if_admin_status = '.1.3.6.1.2.1.2.2.1.7.1'
+if_descr = '.1.3.6.1.2.1.2.2.1.2.1'
+
+class AgentXSetTestCase(unittest.TestCase):
+	def setUp(self):
+		self.master = AgentXMaster(17705)
+		self.dir = tempfile.mkdtemp()
+		for name in ('system', 'interfaces'):
+			shutil.copy('mibs/%s.lua' % name, self.dir)
+		open(os.path.join(self.dir, 'setter.lua'), 'w').write(setter)
+		self.conf = os.path.join(self.dir, 'agentx.conf')
+		conf = open(self.conf, 'w')
+		conf.write("protocol = 'agentx'\n")
+		conf.write("port = 17705\n")
+		conf.write("mib_module_path = '%s'\n" % self.dir)
+		conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system', ['1.3.6.1.2.1.2'] = 'interfaces', ['1.3.6.1.4.1.9999.7'] = 'setter' }\n")
+		conf.close()
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		self.agentx = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", self.conf], env = env, stdout = open(os.devnull, 'w'))
+		self.master.accept()
+		self.master.serve_admin()
+
+	def tearDown(self):
+		self.agentx.terminate()
+		self.agentx.wait()
+		self.master.close()
+		shutil.rmtree(self.dir)
+
+	def cleanup(self, tid):
+		# CleanupSet is not answered
+		self.master.packet_id += 1
+		self.master.sock.sendall(self.master.pdu(AGENTX_CLEANUPSET, b'', self.master.packet_id, tid, session_id = self.master.session()))
+
+	def value(self, oid):
+		return self.master.get([oid])['varbinds'][0][2]
+
+	def test_agentx_set_undo_after_failed_commit(self):
+		payload = varbind_encode('.1.3.6.1.4.1.9999.7.1.0', 2, 5) + varbind_encode('.1.3.6.1.4.1.9999.7.2.0', 2, 13)
+		reply = self.master.request(AGENTX_TESTSET, payload, tid = 300)
+		self.assertEqual(reply['error'], 0)
+		reply = self.master.request(AGENTX_COMMITSET, b'', tid = 300)
+		self.assertEqual(reply['error'], 14)
+		self.assertEqual(self.value('.1.3.6.1.4.1.9999.7.1.0'), 5)
+		# The write before the failed one is taken back
+		reply = self.master.request(AGENTX_UNDOSET, b'', tid = 300)
+		self.assertEqual(reply['error'], 0)
+		self.cleanup(300)
+		self.assertEqual(self.value('.1.3.6.1.4.1.9999.7.1.0'), 0)
+		self.assertEqual(self.value('.1.3.6.1.4.1.9999.7.2.0'), 0)
+
+	def test_agentx_set_native_checked_at_testset(self):
+		# Read-only and wrongly typed objects of a native group fail TestSet
+		reply = self.master.request(AGENTX_TESTSET, varbind_encode(if_descr, 4, b'eth9'), tid = 400)
+		self.assertEqual((reply['error'], reply['index']), (17, 1))
+		self.cleanup(400)
+		reply = self.master.request(AGENTX_TESTSET, varbind_encode(if_admin_status, 4, b'up'), tid = 401)
+		self.assertEqual((reply['error'], reply['index']), (7, 1))
+		self.cleanup(401)
+		# Nothing staged before the failure is written
+		payload = varbind_encode('.1.3.6.1.4.1.9999.7.1.0', 2, 7) + varbind_encode(if_descr, 4, b'eth9')
+		reply = self.master.request(AGENTX_TESTSET, payload, tid = 402)
+		self.assertEqual((reply['error'], reply['index']), (17, 2))
+		self.cleanup(402)
+		self.assertEqual(self.value('.1.3.6.1.4.1.9999.7.1.0'), 0)
+		self.assertNotEqual(self.value(if_descr), b'eth9')
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,135 @@
+import unittest
+import os, time, subprocess, tempfile
+from agentx_subagent import *
+from snmp_client import *
+
+snmp_port = 16161
+master_port = 17706
+
+subtree = '.1.3.6.1.4.1.8888'
+objects = {
+	subtree + '.1.0': (2, 7),
+	subtree + '.2.0': (4, b'remote'),
+	subtree + '.3.1': (65, 100),
+	subtree + '.3.2': (65, 200),
+}
+
+class AgentXMasterTestCase(unittest.TestCase):
+	def setUp(self):
+		conf = tempfile.NamedTemporaryFile(mode = 'w', suffix = '.conf', delete = False)
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % snmp_port)
+		conf.write("agentx_master = %d\n" % master_port)
+		conf.write("communities = { { community = 'public', views = { ['.'] = 'ro' } }, { community = 'private', views = { ['.'] = 'rw' } } }\n")
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system' }\n")
+		conf.close()
+		self.conf = conf.name
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		self.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", self.conf], env = env, stdout = open(os.devnull, 'w'))
+		# Wait for the master to listen
+		for i in range(50):
+			try:
+				self.subagent = AgentXSubAgent(master_port, objects)
+				break
+			except socket.error:
+				time.sleep(0.1)
+		self.assertEqual(self.subagent.open(timeout = 1), 0)
+		self.assertEqual(self.subagent.register(subtree), 0)
+		self.subagent.start()
+		self.client = SNMPClient(snmp_port)
+
+	def tearDown(self):
+		self.client.close()
+		self.subagent.stop()
+		self.snmpd.terminate()
+		self.snmpd.wait()
+		os.unlink(self.conf)
+
+	def test_agentx_master_get(self):
+		error, index, varbinds = self.client.get([subtree + '.1.0', '.1.3.6.1.2.1.1.3.0', subtree + '.2.0', subtree + '.9.0'])
+		self.assertEqual(error, 0)
+		self.assertEqual(varbinds[0], (subtree + '.1.0', 7))
+		self.assertEqual(varbinds[1][0], '.1.3.6.1.2.1.1.3.0')
+		self.assertEqual(varbinds[2], (subtree + '.2.0', b'remote'))
+		self.assertEqual(varbinds[3], (subtree + '.9.0', 'noSuchObject'))
+		# Remote varbinds of one request share one AgentX Get
+		self.assertEqual([(t, len(r)) for t, r in self.subagent.requests], [(AGENTX_GET, 3)])
+
+	def test_agentx_master_walk(self):
+		self.assertEqual(self.client.walk(subtree), [(oid, objects[oid][1]) for oid in sorted(objects.keys(), key = oid_key)])
+		# Past the registration ends the MIB view
+		error, index, varbinds = self.client.getnext([subtree + '.3.2'])
+		self.assertEqual(varbinds[0][1], 'endOfMibView')
+		# Local objects before the registration lead into it
+		error, index, varbinds = self.client.getnext(['.1.3.6.1.2.1.1.9'])
+		self.assertEqual(varbinds[0], (subtree + '.1.0', 7))
+
+	def test_agentx_master_set(self):
+		self.client.close()
+		self.client = SNMPClient(snmp_port, 'private')
+		error, index, varbinds = self.client.set_int(subtree + '.1.0', 9)
+		self.assertEqual(error, 0)
+		# CleanupSet is not answered, the Get after it is
+		self.assertEqual(self.client.get([subtree + '.1.0'])[2][0], (subtree + '.1.0', 9))
+		types = [t for t, r in self.subagent.requests]
+		self.assertEqual(types, [AGENTX_TESTSET, AGENTX_COMMITSET, AGENTX_CLEANUPSET, AGENTX_GET])
+		self.assertEqual(self.subagent.requests[1][1], self.subagent.requests[2][1])
+		# Refused at TestSet
+		error, index, varbinds = self.client.set_int(subtree + '.4.0', 1)
+		self.assertEqual((error, index), (AGENTX_NOT_WRITABLE, 1))
+
+	def test_agentx_master_set_batched(self):
+		self.client.close()
+		self.client = SNMPClient(snmp_port, 'private')
+		error, index, varbinds = self.client.request(SNMP_SET, [(subtree + '.1.0', int_encode(10)), (subtree + '.3.1', tlv(65, b'\x05'))])
+		self.assertEqual(error, 0)
+		# CleanupSet is not answered, the Get after it is
+		self.assertEqual(self.client.get([subtree + '.1.0', subtree + '.3.1'])[2], [(subtree + '.1.0', 10), (subtree + '.3.1', 5)])
+		# Both writes in one transaction
+		self.assertEqual([t for t, r in self.subagent.requests], [AGENTX_TESTSET, AGENTX_COMMITSET, AGENTX_CLEANUPSET, AGENTX_GET])
+		self.assertEqual([oid for oid, tag, value in self.subagent.requests[0][1]], [subtree + '.1.0', subtree + '.3.1'])
+		# Refused as a whole at TestSet, at the varbind of the sub-agent
+		self.subagent.requests = []
+		error, index, varbinds = self.client.request(SNMP_SET, [(subtree + '.1.0', int_encode(11)), (subtree + '.4.0', int_encode(1))])
+		self.assertEqual((error, index), (AGENTX_NOT_WRITABLE, 2))
+		self.assertEqual(self.client.get([subtree + '.1.0'])[2][0], (subtree + '.1.0', 10))
+		self.assertEqual([t for t, r in self.subagent.requests], [AGENTX_TESTSET, AGENTX_CLEANUPSET, AGENTX_GET])
+
+	def test_agentx_master_set_undone(self):
+		self.client.close()
+		self.client = SNMPClient(snmp_port, 'private')
+		self.subagent.commit_fail = subtree + '.3.1'
+		error, index, varbinds = self.client.request(SNMP_SET, [(subtree + '.1.0', int_encode(12)), (subtree + '.3.1', tlv(65, b'\x06'))])
+		self.assertEqual((error, index), (AGENTX_COMMIT_FAILED, 2))
+		# The write committed before is taken back
+		self.assertEqual(self.client.get([subtree + '.1.0'])[2][0], (subtree + '.1.0', 7))
+		self.assertEqual([t for t, r in self.subagent.requests], [AGENTX_TESTSET, AGENTX_COMMITSET, AGENTX_UNDOSET, AGENTX_CLEANUPSET, AGENTX_GET])
+
+	def test_agentx_master_timeout(self):
+		self.subagent.silent = True
+		start = time.time()
+		error, index, varbinds = self.client.get([subtree + '.1.0'])
+		self.assertEqual((error, index), (5, 1))
+		self.assertTrue(time.time() - start >= 0.9)
+
+	def test_agentx_master_close(self):
+		self.subagent.stop()
+		time.sleep(0.2)
+		error, index, varbinds = self.client.get([subtree + '.1.0'])
+		self.assertEqual(varbinds[0], (subtree + '.1.0', 'noSuchObject'))
+		self.assertEqual(self.client.walk(subtree), [])
+
+	def test_agentx_master_duplicate_registration(self):
+		subagent = AgentXSubAgent(master_port)
+		self.assertEqual(subagent.open(), 0)
+		self.assertEqual(subagent.register('.1.3.6.1.2.1.1'), 263)
+		self.assertEqual(subagent.register(subtree + '.3'), 263)
+		self.assertEqual(subagent.register('.1.3.6.1.4.1.8889'), 0)
+		self.assertEqual(subagent.close(), 0)
+		subagent.stop()
+
+if __name__ == '__main__':
+    unittest.main()
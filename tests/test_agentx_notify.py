@@ -0,0 +1,149 @@
+import unittest
+import os, time, socket, subprocess, tempfile
+from agentx_subagent import *
+from snmp_client import *
+
+master_port = 17707
+snmp_port = 16180
+trap_port = 16181
+
+link_down = '.1.3.6.1.6.3.1.1.5.3'
+snmp_trap_oid = '.1.3.6.1.6.3.1.1.4.1.0'
+if_index = '.1.3.6.1.2.1.2.2.1.1'
+
+# Set of .1.0 raises that many notifications
+notifier = """
+local mib = require "smartsnmp"
+
+return {
+    [1] = mib.Int(function () return 0 end, function (v)
+        for i = 1, v do
+            mib.trap({ 1, 3, 6, 1, 6, 3, 1, 1, 5, 3 }, {
+                { oid = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 1, i }, type = 'Int', value = i },
+                { oid = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 2, i }, type = 'OctString', value = 'eth' .. i },
+            })
+        end
+    end),
+}
+"""
+
+def agent_start(dir, conf_lines):
+	open(os.path.join(dir, 'notifier.lua'), 'w').write(notifier)
+	conf_path = os.path.join(dir, 'snmp.conf')
+	conf = open(conf_path, 'w')
+	for line in conf_lines:
+		conf.write(line + "\n")
+	conf.write("mib_module_path = '%s'\n" % dir)
+	conf.close()
+	env = dict(os.environ)
+	env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+	env['LUA_CPATH'] = "build/?.so"
+	return subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'))
+
+def notify_decode(pdu):
+	pos = 0
+	varbinds = []
+	while pos < len(pdu['payload']):
+		vb, pos = varbind_decode(pdu['payload'], pos)
+		varbinds.append(vb)
+	return varbinds
+
+class AgentXNotifyTestCase(unittest.TestCase):
+	def setUp(self):
+		self.dir = tempfile.mkdtemp()
+		self.master = AgentXMaster(master_port)
+		self.agentx = agent_start(self.dir, ["protocol = 'agentx'", "port = %d" % master_port,
+		                                     "mib_modules = { ['1.3.6.1.4.1.9999.9'] = 'notifier' }"])
+		self.master.accept()
+		# Open and the group
+		self.master.serve_admin(count = 2)
+
+	def tearDown(self):
+		self.agentx.terminate()
+		self.agentx.wait()
+		self.master.close()
+		for name in os.listdir(self.dir):
+			os.unlink(os.path.join(self.dir, name))
+		os.rmdir(self.dir)
+
+	def raise_notifications(self, n):
+		self.master.request(AGENTX_TESTSET, varbind_encode('.1.3.6.1.4.1.9999.9.1.0', 2, n), tid = 100)
+		reply = self.master.request(AGENTX_COMMITSET, b'', tid = 100)
+		self.assertEqual(reply['error'], 0)
+
+	def test_agentx_notify(self):
+		self.raise_notifications(3)
+		# Sent one after another without waiting for responses
+		notifies = [self.master.read_pdu() for i in range(3)]
+		for i, pdu in enumerate(notifies):
+			self.assertEqual(pdu['type'], AGENTX_NOTIFY)
+			self.assertEqual(pdu['sid'], self.master.session())
+			self.assertEqual(notify_decode(pdu), [(snmp_trap_oid, 6, link_down),
+			                                     (if_index + '.%d' % (i + 1), 2, i + 1),
+			                                     ('.1.3.6.1.2.1.2.2.1.2.%d' % (i + 1), 4, ('eth%d' % (i + 1)).encode('ascii'))])
+		self.assertEqual(len(set([pdu['pid'] for pdu in notifies])), 3)
+		for pdu in notifies:
+			self.master.sock.sendall(self.master.response_pdu(pdu))
+		# Still serving requests
+		self.assertEqual(self.master.get(['.1.3.6.1.4.1.9999.9.1.0'])['error'], 0)
+
+	def test_agentx_notify_window(self):
+		self.raise_notifications(40)
+		notifies = [self.master.read_pdu() for i in range(32)]
+		self.assertEqual([notify_decode(pdu)[1][2] for pdu in notifies], list(range(1, 33)))
+		# 32 awaiting response at most, the rest go as responses come
+		self.assertRaises(socket.timeout, self.master.read_pdu, 0.2)
+		for pdu in notifies[:8]:
+			self.master.sock.sendall(self.master.response_pdu(pdu))
+		notifies = [self.master.read_pdu() for i in range(8)]
+		self.assertEqual([notify_decode(pdu)[1][2] for pdu in notifies], list(range(33, 41)))
+
+class AgentXMasterNotifyTestCase(unittest.TestCase):
+	def setUp(self):
+		self.dir = tempfile.mkdtemp()
+		self.listener = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.listener.bind(('127.0.0.1', trap_port))
+		self.listener.settimeout(2)
+		self.snmpd = agent_start(self.dir, ["protocol = 'snmp'", "port = %d" % snmp_port, "agentx_master = %d" % master_port,
+		                                    "trap_targets = { { host = '127.0.0.1', port = %d, community = 'traps' } }" % trap_port,
+		                                    "mib_modules = {}"])
+		for i in range(50):
+			try:
+				self.subagent = AgentXSubAgent(master_port)
+				break
+			except socket.error:
+				time.sleep(0.1)
+		self.assertEqual(self.subagent.open(timeout = 1), 0)
+
+	def tearDown(self):
+		self.subagent.stop()
+		self.snmpd.terminate()
+		self.snmpd.wait()
+		self.listener.close()
+		for name in os.listdir(self.dir):
+			os.unlink(os.path.join(self.dir, name))
+		os.rmdir(self.dir)
+
+	def test_agentx_master_forwards_notify(self):
+		error = self.subagent.notify([('.1.3.6.1.2.1.1.3.0', 67, 1234), (snmp_trap_oid, 6, link_down),
+		                              (if_index + '.2', 2, 2), ('.1.3.6.1.2.1.2.2.1.2.2', 4, b'eth2')])
+		self.assertEqual(error, 0)
+		tag, msg, pos = tlv_decode(bytearray(self.listener.recv(65536)), 0)
+		tag, version, pos = tlv_decode(msg, 0)
+		tag, community, pos = tlv_decode(msg, pos)
+		tag, pdu, pos = tlv_decode(msg, pos)
+		self.assertEqual((tag, bytes(community)), (0xa7, b'traps'))
+		for i in range(4):
+			tag, vbs, pos = tlv_decode(pdu, pos if i else 0)
+		varbinds = varbinds_decode(vbs)
+		self.assertEqual([oid for oid, value in varbinds], ['.1.3.6.1.2.1.1.3.0', snmp_trap_oid, if_index + '.2', '.1.3.6.1.2.1.2.2.1.2.2'])
+		self.assertEqual(varbinds[1:], [(snmp_trap_oid, link_down), (if_index + '.2', 2), ('.1.3.6.1.2.1.2.2.1.2.2', b'eth2')])
+
+	def test_agentx_master_refuses_bad_notify(self):
+		# snmpTrapOID.0 missing
+		self.assertEqual(self.subagent.notify([(if_index + '.2', 2, 2)]), 268)
+		self.listener.settimeout(0.2)
+		self.assertRaises(socket.timeout, self.listener.recv, 65536)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,89 @@
+import unittest
+import sys, os, time, subprocess, tempfile
+from agentx_master import *
+
+# Round trips timed per transport
+requests = 1000
+
+class AgentXTransportTestCase(unittest.TestCase):
+	def agentx_start(self, address):
+		self.master = AgentXMaster(address)
+		conf = tempfile.NamedTemporaryFile(mode = 'w', suffix = '.conf', delete = False)
+		conf.write("protocol = 'agentx'\n")
+		if isinstance(address, int):
+			conf.write("port = %d\n" % address)
+		else:
+			conf.write("agentx_socket = '%s'\n" % address)
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system' }\n")
+		conf.close()
+		self.conf = conf.name
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		self.agentx = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", self.conf], env = env, stdout = open(os.devnull, 'w'))
+		self.master.accept()
+		# Open and system group registration
+		self.master.serve_admin(count = 2)
+
+	def agentx_stop(self):
+		self.agentx.terminate()
+		self.agentx.wait()
+		self.master.close()
+		os.unlink(self.conf)
+
+	def round_trip(self, address):
+		self.agentx_start(address)
+		try:
+			reply = self.master.get(['.1.3.6.1.2.1.1.1.0'])
+			self.assertEqual(reply['error'], 0)
+			self.assertEqual(reply['varbinds'][0][1], 4)
+			start = time.time()
+			for i in range(requests):
+				self.master.get(['.1.3.6.1.2.1.1.1.0'])
+			return (time.time() - start) / requests
+		finally:
+			self.agentx_stop()
+
+	def test_agentx_transport_coalesced(self):
+		self.agentx_start(17705)
+		try:
+			# Two PDUs in one segment
+			first = self.master.request_pdu(AGENTX_GET, self.master.ranges(['.1.3.6.1.2.1.1.1.0'], 1))
+			second = self.master.request_pdu(AGENTX_GET, self.master.ranges(['.1.3.6.1.2.1.1.2.0'], 1))
+			self.master.sock.sendall(first + second)
+			# Both responses in one send
+			pdus = self.master.read_batch()
+			self.assertEqual([pdu['pid'] for pdu in pdus], [self.master.packet_id - 1, self.master.packet_id])
+			replies = [self.master.parse_response(pdu) for pdu in pdus]
+			self.assertEqual([reply['varbinds'][0][0] for reply in replies], ['.1.3.6.1.2.1.1.1.0', '.1.3.6.1.2.1.1.2.0'])
+		finally:
+			self.agentx_stop()
+
+	def test_agentx_transport_split(self):
+		self.agentx_start(17705)
+		try:
+			first = self.master.request_pdu(AGENTX_GET, self.master.ranges(['.1.3.6.1.2.1.1.1.0'], 1))
+			second = self.master.request_pdu(AGENTX_GET, self.master.ranges(['.1.3.6.1.2.1.1.2.0'], 1))
+			# One PDU split across two sends, the second send completes it
+			# and brings another one
+			self.master.sock.sendall(first[:HDR_LEN + 4])
+			r, w, x = select.select([self.master.sock], [], [], 0.2)
+			self.assertEqual(r, [])
+			self.master.sock.sendall(first[HDR_LEN + 4:] + second)
+			pdus = self.master.read_batch()
+			self.assertEqual([pdu['pid'] for pdu in pdus], [self.master.packet_id - 1, self.master.packet_id])
+			replies = [self.master.parse_response(pdu) for pdu in pdus]
+			self.assertEqual([reply['error'] for reply in replies], [0, 0])
+			self.assertEqual(replies[0]['varbinds'][0][1], 4)
+		finally:
+			self.agentx_stop()
+
+	def test_agentx_transport_latency(self):
+		path = os.path.join(tempfile.gettempdir(), "smartsnmp_agentx_master")
+		tcp = self.round_trip(17705)
+		unix = self.round_trip(path)
+		sys.stderr.write("\nAgentX GET round trip: TCP loopback %.1f us, Unix socket %.1f us\n" % (tcp * 1e6, unix * 1e6))
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,118 @@
+import unittest
+import os, time, socket, subprocess, tempfile
+from snmp_client import *
+
+port = 16200
+
+latency_entry = '.1.3.6.1.4.1.9999.3.1.1'
+latency_name = latency_entry + '.2'
+latency_count = latency_entry + '.3'
+latency_p50 = latency_entry + '.5'
+latency_max = latency_entry + '.8'
+
+sys_uptime = '.1.3.6.1.2.1.1.3.0'
+sys_descr = '.1.3.6.1.2.1.1.1.0'
+
+stages = [b'decode', b'search', b'encode', b'send', b'request']
+
+class LatencyTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		cls.dump = os.path.join(cls.dir, 'latency')
+		conf_path = os.path.join(cls.dir, 'snmp.conf')
+		conf = open(conf_path, 'w')
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % port)
+		conf.write("communities = { { community = 'public', views = { ['.'] = 'ro' } } }\n")
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = {\n")
+		conf.write("  ['1.3.6.1.2.1.1'] = 'system',\n")
+		conf.write("  ['1.3.6.1.2.1.11'] = 'snmp',\n")
+		conf.write("  ['1.3.6.1.4.1.9999.3'] = 'latency',\n")
+		conf.write("}\n")
+		conf.close()
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		client = SNMPClient(port, 'public', timeout = 0.5)
+		cls.snmpd = None
+		for dump in (True, False):
+			if dump:
+				conf = open(conf_path, 'a')
+				conf.write("latency_dump = { file = '%s', interval = 0.2 }\n" % cls.dump)
+				conf.close()
+			else:
+				# Built without histograms, the dump can't be configured
+				lines = open(conf_path).readlines()[:-1]
+				open(conf_path, 'w').writelines(lines)
+			cls.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'))
+			for i in range(50):
+				if cls.snmpd.poll() is not None:
+					break
+				try:
+					client.get([sys_uptime])
+					break
+				except socket.timeout:
+					pass
+			if cls.snmpd.poll() is None:
+				break
+		client.close()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		for name in os.listdir(cls.dir):
+			os.unlink(os.path.join(cls.dir, name))
+		os.rmdir(cls.dir)
+
+	def setUp(self):
+		self.client = SNMPClient(port, 'public', timeout = 2)
+		self.rows = self.client.walk(latency_name)
+		if not self.rows:
+			self.skipTest('agent built without latency histograms')
+
+	def tearDown(self):
+		self.client.close()
+
+	def row(self, name):
+		for oid, value in self.rows:
+			if bytes(value) == name:
+				return oid[len(latency_name):]
+		self.fail('no latency row of %s' % name)
+
+	def test_latency_rows(self):
+		self.assertEqual([bytes(value) for oid, value in self.rows[:5]], stages)
+		self.assertEqual([oid for oid, value in self.rows[:5]], [latency_name + '.%d' % i for i in range(1, 6)])
+		# Groups named by their oid
+		names = [bytes(value) for oid, value in self.rows[5:]]
+		for name in (b'1.3.6.1.2.1.1', b'1.3.6.1.2.1.11', b'1.3.6.1.4.1.9999.3'):
+			self.assertTrue(name in names)
+
+	def test_latency_counts(self):
+		system = self.row(b'1.3.6.1.2.1.1')
+		oids = [latency_count + '.5', latency_count + system]
+		error, index, varbinds = self.client.get(oids)
+		before = [value for oid, value in varbinds]
+		for i in range(10):
+			self.assertEqual(self.client.get([sys_uptime, sys_descr])[0], 0)
+		error, index, varbinds = self.client.get(oids)
+		after = [value for oid, value in varbinds]
+		# Requests, reading the counts among them, and system handler calls
+		self.assertEqual(after[0] - before[0], 11)
+		self.assertEqual(after[1] - before[1], 20)
+		error, index, varbinds = self.client.get([latency_p50 + system, latency_max + system])
+		self.assertTrue(0 < varbinds[0][1] <= varbinds[1][1])
+
+	def test_latency_dump(self):
+		for i in range(50):
+			if os.path.exists(self.dump):
+				break
+			time.sleep(0.1)
+		lines = open(self.dump).read().splitlines()
+		self.assertEqual(lines[0].split()[:3], ['id', 'name', 'count'])
+		self.assertEqual([line.split()[1] for line in lines[1:6]], [s.decode('ascii') for s in stages])
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,88 @@
+import unittest
+import os, time, socket, subprocess, tempfile, threading
+from snmp_client import *
+
+port = 16230
+
+# .1.0 sleeps before it answers, .2.0 answers at once, .3.0 runs a command
+# outliving its sh_call timeout and .4.0 one which does not.
+waiter = """
+local mib = require "smartsnmp"
+
+return {
+    [1] = mib.ConstInt(function () mib.sleep(500) return 1 end),
+    [2] = mib.ConstInt(function () return 2 end),
+    [3] = mib.ConstOctString(function () return mib.sh_call("sleep 30; echo late", "*line", 300) or "timeout" end),
+    [4] = mib.ConstOctString(function () return mib.sh_call("echo hi", "*line") end),
+}
+"""
+
+group = '.1.3.6.1.4.1.9999.4'
+
+class MibAsyncTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		open(os.path.join(cls.dir, 'waiter.lua'), 'w').write(waiter)
+		conf_path = os.path.join(cls.dir, 'snmp.conf')
+		conf = open(conf_path, 'w')
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % port)
+		conf.write("communities = { { community = 'public', views = { ['.'] = 'ro' } } }\n")
+		conf.write("mib_module_path = '%s'\n" % cls.dir)
+		conf.write("mib_modules = { ['1.3.6.1.4.1.9999.4'] = 'waiter' }\n")
+		conf.close()
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		cls.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'))
+		client = SNMPClient(port, 'public', timeout = 0.5)
+		for i in range(50):
+			try:
+				client.get([group + '.2.0'])
+				break
+			except socket.timeout:
+				pass
+		client.close()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		for name in os.listdir(cls.dir):
+			os.unlink(os.path.join(cls.dir, name))
+		os.rmdir(cls.dir)
+
+	def test_parked_handler_replayed(self):
+		slow = SNMPClient(port, 'public')
+		fast = SNMPClient(port, 'public')
+		answers = {}
+		def get_slow():
+			answers['slow'] = slow.get([group + '.1.0'])
+			answers['slow_at'] = time.time()
+		start = time.time()
+		thread = threading.Thread(target = get_slow)
+		thread.start()
+		time.sleep(0.1)
+		# Served while the first request is parked
+		self.assertEqual(fast.get([group + '.2.0'])[2], [(group + '.2.0', 2)])
+		fast_at = time.time()
+		thread.join()
+		slow.close()
+		fast.close()
+		self.assertTrue(fast_at - start < 0.4)
+		self.assertTrue(answers['slow_at'] > fast_at)
+		self.assertTrue(answers['slow_at'] - start >= 0.45)
+		# Replayed with the value the handler finished with
+		self.assertEqual(answers['slow'], (0, 0, [(group + '.1.0', 1)]))
+
+	def test_sh_call_timeout(self):
+		client = SNMPClient(port, 'public')
+		start = time.time()
+		self.assertEqual(client.get([group + '.3.0'])[2], [(group + '.3.0', b'timeout')])
+		self.assertTrue(0.25 < time.time() - start < 2)
+		self.assertEqual(client.get([group + '.4.0'])[2], [(group + '.4.0', b'hi')])
+		client.close()
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,125 @@
+import unittest
+import os, time, socket, struct, subprocess, tempfile
+from snmp_client import *
+
+port = 16233
+
+tcp_conn_state = '.1.3.6.1.2.1.6.13.1.1'
+udp_local_port = '.1.3.6.1.2.1.7.5.1.2'
+
+# Kernel socket state to tcpConnState
+tcp_states = [12, 5, 3, 4, 6, 7, 11, 1, 8, 9, 2, 10]
+
+# Snapshots are at most this old once the refresh went by
+refresh = 3.2
+
+def proc_endpoint(field):
+	"""(address, port) of a little endian hex /proc/net/{tcp,udp} field"""
+	addr, port = field.split(':')
+	return socket.inet_ntoa(struct.pack('<I', int(addr, 16))), int(port, 16)
+
+def proc_sockets(path):
+	"""[(local, remote, kernel state)] of /proc/net/{tcp,udp}"""
+	result = []
+	for line in open(path).readlines()[1:]:
+		fields = line.split()
+		result.append((proc_endpoint(fields[1]), proc_endpoint(fields[2]), int(fields[3], 16)))
+	return result
+
+def index_endpoints(oid, root, count):
+	"""count (address, port) endpoints of the index of oid in column root"""
+	subs = oid[len(root) + 1:].split('.')
+	return tuple(('.'.join(subs[i * 5:i * 5 + 4]), int(subs[i * 5 + 4])) for i in range(count))
+
+class MibInetTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		conf_path = os.path.join(cls.dir, 'snmp.conf')
+		conf = open(conf_path, 'w')
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % port)
+		conf.write("communities = { { community = 'public', views = { ['.'] = 'ro' } } }\n")
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system', ['1.3.6.1.2.1.6'] = 'tcp', ['1.3.6.1.2.1.7'] = 'udp' }\n")
+		conf.close()
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		cls.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'))
+		client = SNMPClient(port, 'public', timeout = 0.5)
+		for i in range(50):
+			try:
+				client.get(['.1.3.6.1.2.1.1.1.0'])
+				break
+			except socket.timeout:
+				pass
+		client.close()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		os.unlink(os.path.join(cls.dir, 'snmp.conf'))
+		os.rmdir(cls.dir)
+
+	def setUp(self):
+		# Bound ahead, the client socket is in the snapshots to compare
+		self.client = SNMPClient(port, 'public')
+		self.client.sock.bind(('127.0.0.1', 0))
+
+	def tearDown(self):
+		self.client.close()
+
+	def settled(self, walk, proc):
+		"""Walk result once it matches procfs, sockets going away (e.g. out
+		of TIME_WAIT) between the snapshot and procfs are waited out"""
+		for i in range(3):
+			time.sleep(refresh)
+			rows = walk()
+			if rows == proc():
+				break
+		return rows
+
+	def test_tcp_conn_table_procfs(self):
+		listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		listener.bind(('127.0.0.1', 0))
+		listener.listen(1)
+		active = socket.create_connection(listener.getsockname())
+		passive, addr = listener.accept()
+		def walk():
+			return dict((index_endpoints(oid, tcp_conn_state, 2), state) for oid, state in self.client.walk(tcp_conn_state))
+		def proc():
+			return dict(((local, remote), tcp_states[st]) for local, remote, st in proc_sockets('/proc/net/tcp'))
+		try:
+			rows = self.settled(walk, proc)
+			self.assertEqual(rows, proc())
+			self.assertEqual(rows[(listener.getsockname(), ('0.0.0.0', 0))], 2)
+			self.assertEqual(rows[(active.getsockname(), listener.getsockname())], 5)
+			self.assertEqual(rows[(passive.getsockname(), active.getsockname())], 5)
+		finally:
+			passive.close()
+			active.close()
+			listener.close()
+
+	def test_udp_table_procfs(self):
+		sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		sock.bind(('127.0.0.1', 0))
+		local = sock.getsockname()
+		def walk():
+			return dict((index_endpoints(oid, udp_local_port, 1)[0], value) for oid, value in self.client.walk(udp_local_port))
+		def proc():
+			return dict((addr, addr[1]) for addr, remote, st in proc_sockets('/proc/net/udp'))
+		try:
+			rows = self.settled(walk, proc)
+			self.assertEqual(rows, proc())
+			self.assertEqual(rows[local], local[1])
+			self.assertEqual(rows[('0.0.0.0', port)], port)
+		finally:
+			sock.close()
+		# Gone with the next snapshot
+		time.sleep(refresh)
+		self.assertFalse(local in walk())
+
+if __name__ == '__main__':
+    unittest.main()
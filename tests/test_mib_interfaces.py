@@ -0,0 +1,90 @@
+import unittest
+import os, time, socket, subprocess, tempfile
+from snmp_client import *
+
+port = 16232
+
+if_number = '.1.3.6.1.2.1.2.1.0'
+if_index = '.1.3.6.1.2.1.2.2.1.1'
+if_descr = '.1.3.6.1.2.1.2.2.1.2'
+if_mtu = '.1.3.6.1.2.1.2.2.1.4'
+if_name = '.1.3.6.1.2.1.31.1.1.1.1'
+
+def sysfs_interfaces():
+	"""{ifindex: (name, mtu)} of /sys/class/net"""
+	result = {}
+	for name in os.listdir('/sys/class/net'):
+		path = os.path.join('/sys/class/net', name)
+		result[int(open(os.path.join(path, 'ifindex')).read())] = (name, int(open(os.path.join(path, 'mtu')).read()))
+	return result
+
+def column(client, oid):
+	"""{index: value} of a table column"""
+	return dict((int(o.split('.')[-1]), v) for o, v in client.walk(oid))
+
+class MibInterfacesTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		conf_path = os.path.join(cls.dir, 'snmp.conf')
+		conf = open(conf_path, 'w')
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % port)
+		conf.write("communities = { { community = 'public', views = { ['.'] = 'ro' } } }\n")
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system', ['1.3.6.1.2.1.2'] = 'interfaces', ['1.3.6.1.2.1.31'] = 'ifmib' }\n")
+		conf.close()
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		cls.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'))
+		client = SNMPClient(port, 'public', timeout = 0.5)
+		for i in range(50):
+			try:
+				client.get([if_number])
+				break
+			except socket.timeout:
+				pass
+		client.close()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		os.unlink(os.path.join(cls.dir, 'snmp.conf'))
+		os.rmdir(cls.dir)
+
+	def test_if_table_sysfs(self):
+		client = SNMPClient(port, 'public')
+		interfaces = sysfs_interfaces()
+		self.assertEqual(client.get([if_number])[2], [(if_number, len(interfaces))])
+		self.assertEqual(column(client, if_index), dict((i, i) for i in interfaces))
+		self.assertEqual(column(client, if_descr), dict((i, name.encode()) for i, (name, mtu) in interfaces.items()))
+		self.assertEqual(column(client, if_mtu), dict((i, mtu) for i, (name, mtu) in interfaces.items()))
+		self.assertEqual(column(client, if_name), column(client, if_descr))
+		client.close()
+
+	def test_if_table_link_changed(self):
+		link = 'ssnmp%d' % os.getpid()
+		if subprocess.call(['ip', 'link', 'add', link, 'type', 'ifb'], stdout = open(os.devnull, 'w'), stderr = subprocess.STDOUT) != 0:
+			self.skipTest('no link can be added here')
+		client = SNMPClient(port, 'public')
+		try:
+			index = int(open('/sys/class/net/%s/ifindex' % link).read())
+			# Link notifications update the cache
+			for i in range(20):
+				if index in column(client, if_descr):
+					break
+				time.sleep(0.1)
+			self.assertEqual(column(client, if_descr)[index], link.encode())
+		finally:
+			subprocess.call(['ip', 'link', 'del', link])
+		for i in range(20):
+			if index not in column(client, if_descr):
+				break
+			time.sleep(0.1)
+		self.assertEqual(column(client, if_descr), dict((i, name.encode()) for i, (name, mtu) in sysfs_interfaces().items()))
+		client.close()
+
+if __name__ == '__main__':
+    unittest.main()
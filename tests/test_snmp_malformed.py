@@ -0,0 +1,118 @@
+import unittest
+import os, time, socket, subprocess, tempfile
+from snmp_client import *
+
+port = 16210
+
+snmp_in_asn_parse_errs = '.1.3.6.1.2.1.11.6.0'
+sys_uptime = '.1.3.6.1.2.1.1.3.0'
+sys_object_id = '.1.3.6.1.2.1.1.2.0'
+
+class SNMPMalformedTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		conf_path = os.path.join(cls.dir, 'snmp.conf')
+		conf = open(conf_path, 'w')
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % port)
+		conf.write("communities = {\n")
+		conf.write("  { community = 'public', views = { ['.'] = 'ro' } },\n")
+		conf.write("  { community = 'private', views = { ['.'] = 'rw' } },\n")
+		conf.write("}\n")
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = {\n")
+		conf.write("  ['1.3.6.1.2.1.1'] = 'system',\n")
+		conf.write("  ['1.3.6.1.2.1.11'] = 'snmp',\n")
+		conf.write("}\n")
+		conf.close()
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		cls.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'), stderr = open(os.devnull, 'w'))
+		client = SNMPClient(port, 'public', timeout = 0.5)
+		for i in range(50):
+			try:
+				client.get([sys_uptime])
+				break
+			except socket.timeout:
+				pass
+		client.close()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		for name in os.listdir(cls.dir):
+			os.unlink(os.path.join(cls.dir, name))
+		os.rmdir(cls.dir)
+
+	def setUp(self):
+		self.client = SNMPClient(port, 'public', timeout = 2)
+
+	def tearDown(self):
+		self.client.close()
+
+	def parse_errs(self):
+		error, index, varbinds = self.client.get([snmp_in_asn_parse_errs])
+		self.assertEqual(error, 0)
+		return varbinds[0][1]
+
+	def send(self, msg):
+		self.client.sock.sendto(bytes(msg), ('127.0.0.1', port))
+
+	def response(self, msg):
+		"""Send msg, return request id, error status, error index and varbinds"""
+		self.send(msg)
+		pdu = self.client.scoped_pdu(bytearray(self.client.sock.recv(65536)))
+		tag, request_id, pos = tlv_decode(pdu, 0)
+		tag, error, pos = tlv_decode(pdu, pos)
+		tag, index, pos = tlv_decode(pdu, pos)
+		tag, vbs, pos = tlv_decode(pdu, pos)
+		self.assertEqual(pos, len(pdu))
+		return value_decode(ASN1_INT, request_id), value_decode(ASN1_INT, error), value_decode(ASN1_INT, index), varbinds_decode(vbs)
+
+	def test_dropped(self):
+		before = self.parse_errs()
+		vb = tlv(0x30, oid_encode(sys_uptime) + tlv(ASN1_NULL, b''))
+		hdr = int_encode(1) + int_encode(0) + int_encode(0)
+		msgs = [
+			# Varbind running past its list
+			self.client.message(tlv(SNMP_GET, hdr + bytearray([0x30, len(vb) - 1]) + vb)),
+			# Value running past its varbind
+			self.client.message(tlv(SNMP_GET, hdr + tlv(0x30, bytearray([0x30, len(vb) - 3]) + vb[2:]))),
+			# Length of 5 bytes, and indefinite
+			bytearray([0x30, 0x85, 0, 0, 0, 0, 3]) + int_encode(1),
+			bytearray([0x30, 0x80]) + int_encode(1) + bytearray([0, 0]),
+			# Object identifier of more sub-ids than an oid holds
+			tlv(0x30, int_encode(1) + tlv(ASN1_OCTSTR, b'private') + tlv(SNMP_SET, hdr + tlv(0x30, tlv(0x30, oid_encode(sys_object_id) + oid_encode('.1.3' + '.1' * 200))))),
+		]
+		for msg in msgs:
+			self.send(msg)
+		self.client.sock.settimeout(0.2)
+		self.assertRaises(socket.timeout, self.client.sock.recv, 65536)
+		self.client.sock.settimeout(2)
+		self.assertEqual(self.parse_errs() - before, len(msgs))
+
+	def test_long_integers(self):
+		vbs = tlv(0x30, tlv(0x30, oid_encode(sys_uptime) + tlv(ASN1_NULL, b'')))
+		# Request id in 5 bytes, error index in none
+		hdr = tlv(ASN1_INT, b'\xff\xff\xff\xff\xf9') + int_encode(0) + tlv(ASN1_INT, b'')
+		request_id, error, index, varbinds = self.response(self.client.message(tlv(SNMP_GET, hdr + vbs)))
+		self.assertEqual((request_id, error, index), (-7, 0, 0))
+		self.assertEqual(varbinds[0][0], sys_uptime)
+
+	def test_getbulk_repetitions(self):
+		vbs = tlv(0x30, tlv(0x30, oid_encode('.1.3.6.1.2.1.1') + tlv(ASN1_NULL, b'')))
+		# Negative max-repetitions is taken as 0
+		msg = self.client.message(tlv(SNMP_GETBULK, int_encode(1) + int_encode(0) + int_encode(-124) + vbs))
+		self.assertEqual(self.response(msg), (1, 0, 0, []))
+		# Far more than a datagram holds, cut to fit
+		msg = self.client.message(tlv(SNMP_GETBULK, int_encode(2) + int_encode(0) + int_encode(0x7fffffff) + vbs))
+		request_id, error, index, varbinds = self.response(msg)
+		self.assertEqual((request_id, error), (2, 0))
+		self.assertEqual(varbinds[-1][1], 'endOfMibView')
+		self.assertEqual(self.client.get([sys_uptime])[0], 0)
+
+if __name__ == '__main__':
+    unittest.main()
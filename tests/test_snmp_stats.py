@@ -0,0 +1,151 @@
+import unittest
+import os, time, socket, subprocess, tempfile
+from snmp_client import *
+
+port = 16190
+
+snmp_in_pkts = '.1.3.6.1.2.1.11.1.0'
+snmp_out_pkts = '.1.3.6.1.2.1.11.2.0'
+snmp_in_bad_versions = '.1.3.6.1.2.1.11.3.0'
+snmp_in_bad_community_names = '.1.3.6.1.2.1.11.4.0'
+snmp_in_bad_community_uses = '.1.3.6.1.2.1.11.5.0'
+snmp_in_asn_parse_errs = '.1.3.6.1.2.1.11.6.0'
+snmp_in_total_req_vars = '.1.3.6.1.2.1.11.13.0'
+snmp_in_get_requests = '.1.3.6.1.2.1.11.15.0'
+snmp_in_traps = '.1.3.6.1.2.1.11.19.0'
+snmp_out_get_responses = '.1.3.6.1.2.1.11.28.0'
+snmp_unknown_security_models = '.1.3.6.1.6.3.11.2.1.1.0'
+snmp_unknown_pdu_handlers = '.1.3.6.1.6.3.11.2.1.3.0'
+
+sys_uptime = '.1.3.6.1.2.1.1.3.0'
+sys_descr = '.1.3.6.1.2.1.1.1.0'
+
+class SNMPStatsTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		conf_path = os.path.join(cls.dir, 'snmp.conf')
+		conf = open(conf_path, 'w')
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % port)
+		conf.write("communities = {\n")
+		conf.write("  { community = 'public', views = { ['.'] = 'ro' } },\n")
+		conf.write("  { community = 'private', views = { ['.'] = 'rw' } },\n")
+		conf.write("}\n")
+		conf.write("users = { { user = 'noAuth', views = { ['.'] = 'ro' } } }\n")
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = {\n")
+		conf.write("  ['1.3.6.1.2.1.1'] = 'system',\n")
+		conf.write("  ['1.3.6.1.2.1.11'] = 'snmp',\n")
+		conf.write("  ['1.3.6.1.6.3.11.2.1'] = 'mpd_stats',\n")
+		conf.write("  ['1.3.6.1.6.3.15.1.1'] = 'usm_stats',\n")
+		conf.write("}\n")
+		conf.close()
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		cls.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'))
+		client = SNMPClient(port, 'public', timeout = 0.5)
+		for i in range(50):
+			try:
+				client.get([sys_uptime])
+				break
+			except socket.timeout:
+				pass
+		client.close()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		for name in os.listdir(cls.dir):
+			os.unlink(os.path.join(cls.dir, name))
+		os.rmdir(cls.dir)
+
+	def setUp(self):
+		self.client = SNMPClient(port, 'public', timeout = 2)
+
+	def tearDown(self):
+		self.client.close()
+
+	def counters(self, oids):
+		error, index, varbinds = self.client.get(oids)
+		self.assertEqual(error, 0)
+		return [value for oid, value in varbinds]
+
+	def send(self, msg):
+		self.client.sock.sendto(bytes(msg), ('127.0.0.1', port))
+
+	def test_snmp_group(self):
+		oids = [oid for oid, value in self.client.walk('.1.3.6.1.2.1.11')]
+		self.assertEqual(oids, ['.1.3.6.1.2.1.11.%d.0' % i for i in range(1, 33) if i not in (7, 23)])
+		# snmpEnableAuthenTraps disabled
+		self.assertEqual(self.counters(['.1.3.6.1.2.1.11.30.0']), [2])
+		self.assertEqual(self.client.get(['.1.3.6.1.2.1.11.7.0'])[2][0][1], 'noSuchObject')
+		self.assertEqual(self.client.get(['.1.3.6.1.2.1.11.1.1'])[2][0][1], 'noSuchInstance')
+
+	def test_request_counters(self):
+		oids = [snmp_in_pkts, snmp_out_pkts, snmp_in_get_requests, snmp_in_total_req_vars, snmp_out_get_responses]
+		before = self.counters(oids)
+		self.assertEqual(self.client.get([sys_uptime, sys_descr])[0], 0)
+		after = self.counters(oids)
+		# Reading the counters is a request of its own
+		self.assertEqual([a - b for a, b in zip(after, before)], [2, 2, 2, len(oids) + 2, 2])
+
+	def test_bad_community(self):
+		oids = [snmp_in_bad_community_names, snmp_in_bad_community_uses]
+		before = self.counters(oids)
+		client = SNMPClient(port, 'nobody', timeout = 2)
+		# noAccess
+		self.assertEqual(client.get([sys_uptime])[0], 6)
+		client.close()
+		self.assertNotEqual(self.client.set_int('.1.3.6.1.2.1.1.5.0', 1)[0], 0)
+		client = SNMPClient(port, 'private', timeout = 2)
+		client.get([sys_uptime])
+		client.close()
+		self.assertEqual([a - b for a, b in zip(self.counters(oids), before)], [1, 1])
+
+	def test_dropped_messages(self):
+		oids = [snmp_in_bad_versions, snmp_in_asn_parse_errs]
+		before = self.counters(oids)
+		pdu = tlv(SNMP_GET, int_encode(1) + int_encode(0) + int_encode(0) + tlv(0x30, b''))
+		# SNMPv2u, then a length not matching the datagram
+		self.send(tlv(0x30, int_encode(2) + tlv(ASN1_OCTSTR, b'public') + pdu))
+		self.send(self.client.message(pdu)[:-1])
+		# Context name is no octet string
+		self.send(tlv(0x30, int_encode(1) + int_encode(0) + pdu))
+		self.client.sock.settimeout(0.2)
+		self.assertRaises(socket.timeout, self.client.sock.recv, 65536)
+		self.client.sock.settimeout(2)
+		self.assertEqual([a - b for a, b in zip(self.counters(oids), before)], [1, 2])
+
+	def test_unhandled_pdus(self):
+		oids = [snmp_in_traps, snmp_unknown_pdu_handlers]
+		before = self.counters(oids)
+		trap = tlv(0xa7, int_encode(1) + int_encode(0) + int_encode(0) + tlv(0x30, b''))
+		self.send(self.client.message(trap))
+		self.client.sock.settimeout(0.2)
+		self.assertRaises(socket.timeout, self.client.sock.recv, 65536)
+		self.client.sock.settimeout(2)
+		self.assertEqual([a - b for a, b in zip(self.counters(oids), before)], [1, 1])
+
+	def test_usm_mpd_stats(self):
+		before = self.counters([usm_stats_unknown_engine_ids, usm_stats_unknown_user_names, snmp_unknown_security_models])
+		client = SNMPv3Client(port, 'noAuth', timeout = 0.5)
+		client.discover()
+		self.assertEqual(client.get([sys_uptime])[0], 0)
+		# msgSecurityModel 2 is no USM
+		client.request_id += 1
+		pdu = tlv(SNMP_GET, int_encode(client.request_id) + int_encode(0) + int_encode(0) + tlv(0x30, b''))
+		msg = bytes(client.message(pdu)).replace(b'\x04\x01\x04\x02\x01\x03', b'\x04\x01\x04\x02\x01\x02', 1)
+		client.sock.sendto(msg, ('127.0.0.1', port))
+		self.assertRaises(socket.timeout, client.sock.recv, 65536)
+		client.close()
+		client = SNMPv3Client(port, 'nobody', 'SHA', 'nobody_auth', timeout = 0.5)
+		self.assertRaises(SNMPReport, client.get, [sys_uptime])
+		client.close()
+		after = self.counters([usm_stats_unknown_engine_ids, usm_stats_unknown_user_names, snmp_unknown_security_models])
+		self.assertEqual([a - b for a, b in zip(after, before)], [2, 1, 1])
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,324 @@
+import unittest
+import os, time, socket, subprocess, tempfile
+from snmp_client import *
+
+port = 16170
+fast_port = 16171
+slow_port = 16172
+inform_port = 16173
+
+# Agents built with the libevent or uloop transport have no timers, their
+# queues move on with the requests received.
+polled = os.environ.get('TRANSPORT') in ('libevent', 'uloop')
+
+link_down = '.1.3.6.1.6.3.1.1.5.3'
+if_index = '.1.3.6.1.2.1.2.2.1.1'
+
+# Sets raise notifications: distinct ones for .1.0, repeats of one for .2.0.
+# .3.0 to .8.0 are the counters of trap_stats().
+trapper = """
+local mib = require "smartsnmp"
+
+local link_down = { 1, 3, 6, 1, 6, 3, 1, 1, 5, 3 }
+local raise = function (n, same)
+    for i = 1, n do
+        local index = same and 1 or i
+        mib.trap(link_down, {
+            { oid = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 1, index }, type = 'Int', value = index },
+            { oid = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 2, index }, type = 'OctString', value = 'eth' .. index },
+        })
+    end
+end
+
+return {
+    [1] = mib.Int(function () return 0 end, function (v) raise(v, false) end),
+    [2] = mib.Int(function () return 0 end, function (v) raise(v, true) end),
+    [3] = mib.ConstCount(function () return mib.trap_stats().sent end),
+    [4] = mib.ConstCount(function () return mib.trap_stats().merged end),
+    [5] = mib.ConstCount(function () return mib.trap_stats().dropped end),
+    [6] = mib.ConstCount(function () return mib.trap_stats().inform_acked end),
+    [7] = mib.ConstCount(function () return mib.trap_stats().inform_retries end),
+    [8] = mib.ConstCount(function () return mib.trap_stats().inform_failed end),
+}
+"""
+
+def agent_start(dir, port, targets):
+	open(os.path.join(dir, 'trapper.lua'), 'w').write(trapper)
+	conf_path = os.path.join(dir, 'snmp_%d.conf' % port)
+	conf = open(conf_path, 'w')
+	conf.write("protocol = 'snmp'\n")
+	conf.write("port = %d\n" % port)
+	conf.write("communities = { { community = 'private', views = { ['.'] = 'rw' } } }\n")
+	conf.write("trap_targets = {\n")
+	for target in targets:
+		conf.write("  { host = '127.0.0.1', community = 'traps', %s },\n" % target)
+	conf.write("}\n")
+	conf.write("mib_module_path = '%s'\n" % dir)
+	conf.write("mib_modules = { ['1.3.6.1.4.1.9999.9'] = 'trapper' }\n")
+	conf.close()
+	env = dict(os.environ)
+	env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+	env['LUA_CPATH'] = "build/?.so"
+	snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'))
+	client = SNMPClient(port, 'private', timeout = 0.5)
+	for i in range(50):
+		try:
+			client.get(['.1.3.6.1.4.1.9999.9.3.0'])
+			break
+		except socket.timeout:
+			pass
+	client.close()
+	return snmpd
+
+def listener(port):
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.bind(('127.0.0.1', port))
+	sock.settimeout(2)
+	return sock
+
+def trap_decode(data, pdu_type = 0xa7):
+	"""(community, request id, [(oid, value)]) of SNMPv2-Trap or
+	InformRequest message"""
+	tag, msg, pos = tlv_decode(bytearray(data), 0)
+	tag, version, pos = tlv_decode(msg, 0)
+	assert value_decode(ASN1_INT, version) == 1
+	tag, community, pos = tlv_decode(msg, pos)
+	tag, pdu, pos = tlv_decode(msg, pos)
+	assert tag == pdu_type
+	tag, request_id, pos = tlv_decode(pdu, 0)
+	tag, error, pos = tlv_decode(pdu, pos)
+	tag, index, pos = tlv_decode(pdu, pos)
+	tag, vbs, pos = tlv_decode(pdu, pos)
+	return bytes(community), value_decode(ASN1_INT, request_id), varbinds_decode(vbs)
+
+def drain(sock):
+	sock.settimeout(0.2)
+	try:
+		while True:
+			sock.recv(65536)
+	except socket.timeout:
+		pass
+	sock.settimeout(2)
+
+class SNMPTrapTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		cls.fast = listener(fast_port)
+		cls.slow = listener(slow_port)
+		# No limit and 10 per second after 2
+		cls.snmpd = agent_start(cls.dir, port, ["port = %d" % fast_port, "port = %d, rate = 10, burst = 2" % slow_port])
+		cls.client = SNMPClient(port, 'private')
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.client.close()
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		cls.fast.close()
+		cls.slow.close()
+		for name in os.listdir(cls.dir):
+			os.unlink(os.path.join(cls.dir, name))
+		os.rmdir(cls.dir)
+
+	def setUp(self):
+		# Let the slow target catch up and fill its bucket
+		drain(self.slow)
+		drain(self.fast)
+
+	def counter(self, n):
+		return self.client.get(['.1.3.6.1.4.1.9999.9.%d.0' % n])[2][0][1]
+
+	def test_trap_delivery(self):
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.1.0', 3)[0], 0)
+		traps = [trap_decode(self.fast.recv(65536)) for i in range(3)]
+		request_ids = [request_id for community, request_id, varbinds in traps]
+		for i, (community, request_id, varbinds) in enumerate(traps):
+			self.assertEqual(community, b'traps')
+			self.assertEqual([oid for oid, value in varbinds], ['.1.3.6.1.2.1.1.3.0', '.1.3.6.1.6.3.1.1.4.1.0',
+			                  if_index + '.%d' % (i + 1), '.1.3.6.1.2.1.2.2.1.2.%d' % (i + 1)])
+			self.assertEqual(varbinds[1][1], link_down)
+			self.assertEqual(varbinds[2][1], i + 1)
+			self.assertEqual(varbinds[3][1], ('eth%d' % (i + 1)).encode('ascii'))
+		self.assertEqual(len(set(request_ids)), 3)
+
+	def test_trap_duplicates_merged(self):
+		merged = self.counter(4)
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.2.0', 50)[0], 0)
+		community, request_id, varbinds = trap_decode(self.fast.recv(65536))
+		self.assertEqual(varbinds[2], (if_index + '.1', 1))
+		self.fast.settimeout(0.2)
+		self.assertRaises(socket.timeout, self.fast.recv, 65536)
+		self.assertEqual(self.counter(4) - merged, 49)
+
+	def test_trap_repeat_after_sent(self):
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.1.0', 3)[0], 0)
+		for i in range(3):
+			self.fast.recv(65536)
+		# The third still waits for the slow target, repeats are sent anew
+		merged = self.counter(4)
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.1.0', 3)[0], 0)
+		again = [trap_decode(self.fast.recv(65536))[2][2][1] for i in range(3)]
+		self.assertEqual(again, [1, 2, 3])
+		self.assertEqual(self.counter(4), merged)
+
+	@unittest.skipIf(polled, "held traps wait for a request")
+	def test_trap_rate_limited(self):
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.1.0', 6)[0], 0)
+		start = time.time()
+		# The unlimited target gets them all at once
+		fast = [trap_decode(self.fast.recv(65536)) for i in range(6)]
+		self.assertTrue(time.time() - start < 0.1)
+		# The burst of 2 at once, then one per 100ms, in order
+		arrivals = []
+		for i in range(6):
+			community, request_id, varbinds = trap_decode(self.slow.recv(65536))
+			arrivals.append(time.time() - start)
+			self.assertEqual(varbinds[2][1], i + 1)
+		self.assertTrue(arrivals[1] < 0.05)
+		self.assertTrue(arrivals[5] > 0.35)
+		self.assertTrue(arrivals[5] < 1.0)
+
+	def test_trap_slow_target_loses_oldest(self):
+		dir = tempfile.mkdtemp()
+		sock = listener(slow_port + 10)
+		snmpd = agent_start(dir, port + 10, ["port = %d, rate = 1, burst = 1" % (slow_port + 10)])
+		try:
+			client = SNMPClient(port + 10, 'private')
+			self.assertEqual(client.set_int('.1.3.6.1.4.1.9999.9.1.0', 300)[0], 0)
+			community, request_id, varbinds = trap_decode(sock.recv(65536))
+			dropped = client.get(['.1.3.6.1.4.1.9999.9.5.0'])[2][0][1]
+			client.close()
+			# Ring of 256 keeps the newest ones
+			self.assertEqual(dropped, 300 - 256)
+			self.assertEqual(varbinds[2][1], 300 - 256 + 1)
+		finally:
+			snmpd.terminate()
+			snmpd.wait()
+			sock.close()
+			for name in os.listdir(dir):
+				os.unlink(os.path.join(dir, name))
+			os.rmdir(dir)
+
+def inform_response(sock, request_id, peer):
+	pdu = tlv(0xa2, int_encode(request_id) + int_encode(0) + int_encode(0) + tlv(0x30, b''))
+	sock.sendto(bytes(tlv(0x30, int_encode(1) + tlv(ASN1_OCTSTR, b'traps') + pdu)), peer)
+
+class SNMPInformTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		cls.manager = listener(inform_port)
+		# 2 awaiting response, sent again after 100ms and 200ms
+		cls.snmpd = agent_start(cls.dir, port + 20, ["port = %d, inform = true, window = 2, timeout = 100, retries = 2" % inform_port])
+		cls.client = SNMPClient(port + 20, 'private')
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.client.close()
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		cls.manager.close()
+		for name in os.listdir(cls.dir):
+			os.unlink(os.path.join(cls.dir, name))
+		os.rmdir(cls.dir)
+
+	def setUp(self):
+		# Let informs of other cases be given up
+		for i in range(4):
+			time.sleep(0.4)
+			self.counter(8)
+		drain(self.manager)
+
+	def counter(self, n):
+		return self.client.get(['.1.3.6.1.4.1.9999.9.%d.0' % n])[2][0][1]
+
+	def test_inform_acknowledged(self):
+		acked, retries = self.counter(6), self.counter(7)
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.1.0', 1)[0], 0)
+		data, peer = self.manager.recvfrom(65536)
+		community, request_id, varbinds = trap_decode(data, 0xa6)
+		self.assertEqual(community, b'traps')
+		self.assertEqual(varbinds[1], ('.1.3.6.1.6.3.1.1.4.1.0', link_down))
+		inform_response(self.manager, request_id, peer)
+		self.manager.settimeout(0.3)
+		self.assertRaises(socket.timeout, self.manager.recv, 65536)
+		self.assertEqual(self.counter(6) - acked, 1)
+		self.assertEqual(self.counter(7) - retries, 0)
+
+	def test_inform_window(self):
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.1.0', 5)[0], 0)
+		informs = []
+		for i in range(2):
+			data, peer = self.manager.recvfrom(65536)
+			community, request_id, varbinds = trap_decode(data, 0xa6)
+			informs.append((request_id, varbinds[2][1]))
+		self.assertEqual([value for request_id, value in informs], [1, 2])
+		# Two awaiting response at most
+		self.manager.settimeout(0.05)
+		self.assertRaises(socket.timeout, self.manager.recv, 65536)
+		self.manager.settimeout(2)
+		# Each response lets the next one go
+		inform_response(self.manager, informs[0][0], peer)
+		received = [1, 2]
+		while len(received) < 5:
+			data, peer = self.manager.recvfrom(65536)
+			community, request_id, varbinds = trap_decode(data, 0xa6)
+			inform_response(self.manager, request_id, peer)
+			if varbinds[2][1] not in received:
+				received.append(varbinds[2][1])
+		self.assertEqual(received, [1, 2, 3, 4, 5])
+
+	@unittest.skipIf(polled, "retries wait for a request")
+	def test_inform_retransmitted(self):
+		retries, failed = self.counter(7), self.counter(8)
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.1.0', 1)[0], 0)
+		start = time.time()
+		arrivals = []
+		request_ids = []
+		for i in range(3):
+			community, request_id, varbinds = trap_decode(self.manager.recv(65536), 0xa6)
+			arrivals.append(time.time() - start)
+			request_ids.append(request_id)
+		# Same request after 100ms and 200ms more, then given up
+		self.assertEqual(len(set(request_ids)), 1)
+		self.assertTrue(0.08 < arrivals[1] < 0.2)
+		self.assertTrue(0.25 < arrivals[2] < 0.45)
+		self.manager.settimeout(0.6)
+		self.assertRaises(socket.timeout, self.manager.recv, 65536)
+		self.assertEqual(self.counter(7) - retries, 2)
+		self.assertEqual(self.counter(8) - failed, 1)
+
+	def test_inform_retried_on_request(self):
+		# Each request received is a turn to retry with, timers or not
+		retries, failed = self.counter(7), self.counter(8)
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.1.0', 1)[0], 0)
+		request_ids = [trap_decode(self.manager.recv(65536), 0xa6)[1]]
+		for wait in (0.15, 0.25):
+			time.sleep(wait)
+			self.counter(3)
+			request_ids.append(trap_decode(self.manager.recv(65536), 0xa6)[1])
+		self.assertEqual(len(set(request_ids)), 1)
+		time.sleep(0.45)
+		self.assertEqual(self.counter(7) - retries, 2)
+		self.assertEqual(self.counter(8) - failed, 1)
+
+	def test_inform_window_given_up(self):
+		self.assertEqual(self.client.set_int('.1.3.6.1.4.1.9999.9.1.0', 3)[0], 0)
+		values = [trap_decode(self.manager.recv(65536), 0xa6)[2][2][1] for i in range(2)]
+		self.assertEqual(values, [1, 2])
+		# Both unanswered, the third goes once they are given up
+		for i in range(4):
+			time.sleep(0.4)
+			self.counter(3)
+		self.manager.settimeout(0.2)
+		try:
+			while True:
+				values.append(trap_decode(self.manager.recv(65536), 0xa6)[2][2][1])
+		except socket.timeout:
+			pass
+		self.manager.settimeout(2)
+		self.assertIn(3, values)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,85 @@
+import unittest
+import os, time, socket, subprocess, tempfile
+from snmp_client import *
+
+port = 16162
+password = 'smartsnmp_auth'
+
+class SNMPv3AuthTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		conf = tempfile.NamedTemporaryFile(mode = 'w', suffix = '.conf', delete = False)
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % port)
+		conf.write("users = {\n")
+		conf.write("  { user = 'roNoAuthUser', views = { ['.'] = 'ro' } },\n")
+		for proto in auth_protocols:
+			conf.write("  { user = '%s', auth_protocol = '%s', auth_password = '%s', views = { ['.'] = 'rw' } },\n" % (proto, proto, password))
+		conf.write("}\n")
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system', ['1.3.6.1.2.1.4'] = 'ip' }\n")
+		conf.close()
+		cls.conf = conf.name
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		cls.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", cls.conf], env = env, stdout = open(os.devnull, 'w'))
+		# Keys of every user are localized before the agent listens
+		client = SNMPv3Client(port, timeout = 0.5)
+		for i in range(50):
+			try:
+				client.get(['.1.3.6.1.2.1.1.3.0'])
+				break
+			except socket.timeout:
+				pass
+		client.close()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		os.unlink(cls.conf)
+
+	def test_snmpv3_auth_get(self):
+		for proto in auth_protocols:
+			client = SNMPv3Client(port, proto, proto, password)
+			error, index, varbinds = client.get(['.1.3.6.1.2.1.1.3.0'])
+			client.close()
+			self.assertEqual(error, 0)
+			self.assertEqual(varbinds[0][0], '.1.3.6.1.2.1.1.3.0')
+
+	def test_snmpv3_auth_set(self):
+		client = SNMPv3Client(port, 'SHA-256', 'SHA-256', password)
+		error, index, varbinds = client.set_int('.1.3.6.1.2.1.4.1.0', 2)
+		self.assertEqual(error, 0)
+		self.assertEqual(client.get(['.1.3.6.1.2.1.4.1.0'])[2][0][1], 2)
+		client.close()
+
+	def test_snmpv3_auth_rejected(self):
+		rejected = [
+			# Wrong password
+			(SNMPv3Client(port, 'SHA', 'SHA', 'wrong_password'), usm_stats_wrong_digests),
+			# Key of another protocol
+			(SNMPv3Client(port, 'SHA', 'MD5', password), usm_stats_wrong_digests),
+			# Unauthenticated request of a user with key
+			(SNMPv3Client(port, 'SHA'), usm_stats_unsupported_sec_levels),
+			# Unknown user
+			(SNMPv3Client(port, 'nobody', 'SHA', password), usm_stats_unknown_user_names),
+		]
+		for client, oid in rejected:
+			with self.assertRaises(SNMPReport) as cm:
+				client.get(['.1.3.6.1.2.1.1.3.0'])
+			client.close()
+			# Unauthenticated Report of the counter
+			self.assertEqual(cm.exception.oid, oid)
+			self.assertEqual(cm.exception.flags, 0)
+			self.assertTrue(cm.exception.value >= 1)
+
+	def test_snmpv3_noauth(self):
+		client = SNMPv3Client(port)
+		error, index, varbinds = client.get(['.1.3.6.1.2.1.1.3.0'])
+		client.close()
+		self.assertEqual(error, 0)
+
+if __name__ == '__main__':
+    unittest.main()
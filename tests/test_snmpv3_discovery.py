@@ -0,0 +1,132 @@
+import unittest
+import os, time, socket, subprocess, tempfile
+from snmp_client import *
+
+port = 16164
+auth_password = 'smartsnmp_auth'
+priv_password = 'smartsnmp_priv'
+engine = b'\x80\x00\x00\x00\x04DiscoveryTest'
+
+def agent_start(conf_path, port, boots_file):
+	conf = open(conf_path, 'w')
+	conf.write("protocol = 'snmp'\n")
+	conf.write("port = %d\n" % port)
+	conf.write("engine_id = 'DiscoveryTest'\n")
+	conf.write("engine_boots_file = '%s'\n" % boots_file)
+	conf.write("users = {\n")
+	conf.write("  { user = 'noAuth', views = { ['.'] = 'ro' } },\n")
+	conf.write("  { user = 'auth', auth_protocol = 'SHA', auth_password = '%s', views = { ['.'] = 'ro' } },\n" % auth_password)
+	conf.write("  { user = 'priv', auth_protocol = 'SHA-256', auth_password = '%s', priv_protocol = 'AES', priv_password = '%s', views = { ['.'] = 'ro' } },\n" % (auth_password, priv_password))
+	conf.write("}\n")
+	conf.write("mib_module_path = 'mibs'\n")
+	conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system' }\n")
+	conf.close()
+	env = dict(os.environ)
+	env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+	env['LUA_CPATH'] = "build/?.so"
+	snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'))
+	client = SNMPv3Client(port, 'noAuth', timeout = 0.5)
+	for i in range(50):
+		try:
+			client.get(['.1.3.6.1.2.1.1.3.0'])
+			break
+		except socket.timeout:
+			pass
+	client.close()
+	return snmpd
+
+class SNMPv3DiscoveryTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		cls.boots_file = os.path.join(cls.dir, 'engine_boots')
+		open(cls.boots_file, 'w').write('41\n')
+		cls.snmpd = agent_start(os.path.join(cls.dir, 'snmp.conf'), port, cls.boots_file)
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		for name in os.listdir(cls.dir):
+			os.unlink(os.path.join(cls.dir, name))
+		os.rmdir(cls.dir)
+
+	def test_discovery_probe(self):
+		client = SNMPv3Client(port, 'noAuth')
+		# Probes until the client takes the engine id
+		with self.assertRaises(SNMPReport) as first:
+			SNMPClient.request(client, SNMP_GET, [])
+		with self.assertRaises(SNMPReport) as second:
+			SNMPClient.request(client, SNMP_GET, [])
+		# Known engine, empty request
+		self.assertEqual(client.get([]), (0, 0, []))
+		client.close()
+		# Unauthenticated usmStatsUnknownEngineIDs for the probe request
+		self.assertEqual(first.exception.oid, usm_stats_unknown_engine_ids)
+		self.assertEqual(first.exception.flags, 0)
+		self.assertEqual(first.exception.request_id, 1)
+		self.assertEqual(second.exception.request_id, 2)
+		self.assertEqual(second.exception.value, first.exception.value + 1)
+		self.assertEqual(client.peer_engine_id, engine)
+		self.assertEqual(client.peer_boots, 42)
+
+	def test_unreportable_probe(self):
+		client = SNMPv3Client(port, 'noAuth', timeout = 0.5)
+		client.request_id = 1
+		pdu = tlv(SNMP_GET, int_encode(1) + int_encode(0) + int_encode(0) + tlv(0x30, b''))
+		msg = bytes(client.message(pdu)).replace(b'\x04\x01\x04', b'\x04\x01\x00', 1)
+		client.sock.sendto(msg, ('127.0.0.1', port))
+		self.assertRaises(socket.timeout, client.sock.recv, 65536)
+		client.close()
+
+	def test_responses_carry_engine(self):
+		client = SNMPv3Client(port, 'auth', 'SHA', auth_password)
+		error, index, varbinds = client.get(['.1.3.6.1.2.1.1.3.0'])
+		client.close()
+		self.assertEqual(error, 0)
+		self.assertEqual(client.peer_engine_id, engine)
+		self.assertEqual(client.peer_boots, 42)
+		self.assertTrue(0 <= client.peer_time < 300)
+
+	def test_not_in_time_window(self):
+		for client in [SNMPv3Client(port, 'auth', 'SHA', auth_password),
+		               SNMPv3Client(port, 'priv', 'SHA-256', auth_password, 'AES', priv_password)]:
+			client.discover()
+			# What a manager sends before it knows the engine time
+			client.boots, client.time = 0, 0
+			with self.assertRaises(SNMPReport) as cm:
+				client.get(['.1.3.6.1.2.1.1.3.0'])
+			# Signed Report, the client took boots and time from it
+			self.assertEqual(cm.exception.oid, usm_stats_not_in_time_windows)
+			self.assertEqual(cm.exception.flags, 0x01)
+			self.assertEqual(client.boots, 42)
+			error, index, varbinds = client.get(['.1.3.6.1.2.1.1.3.0'])
+			client.close()
+			self.assertEqual(error, 0)
+
+	def test_time_window_edges(self):
+		client = SNMPv3Client(port, 'auth', 'SHA', auth_password)
+		client.discover()
+		client.synced -= 100
+		self.assertEqual(client.get(['.1.3.6.1.2.1.1.3.0'])[0], 0)
+		client.synced -= 200
+		self.assertRaises(SNMPReport, client.get, ['.1.3.6.1.2.1.1.3.0'])
+		client.boots += 1
+		self.assertRaises(SNMPReport, client.get, ['.1.3.6.1.2.1.1.3.0'])
+		client.close()
+
+	def test_boots_persisted(self):
+		self.assertEqual(open(self.boots_file).read(), '42\n')
+		snmpd = agent_start(os.path.join(self.dir, 'restart.conf'), port + 1, self.boots_file)
+		try:
+			self.assertEqual(open(self.boots_file).read(), '43\n')
+			client = SNMPv3Client(port + 1, 'auth', 'SHA', auth_password)
+			self.assertEqual(client.get(['.1.3.6.1.2.1.1.3.0'])[0], 0)
+			client.close()
+			self.assertEqual(client.peer_boots, 43)
+		finally:
+			snmpd.terminate()
+			snmpd.wait()
+
+if __name__ == '__main__':
+    unittest.main()
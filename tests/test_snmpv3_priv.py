@@ -0,0 +1,92 @@
+import unittest
+import os, time, socket, subprocess, tempfile
+from snmp_client import *
+
+port = 16164
+auth_password = 'smartsnmp_auth'
+priv_password = 'smartsnmp_priv'
+
+# (user, auth protocol, privacy protocol)
+users = [
+	('md5aes', 'MD5', 'AES'),
+	('shaaes', 'SHA', 'AES'),
+	('shaaes192', 'SHA', 'AES-192'),
+	('shaaes256', 'SHA', 'AES-256'),
+	('sha256aes256', 'SHA-256', 'AES-256'),
+	('sha512aes', 'SHA-512', 'AES'),
+]
+
+class SNMPv3PrivTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		conf = tempfile.NamedTemporaryFile(mode = 'w', suffix = '.conf', delete = False)
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % port)
+		conf.write("users = {\n")
+		conf.write("  { user = 'roNoAuthUser', views = { ['.'] = 'ro' } },\n")
+		conf.write("  { user = 'authOnly', auth_protocol = 'SHA', auth_password = '%s', views = { ['.'] = 'ro' } },\n" % auth_password)
+		for user, auth, priv in users:
+			conf.write("  { user = '%s', auth_protocol = '%s', auth_password = '%s', priv_protocol = '%s', priv_password = '%s', views = { ['.'] = 'rw' } },\n" % (user, auth, auth_password, priv, priv_password))
+		conf.write("}\n")
+		conf.write("mib_module_path = 'mibs'\n")
+		conf.write("mib_modules = { ['1.3.6.1.2.1.1'] = 'system', ['1.3.6.1.2.1.4'] = 'ip' }\n")
+		conf.close()
+		cls.conf = conf.name
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		cls.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", cls.conf], env = env, stdout = open(os.devnull, 'w'))
+		client = SNMPv3Client(port, timeout = 0.5)
+		for i in range(50):
+			try:
+				client.get(['.1.3.6.1.2.1.1.3.0'])
+				break
+			except socket.timeout:
+				pass
+		client.close()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		os.unlink(cls.conf)
+
+	def test_snmpv3_priv_get(self):
+		for user, auth, priv in users:
+			client = SNMPv3Client(port, user, auth, auth_password, priv, priv_password)
+			error, index, varbinds = client.get(['.1.3.6.1.2.1.1.1.0', '.1.3.6.1.2.1.1.3.0'])
+			client.close()
+			self.assertEqual(error, 0)
+			self.assertEqual([oid for oid, value in varbinds], ['.1.3.6.1.2.1.1.1.0', '.1.3.6.1.2.1.1.3.0'])
+
+	def test_snmpv3_priv_set(self):
+		client = SNMPv3Client(port, 'shaaes', 'SHA', auth_password, 'AES', priv_password)
+		error, index, varbinds = client.set_int('.1.3.6.1.2.1.4.1.0', 2)
+		self.assertEqual(error, 0)
+		self.assertEqual(client.get(['.1.3.6.1.2.1.4.1.0'])[2][0][1], 2)
+		client.close()
+
+	def test_snmpv3_priv_bulk(self):
+		client = SNMPv3Client(port, 'sha256aes256', 'SHA-256', auth_password, 'AES-256', priv_password)
+		error, index, varbinds = client.getbulk(['.1.3.6.1.2.1.1'], max_rep = 20)
+		client.close()
+		self.assertEqual(error, 0)
+		self.assertEqual(len(varbinds), 20)
+
+	def test_snmpv3_priv_rejected(self):
+		rejected = [
+			# Wrong privacy password decrypts to garbage
+			(SNMPv3Client(port, 'shaaes', 'SHA', auth_password, 'AES', 'wrong_password'), usm_stats_decryption_errors),
+			# Privacy user without encryption
+			(SNMPv3Client(port, 'shaaes', 'SHA', auth_password), usm_stats_unsupported_sec_levels),
+			# Encryption for a user without privacy
+			(SNMPv3Client(port, 'authOnly', 'SHA', auth_password, 'AES', priv_password), usm_stats_unsupported_sec_levels),
+		]
+		for client, oid in rejected:
+			with self.assertRaises(SNMPReport) as cm:
+				client.get(['.1.3.6.1.2.1.1.3.0'])
+			client.close()
+			self.assertEqual(cm.exception.oid, oid)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,91 @@
+import unittest
+import os, socket, subprocess, tempfile
+from snmp_client import *
+
+port = 16231
+
+# Table .1 of rows valued by their index and the generation of the table,
+# setting .2.0 adds a row and starts a new generation.
+changer = """
+local mib = require "smartsnmp"
+
+local rows = { true, true, true }
+local gen = 1
+
+return {
+    [1] = {
+        [1] = {
+            indexes = rows,
+            snapshot = 10,
+            [1] = mib.ConstInt(function (i) if rows[i] then return gen * 100 + i end end),
+        }
+    },
+    [2] = mib.Int(function () return gen end, function (v)
+        gen = gen + 1
+        rows[#rows + 1] = true
+    end),
+}
+"""
+
+group = '.1.3.6.1.4.1.9999.5'
+column = group + '.1.1.1'
+
+class TableSnapshotTestCase(unittest.TestCase):
+	@classmethod
+	def setUpClass(cls):
+		cls.dir = tempfile.mkdtemp()
+		open(os.path.join(cls.dir, 'changer.lua'), 'w').write(changer)
+		conf_path = os.path.join(cls.dir, 'snmp.conf')
+		conf = open(conf_path, 'w')
+		conf.write("protocol = 'snmp'\n")
+		conf.write("port = %d\n" % port)
+		conf.write("communities = { { community = 'public', views = { ['.'] = 'ro' } }, { community = 'private', views = { ['.'] = 'rw' } } }\n")
+		conf.write("mib_module_path = '%s'\n" % cls.dir)
+		conf.write("mib_modules = { ['1.3.6.1.4.1.9999.5'] = 'changer' }\n")
+		conf.close()
+		env = dict(os.environ)
+		env['LUA_PATH'] = "lualib/?/init.lua;lualib/?.lua;./?.lua"
+		env['LUA_CPATH'] = "build/?.so"
+		cls.snmpd = subprocess.Popen([os.environ.get('LUA', "lua5.1"), "./bin/smartsnmpd", "-c", conf_path], env = env, stdout = open(os.devnull, 'w'))
+		client = SNMPClient(port, 'public', timeout = 0.5)
+		for i in range(50):
+			try:
+				client.get([group + '.2.0'])
+				break
+			except socket.timeout:
+				pass
+		client.close()
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.snmpd.terminate()
+		cls.snmpd.wait()
+		for name in os.listdir(cls.dir):
+			os.unlink(os.path.join(cls.dir, name))
+		os.rmdir(cls.dir)
+
+	def test_snapshot_walk_table_changed(self):
+		walker = SNMPClient(port, 'public')
+		writer = SNMPClient(port, 'private')
+		gen = walker.get([group + '.2.0'])[2][0][1]
+		# Entering from the table root pins a snapshot
+		oid, value = walker.getnext([group + '.1'])[2][0]
+		self.assertEqual((oid, value), (column + '.1', gen * 100 + 1))
+		# The table changes mid-walk
+		self.assertEqual(writer.set_int(group + '.2.0', 1)[0], 0)
+		rest = []
+		while True:
+			oid, value = walker.getnext([oid])[2][0]
+			if not oid.startswith(column + '.'):
+				break
+			rest.append((oid, value))
+		# The walk goes on in the rows it started with
+		self.assertEqual(rest, [(column + '.%d' % i, gen * 100 + i) for i in range(2, gen + 3)])
+		# A new walk sees the change
+		rows = walker.walk(column)
+		self.assertEqual(rows, [(column + '.%d' % i, (gen + 1) * 100 + i) for i in range(1, gen + 4)])
+		walker.close()
+		writer.close()
+
+if __name__ == '__main__':
+    unittest.main()